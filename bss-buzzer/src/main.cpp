@@ -10,7 +10,17 @@
 #include <nvs_flash.h>
 #include <ReactESP.h>
 #include <FastLED.h>
+#include <sys/time.h>
 #include "bss_shared.h"
+#include "bss_frame.h"
+#include "bss_button.h"
+#include "bss_buzzer.h"
+#include "bss_auth.h"
+#include "bss_config.h"
+#include "bss_slot.h"
+#include "bss_trace.h"
+#include "bss_txq.h"
+#include "bss_relay.h"
 
 uint8_t broadcast_mac[MAC_SIZE] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
 esp_now_peer_info_t broadcast_peer;
@@ -20,54 +30,49 @@ esp_now_peer_info_t broadcast_peer;
 #define ACTIVATION_5V_PIN 26
 
 #define uS_TO_S_FACTOR 1000000
-#define TIME_TO_SLEEP 5
 
-#define LED_NUM 12
-#define BRIGHTNESS 10
+// sized for the largest configurable strip, buzzer.config.led_num are used
+CRGB leds[BSS_CONFIG_MAX_LEDS];
+// the color the controller decided last
+CRGB show_color = CRGB::Black;
+// shown on a press until the controller decided, see bss_buzzer_speculate
+#define PROVISIONAL_COLOR CRGB(64, 64, 64)
 
-CRGB leds[LED_NUM];
-
-uint8_t msg_buf[250];
+// every frame goes out through the transmit queue
+bss_txq_t txq;
+// pumps the queue once the radio is done with a frame
+TaskHandle_t tx_task = NULL;
 
 #define sec *1000
 
 uint8_t my_mac[MAC_SIZE];
 uint8_t my_id;
 
-uint8_t controller_mac[MAC_SIZE];
 esp_now_peer_info_t controller_peer;
 
 ulong last_buzzer_pressed = 0;
-ulong last_sucessful_msg_to_master = 0;
+// the next slot ping goes out even after a press, the controller asked for it
+bool ping_forced = false;
+// millis() of the last heartbeat, 0 if the controller is considered lost
+ulong last_heartbeat = 0;
 
 reactesp::ReactESP app;
 reactesp::RepeatReaction *pairing_loop = NULL;
 reactesp::DelayReaction *pairing_disable_delay;
-reactesp::RepeatReaction *ping_loop;
+reactesp::DelayReaction *ping_delay;
 
-enum bss_client_pairing_state
-{
-    UNPAIRED,
-    PAIRING_MODE,
-    PAIRED,
-};
-enum bss_client_pairing_state pairing_state = UNPAIRED;
+bss_buzzer_t buzzer;
 
-enum bss_client_show_state
-{
-    UNINITIALIZED,
-    INIT,
-    SHOW,
-};
-enum bss_client_show_state show_state = UNINITIALIZED;
+BssButton buzzer_button(BUZZER_PIN);
 
-enum bss_client_buzzer_state
-{
-    UNPRESSED,
-    PRESSED,
-    HOLD,
-    RELEASED,
-};
+// Frame counters survive deep sleep in RTC memory and power loss through the
+// reservations in NVS.
+RTC_DATA_ATTR uint32_t tx_counter = 0;
+RTC_DATA_ATTR uint32_t tx_counter_reserved = 0;
+RTC_DATA_ATTR uint32_t controller_counter = 0;
+RTC_DATA_ATTR uint32_t controller_counter_persisted = 0;
+// offset of the controller clock to clock_millis(), kept while sleeping
+RTC_DATA_ATTR uint32_t clock_offset = 0;
 
 esp_sleep_wakeup_cause_t wakeup_cause;
 
@@ -75,60 +80,275 @@ nvs_handle_t nvs_bss_handle;
 
 SemaphoreHandle_t xMutex = NULL;
 
-void on_data_sent(const uint8_t *mac, esp_now_send_status_t status)
+// Writes the last accepted controller counter to NVS once it moved a block
+// ahead, which bounds the replay window after a power loss.
+void persist_controller_counter()
 {
-    if (status == ESP_NOW_SEND_SUCCESS && pairing_state == PAIRED && mac_equal(mac, controller_mac))
+    controller_counter = buzzer.controller_counter;
+
+    if (controller_counter >= controller_counter_persisted && controller_counter < controller_counter_persisted + BSS_AUTH_COUNTER_BLOCK)
+        return;
+
+    esp_err_t err = nvs_open("bss_client", NVS_READWRITE, &nvs_bss_handle);
+    if (err == ESP_OK)
     {
-        last_sucessful_msg_to_master = millis();
+        nvs_set_u32(nvs_bss_handle, "ctrl_counter", controller_counter);
+
+        nvs_commit(nvs_bss_handle);
+        nvs_close(nvs_bss_handle);
+
+        controller_counter_persisted = controller_counter;
     }
 }
 
+// Persists the next block of frame counters before it is used, so counters
+// never repeat across power loss.
+void reserve_tx_counter()
+{
+    if (tx_counter + BSS_AUTH_COUNTER_BLOCK / 2 < tx_counter_reserved)
+        return;
+
+    tx_counter_reserved = tx_counter + BSS_AUTH_COUNTER_BLOCK;
+
+    esp_err_t err = nvs_open("bss_client", NVS_READWRITE, &nvs_bss_handle);
+    if (err == ESP_OK)
+    {
+        nvs_set_u32(nvs_bss_handle, "tx_counter", tx_counter_reserved);
+
+        nvs_commit(nvs_bss_handle);
+        nvs_close(nvs_bss_handle);
+    }
+}
+
+// Milliseconds of the RTC, which keep running in deep sleep unlike millis().
+// The uplink slots are scheduled on this clock.
+uint32_t clock_millis()
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+
+    return (uint64_t)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
 void go_to_sleep()
 {
     Serial.println("go to sleep now!");
 
-    fill_solid(leds, LED_NUM, CRGB::Black);
+    persist_controller_counter();
+
+    fill_solid(leds, buzzer.config.led_num, CRGB::Black);
     FastLED.show();
     digitalWrite(ACTIVATION_5V_PIN, LOW);
 
     Serial.flush();
 
-    if (pairing_state == PAIRED)
-        esp_sleep_enable_timer_wakeup(TIME_TO_SLEEP * uS_TO_S_FACTOR);
+    if (buzzer.pairing_state == PAIRED)
+    {
+        // wake up at the start of the own slot, the wakeup request then only
+        // trails it by the boot time
+        uint32_t sleep_ms = buzzer.config.sleep_s * 1000;
+        sleep_ms += bss_buzzer_slot_wait(&buzzer, clock_millis() + sleep_ms) % buzzer.config.ping_ms;
+
+        esp_sleep_enable_timer_wakeup((uint64_t)sleep_ms * 1000);
+    }
+
+    clock_offset = buzzer.clock_offset;
 
     esp_deep_sleep_start();
 }
 
-void send_msg(const uint8_t *mac_addr, const uint8_t *data, const uint8_t size)
+bool send_msg(const uint8_t *mac_addr, const uint8_t *data, size_t size)
 {
+    BSS_TRACE_BEGIN(BSS_TRACE_SEND);
     esp_err_t result = esp_now_send(mac_addr, data, size);
+    BSS_TRACE_END(BSS_TRACE_SEND);
+
+    return result == ESP_OK;
+}
+
+size_t seal_frame(uint8_t *buf, size_t len, uint8_t key_id, const uint8_t *key)
+{
+    BSS_TRACE_BEGIN(BSS_TRACE_SEAL);
+    size_t size = bss_auth_seal(buf, len, BSS_FRAME_MAX_SIZE, my_mac, key_id, key, tx_counter++);
+    BSS_TRACE_END(BSS_TRACE_SEAL);
+
+    return size;
+}
 
-    Serial.println(millis());
+// Presses overtake everything else, and only the latest pending ping or
+// request of a kind is sent.
+void send_record(const uint8_t *mac, uint8_t type, const uint8_t *payload, uint8_t payload_len,
+                 uint8_t key_id, const uint8_t *key)
+{
+    uint8_t priority = BSS_TX_NORMAL;
+    uint16_t supersede = BSS_TXQ_KEY(type, 0);
 
-    if (result == ESP_OK)
+    if (type == BSS_MSG_BUZZER_PRESSED)
     {
-        Serial.println("Sent with success\n");
+        priority = BSS_TX_URGENT;
+        supersede = BSS_TXQ_KEEP;
     }
-    else
+    else if (type == BSS_MSG_PING)
+        priority = BSS_TX_BACKGROUND;
+
+    bss_pool_buffer_t *buffer = bss_txq_acquire(&txq, priority);
+
+    if (buffer == NULL)
+    {
+        Serial.println("no frame buffer left\n");
+        return;
+    }
+
+    buffer->len = bss_record_put(buffer->data, BSS_FRAME_MAX_SIZE - BSS_AUTH_TRAILER_SIZE, 0, my_id, type, payload,
+                                 payload_len);
+    bss_txq_push(&txq, buffer, mac, priority, supersede, key_id, key);
+}
+
+// Runs on the WiFi task, sealing and sending the next frame is left to tx_task.
+void on_data_sent(const uint8_t *mac_addr, esp_now_send_status_t status)
+{
+    if (bss_txq_sent(&txq))
+        xTaskNotifyGive(tx_task);
+}
+
+void pump_frames(void *)
+{
+    for (;;)
     {
-        Serial.println("Error sending the data\n");
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        bss_txq_pump(&txq);
     }
 }
 
+void print_txq()
+{
+    bss_txq_stats_t stats;
+
+    bss_txq_get_stats(&txq, &stats);
+    Serial.printf("txq depth=%u max=%u in_flight=%u sent=%lu superseded=%lu dropped=%lu failed=%lu\n", stats.depth,
+                  stats.max_depth, stats.in_flight, (unsigned long)stats.sent, (unsigned long)stats.superseded,
+                  (unsigned long)stats.dropped, (unsigned long)stats.failed);
+}
+
+// Far buzzers broadcast their uplink for the relays, see bss_relay.h.
+const uint8_t *uplink_mac()
+{
+    return buzzer.relay.flags & BSS_RELAY_BROADCAST ? broadcast_mac : buzzer.controller_mac;
+}
+
+// The press carries the controller time it happened at, so it still wins
+// when it arrives late over a relay.
+void send_press()
+{
+    uint8_t time[4];
+
+    bss_put_u32(time, clock_millis() + buzzer.clock_offset);
+    send_record(uplink_mac(), BSS_MSG_BUZZER_PRESSED, time, sizeof(time), BSS_AUTH_KEY_SESSION, buzzer.session_key);
+}
+
+// PING and WAKEUP_REQUEST carry the config version, so the controller can
+// send the current configuration to buzzers that missed it.
+void send_config_version(uint8_t type)
+{
+    uint8_t version[BSS_CONFIG_VERSION_SIZE];
+
+    bss_put_u16(version, buzzer.config.version);
+    send_record(uplink_mac(), type, version, sizeof(version), BSS_AUTH_KEY_SESSION, buzzer.session_key);
+}
+
+// Without heartbeats the displayed state can not be trusted anymore.
+void check_controller()
+{
+    if (last_heartbeat == 0 || millis() - last_heartbeat < BSS_HEARTBEAT_LOST_PERIODS * buzzer.config.ping_ms)
+        return;
+
+    Serial.println("controller lost");
+
+    last_heartbeat = 0;
+    buzzer.show_stale = true;
+    show_color = CRGB::Black;
+
+    fill_solid(leds, buzzer.config.led_num, show_color);
+    FastLED.show();
+}
+
+// Pings go out at the start of the own uplink slot. A press in the last
+// period already told the controller that we are alive, the ping is left out
+// then, unless the heartbeat asked for it.
 void set_ping_loop()
 {
-    if (ping_loop == NULL)
+    if (ping_delay == NULL)
     {
-        ping_loop = app.onRepeat(2 sec, []()
+        ping_delay = app.onDelay(bss_buzzer_slot_wait(&buzzer, clock_millis()), []()
                                  {
-                                    msg_buf[0] = my_id;
-                                    msg_buf[1] = 1;
-                                    msg_buf[2] = BSS_MSG_PING;
+                                     ping_delay = NULL;
+
+                                     check_controller();
+
+                                     if (ping_forced || last_buzzer_pressed == 0 ||
+                                         millis() - last_buzzer_pressed >= buzzer.config.ping_ms)
+                                         send_config_version(BSS_MSG_PING);
+
+                                     ping_forced = false;
+
+                                     set_ping_loop(); });
+    }
+}
+
+void load_config()
+{
+    uint8_t buf[BSS_CONFIG_WIRE_SIZE];
+    size_t size = sizeof(buf);
 
-                                    send_msg(controller_mac, msg_buf, 3); });
+    if (nvs_open("bss_client", NVS_READONLY, &nvs_bss_handle) == ESP_OK)
+    {
+        if (nvs_get_blob(nvs_bss_handle, "config", buf, &size) == ESP_OK)
+            bss_config_decode(buf, size, &buzzer.config);
+
+        nvs_close(nvs_bss_handle);
     }
 }
 
+// The configuration is written as one blob, so NVS keeps either the old or
+// the new one if power is lost meanwhile.
+void persist_config()
+{
+    uint8_t buf[BSS_CONFIG_WIRE_SIZE];
+
+    bss_config_encode(&buzzer.config, buf);
+
+    if (nvs_open("bss_client", NVS_READWRITE, &nvs_bss_handle) == ESP_OK)
+    {
+        nvs_set_blob(nvs_bss_handle, "config", buf, sizeof(buf));
+
+        nvs_commit(nvs_bss_handle);
+        nvs_close(nvs_bss_handle);
+    }
+}
+
+// Applies buzzer.config to a running buzzer.
+void apply_config()
+{
+    fill_solid(leds, BSS_CONFIG_MAX_LEDS, CRGB::Black);
+    FastLED.show();
+
+    FastLED[0].setLeds(leds, buzzer.config.led_num);
+    FastLED.setBrightness(buzzer.config.brightness);
+
+    buzzer_button.debounce_ms = buzzer.config.debounce_ms;
+
+    if (ping_delay != NULL)
+    {
+        ping_delay->remove();
+        ping_delay = NULL;
+
+        set_ping_loop();
+    }
+
+    if (buzzer.pairing_state == PAIRED)
+        esp_sleep_enable_timer_wakeup((uint64_t)buzzer.config.sleep_s * uS_TO_S_FACTOR);
+}
+
 void remove_pairing_disable_delay()
 {
     if (pairing_disable_delay != NULL)
@@ -145,7 +365,7 @@ void remove_pairing_loop()
         pairing_loop->remove();
         pairing_loop = NULL;
 
-        fill_solid(leds, LED_NUM, CRGB::Black);
+        fill_solid(leds, buzzer.config.led_num, CRGB::Black);
         FastLED.show();
     }
 }
@@ -155,121 +375,220 @@ void print_mac(const uint8_t *mac)
     Serial.printf("%02X:%02X:%02X:%02X:%02X:%02X\n", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5], mac[6]);
 }
 
+void print_trace_line(const char *line, void *context)
+{
+    Serial.println(line);
+}
+
+// Serial 't' prints the stage trace summary (-DBSS_TRACE).
+void print_trace()
+{
+    Serial.println("trace begin");
+    bss_trace_summary(print_trace_line, NULL);
+    Serial.println("trace end");
+
+    bss_trace_reset();
+}
+
+// Forwards the frames of far buzzers to the controller and repeats the group
+// frames of the controller for them.
+void relay_frame(const uint8_t *mac, const uint8_t *data, int len)
+{
+    uint8_t ttl;
+    uint8_t priority = bss_relay_priority(data, len);
+    bss_pool_buffer_t *buffer;
+
+    if (bss_relay_accept(&buzzer.relay, mac, data, len, &ttl))
+    {
+        if ((buffer = bss_txq_acquire(&txq, priority)) == NULL)
+            return;
+
+        buffer->len = bss_relay_put(buffer->data, BSS_FRAME_MAX_SIZE - BSS_AUTH_TRAILER_SIZE, 0, my_id, ttl, mac, data,
+                                    len);
+
+        if (buffer->len > 0)
+            bss_txq_push(&txq, buffer, uplink_mac(), priority, BSS_TXQ_KEEP, BSS_AUTH_KEY_SESSION, buzzer.session_key);
+        else
+            bss_txq_release(&txq, buffer);
+    }
+    else if (bss_relay_repeat(&buzzer.relay, buzzer.controller_mac, buzzer.group_key, mac, data, len))
+    {
+        if ((buffer = bss_txq_acquire(&txq, priority)) == NULL)
+            return;
+
+        memcpy(buffer->data, data, len);
+        buffer->len = len;
+        bss_txq_push(&txq, buffer, broadcast_mac, priority, BSS_TXQ_KEEP, BSS_TXQ_SEALED, NULL);
+    }
+}
+
 void on_data_recv(const uint8_t *mac, const uint8_t *data, int len)
 {
     Serial.println("Recived some things...");
-    if (xSemaphoreTake(xMutex, portMAX_DELAY))
+
+    BSS_TRACE_BEGIN(BSS_TRACE_MUTEX_WAIT);
+    bool locked = xSemaphoreTake(xMutex, portMAX_DELAY);
+    BSS_TRACE_END(BSS_TRACE_MUTEX_WAIT);
+
+    if (locked)
     {
         Serial.println("Got mutex!");
-        uint8_t msg_type;
-        const uint8_t *start_ptr;
-        bool for_me = false;
 
-        Serial.println("my id: ");
-        Serial.println(my_id);
+        const uint8_t *sender = mac;
 
-        for (uint8_t i = 0; i < len;)
+        if (buzzer.pairing_state == PAIRED)
         {
-            if (data[i] == my_id)
-            {
-                start_ptr = &data[i];
-                for_me = true;
-                break;
-            }
-            Serial.println(data[i]);
-            i += data[i + 1] + 2;
+            relay_frame(mac, data, len);
+
+            if (bss_relay_repeated(buzzer.controller_mac, buzzer.group_key, mac, data, len))
+                sender = buzzer.controller_mac;
         }
 
+        BSS_TRACE_BEGIN(BSS_TRACE_OPEN_FRAME);
+        const uint8_t *record = bss_buzzer_open_frame(&buzzer, my_mac, my_id, sender, data, len);
+        BSS_TRACE_END(BSS_TRACE_OPEN_FRAME);
+
         print_mac(mac);
         Serial.print("Bytes received: ");
         Serial.println(len);
-        // Serial.println(start);
 
-        if (for_me)
+        if (record != NULL)
         {
             esp_err_t err = 0;
+            const uint8_t *payload = bss_record_payload(record);
 
-            switch (start_ptr[2])
+            switch (bss_buzzer_handle_record(&buzzer, sender, record))
             {
-            case BSS_MSG_WAKEUP_ACCEPTED:
+            case BSS_BUZZER_SHOW_INIT:
                 Serial.println("wakeup accepted");
-                if (mac_equal(mac, controller_mac))
-                {
-                    show_state = INIT;
 
-                    fill_solid(leds, LED_NUM, CRGB::Green);
-                    FastLED.show();
-                }
+                bss_buzzer_sync_clock(&buzzer, record, clock_millis());
 
+                fill_solid(leds, buzzer.config.led_num, CRGB::Green);
+                FastLED.show();
                 break;
 
-            case BSS_MSG_SET_NEOPIXEL_COLOR:
-                if (mac_equal(mac, controller_mac))
-                {
-                    CRGB neopixel_color;
-                    neopixel_color.setRGB(start_ptr[3], start_ptr[4], start_ptr[5]);
+            case BSS_BUZZER_SET_COLOR:
+                show_color.setRGB(payload[0], payload[1], payload[2]);
 
-                    fill_solid(leds, LED_NUM, neopixel_color);
-                    FastLED.show();
-                }
+                BSS_TRACE_BEGIN(BSS_TRACE_LED_SHOW);
+                fill_solid(leds, buzzer.config.led_num, show_color);
+                FastLED.show();
+                BSS_TRACE_END(BSS_TRACE_LED_SHOW);
                 break;
 
-            case BSS_MSG_PAIRING_ACCEPTED:
+            case BSS_BUZZER_PAIRED:
                 Serial.println("Pairing Accepted");
 
                 remove_pairing_disable_delay();
                 remove_pairing_loop();
 
-                if (pairing_state != PAIRED)
+                mac_copy(controller_peer.peer_addr, buzzer.controller_mac);
+                esp_now_add_peer(&controller_peer);
+
+                bss_buzzer_sync_clock(&buzzer, record, clock_millis());
+
+                err = nvs_open("bss_client", NVS_READWRITE, &nvs_bss_handle);
+                if (err == ESP_OK)
                 {
-                    pairing_state = PAIRED;
+                    nvs_set_u8(nvs_bss_handle, "paired", true);
+                    nvs_set_blob(nvs_bss_handle, "controller_mac", buzzer.controller_mac, MAC_SIZE);
+                    nvs_set_blob(nvs_bss_handle, "session_key", buzzer.session_key, BSS_AUTH_KEY_SIZE);
+                    nvs_set_blob(nvs_bss_handle, "group_key", buzzer.group_key, BSS_AUTH_KEY_SIZE);
+                    nvs_set_u8(nvs_bss_handle, "slot", buzzer.slot);
+
+                    nvs_commit(nvs_bss_handle);
+                    nvs_close(nvs_bss_handle);
+                }
 
-                    mac_copy(controller_mac, mac);
+                controller_counter_persisted = 0;
+                persist_controller_counter();
 
-                    mac_copy(controller_peer.peer_addr, controller_mac);
-                    esp_now_add_peer(&controller_peer);
+                fill_solid(leds, buzzer.config.led_num, CRGB::Green);
+                FastLED.show();
 
-                    err = nvs_open("bss_client", NVS_READWRITE, &nvs_bss_handle);
-                    if (err == ESP_OK)
-                    {
-                        nvs_set_u8(nvs_bss_handle, "paired", true);
-                        nvs_set_blob(nvs_bss_handle, "controller_mac", controller_mac, MAC_SIZE);
+                if (ping_delay != NULL)
+                {
+                    ping_delay->remove();
+                    ping_delay = NULL;
+                }
 
-                        nvs_commit(nvs_bss_handle);
-                        nvs_close(nvs_bss_handle);
-                    }
+                set_ping_loop();
 
-                    show_state = INIT;
+                esp_sleep_enable_timer_wakeup((uint64_t)buzzer.config.sleep_s * uS_TO_S_FACTOR);
+                break;
 
-                    fill_solid(leds, LED_NUM, CRGB::Green);
-                    FastLED.show();
+            case BSS_BUZZER_TAKEOVER:
+                Serial.println("standby took over");
+                print_mac(buzzer.controller_mac);
+
+                mac_copy(controller_peer.peer_addr, buzzer.controller_mac);
+                esp_now_add_peer(&controller_peer);
 
-                    set_ping_loop();
+                err = nvs_open("bss_client", NVS_READWRITE, &nvs_bss_handle);
+                if (err == ESP_OK)
+                {
+                    nvs_set_blob(nvs_bss_handle, "controller_mac", buzzer.controller_mac, MAC_SIZE);
 
-                    esp_sleep_enable_timer_wakeup(TIME_TO_SLEEP * uS_TO_S_FACTOR);
+                    nvs_commit(nvs_bss_handle);
+                    nvs_close(nvs_bss_handle);
                 }
+
+                // counters of the new controller
+                controller_counter_persisted = 0;
+                persist_controller_counter();
                 break;
 
-            case BSS_MSG_PAIRING_REMOVE:
+            case BSS_BUZZER_UNPAIRED:
                 Serial.println("Please remove Pairing");
 
                 remove_pairing_disable_delay();
                 remove_pairing_loop();
 
-                if (pairing_state != UNPAIRED)
+                err = nvs_open("bss_client", NVS_READWRITE, &nvs_bss_handle);
+                if (err == ESP_OK)
+                {
+                    nvs_set_u8(nvs_bss_handle, "paired", false);
+
+                    nvs_commit(nvs_bss_handle);
+                    nvs_close(nvs_bss_handle);
+                }
+                break;
+
+            case BSS_BUZZER_PAIRING_STOP:
+                remove_pairing_disable_delay();
+                remove_pairing_loop();
+                break;
+
+            case BSS_BUZZER_HEARTBEAT:
+                last_heartbeat = millis();
+
+                bss_buzzer_sync_clock(&buzzer, record, clock_millis());
+
+                if (bss_buzzer_resync_show(&buzzer))
                 {
-                    pairing_state = UNPAIRED;
+                    Serial.printf("resync show %u\n", buzzer.show_seq);
 
-                    err = nvs_open("bss_client", NVS_READWRITE, &nvs_bss_handle);
-                    if (err == ESP_OK)
-                    {
-                        nvs_set_u8(nvs_bss_handle, "paired", false);
+                    show_color.setRGB(buzzer.heartbeat.color[0], buzzer.heartbeat.color[1], buzzer.heartbeat.color[2]);
 
-                        nvs_commit(nvs_bss_handle);
-                        nvs_close(nvs_bss_handle);
-                    }
+                    fill_solid(leds, buzzer.config.led_num, show_color);
+                    FastLED.show();
                 }
 
+                // in the own slot, the whole fleet may read the same heartbeat
+                if (!bss_buzzer_heard(&buzzer))
+                    ping_forced = true;
+                break;
+
+            case BSS_BUZZER_RELAY_ROLE:
+                Serial.printf("relay flags %u far %u\n", buzzer.relay.flags, buzzer.relay.far_count);
+                break;
+
+            case BSS_BUZZER_CONFIG:
+                Serial.printf("config version %u\n", buzzer.config.version);
+
+                persist_config();
+                apply_config();
                 break;
 
             default:
@@ -285,28 +604,56 @@ void setup()
 {
     wakeup_cause = esp_sleep_get_wakeup_cause();
 
-    esp_sleep_enable_ext0_wakeup((gpio_num_t)BUZZER_PIN, LOW);
+    bss_buzzer_init(&buzzer);
 
     nvs_flash_init();
+    load_config();
+
+    buzzer_button.debounce_ms = buzzer.config.debounce_ms;
+
+    esp_sleep_enable_ext0_wakeup((gpio_num_t)BUZZER_PIN, LOW);
 
     esp_err_t err = nvs_open("bss_client", NVS_READONLY, &nvs_bss_handle);
     if (err == ESP_OK)
     {
         uint8_t paired = 0;
         nvs_get_u8(nvs_bss_handle, "paired", &paired);
-        pairing_state = paired == 1 ? PAIRED : UNPAIRED;
+        buzzer.pairing_state = paired == 1 ? PAIRED : UNPAIRED;
 
         size_t mac_size = MAC_SIZE;
+        size_t key_size = BSS_AUTH_KEY_SIZE;
 
         if (paired)
-            nvs_get_blob(nvs_bss_handle, "controller_mac", controller_mac, &mac_size);
+        {
+            nvs_get_blob(nvs_bss_handle, "controller_mac", buzzer.controller_mac, &mac_size);
+            nvs_get_blob(nvs_bss_handle, "session_key", buzzer.session_key, &key_size);
+            key_size = BSS_AUTH_KEY_SIZE;
+            nvs_get_blob(nvs_bss_handle, "group_key", buzzer.group_key, &key_size);
+            nvs_get_u8(nvs_bss_handle, "slot", &buzzer.slot);
+        }
+
+        // RTC memory is cleared on power loss, continue from the reservations
+        if (tx_counter == 0)
+        {
+            nvs_get_u32(nvs_bss_handle, "tx_counter", &tx_counter);
+            nvs_get_u32(nvs_bss_handle, "ctrl_counter", &controller_counter);
+
+            tx_counter++;
+            controller_counter_persisted = controller_counter;
+        }
 
         nvs_close(nvs_bss_handle);
     }
 
-    if (pairing_state == UNPAIRED && wakeup_cause == ESP_SLEEP_WAKEUP_TIMER)
+    if (tx_counter == 0)
+        tx_counter = 1;
+
+    buzzer.controller_counter = controller_counter;
+    buzzer.clock_offset = clock_offset;
+
+    if (buzzer.pairing_state == UNPAIRED && wakeup_cause == ESP_SLEEP_WAKEUP_TIMER)
         esp_deep_sleep_start();
-    else if (pairing_state == PAIRED)
+    else if (buzzer.pairing_state == PAIRED)
         set_ping_loop();
 
     Serial.begin(115200);
@@ -317,14 +664,7 @@ void setup()
 
     WiFi.macAddress(my_mac);
 
-    uint64_t id_buf = 0;
-
-    for (uint8_t i = 0; i < MAC_SIZE; i++)
-    {
-        id_buf += my_mac[i];
-    }
-
-    my_id = ((uint8_t *)&id_buf)[0];
+    my_id = bss_buzzer_id(my_mac);
 
     if (esp_now_init() != ESP_OK)
     {
@@ -338,6 +678,9 @@ void setup()
     print_mac(my_mac);
 
     xMutex = xSemaphoreCreateMutex();
+    bss_txq_init(&txq, send_msg, seal_frame);
+    // above loop() and below the WiFi task
+    xTaskCreate(pump_frames, "tx", 4096, NULL, 5, &tx_task);
 
     esp_now_register_recv_cb(on_data_recv);
     esp_now_register_send_cb(on_data_sent);
@@ -350,23 +693,20 @@ void setup()
     controller_peer.channel = BSS_ESP_NOW_CHANNEL;
     controller_peer.encrypt = BSS_ESP_NOW_ENCRYPT;
 
-    if (pairing_state == PAIRED)
+    if (buzzer.pairing_state == PAIRED)
     {
-        mac_copy(controller_peer.peer_addr, controller_mac);
+        mac_copy(controller_peer.peer_addr, buzzer.controller_mac);
         esp_now_add_peer(&controller_peer);
 
-        esp_sleep_enable_timer_wakeup(TIME_TO_SLEEP * uS_TO_S_FACTOR);
+        esp_sleep_enable_timer_wakeup((uint64_t)buzzer.config.sleep_s * uS_TO_S_FACTOR);
 
         if (wakeup_cause == ESP_SLEEP_WAKEUP_TIMER)
         {
-            msg_buf[0] = my_id;
-            msg_buf[1] = 1;
-            msg_buf[2] = BSS_MSG_WAKEUP_REQUEST;
-            send_msg(controller_mac, msg_buf, 3);
+            send_config_version(BSS_MSG_WAKEUP_REQUEST);
 
             app.onDelay(1000, []()
                         {
-                            if(show_state == UNINITIALIZED)
+                            if(buzzer.show_state == UNINITIALIZED)
                                 go_to_sleep(); });
         }
     }
@@ -375,13 +715,13 @@ void setup()
     pinMode(ACTIVATION_5V_PIN, OUTPUT);
     digitalWrite(ACTIVATION_5V_PIN, HIGH);
 
-    FastLED.addLeds<WS2812B, LED_PIN, GRB>(leds, LED_NUM).setCorrection(TypicalLEDStrip);
-    FastLED.setBrightness(BRIGHTNESS);
+    FastLED.addLeds<WS2812B, LED_PIN, GRB>(leds, buzzer.config.led_num).setCorrection(TypicalLEDStrip);
+    FastLED.setBrightness(buzzer.config.brightness);
 
     if (wakeup_cause == ESP_SLEEP_WAKEUP_EXT0)
-        fill_solid(leds, LED_NUM, CRGB::Yellow);
+        fill_solid(leds, buzzer.config.led_num, CRGB::Yellow);
     else
-        fill_solid(leds, LED_NUM, CRGB::Black);
+        fill_solid(leds, buzzer.config.led_num, CRGB::Black);
 
     FastLED.show();
 
@@ -389,111 +729,129 @@ void setup()
     Serial.println(wakeup_cause);
 }
 
-void loop()
+// Enters pairing mode: the old pairing is dropped for good, the request is
+// repeated every second until the pairing time is over.
+void start_pairing()
 {
-    if (xSemaphoreTake(xMutex, 10))
+    esp_fill_random(buzzer.pairing_nonce, BSS_AUTH_NONCE_SIZE);
+
+    esp_err_t err = nvs_open("bss_client", NVS_READWRITE, &nvs_bss_handle);
+    if (err == ESP_OK)
     {
-        static bool buzzer_pin_state = false;
-        static bool buzzer_pin_state_old = false;
-        static bss_client_buzzer_state buzzer_state = UNPRESSED;
-        static ulong last_pressed = 0;
-        static ulong last_released = 0;
+        nvs_set_u8(nvs_bss_handle, "paired", false);
 
-        buzzer_pin_state_old = buzzer_pin_state;
-        buzzer_pin_state = !digitalRead(BUZZER_PIN);
+        nvs_commit(nvs_bss_handle);
+        nvs_close(nvs_bss_handle);
+    }
 
-        if (buzzer_pin_state && !buzzer_pin_state_old)
-        {
-            if ((millis() - last_pressed) >= 10)
-            {
-                Serial.println("buzzer pressed");
+    if (pairing_disable_delay == NULL)
+    {
+        pairing_disable_delay = app.onDelay(buzzer.config.pairing_ms, []()
+                                            {
+                                                    if (buzzer.pairing_state != PAIRED)
+                                                        go_to_sleep();
 
-                buzzer_state = PRESSED;
-            }
+                                                    pairing_disable_delay = NULL; });
+    }
 
-            last_pressed = millis();
-        }
-        else if (!buzzer_pin_state && buzzer_pin_state_old)
-        {
-            if ((millis() - last_released) >= 10)
-            {
-                Serial.println("buzzer released");
+    if (pairing_loop == NULL)
+    {
+        pairing_loop = app.onRepeat(1 sec, []()
+                                    {
+                                            static bool led_state = true;
 
-                buzzer_state = RELEASED;
-            }
+                                            led_state = !led_state;
 
-            last_released = millis();
-        }
-        else if (buzzer_pin_state && buzzer_pin_state_old)
-            buzzer_state = HOLD;
-        else //(!buzzer_pin_state && !buzzer_pin_state_old)
-            buzzer_state = UNPRESSED;
-        if (pairing_state == PAIRED)
+                                            if (led_state)
+                                            {
+                                                fill_solid(leds, buzzer.config.led_num, CRGB::White);
+                                            }
+                                            else
+                                            {
+                                                fill_solid(leds, buzzer.config.led_num, CRGB::Black);
+                                            }
+                                            FastLED.show();
+
+                                            send_record(broadcast_mac, BSS_MSG_PAIRING_REQUEST, buzzer.pairing_nonce, BSS_AUTH_NONCE_SIZE,
+                                                        BSS_AUTH_KEY_FLEET, bss_fleet_key); });
+    }
+
+    fill_solid(leds, buzzer.config.led_num, CRGB::White);
+    FastLED.show();
+}
+
+void loop()
+{
+    if (xSemaphoreTake(xMutex, 10))
+    {
+        BSS_TRACE_BEGIN(BSS_TRACE_DEBOUNCE);
+        buzzer_button.read();
+        bss_buzzer_action action = bss_buzzer_handle_button(&buzzer, &buzzer_button, millis());
+        BSS_TRACE_END(BSS_TRACE_DEBOUNCE);
+
+        if (buzzer_button.state == PRESSED)
+            Serial.println("buzzer pressed");
+        else if (buzzer_button.state == RELEASED)
+            Serial.println("buzzer released");
+
+        if (Serial.available() > 0)
         {
-            msg_buf[0] = my_id;
-            msg_buf[1] = 1;
-            msg_buf[2] = BSS_MSG_BUZZER_PRESSED;
-            send_msg(controller_mac, msg_buf, 3);
+            int command = Serial.read();
+
+            if (command == 'q')
+                print_txq();
+#ifdef BSS_TRACE
+            else if (command == 't')
+                print_trace();
+#endif
         }
-        else if (pairing_state != PAIRING_MODE)
-        {
-            if (show_state == UNINITIALIZED && buzzer_state == UNPRESSED && (millis() - last_pressed) > 1 sec)
-            go_to_sleep();
-            else if (buzzer_state == HOLD && (millis() - last_pressed) >= 3 sec)
-        {
-            pairing_state = PAIRING_MODE;
-
-            esp_err_t err = nvs_open("bss_client", NVS_READWRITE, &nvs_bss_handle);
-            if (err == ESP_OK)
-            {
-                nvs_set_u8(nvs_bss_handle, "paired", false);
 
-                nvs_commit(nvs_bss_handle);
-                nvs_close(nvs_bss_handle);
-            }
+        switch (action)
+        {
+        case BSS_BUZZER_SEND_PRESS:
+            last_buzzer_pressed = millis();
+            send_press();
 
-            if (pairing_disable_delay == NULL)
+            // the controller still decides, its next show color confirms or
+            // reverts this
+            if (bss_buzzer_speculate(&buzzer, millis()))
             {
-                pairing_disable_delay = app.onDelay(10 sec, []()
-                                                    {
-                                                            if (pairing_state != PAIRED)
-                                                                go_to_sleep();
-
-                                                            pairing_disable_delay = NULL; });
+                fill_solid(leds, buzzer.config.led_num, PROVISIONAL_COLOR);
+                FastLED.show();
             }
+            break;
 
-            if (pairing_loop == NULL)
-            {
-                pairing_loop = app.onRepeat(1 sec, []()
-                                            {
-                                                    static bool led_state = true;
+        case BSS_BUZZER_SLEEP:
+            go_to_sleep();
+            break;
 
-                                                    led_state = !led_state;
+        case BSS_BUZZER_UNPAIR:
+            Serial.println("pairing dropped");
 
-                                                    if (led_state)
-                                                    {
-                                                        fill_solid(leds, LED_NUM, CRGB::White);
-                                                    }
-                                                    else
-                                                    {
-                                                        fill_solid(leds, LED_NUM, CRGB::Black);
-                                                    }
-                                                    FastLED.show();
+            // a controller that still knows us frees the slot
+            send_record(uplink_mac(), BSS_MSG_PAIRING_REMOVE, NULL, 0, BSS_AUTH_KEY_SESSION, buzzer.session_key);
+            start_pairing();
+            break;
 
-                                                    msg_buf[0] = my_id;
-                                                    msg_buf[1] = 1;
-                                                    msg_buf[2] = BSS_MSG_PAIRING_REQUEST;
+        case BSS_BUZZER_PAIRING_START:
+            start_pairing();
+            break;
 
-                                                    send_msg(broadcast_mac, msg_buf, 3); });
-            }
+        default:
+            break;
+        }
 
-            fill_solid(leds, LED_NUM, CRGB::White);
+        // the controller never decided on the press
+        if (bss_buzzer_provisional_expired(&buzzer, millis()))
+        {
+            fill_solid(leds, buzzer.config.led_num, show_color);
             FastLED.show();
-            }
         }
 
         app.tick();
 
+        reserve_tx_counter();
+
         xSemaphoreGive(xMutex);
     }
 }
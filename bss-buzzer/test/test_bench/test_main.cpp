@@ -0,0 +1,137 @@
+/*
+  Copyright © 2024 Leonard Sebastian Schwennesen. All rights reserved.
+*/
+
+// Microbenchmarks of the buzzer's per-packet work. Run them before and after
+// every protocol or hot-path change and compare the reported numbers:
+//   pio test -e native -f test_bench -v
+
+#include <unity.h>
+#include <stdio.h>
+#include "bss_shared.h"
+#include "bss_frame.h"
+#include "bss_buzzer.h"
+#include "bss_auth.h"
+
+#ifdef ARDUINO
+#include <Arduino.h>
+
+static uint64_t bench_now_ns()
+{
+    return (uint64_t)micros() * 1000;
+}
+#else
+#include <chrono>
+
+static uint64_t bench_now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+#endif
+
+#define BENCH_ITERATIONS 100000
+
+static const uint8_t controller_mac[6] = {0x40, 0, 0, 0, 0, 0x01};
+static const uint8_t my_mac[6] = {0x40, 0, 0, 0, 0, 0x02};
+static const uint8_t group_key[BSS_AUTH_KEY_SIZE] = {7};
+
+static uint8_t frame[BSS_FRAME_MAX_SIZE];
+static size_t frame_size;
+static volatile uint32_t sink;
+
+static void bench_report(const char *name, uint64_t start, uint64_t end)
+{
+    char msg[96];
+
+    snprintf(msg, sizeof(msg), "%s: %.1f ns/op", name, (double)(end - start) / BENCH_ITERATIONS);
+    TEST_MESSAGE(msg);
+}
+
+void setUp()
+{
+    const uint8_t white[3] = {255, 255, 255};
+
+    // a full lockout broadcast
+    frame_size = 0;
+    for (uint8_t id = 0; id < (BSS_FRAME_MAX_SIZE - BSS_AUTH_TRAILER_SIZE) / 6; id++)
+        frame_size = bss_record_put(frame, sizeof(frame) - BSS_AUTH_TRAILER_SIZE, frame_size, id, BSS_MSG_SET_NEOPIXEL_COLOR, white, sizeof(white));
+}
+
+void tearDown() {}
+
+// Receive path of the last buzzer in a full broadcast: walk the frame to the
+// own record and apply it.
+void bench_broadcast_walk()
+{
+    bss_buzzer_t buzzer;
+    uint8_t own_id = frame_size / 6 - 1;
+
+    bss_buzzer_init(&buzzer);
+    buzzer.pairing_state = PAIRED;
+    mac_copy(buzzer.controller_mac, controller_mac);
+    sink = 0;
+
+    uint64_t start = bench_now_ns();
+
+    for (uint32_t i = 0; i < BENCH_ITERATIONS; i++)
+    {
+        const uint8_t *record = bss_frame_find(frame, frame_size, own_id);
+
+        sink += bss_buzzer_handle_record(&buzzer, controller_mac, record) == BSS_BUZZER_SET_COLOR;
+    }
+
+    bench_report("broadcast walk (40 records)", start, bench_now_ns());
+    TEST_ASSERT_EQUAL(BENCH_ITERATIONS, sink);
+}
+
+// The same with authentication of the full frame in front.
+void bench_broadcast_open()
+{
+    bss_buzzer_t buzzer;
+    uint8_t own_id = frame_size / 6 - 1;
+    uint8_t sealed[BSS_FRAME_MAX_SIZE];
+
+    bss_buzzer_init(&buzzer);
+    buzzer.pairing_state = PAIRED;
+    mac_copy(buzzer.controller_mac, controller_mac);
+    memcpy(buzzer.group_key, group_key, BSS_AUTH_KEY_SIZE);
+    memcpy(sealed, frame, frame_size);
+    sink = 0;
+
+    // every iteration needs a fresh counter to pass the replay check
+    uint64_t start = bench_now_ns();
+
+    for (uint32_t i = 0; i < BENCH_ITERATIONS; i++)
+    {
+        size_t len = bss_auth_seal(sealed, frame_size, sizeof(sealed), controller_mac, BSS_AUTH_KEY_GROUP, group_key, i + 1);
+        const uint8_t *record = bss_buzzer_open_frame(&buzzer, my_mac, own_id, controller_mac, sealed, len);
+
+        sink += record != NULL && bss_buzzer_handle_record(&buzzer, controller_mac, record) == BSS_BUZZER_SET_COLOR;
+    }
+
+    bench_report("broadcast seal + open (40 records)", start, bench_now_ns());
+    TEST_ASSERT_EQUAL(BENCH_ITERATIONS, sink);
+}
+
+int run_tests()
+{
+    UNITY_BEGIN();
+    RUN_TEST(bench_broadcast_walk);
+    RUN_TEST(bench_broadcast_open);
+    return UNITY_END();
+}
+
+#ifdef ARDUINO
+void setup()
+{
+    delay(2000);
+    run_tests();
+}
+
+void loop() {}
+#else
+int main()
+{
+    return run_tests();
+}
+#endif
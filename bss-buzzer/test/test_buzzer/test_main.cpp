@@ -0,0 +1,745 @@
+/*
+  Copyright © 2024 Leonard Sebastian Schwennesen. All rights reserved.
+*/
+
+#include <unity.h>
+#include "bss_shared.h"
+#include "bss_frame.h"
+#include "bss_buzzer.h"
+#include "bss_auth.h"
+#include "bss_show.h"
+#include "bss_standby.h"
+
+static const uint8_t controller_mac[6] = {0x40, 0, 0, 0, 0, 0x01};
+static const uint8_t other_mac[6] = {0x40, 0, 0, 0, 0, 0x02};
+static const uint8_t my_mac[6] = {0x40, 0, 0, 0, 0, 0x05};
+static const uint8_t my_id = 5;
+static const uint8_t group_key[BSS_AUTH_KEY_SIZE] = {0x11, 0x22};
+
+static bss_buzzer_t buzzer;
+static uint8_t record[BSS_FRAME_MAX_SIZE];
+
+static const uint8_t *make_record(uint8_t type)
+{
+    const uint8_t color[3] = {1, 2, 3};
+
+    bss_record_put(record, sizeof(record), 0, 5, type, color, type == BSS_MSG_SET_NEOPIXEL_COLOR ? 3 : 0);
+
+    return record;
+}
+
+// What the controller answers to a PAIRING_REQUEST carrying 'buzzer_nonce'.
+static size_t make_pairing_accepted(uint8_t *frame, const uint8_t *buzzer_nonce, uint32_t counter)
+{
+    uint8_t session_key[BSS_AUTH_KEY_SIZE];
+    uint8_t payload[BSS_AUTH_NONCE_SIZE + BSS_AUTH_KEY_SIZE] = {0xC0, 0x01};
+
+    bss_auth_derive_session_key(session_key, my_mac, controller_mac, buzzer_nonce, payload);
+    memcpy(&payload[BSS_AUTH_NONCE_SIZE], group_key, BSS_AUTH_KEY_SIZE);
+    bss_auth_crypt(&payload[BSS_AUTH_NONCE_SIZE], BSS_AUTH_KEY_SIZE, session_key, payload);
+
+    size_t len = bss_record_put(frame, BSS_FRAME_MAX_SIZE, 0, my_id, BSS_MSG_PAIRING_ACCEPTED, payload, sizeof(payload));
+
+    return bss_auth_seal(frame, len, BSS_FRAME_MAX_SIZE, controller_mac, BSS_AUTH_KEY_SESSION, session_key, counter);
+}
+
+static void pair()
+{
+    uint8_t frame[BSS_FRAME_MAX_SIZE];
+
+    buzzer.pairing_state = PAIRING_MODE;
+    size_t len = make_pairing_accepted(frame, buzzer.pairing_nonce, 100);
+
+    bss_buzzer_handle_record(&buzzer, controller_mac, bss_buzzer_open_frame(&buzzer, my_mac, my_id, controller_mac, frame, len));
+}
+
+static size_t make_group_frame(uint8_t *frame, uint8_t type, uint8_t key_id, const uint8_t *key, uint32_t counter)
+{
+    const uint8_t color[3] = {1, 2, 3};
+    size_t len = 0;
+
+    len = bss_record_put(frame, BSS_FRAME_MAX_SIZE, len, my_id - 1, type, color, sizeof(color));
+    len = bss_record_put(frame, BSS_FRAME_MAX_SIZE, len, my_id, type, color, sizeof(color));
+
+    return bss_auth_seal(frame, len, BSS_FRAME_MAX_SIZE, controller_mac, key_id, key, counter);
+}
+
+void setUp()
+{
+    bss_buzzer_init(&buzzer);
+    buzzer.pairing_nonce[0] = 0xB0;
+}
+
+void tearDown() {}
+
+void test_id_is_never_reserved()
+{
+    const uint8_t mac[6] = {0x40, 0, 0, 0, 0, 0x05};
+    const uint8_t standby_sum[6] = {0xF0, 0, 0, 0, 0, 0x0E};
+    const uint8_t all_sum[6] = {0xF0, 0x10, 0, 0, 0, 0xFF};
+
+    TEST_ASSERT_EQUAL_UINT8(0x45, bss_buzzer_id(mac));
+    TEST_ASSERT_FALSE(bss_frame_id_reserved(bss_buzzer_id(standby_sum)));
+    TEST_ASSERT_FALSE(bss_frame_id_reserved(bss_buzzer_id(all_sum)));
+}
+
+void test_pairing_accepted_pairs_with_sender()
+{
+    buzzer.pairing_state = PAIRING_MODE;
+
+    TEST_ASSERT_EQUAL(BSS_BUZZER_PAIRED, bss_buzzer_handle_record(&buzzer, controller_mac, make_record(BSS_MSG_PAIRING_ACCEPTED)));
+    TEST_ASSERT_EQUAL(PAIRED, buzzer.pairing_state);
+    TEST_ASSERT_EQUAL(INIT, buzzer.show_state);
+    TEST_ASSERT_EQUAL_MEMORY(controller_mac, buzzer.controller_mac, 6);
+
+    // a second controller answering the same request does not take over
+    TEST_ASSERT_EQUAL(BSS_BUZZER_PAIRING_STOP, bss_buzzer_handle_record(&buzzer, other_mac, make_record(BSS_MSG_PAIRING_ACCEPTED)));
+    TEST_ASSERT_EQUAL_MEMORY(controller_mac, buzzer.controller_mac, 6);
+}
+
+void test_pairing_remove()
+{
+    buzzer.pairing_state = PAIRING_MODE;
+    bss_buzzer_handle_record(&buzzer, controller_mac, make_record(BSS_MSG_PAIRING_ACCEPTED));
+
+    TEST_ASSERT_EQUAL(BSS_BUZZER_UNPAIRED, bss_buzzer_handle_record(&buzzer, controller_mac, make_record(BSS_MSG_PAIRING_REMOVE)));
+    TEST_ASSERT_EQUAL(UNPAIRED, buzzer.pairing_state);
+
+    TEST_ASSERT_EQUAL(BSS_BUZZER_PAIRING_STOP, bss_buzzer_handle_record(&buzzer, controller_mac, make_record(BSS_MSG_PAIRING_REMOVE)));
+}
+
+void test_wakeup_accepted_only_from_controller()
+{
+    buzzer.pairing_state = PAIRED;
+    mac_copy(buzzer.controller_mac, controller_mac);
+
+    TEST_ASSERT_EQUAL(BSS_BUZZER_NONE, bss_buzzer_handle_record(&buzzer, other_mac, make_record(BSS_MSG_WAKEUP_ACCEPTED)));
+    TEST_ASSERT_EQUAL(UNINITIALIZED, buzzer.show_state);
+
+    TEST_ASSERT_EQUAL(BSS_BUZZER_SHOW_INIT, bss_buzzer_handle_record(&buzzer, controller_mac, make_record(BSS_MSG_WAKEUP_ACCEPTED)));
+    TEST_ASSERT_EQUAL(INIT, buzzer.show_state);
+}
+
+void test_set_color_only_from_controller()
+{
+    buzzer.pairing_state = PAIRED;
+    mac_copy(buzzer.controller_mac, controller_mac);
+
+    TEST_ASSERT_EQUAL(BSS_BUZZER_NONE, bss_buzzer_handle_record(&buzzer, other_mac, make_record(BSS_MSG_SET_NEOPIXEL_COLOR)));
+    TEST_ASSERT_EQUAL(BSS_BUZZER_SET_COLOR, bss_buzzer_handle_record(&buzzer, controller_mac, make_record(BSS_MSG_SET_NEOPIXEL_COLOR)));
+}
+
+void test_set_color_requires_payload()
+{
+    const uint8_t short_record[] = {5, 2, BSS_MSG_SET_NEOPIXEL_COLOR, 255};
+
+    buzzer.pairing_state = PAIRED;
+    mac_copy(buzzer.controller_mac, controller_mac);
+
+    TEST_ASSERT_EQUAL(BSS_BUZZER_NONE, bss_buzzer_handle_record(&buzzer, controller_mac, short_record));
+}
+
+void test_paired_press_is_sent_once()
+{
+    BssButton button(0);
+
+    buzzer.pairing_state = PAIRED;
+
+    button.update(true, 100);
+    TEST_ASSERT_EQUAL(BSS_BUZZER_SEND_PRESS, bss_buzzer_handle_button(&buzzer, &button, 100));
+
+    button.update(true, 101);
+    TEST_ASSERT_EQUAL(BSS_BUZZER_NONE, bss_buzzer_handle_button(&buzzer, &button, 101));
+
+    button.update(false, 150);
+    TEST_ASSERT_EQUAL(BSS_BUZZER_NONE, bss_buzzer_handle_button(&buzzer, &button, 150));
+}
+
+void test_unpaired_idle_goes_to_sleep()
+{
+    BssButton button(0);
+
+    button.update(true, 100);
+    button.update(false, 200);
+    button.update(false, 201);
+    TEST_ASSERT_EQUAL(BSS_BUZZER_NONE, bss_buzzer_handle_button(&buzzer, &button, 201));
+
+    button.update(false, 100 + BSS_BUZZER_IDLE_SLEEP_MS + 1);
+    TEST_ASSERT_EQUAL(BSS_BUZZER_SLEEP, bss_buzzer_handle_button(&buzzer, &button, 100 + BSS_BUZZER_IDLE_SLEEP_MS + 1));
+}
+
+void test_hold_enters_pairing_mode()
+{
+    BssButton button(0);
+    unsigned long now = 100;
+
+    button.update(true, now);
+
+    for (now = 101; now < 100 + BSS_BUZZER_PAIRING_HOLD_MS; now += 50)
+    {
+        button.update(true, now);
+        TEST_ASSERT_EQUAL(BSS_BUZZER_NONE, bss_buzzer_handle_button(&buzzer, &button, now));
+    }
+
+    now = 100 + BSS_BUZZER_PAIRING_HOLD_MS;
+    button.update(true, now);
+    TEST_ASSERT_EQUAL(BSS_BUZZER_PAIRING_START, bss_buzzer_handle_button(&buzzer, &button, now));
+    TEST_ASSERT_EQUAL(PAIRING_MODE, buzzer.pairing_state);
+
+    // no second start and no sleep while pairing
+    button.update(false, now + 5000);
+    TEST_ASSERT_EQUAL(BSS_BUZZER_NONE, bss_buzzer_handle_button(&buzzer, &button, now + 5000));
+}
+
+void test_long_hold_drops_the_pairing()
+{
+    uint8_t frame[BSS_FRAME_MAX_SIZE];
+    BssButton button(0);
+    unsigned long now = 100;
+
+    pair();
+    buzzer.show_stale = false;
+
+    button.update(true, now);
+    TEST_ASSERT_EQUAL(BSS_BUZZER_SEND_PRESS, bss_buzzer_handle_button(&buzzer, &button, now));
+
+    // a pairing hold is just a long press
+    for (now = 101; now < 100 + BSS_BUZZER_UNPAIR_HOLDS * BSS_BUZZER_PAIRING_HOLD_MS; now += 50)
+    {
+        button.update(true, now);
+        TEST_ASSERT_EQUAL(BSS_BUZZER_NONE, bss_buzzer_handle_button(&buzzer, &button, now));
+    }
+
+    now = 100 + BSS_BUZZER_UNPAIR_HOLDS * BSS_BUZZER_PAIRING_HOLD_MS;
+    button.update(true, now);
+    TEST_ASSERT_EQUAL(BSS_BUZZER_UNPAIR, bss_buzzer_handle_button(&buzzer, &button, now));
+    TEST_ASSERT_EQUAL(PAIRING_MODE, buzzer.pairing_state);
+    TEST_ASSERT_TRUE(buzzer.show_stale);
+
+    button.update(true, now + 50);
+    TEST_ASSERT_EQUAL(BSS_BUZZER_NONE, bss_buzzer_handle_button(&buzzer, &button, now + 50));
+
+    // a controller that lost its state starts its counters from scratch
+    buzzer.pairing_nonce[0] = 0xB1;
+    size_t len = make_pairing_accepted(frame, buzzer.pairing_nonce, 1);
+    const uint8_t *record = bss_buzzer_open_frame(&buzzer, my_mac, my_id, controller_mac, frame, len);
+
+    TEST_ASSERT_NOT_NULL(record);
+    TEST_ASSERT_EQUAL(BSS_BUZZER_PAIRED, bss_buzzer_handle_record(&buzzer, controller_mac, record));
+    TEST_ASSERT_EQUAL(PAIRED, buzzer.pairing_state);
+}
+
+static const uint8_t *make_config_record(const bss_config_t *config)
+{
+    uint8_t payload[BSS_CONFIG_WIRE_SIZE];
+
+    bss_config_encode(config, payload);
+    bss_record_put(record, sizeof(record), 0, my_id, BSS_MSG_CONFIG, payload, sizeof(payload));
+
+    return record;
+}
+
+void test_config_is_applied_once()
+{
+    bss_config_t config;
+
+    buzzer.pairing_state = PAIRED;
+    mac_copy(buzzer.controller_mac, controller_mac);
+
+    bss_config_default(&config);
+    config.version = 3;
+    config.brightness = 40;
+
+    TEST_ASSERT_EQUAL(BSS_BUZZER_NONE, bss_buzzer_handle_record(&buzzer, other_mac, make_config_record(&config)));
+    TEST_ASSERT_EQUAL(BSS_BUZZER_CONFIG, bss_buzzer_handle_record(&buzzer, controller_mac, make_config_record(&config)));
+    TEST_ASSERT_EQUAL_UINT16(3, buzzer.config.version);
+    TEST_ASSERT_EQUAL_UINT8(40, buzzer.config.brightness);
+
+    TEST_ASSERT_EQUAL(BSS_BUZZER_NONE, bss_buzzer_handle_record(&buzzer, controller_mac, make_config_record(&config)));
+}
+
+void test_invalid_config_is_ignored()
+{
+    bss_config_t config;
+
+    buzzer.pairing_state = PAIRED;
+    mac_copy(buzzer.controller_mac, controller_mac);
+
+    bss_config_default(&config);
+    config.version = 4;
+    config.led_num = 0;
+
+    TEST_ASSERT_EQUAL(BSS_BUZZER_NONE, bss_buzzer_handle_record(&buzzer, controller_mac, make_config_record(&config)));
+    TEST_ASSERT_EQUAL_UINT16(0, buzzer.config.version);
+    TEST_ASSERT_EQUAL_UINT8(12, buzzer.config.led_num);
+}
+
+void test_configured_pairing_hold()
+{
+    BssButton button(0);
+
+    buzzer.config.pairing_hold_ms = 500;
+
+    button.update(true, 100);
+    button.update(true, 599);
+    TEST_ASSERT_EQUAL(BSS_BUZZER_NONE, bss_buzzer_handle_button(&buzzer, &button, 599));
+
+    button.update(true, 600);
+    TEST_ASSERT_EQUAL(BSS_BUZZER_PAIRING_START, bss_buzzer_handle_button(&buzzer, &button, 600));
+}
+
+void test_pairing_accepted_assigns_slot_and_clock()
+{
+    uint8_t payload[BSS_AUTH_NONCE_SIZE + BSS_AUTH_KEY_SIZE + 1 + BSS_SLOT_TIME_SIZE] = {0};
+
+    payload[BSS_AUTH_NONCE_SIZE + BSS_AUTH_KEY_SIZE] = 16;
+    bss_put_u32(&payload[BSS_AUTH_NONCE_SIZE + BSS_AUTH_KEY_SIZE + 1], 101000);
+    bss_record_put(record, sizeof(record), 0, my_id, BSS_MSG_PAIRING_ACCEPTED, payload, sizeof(payload));
+
+    buzzer.pairing_state = PAIRING_MODE;
+    TEST_ASSERT_EQUAL(BSS_BUZZER_PAIRED, bss_buzzer_handle_record(&buzzer, controller_mac, record));
+    TEST_ASSERT_EQUAL_UINT8(16, buzzer.slot);
+
+    TEST_ASSERT_TRUE(bss_buzzer_sync_clock(&buzzer, record, 100000));
+    TEST_ASSERT_EQUAL_UINT32(1000, buzzer.clock_offset);
+
+    // slot 16 of 64 starts 500 ms into the 2 s period, the controller is at
+    // 1000 ms into it
+    TEST_ASSERT_EQUAL_UINT32(1500, bss_buzzer_slot_wait(&buzzer, 100000));
+    TEST_ASSERT_EQUAL_UINT32(2000, bss_buzzer_slot_wait(&buzzer, 101500));
+    TEST_ASSERT_EQUAL_UINT32(1, bss_buzzer_slot_wait(&buzzer, 101499));
+}
+
+void test_no_slot_pings_every_period()
+{
+    TEST_ASSERT_EQUAL_UINT8(BSS_SLOT_NONE, buzzer.slot);
+    TEST_ASSERT_EQUAL_UINT32(buzzer.config.ping_ms, bss_buzzer_slot_wait(&buzzer, 1234));
+
+    // an old controller without slot and clock
+    TEST_ASSERT_FALSE(bss_buzzer_sync_clock(&buzzer, make_record(BSS_MSG_WAKEUP_ACCEPTED), 0));
+}
+
+void test_slots_are_spread_over_the_period()
+{
+    uint32_t previous = bss_slot_offset(0, 2000);
+
+    TEST_ASSERT_EQUAL_UINT32(0, previous);
+
+    for (uint8_t slot = 1; slot < BSS_SLOT_COUNT; slot++)
+    {
+        uint32_t offset = bss_slot_offset(slot, 2000);
+
+        TEST_ASSERT_TRUE(offset - previous >= 31 && offset - previous <= 32);
+        previous = offset;
+    }
+
+    TEST_ASSERT_TRUE(previous < 2000);
+}
+
+void test_own_record_in_broadcast()
+{
+    uint8_t frame[BSS_FRAME_MAX_SIZE];
+    const uint8_t white[3] = {255, 255, 255};
+    size_t size = 0;
+
+    buzzer.pairing_state = PAIRED;
+    mac_copy(buzzer.controller_mac, controller_mac);
+
+    for (uint8_t id = 0; id < 10; id++)
+        size = bss_record_put(frame, sizeof(frame), size, id, BSS_MSG_SET_NEOPIXEL_COLOR, white, sizeof(white));
+
+    const uint8_t *own = bss_frame_find(frame, size, 7);
+    TEST_ASSERT_NOT_NULL(own);
+    TEST_ASSERT_EQUAL(BSS_BUZZER_SET_COLOR, bss_buzzer_handle_record(&buzzer, controller_mac, own));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(white, bss_record_payload(own), 3);
+
+    TEST_ASSERT_NULL(bss_frame_find(frame, size, 10));
+}
+
+void test_open_pairing_accepted_installs_keys()
+{
+    uint8_t frame[BSS_FRAME_MAX_SIZE];
+
+    buzzer.pairing_state = PAIRING_MODE;
+    size_t len = make_pairing_accepted(frame, buzzer.pairing_nonce, 100);
+
+    const uint8_t *record = bss_buzzer_open_frame(&buzzer, my_mac, my_id, controller_mac, frame, len);
+    TEST_ASSERT_NOT_NULL(record);
+    TEST_ASSERT_EQUAL_MEMORY(group_key, buzzer.group_key, BSS_AUTH_KEY_SIZE);
+    TEST_ASSERT_EQUAL_UINT32(100, buzzer.controller_counter);
+
+    TEST_ASSERT_EQUAL(BSS_BUZZER_PAIRED, bss_buzzer_handle_record(&buzzer, controller_mac, record));
+}
+
+void test_open_rejects_pairing_for_other_nonce()
+{
+    uint8_t frame[BSS_FRAME_MAX_SIZE];
+    const uint8_t old_nonce[BSS_AUTH_NONCE_SIZE] = {0x0D};
+
+    buzzer.pairing_state = PAIRING_MODE;
+    size_t len = make_pairing_accepted(frame, old_nonce, 100);
+
+    TEST_ASSERT_NULL(bss_buzzer_open_frame(&buzzer, my_mac, my_id, controller_mac, frame, len));
+    TEST_ASSERT_EQUAL(PAIRING_MODE, buzzer.pairing_state);
+}
+
+void test_open_group_frame_and_reject_replay()
+{
+    uint8_t frame[BSS_FRAME_MAX_SIZE];
+
+    pair();
+    size_t len = make_group_frame(frame, BSS_MSG_SET_NEOPIXEL_COLOR, BSS_AUTH_KEY_GROUP, group_key, 101);
+
+    const uint8_t *record = bss_buzzer_open_frame(&buzzer, my_mac, my_id, controller_mac, frame, len);
+    TEST_ASSERT_NOT_NULL(record);
+    TEST_ASSERT_EQUAL_UINT8(my_id, bss_record_id(record));
+
+    TEST_ASSERT_NULL(bss_buzzer_open_frame(&buzzer, my_mac, my_id, controller_mac, frame, len));
+}
+
+void test_open_rejects_forgeries()
+{
+    uint8_t frame[BSS_FRAME_MAX_SIZE];
+    const uint8_t guessed_key[BSS_AUTH_KEY_SIZE] = {0};
+
+    pair();
+
+    size_t len = make_group_frame(frame, BSS_MSG_SET_NEOPIXEL_COLOR, BSS_AUTH_KEY_GROUP, guessed_key, 200);
+    TEST_ASSERT_NULL(bss_buzzer_open_frame(&buzzer, my_mac, my_id, controller_mac, frame, len));
+
+    len = make_group_frame(frame, BSS_MSG_SET_NEOPIXEL_COLOR, BSS_AUTH_KEY_GROUP, group_key, 201);
+    TEST_ASSERT_NULL(bss_buzzer_open_frame(&buzzer, my_mac, my_id, other_mac, frame, len));
+
+    // the fleet key is known to every device, it can not even unpair
+    len = make_group_frame(frame, BSS_MSG_SET_NEOPIXEL_COLOR, BSS_AUTH_KEY_FLEET, bss_fleet_key, 202);
+    TEST_ASSERT_NULL(bss_buzzer_open_frame(&buzzer, my_mac, my_id, controller_mac, frame, len));
+
+    len = make_group_frame(frame, BSS_MSG_PAIRING_REMOVE, BSS_AUTH_KEY_FLEET, bss_fleet_key, 0xFFFFFFF0);
+    TEST_ASSERT_NULL(bss_buzzer_open_frame(&buzzer, my_mac, my_id, controller_mac, frame, len));
+
+    // and a forged counter does not move the replay window
+    len = make_group_frame(frame, BSS_MSG_PAIRING_REMOVE, BSS_AUTH_KEY_SESSION, buzzer.session_key, 204);
+    TEST_ASSERT_NOT_NULL(bss_buzzer_open_frame(&buzzer, my_mac, my_id, controller_mac, frame, len));
+}
+
+static size_t make_heartbeat(uint8_t *frame, const bss_heartbeat_t *heartbeat, uint8_t type, uint32_t counter)
+{
+    uint8_t payload[BSS_HEARTBEAT_SIZE];
+
+    bss_heartbeat_encode(heartbeat, payload);
+    size_t len = bss_record_put(frame, BSS_FRAME_MAX_SIZE, 0, BSS_FRAME_ID_ALL, type, payload, sizeof(payload));
+
+    return bss_auth_seal(frame, len, BSS_FRAME_MAX_SIZE, controller_mac, BSS_AUTH_KEY_GROUP, group_key, counter);
+}
+
+void test_heartbeat_addresses_the_fleet()
+{
+    uint8_t frame[BSS_FRAME_MAX_SIZE];
+    bss_heartbeat_t heartbeat = {BSS_SHOW_LOCKED, 3, 42, {255, 255, 255}, 5000, 0, {0}};
+
+    pair();
+
+    size_t len = make_heartbeat(frame, &heartbeat, BSS_MSG_HEARTBEAT, 101);
+    const uint8_t *record = bss_buzzer_open_frame(&buzzer, my_mac, my_id, controller_mac, frame, len);
+
+    TEST_ASSERT_NOT_NULL(record);
+    TEST_ASSERT_EQUAL(BSS_BUZZER_HEARTBEAT, bss_buzzer_handle_record(&buzzer, controller_mac, record));
+    TEST_ASSERT_EQUAL_UINT16(42, buzzer.heartbeat.seq);
+    TEST_ASSERT_EQUAL_UINT8(3, buzzer.heartbeat.winner);
+
+    TEST_ASSERT_TRUE(bss_buzzer_sync_clock(&buzzer, record, 4000));
+    TEST_ASSERT_EQUAL_UINT32(1000, buzzer.clock_offset);
+
+    // only fleet messages may be addressed to every client
+    len = make_heartbeat(frame, &heartbeat, BSS_MSG_SET_NEOPIXEL_COLOR, 102);
+    TEST_ASSERT_NULL(bss_buzzer_open_frame(&buzzer, my_mac, my_id, controller_mac, frame, len));
+}
+
+void test_heartbeat_resyncs_missed_colors()
+{
+    const uint8_t color[5] = {255, 0, 0, 7, 0};
+
+    buzzer.pairing_state = PAIRED;
+    mac_copy(buzzer.controller_mac, controller_mac);
+
+    // nothing displayed with a seq yet
+    buzzer.heartbeat.seq = 7;
+    TEST_ASSERT_TRUE(bss_buzzer_resync_show(&buzzer));
+    TEST_ASSERT_FALSE(bss_buzzer_resync_show(&buzzer));
+
+    bss_record_put(record, sizeof(record), 0, my_id, BSS_MSG_SET_NEOPIXEL_COLOR, color, sizeof(color));
+    TEST_ASSERT_EQUAL(BSS_BUZZER_SET_COLOR, bss_buzzer_handle_record(&buzzer, controller_mac, record));
+    TEST_ASSERT_FALSE(bss_buzzer_resync_show(&buzzer));
+
+    // the reset broadcast was lost
+    buzzer.heartbeat.seq = 8;
+    TEST_ASSERT_TRUE(bss_buzzer_resync_show(&buzzer));
+    TEST_ASSERT_EQUAL_UINT16(8, buzzer.show_seq);
+}
+
+// A heartbeat record of the controller at 'time' with 'seq'.
+static const uint8_t *make_heartbeat_record(uint16_t seq, uint32_t time)
+{
+    uint8_t payload[BSS_HEARTBEAT_SIZE];
+    bss_heartbeat_t heartbeat = {BSS_SHOW_OPEN, 0, seq, {0, 0, 0}, time, 0, {0}};
+
+    bss_heartbeat_encode(&heartbeat, payload);
+    bss_record_put(record, sizeof(record), 0, BSS_FRAME_ID_ALL, BSS_MSG_HEARTBEAT, payload, sizeof(payload));
+
+    return record;
+}
+
+void test_older_show_states_are_ignored()
+{
+    const uint8_t color[5] = {255, 0, 0, 9, 0};
+
+    buzzer.pairing_state = PAIRED;
+    mac_copy(buzzer.controller_mac, controller_mac);
+
+    bss_record_put(record, sizeof(record), 0, my_id, BSS_MSG_SET_NEOPIXEL_COLOR, color, sizeof(color));
+    TEST_ASSERT_EQUAL(BSS_BUZZER_SET_COLOR, bss_buzzer_handle_record(&buzzer, controller_mac, record));
+
+    // a heartbeat queued before the lockout went out after it
+    TEST_ASSERT_EQUAL(BSS_BUZZER_HEARTBEAT, bss_buzzer_handle_record(&buzzer, controller_mac, make_heartbeat_record(8, 1000)));
+    TEST_ASSERT_FALSE(bss_buzzer_resync_show(&buzzer));
+    TEST_ASSERT_EQUAL_UINT16(9, buzzer.show_seq);
+
+    const uint8_t older[5] = {0, 255, 0, 8, 0};
+    bss_record_put(record, sizeof(record), 0, my_id, BSS_MSG_SET_NEOPIXEL_COLOR, older, sizeof(older));
+    TEST_ASSERT_EQUAL(BSS_BUZZER_NONE, bss_buzzer_handle_record(&buzzer, controller_mac, record));
+
+    // across the wrap of the seq
+    buzzer.show_seq = 0xFFFF;
+    bss_buzzer_handle_record(&buzzer, controller_mac, make_heartbeat_record(1, 2000));
+    TEST_ASSERT_TRUE(bss_buzzer_resync_show(&buzzer));
+
+    // a restarted controller counts from 0 again
+    bss_buzzer_handle_record(&buzzer, controller_mac, make_heartbeat_record(0, 500));
+    TEST_ASSERT_TRUE(buzzer.show_stale);
+    TEST_ASSERT_TRUE(bss_buzzer_resync_show(&buzzer));
+    TEST_ASSERT_EQUAL_UINT16(0, buzzer.show_seq);
+}
+
+void test_heartbeat_tells_whether_we_are_heard()
+{
+    buzzer.slot = 10;
+
+    TEST_ASSERT_FALSE(bss_buzzer_heard(&buzzer));
+
+    bss_heartbeat_set_heard(buzzer.heartbeat.heard, 10);
+    TEST_ASSERT_TRUE(bss_buzzer_heard(&buzzer));
+
+    buzzer.heartbeat.config_version = 2;
+    TEST_ASSERT_FALSE(bss_buzzer_heard(&buzzer));
+}
+
+// A TAKEOVER of the standby at other_mac, tagged with 'session_key'.
+static size_t make_takeover(uint8_t *frame, const uint8_t *session_key, uint32_t counter, const uint8_t *key,
+                            uint32_t frame_counter)
+{
+    uint8_t payload[BSS_TAKEOVER_SIZE];
+
+    bss_put_u32(payload, counter);
+    bss_takeover_tag(&payload[4], session_key, other_mac, counter);
+
+    size_t len = bss_record_put(frame, BSS_FRAME_MAX_SIZE, 0, my_id, BSS_MSG_TAKEOVER, payload, sizeof(payload));
+
+    return bss_auth_seal(frame, len, BSS_FRAME_MAX_SIZE, other_mac, BSS_AUTH_KEY_GROUP, key, frame_counter);
+}
+
+void test_takeover_moves_to_the_standby()
+{
+    uint8_t frame[BSS_FRAME_MAX_SIZE];
+
+    pair();
+
+    size_t len = make_takeover(frame, buzzer.session_key, 5000, group_key, 5000);
+    const uint8_t *record = bss_buzzer_open_frame(&buzzer, my_mac, my_id, other_mac, frame, len);
+
+    TEST_ASSERT_NOT_NULL(record);
+    TEST_ASSERT_EQUAL(BSS_BUZZER_TAKEOVER, bss_buzzer_handle_record(&buzzer, other_mac, record));
+    TEST_ASSERT_EQUAL_MEMORY(other_mac, buzzer.controller_mac, 6);
+    TEST_ASSERT_EQUAL(PAIRED, buzzer.pairing_state);
+
+    // the old controller is not heard anymore
+    len = make_group_frame(frame, BSS_MSG_SET_NEOPIXEL_COLOR, BSS_AUTH_KEY_GROUP, group_key, 6000);
+    TEST_ASSERT_NULL(bss_buzzer_open_frame(&buzzer, my_mac, my_id, controller_mac, frame, len));
+}
+
+void test_takeover_rejects_forgeries()
+{
+    uint8_t frame[BSS_FRAME_MAX_SIZE];
+    const uint8_t guessed_key[BSS_AUTH_KEY_SIZE] = {0};
+
+    pair();
+
+    // knows the group key, but not our session key
+    size_t len = make_takeover(frame, guessed_key, 5000, group_key, 5000);
+    TEST_ASSERT_NULL(bss_buzzer_open_frame(&buzzer, my_mac, my_id, other_mac, frame, len));
+
+    len = make_takeover(frame, buzzer.session_key, 5000, guessed_key, 5001);
+    TEST_ASSERT_NULL(bss_buzzer_open_frame(&buzzer, my_mac, my_id, other_mac, frame, len));
+
+    // not above the counters of the current controller
+    len = make_takeover(frame, buzzer.session_key, 100, group_key, 5002);
+    TEST_ASSERT_NULL(bss_buzzer_open_frame(&buzzer, my_mac, my_id, other_mac, frame, len));
+
+    // sealed below its own takeover counter
+    len = make_takeover(frame, buzzer.session_key, 5000, group_key, 4999);
+    TEST_ASSERT_NULL(bss_buzzer_open_frame(&buzzer, my_mac, my_id, other_mac, frame, len));
+
+    TEST_ASSERT_EQUAL_MEMORY(controller_mac, buzzer.controller_mac, 6);
+}
+
+// The controller's show color for 'phase' under 'seq'.
+static const uint8_t *make_show_color(uint8_t phase, uint16_t seq)
+{
+    uint8_t payload[6] = {255, 255, 255};
+
+    bss_put_u16(&payload[3], seq);
+    payload[5] = phase;
+    bss_record_put(record, sizeof(record), 0, my_id, BSS_MSG_SET_NEOPIXEL_COLOR, payload, sizeof(payload));
+
+    return record;
+}
+
+void test_speculation_needs_config_and_open_show()
+{
+    buzzer.pairing_state = PAIRED;
+    mac_copy(buzzer.controller_mac, controller_mac);
+
+    bss_buzzer_handle_record(&buzzer, controller_mac, make_show_color(BSS_SHOW_OPEN, 7));
+    TEST_ASSERT_FALSE(bss_buzzer_speculate(&buzzer, 100));
+
+    buzzer.config.provisional_ms = 500;
+    bss_buzzer_handle_record(&buzzer, controller_mac, make_show_color(BSS_SHOW_LOCKED, 8));
+    TEST_ASSERT_FALSE(bss_buzzer_speculate(&buzzer, 100));
+
+    bss_buzzer_handle_record(&buzzer, controller_mac, make_show_color(BSS_SHOW_OPEN, 9));
+    TEST_ASSERT_TRUE(bss_buzzer_speculate(&buzzer, 100));
+    // once per decision
+    TEST_ASSERT_FALSE(bss_buzzer_speculate(&buzzer, 101));
+}
+
+void test_speculation_is_settled_by_a_newer_seq()
+{
+    buzzer.pairing_state = PAIRED;
+    mac_copy(buzzer.controller_mac, controller_mac);
+    buzzer.config.provisional_ms = 500;
+
+    bss_buzzer_handle_record(&buzzer, controller_mac, make_show_color(BSS_SHOW_OPEN, 7));
+    bss_buzzer_speculate(&buzzer, 100);
+
+    // late repeats of the open show do not revert the press
+    TEST_ASSERT_EQUAL(BSS_BUZZER_NONE, bss_buzzer_handle_record(&buzzer, controller_mac, make_show_color(BSS_SHOW_OPEN, 7)));
+    buzzer.heartbeat.seq = 7;
+    buzzer.heartbeat.phase = BSS_SHOW_OPEN;
+    TEST_ASSERT_FALSE(bss_buzzer_resync_show(&buzzer));
+    TEST_ASSERT_TRUE(buzzer.provisional);
+
+    TEST_ASSERT_EQUAL(BSS_BUZZER_SET_COLOR, bss_buzzer_handle_record(&buzzer, controller_mac, make_show_color(BSS_SHOW_LOCKED, 8)));
+    TEST_ASSERT_FALSE(buzzer.provisional);
+    TEST_ASSERT_FALSE(bss_buzzer_provisional_expired(&buzzer, 1000));
+
+    // a missed decision is caught up by the heartbeat
+    bss_buzzer_handle_record(&buzzer, controller_mac, make_show_color(BSS_SHOW_OPEN, 9));
+    bss_buzzer_speculate(&buzzer, 2000);
+    buzzer.heartbeat.seq = 10;
+    buzzer.heartbeat.phase = BSS_SHOW_LOCKED;
+    TEST_ASSERT_TRUE(bss_buzzer_resync_show(&buzzer));
+    TEST_ASSERT_FALSE(buzzer.provisional);
+}
+
+void test_undecided_speculation_expires()
+{
+    buzzer.pairing_state = PAIRED;
+    mac_copy(buzzer.controller_mac, controller_mac);
+    buzzer.config.provisional_ms = 500;
+
+    bss_buzzer_handle_record(&buzzer, controller_mac, make_show_color(BSS_SHOW_OPEN, 7));
+    bss_buzzer_speculate(&buzzer, 100);
+
+    TEST_ASSERT_FALSE(bss_buzzer_provisional_expired(&buzzer, 599));
+    TEST_ASSERT_TRUE(bss_buzzer_provisional_expired(&buzzer, 600));
+    TEST_ASSERT_FALSE(bss_buzzer_provisional_expired(&buzzer, 601));
+
+    // the open show is displayed again and the next press speculates again
+    TEST_ASSERT_TRUE(bss_buzzer_speculate(&buzzer, 700));
+}
+
+void test_relay_role_and_repeated_frames()
+{
+    uint8_t frame[BSS_FRAME_MAX_SIZE];
+    uint8_t role[1 + BSS_RELAY_ROLE_ENTRY_SIZE] = {BSS_RELAY_FORWARD | BSS_RELAY_BROADCAST, 9};
+
+    pair();
+    mac_copy(&role[2], other_mac);
+    bss_record_put(record, sizeof(record), 0, my_id, BSS_MSG_RELAY_ROLE, role, sizeof(role));
+
+    TEST_ASSERT_EQUAL(BSS_BUZZER_NONE, bss_buzzer_handle_record(&buzzer, other_mac, record));
+    TEST_ASSERT_EQUAL(BSS_BUZZER_RELAY_ROLE, bss_buzzer_handle_record(&buzzer, controller_mac, record));
+    TEST_ASSERT_EQUAL_UINT8(BSS_RELAY_FORWARD | BSS_RELAY_BROADCAST, buzzer.relay.flags);
+    TEST_ASSERT_EQUAL_UINT8(1, buzzer.relay.far_count);
+
+    // a group frame of the controller, heard from a relay
+    size_t len = make_group_frame(frame, BSS_MSG_SET_NEOPIXEL_COLOR, BSS_AUTH_KEY_GROUP, group_key, 300);
+
+    TEST_ASSERT_TRUE(bss_relay_repeated(buzzer.controller_mac, buzzer.group_key, other_mac, frame, len));
+    TEST_ASSERT_NOT_NULL(bss_buzzer_open_frame(&buzzer, my_mac, my_id, controller_mac, frame, len));
+    // only once, whichever copy comes first
+    TEST_ASSERT_NULL(bss_buzzer_open_frame(&buzzer, my_mac, my_id, controller_mac, frame, len));
+}
+
+int run_tests()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_id_is_never_reserved);
+    RUN_TEST(test_pairing_accepted_pairs_with_sender);
+    RUN_TEST(test_pairing_remove);
+    RUN_TEST(test_wakeup_accepted_only_from_controller);
+    RUN_TEST(test_set_color_only_from_controller);
+    RUN_TEST(test_set_color_requires_payload);
+    RUN_TEST(test_paired_press_is_sent_once);
+    RUN_TEST(test_unpaired_idle_goes_to_sleep);
+    RUN_TEST(test_hold_enters_pairing_mode);
+    RUN_TEST(test_long_hold_drops_the_pairing);
+    RUN_TEST(test_own_record_in_broadcast);
+    RUN_TEST(test_config_is_applied_once);
+    RUN_TEST(test_invalid_config_is_ignored);
+    RUN_TEST(test_configured_pairing_hold);
+    RUN_TEST(test_pairing_accepted_assigns_slot_and_clock);
+    RUN_TEST(test_no_slot_pings_every_period);
+    RUN_TEST(test_slots_are_spread_over_the_period);
+    RUN_TEST(test_open_pairing_accepted_installs_keys);
+    RUN_TEST(test_open_rejects_pairing_for_other_nonce);
+    RUN_TEST(test_open_group_frame_and_reject_replay);
+    RUN_TEST(test_open_rejects_forgeries);
+    RUN_TEST(test_heartbeat_addresses_the_fleet);
+    RUN_TEST(test_heartbeat_resyncs_missed_colors);
+    RUN_TEST(test_older_show_states_are_ignored);
+    RUN_TEST(test_heartbeat_tells_whether_we_are_heard);
+    RUN_TEST(test_takeover_moves_to_the_standby);
+    RUN_TEST(test_takeover_rejects_forgeries);
+    RUN_TEST(test_speculation_needs_config_and_open_show);
+    RUN_TEST(test_speculation_is_settled_by_a_newer_seq);
+    RUN_TEST(test_undecided_speculation_expires);
+    RUN_TEST(test_relay_role_and_repeated_frames);
+    return UNITY_END();
+}
+
+#ifdef ARDUINO
+#include <Arduino.h>
+
+void setup()
+{
+    delay(2000);
+    run_tests();
+}
+
+void loop() {}
+#else
+int main()
+{
+    return run_tests();
+}
+#endif
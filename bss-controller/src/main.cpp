@@ -6,8 +6,28 @@
 #include <WiFi.h>
 #include <esp_now.h>
 #include <esp_wifi.h>
+#include <nvs.h>
+#include <nvs_flash.h>
+#include <esp_timer.h>
 #include <ReactESP.h>
+#include <atomic>
 #include "bss_shared.h"
+#include "bss_frame.h"
+#include "bss_button.h"
+#include "bss_input.h"
+#include "bss_registry.h"
+#include "bss_show.h"
+#include "bss_auth.h"
+#include "bss_controller.h"
+#include "bss_journal.h"
+#include "bss_config.h"
+#include "bss_slot.h"
+#include "bss_heartbeat.h"
+#include "bss_trace.h"
+#include "bss_txq.h"
+#include "bss_buzzer.h"
+#include "bss_standby.h"
+#include "bss_relay.h"
 
 #define sec *1000
 #define MAX_ALLOED_TIMEOUT 5 sec
@@ -15,282 +35,1289 @@
 uint8_t broadcast_mac[6] = {0xFF, 0xFF, 0xFF, 0xFF, 0xFF, 0xFF};
 esp_now_peer_info_t broadcast_peer;
 
-typedef struct client_struct
+typedef struct
+{
+    uint8_t r;
+    uint8_t g;
+    uint8_t b;
+} rgb_t;
+
+// indexed by bss_show_phase
+const rgb_t show_colors[] = {{0, 0, 0}, {255, 255, 255}, {0, 255, 0}, {255, 0, 0}};
+
+bss_registry_t clients;
+bss_show_t show;
+// the press that holds the lockout, only used by the receive path
+bss_arbiter_t arbiter;
+bss_journal_t journal;
+// every frame goes out through the transmit queue
+bss_txq_t txq;
+// pumps the queue once the radio is done with a frame
+TaskHandle_t tx_task = NULL;
+
+// Only serialises registry writers (pairing and removal) and changes of the
+// fleet configuration, registry readers take snapshots and never wait for it.
+SemaphoreHandle_t xMutex = NULL;
+
+#define RIGHT_BUTTON D9
+#define RESET_BUTTON D8
+#define WRONG_BUTTON D7
+
+// indexed by bss_moderator_button
+const uint8_t button_pins[] = {RIGHT_BUTTON, RESET_BUTTON, WRONG_BUTTON};
+BssButton buttons[] = {BssButton(RIGHT_BUTTON), BssButton(RESET_BUTTON), BssButton(WRONG_BUTTON)};
+// moderator events from the button scanner
+bss_input_t input;
+esp_timer_handle_t scan_timer;
+
+std::atomic<bool> pairing_mode(false);
+
+// the fleet configuration, pushed to all buzzers on every change
+bss_config_t config;
+// The receive path only compares versions and marks the clients that need
+// the configuration, one bit per slot. loop() owns 'config' and sends it.
+std::atomic<uint16_t> config_version(0);
+std::atomic<uint32_t> config_wanted[BSS_REGISTRY_MAX_CLIENTS / 32];
+
+uint8_t my_mac[MAC_SIZE];
+uint8_t group_key[BSS_AUTH_KEY_SIZE];
+
+// Hot standby, see bss_standby.h. A standby is paired with the primary
+// through 'uplink' and takes over once the primary was silent since
+// 'primary_heard' (millis()) for too long.
+std::atomic<bool> standby(false);
+bss_buzzer_t uplink;
+std::atomic<uint32_t> primary_heard(0);
+// highest frame counter of the primary from its mirror
+uint32_t primary_counter = 0;
+uint32_t takeover_counter = 0;
+uint8_t takeover_repeats = 0;
+// set by a TAKEOVER of another controller, this one must not transmit again
+std::atomic<bool> taken_over(false);
+// highest counter of the controller this one took over from, heard since
+// the last heartbeat
+std::atomic<uint32_t> rival_counter(0);
+
+// Relays for clients with a poor direct link, see bss_relay.h. Optional,
+// persisted as "relay". The plan follows the heartbeat, 'relay_roles' holds
+// the flags last sent to every slot. Relay mode also lets a relayed earlier
+// press take the lockout over, see bss_controller_timed_press.
+std::atomic<bool> relay_mode(false);
+bss_links_t links;
+bss_relay_plan_t relay_plan;
+uint8_t relay_roles[BSS_REGISTRY_MAX_CLIENTS];
+
+std::atomic<uint32_t> tx_counter(1);
+uint32_t tx_counter_reserved = 0;
+
+nvs_handle_t nvs_bss_handle;
+
+reactesp::ReactESP app;
+
+inline void blink(uint8_t pin, bool initial_state)
+{
+    static bool state = !initial_state;
+
+    digitalWrite(pin, state = !state);
+}
+
+bool send_msg(const uint8_t *mac_addr, const uint8_t *data, size_t size)
+{
+    // ESP-NOW keeps about 20 peers for up to 64 clients, the others are sent
+    // to as broadcast, their record id and session key tag still bind the
+    // frame to them
+    if (!esp_now_is_peer_exist(mac_addr))
+        mac_addr = broadcast_mac;
+
+    BSS_TRACE_BEGIN(BSS_TRACE_SEND);
+    esp_err_t result = esp_now_send(mac_addr, data, size);
+    BSS_TRACE_END(BSS_TRACE_SEND);
+
+    return result == ESP_OK;
+}
+
+void print_mac(const uint8_t *mac)
+{
+    Serial.printf("%02X:%02X:%02X:%02X:%02X:%02X\n", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5], mac[6]);
+}
+
+// Persists the next block of frame counters before it is used, so counters
+// never repeat across reboots.
+void reserve_tx_counter()
+{
+    uint32_t counter = tx_counter;
+
+    if (counter + BSS_AUTH_COUNTER_BLOCK / 2 < tx_counter_reserved)
+        return;
+
+    tx_counter_reserved = counter + BSS_AUTH_COUNTER_BLOCK;
+
+    esp_err_t err = nvs_open("bss_ctrl", NVS_READWRITE, &nvs_bss_handle);
+    if (err == ESP_OK)
+    {
+        nvs_set_u32(nvs_bss_handle, "tx_counter", tx_counter_reserved);
+
+        nvs_commit(nvs_bss_handle);
+        nvs_close(nvs_bss_handle);
+    }
+}
+
+// Continues the frame counter at 'counter', unless it is past that already,
+// and returns the next counter.
+uint32_t raise_tx_counter(uint32_t counter)
+{
+    uint32_t current = tx_counter;
+
+    while (current < counter && !tx_counter.compare_exchange_weak(current, counter))
+        ;
+
+    reserve_tx_counter();
+
+    return current < counter ? counter : current;
+}
+
+// The show state and the time of a heartbeat.
+void heartbeat_show(bss_heartbeat_t *heartbeat)
+{
+    bss_show_snapshot_t state = bss_show_read(&show);
+
+    heartbeat->phase = state.phase;
+    heartbeat->winner = state.winner;
+    heartbeat->seq = state.seq;
+    heartbeat->color[0] = show_colors[state.phase].r;
+    heartbeat->color[1] = show_colors[state.phase].g;
+    heartbeat->color[2] = show_colors[state.phase].b;
+    heartbeat->time = millis();
+}
+
+// Heartbeats wait in the queue behind urgent frames, a lockout queued
+// meanwhile must not be followed by the state before it. Their show state
+// is taken again when they leave the queue.
+void refresh_heartbeat(uint8_t *buf, size_t len)
+{
+    const uint8_t *record = bss_frame_first(buf, len);
+    bss_heartbeat_t heartbeat;
+
+    if (record == NULL || bss_record_type(record) != BSS_MSG_HEARTBEAT ||
+        !bss_heartbeat_decode(bss_record_payload(record), bss_record_payload_len(record), &heartbeat))
+        return;
+
+    heartbeat_show(&heartbeat);
+    bss_heartbeat_encode(&heartbeat, &buf[bss_record_payload(record) - buf]);
+}
+
+// The clock a buzzer takes from an accepted pairing or wakeup is the one of
+// the send, not of the queueing.
+void refresh_time(uint8_t *buf, size_t len)
+{
+    const uint8_t *record = bss_frame_first(buf, len);
+
+    if (record == NULL)
+        return;
+
+    int offset = bss_controller_time_offset(bss_record_type(record));
+
+    if (offset >= 0 && bss_record_payload_len(record) >= offset + BSS_SLOT_TIME_SIZE)
+        bss_put_u32(&buf[bss_record_payload(record) - buf + offset], millis());
+}
+
+size_t seal_frame(uint8_t *buf, size_t len, uint8_t key_id, const uint8_t *key)
+{
+    if (key_id == BSS_AUTH_KEY_GROUP)
+        refresh_heartbeat(buf, len);
+    else
+        refresh_time(buf, len);
+
+    BSS_TRACE_BEGIN(BSS_TRACE_SEAL);
+    size_t size = bss_auth_seal(buf, len, BSS_FRAME_MAX_SIZE, my_mac, key_id, key, tx_counter++);
+    BSS_TRACE_END(BSS_TRACE_SEAL);
+
+    return size;
+}
+
+bss_pool_buffer_t *acquire_frame(uint8_t priority)
+{
+    bss_pool_buffer_t *buffer = bss_txq_acquire(&txq, priority);
+
+    if (buffer == NULL)
+        Serial.println("no frame buffer left\n");
+
+    return buffer;
+}
+
+// Queues one record. A pending frame with the same 'supersede' key and
+// destination is replaced instead of sent.
+void send_record(const uint8_t *mac, uint8_t id, uint8_t type, const uint8_t *payload, uint8_t payload_len,
+                 uint8_t key_id, const uint8_t *key, uint8_t priority = BSS_TX_NORMAL,
+                 uint16_t supersede = BSS_TXQ_KEEP)
+{
+    bss_pool_buffer_t *buffer = acquire_frame(priority);
+
+    if (buffer == NULL)
+        return;
+
+    buffer->len = bss_record_put(buffer->data, BSS_FRAME_MAX_SIZE - BSS_AUTH_TRAILER_SIZE, 0, id, type, payload,
+                                 payload_len);
+    bss_txq_push(&txq, buffer, mac, priority, supersede, key_id, key);
+}
+
+// Sends a record of 'type' to every client. Needs more than one frame for
+// larger fleets. Every broadcast replaces the pending chunks of the previous
+// one of the same type.
+void send_broadcast(uint8_t type, const uint8_t *payload, uint8_t payload_len, uint8_t priority)
+{
+    int next_slot = 0;
+
+    for (uint8_t chunk = 0; next_slot < BSS_REGISTRY_MAX_CLIENTS; chunk++)
+    {
+        bss_pool_buffer_t *buffer = acquire_frame(priority);
+
+        if (buffer == NULL)
+            return;
+
+        BSS_TRACE_BEGIN(BSS_TRACE_BROADCAST_BUILD);
+        buffer->len = bss_registry_build_broadcast(&clients, buffer->data, BSS_FRAME_MAX_SIZE - BSS_AUTH_TRAILER_SIZE,
+                                                   type, payload, payload_len, &next_slot);
+        BSS_TRACE_END(BSS_TRACE_BROADCAST_BUILD);
+
+        if (buffer->len > 0)
+            bss_txq_push(&txq, buffer, broadcast_mac, priority, BSS_TXQ_KEY(type, chunk), BSS_AUTH_KEY_GROUP,
+                         group_key);
+        else
+            bss_txq_release(&txq, buffer);
+    }
+}
+
+// Sends the color of the current show state, with its seq so buzzers can tell
+// whether a heartbeat is newer.
+void send_show_broadcast()
+{
+    bss_show_snapshot_t state = bss_show_read(&show);
+    const rgb_t *rgb = &show_colors[state.phase];
+    uint8_t payload[6] = {rgb->r, rgb->g, rgb->b};
+
+    bss_put_u16(&payload[3], state.seq);
+    payload[5] = state.phase;
+    send_broadcast(BSS_MSG_SET_NEOPIXEL_COLOR, payload, sizeof(payload), BSS_TX_URGENT);
+}
+
+// Buzzers that miss the push are caught up by their next ping.
+void send_config_broadcast(const bss_config_t *fleet_config)
+{
+    uint8_t payload[BSS_CONFIG_WIRE_SIZE];
+
+    bss_config_encode(fleet_config, payload);
+    send_broadcast(BSS_MSG_CONFIG, payload, sizeof(payload), BSS_TX_NORMAL);
+}
+
+// The slot of a paired standby controller, or BSS_REGISTRY_NO_SLOT.
+int find_standby(bss_client *client)
+{
+    for (int slot = 0; slot < BSS_REGISTRY_MAX_CLIENTS; slot++)
+    {
+        if (bss_registry_get(&clients, slot, client) && client->role == BSS_CLIENT_STANDBY)
+            return slot;
+    }
+
+    return BSS_REGISTRY_NO_SLOT;
+}
+
+// Sends the changed registry record of 'slot' to the standby.
+void mirror_client(int slot)
+{
+    bss_client target;
+
+    if (standby || find_standby(&target) == BSS_REGISTRY_NO_SLOT)
+        return;
+
+    bss_pool_buffer_t *buffer = acquire_frame(BSS_TX_NORMAL);
+
+    if (buffer == NULL)
+        return;
+
+    // a counter value doubles as nonce of the key encryption, it never repeats
+    buffer->len = bss_mirror_put_client(buffer->data, BSS_FRAME_MAX_SIZE - BSS_AUTH_TRAILER_SIZE, 0, &clients, slot,
+                                        target.key, tx_counter++);
+    bss_txq_push(&txq, buffer, target.mac, BSS_TX_NORMAL, BSS_TXQ_KEEP, BSS_AUTH_KEY_SESSION, target.key);
+}
+
+// With every heartbeat the standby gets the show state and as many registry
+// records as fit, round robin, so a restarted standby catches up by itself.
+void send_mirror()
+{
+    static int cursor = 0;
+    bss_client target;
+    bss_client client;
+    int standby_slot = find_standby(&target);
+
+    if (standby_slot == BSS_REGISTRY_NO_SLOT)
+        return;
+
+    bss_pool_buffer_t *buffer = acquire_frame(BSS_TX_BACKGROUND);
+
+    if (buffer == NULL)
+        return;
+
+    size_t capacity = BSS_FRAME_MAX_SIZE - BSS_AUTH_TRAILER_SIZE;
+    size_t len = bss_mirror_put_state(buffer->data, capacity, 0, tx_counter, bss_show_read(&show), &config);
+
+    for (int n = 0; n < BSS_REGISTRY_MAX_CLIENTS; n++)
+    {
+        if (cursor != standby_slot && bss_registry_get(&clients, cursor, &client))
+        {
+            size_t end = bss_mirror_put_client(buffer->data, capacity, len, &clients, cursor, target.key, tx_counter++);
+
+            if (end == len)
+                break;
+
+            len = end;
+        }
+
+        cursor = (cursor + 1) % BSS_REGISTRY_MAX_CLIENTS;
+    }
+
+    buffer->len = len;
+    bss_txq_push(&txq, buffer, target.mac, BSS_TX_BACKGROUND, BSS_TXQ_KEY(BSS_MSG_MIRROR_STATE, 0),
+                 BSS_AUTH_KEY_SESSION, target.key);
+}
+
+// Moves the fleet over to this controller, without a new pairing.
+void send_takeover(uint32_t counter)
+{
+    int next_slot = 0;
+
+    for (uint8_t chunk = 0; next_slot < BSS_REGISTRY_MAX_CLIENTS; chunk++)
+    {
+        bss_pool_buffer_t *buffer = acquire_frame(BSS_TX_URGENT);
+
+        if (buffer == NULL)
+            return;
+
+        buffer->len = bss_standby_build_takeover(&clients, buffer->data, BSS_FRAME_MAX_SIZE - BSS_AUTH_TRAILER_SIZE,
+                                                 my_mac, counter, &next_slot);
+
+        if (buffer->len > 0)
+            bss_txq_push(&txq, buffer, broadcast_mac, BSS_TX_URGENT, BSS_TXQ_KEY(BSS_MSG_TAKEOVER, chunk),
+                         BSS_AUTH_KEY_GROUP, group_key);
+        else
+            bss_txq_release(&txq, buffer);
+    }
+}
+
+// Plans the relays once in BSS_RELAY_PLAN_PERIODS and sends every client its
+// role. Roles are repeated with every plan, and a role that ended is sent
+// once more, as empty.
+void plan_relays()
+{
+    static uint8_t periods = 0;
+
+    if (++periods < BSS_RELAY_PLAN_PERIODS)
+        return;
+
+    periods = 0;
+
+    if (relay_mode)
+        bss_relay_plan(&relay_plan, &clients, &links, millis(), BSS_RELAY_ALIVE_PERIODS * config.ping_ms);
+    else
+        bss_relay_plan_init(&relay_plan);
+
+    for (int slot = 0; slot < BSS_REGISTRY_MAX_CLIENTS; slot++)
+    {
+        bss_client client;
+        uint8_t payload[BSS_RELAY_ROLE_MAX_SIZE];
+
+        if (!bss_registry_get(&clients, slot, &client) || client.role == BSS_CLIENT_STANDBY)
+            continue;
+
+        size_t len = bss_relay_role(&relay_plan, &clients, slot, payload);
+
+        if (payload[0] == 0 && relay_roles[slot] == 0)
+            continue;
+
+        relay_roles[slot] = payload[0];
+        send_record(client.mac, client.id, BSS_MSG_RELAY_ROLE, payload, len, BSS_AUTH_KEY_SESSION, client.key,
+                    BSS_TX_NORMAL, BSS_TXQ_KEY(BSS_MSG_RELAY_ROLE, 0));
+    }
+}
+
+// One frame per ping period for the whole fleet.
+void send_heartbeat()
+{
+    uint8_t payload[BSS_HEARTBEAT_SIZE];
+    bss_heartbeat_t heartbeat;
+
+    // filled in again by seal_frame
+    heartbeat_show(&heartbeat);
+    heartbeat.config_version = config.version;
+    bss_registry_heard(&clients, heartbeat.time, BSS_HEARTBEAT_HEARD_PERIODS * config.ping_ms, heartbeat.heard);
+
+    bss_heartbeat_encode(&heartbeat, payload);
+
+    send_record(broadcast_mac, BSS_FRAME_ID_ALL, BSS_MSG_HEARTBEAT, payload, sizeof(payload), BSS_AUTH_KEY_GROUP,
+                group_key, BSS_TX_BACKGROUND, BSS_TXQ_KEY(BSS_MSG_HEARTBEAT, 0));
+
+    send_mirror();
+
+    bss_links_update(&links, &clients);
+    plan_relays();
+
+    uint32_t rival = rival_counter.exchange(0);
+
+    // the old primary is back, it stops once it hears a takeover above its counter
+    if (rival != 0)
+    {
+        takeover_counter = raise_tx_counter(rival + BSS_AUTH_COUNTER_BLOCK);
+        send_takeover(takeover_counter);
+    }
+    // for buzzers that missed the first one
+    else if (takeover_repeats > 0)
+    {
+        takeover_repeats--;
+        send_takeover(takeover_counter);
+    }
+}
+
+void start_heartbeat()
+{
+    static reactesp::RepeatReaction *heartbeat_loop = NULL;
+
+    if (heartbeat_loop != NULL)
+        heartbeat_loop->remove();
+
+    heartbeat_loop = app.onRepeat(config.ping_ms, send_heartbeat);
+}
+
+// Marks the client in 'slot' for the configuration if its ping or wakeup
+// request carries an outdated version.
+void retarget_config(int slot, const uint8_t *record)
+{
+    if (bss_record_payload_len(record) < BSS_CONFIG_VERSION_SIZE ||
+        bss_get_u16(bss_record_payload(record)) == config_version.load(std::memory_order_acquire))
+        return;
+
+    config_wanted[slot / 32].fetch_or(1u << (slot % 32), std::memory_order_relaxed);
+}
+
+// Sends the configuration to the clients marked by retarget_config.
+void send_wanted_config()
+{
+    uint8_t payload[BSS_CONFIG_WIRE_SIZE];
+    bool encoded = false;
+
+    for (int i = 0; i < BSS_REGISTRY_MAX_CLIENTS / 32; i++)
+    {
+        uint32_t wanted = config_wanted[i].exchange(0, std::memory_order_relaxed);
+
+        for (; wanted != 0; wanted &= wanted - 1)
+        {
+            bss_client client;
+
+            if (!bss_registry_get(&clients, i * 32 + __builtin_ctz(wanted), &client))
+                continue;
+
+            if (!encoded)
+            {
+                bss_config_encode(&config, payload);
+                encoded = true;
+            }
+
+            send_record(client.mac, client.id, BSS_MSG_CONFIG, payload, sizeof(payload), BSS_AUTH_KEY_SESSION,
+                        client.key, BSS_TX_NORMAL, BSS_TXQ_KEY(BSS_MSG_CONFIG, 0));
+        }
+    }
+}
+
+// Derived from the buzzer nonce, so repeated requests of one pairing attempt
+// end up with the same session key.
+void derive_controller_nonce(uint8_t *nonce, const uint8_t *mac, const uint8_t *buzzer_nonce)
+{
+    uint8_t buf[MAC_SIZE + BSS_AUTH_NONCE_SIZE];
+
+    mac_copy(buf, mac);
+    memcpy(&buf[MAC_SIZE], buzzer_nonce, BSS_AUTH_NONCE_SIZE);
+
+    uint64_t out = bss_siphash(group_key, buf, sizeof(buf));
+
+    for (int i = 0; i < BSS_AUTH_NONCE_SIZE; i++)
+        nonce[i] = out >> (8 * i);
+}
+
+void add_client_peer(const uint8_t *mac)
+{
+    if (esp_now_is_peer_exist(mac))
+        return;
+
+    esp_now_peer_info_t peer;
+    memset(&peer, 0, sizeof(esp_now_peer_info_t));
+
+    mac_copy(peer.peer_addr, mac);
+    peer.channel = BSS_ESP_NOW_CHANNEL;
+    peer.encrypt = BSS_ESP_NOW_ENCRYPT;
+
+    esp_err_t err = esp_now_add_peer(&peer);
+
+    if (err != ESP_OK)
+        Serial.printf("no peer added (%d), sending as broadcast\n", err);
+}
+
+// The registry lives in its own NVS namespace, one record per slot, so a
+// reboot does not force the fleet to pair again.
+void client_key(char *name, int slot)
+{
+    snprintf(name, 8, "c%02d", slot);
+}
+
+// Rewrites the records of the slots that changed since the last call.
+void persist_clients()
+{
+    int slot = bss_registry_take_dirty(&clients);
+
+    if (slot == BSS_REGISTRY_NO_SLOT)
+        return;
+
+    nvs_handle_t handle;
+    if (nvs_open("bss_clients", NVS_READWRITE, &handle) != ESP_OK)
+        return;
+
+    for (; slot != BSS_REGISTRY_NO_SLOT; slot = bss_registry_take_dirty(&clients))
+    {
+        uint8_t record[BSS_REGISTRY_RECORD_SIZE];
+        char name[8];
+
+        client_key(name, slot);
+
+        if (bss_registry_encode(&clients, slot, record) > 0)
+        {
+            nvs_set_blob(handle, name, record, sizeof(record));
+            bss_registry_persisted(&clients, slot, record);
+        }
+        else
+            nvs_erase_key(handle, name);
+
+        mirror_client(slot);
+    }
+
+    nvs_commit(handle);
+    nvs_close(handle);
+}
+
+void restore_clients()
+{
+    unsigned long start = micros();
+
+    nvs_handle_t handle;
+    if (nvs_open("bss_clients", NVS_READONLY, &handle) != ESP_OK)
+        return;
+
+    for (int slot = 0; slot < BSS_REGISTRY_MAX_CLIENTS; slot++)
+    {
+        uint8_t record[BSS_REGISTRY_RECORD_SIZE];
+        size_t size = sizeof(record);
+        char name[8];
+        bss_client client;
+
+        client_key(name, slot);
+
+        if (nvs_get_blob(handle, name, record, &size) != ESP_OK || !bss_registry_restore(&clients, slot, record, size))
+            continue;
+
+        bss_registry_get(&clients, slot, &client);
+        add_client_peer(client.mac);
+    }
+
+    nvs_close(handle);
+
+    Serial.printf("restored %u clients in %lu us\n", bss_registry_count(&clients), micros() - start);
+}
+
+static_assert(BSS_REGISTRY_MAX_CLIENTS <= BSS_SLOT_COUNT, "every registry slot needs an uplink slot");
+
+void accept_pairing(const uint8_t *mac, uint8_t id, const uint8_t *record)
+{
+    uint8_t session_key[BSS_AUTH_KEY_SIZE];
+    uint8_t payload[BSS_AUTH_NONCE_SIZE + BSS_AUTH_KEY_SIZE + 1 + BSS_SLOT_TIME_SIZE];
+    int slot = BSS_REGISTRY_NO_SLOT;
+    uint8_t role = BSS_CLIENT_BUZZER;
+
+    if (bss_record_payload_len(record) < BSS_AUTH_NONCE_SIZE)
+        return;
+
+    if (bss_record_payload_len(record) > BSS_AUTH_NONCE_SIZE)
+        role = bss_record_payload(record)[BSS_AUTH_NONCE_SIZE];
+
+    // a standby pairs as BSS_STANDBY_ID only, a buzzer never under a reserved id
+    if (role == BSS_CLIENT_STANDBY ? id != BSS_STANDBY_ID : role != BSS_CLIENT_BUZZER || bss_frame_id_reserved(id))
+    {
+        Serial.printf("declined pairing as %u with role %u\n", id, role);
+        return;
+    }
+
+    derive_controller_nonce(payload, mac, bss_record_payload(record));
+    bss_auth_derive_session_key(session_key, mac, my_mac, bss_record_payload(record), payload);
+
+    memcpy(&payload[BSS_AUTH_NONCE_SIZE], group_key, BSS_AUTH_KEY_SIZE);
+    bss_auth_crypt(&payload[BSS_AUTH_NONCE_SIZE], BSS_AUTH_KEY_SIZE, session_key, payload);
+
+    // never waits on the WiFi task, the buzzer repeats its request anyway
+    if (xSemaphoreTake(xMutex, 0))
+    {
+        slot = bss_registry_add(&clients, id, mac, session_key, millis(), role);
+
+        xSemaphoreGive(xMutex);
+    }
+
+    if (slot != BSS_REGISTRY_NO_SLOT)
+    {
+        // the registry slot doubles as uplink slot
+        payload[BSS_AUTH_NONCE_SIZE + BSS_AUTH_KEY_SIZE] = slot;
+        bss_put_u32(&payload[BSS_AUTH_NONCE_SIZE + BSS_AUTH_KEY_SIZE + 1], millis());
+
+        print_mac(mac);
+        add_client_peer(mac);
+
+        Serial.println("add client");
+        send_record(mac, id, BSS_MSG_PAIRING_ACCEPTED, payload, sizeof(payload), BSS_AUTH_KEY_SESSION, session_key);
+    }
+}
+
+void toggle_pairing_mode()
+{
+    static reactesp::RepeatReaction *react_blink = NULL;
+    pairing_mode = !pairing_mode;
+
+    if (pairing_mode && react_blink == NULL)
+    {
+        digitalWrite(D10, true);
+        react_blink = app.onRepeat(1000, []()
+                                   { blink(D10, false); });
+    }
+    else if (!pairing_mode && react_blink != NULL)
+    {
+        digitalWrite(D10, false);
+
+        react_blink->remove();
+        react_blink = NULL;
+    }
+}
+
+// 'input_us' is the journal time of the input, 'lock' the arbiter for a press.
+void apply_decision(bss_decision decision, uint32_t input_us, const bss_arbiter_t *lock)
+{
+    bss_show_snapshot_t state = bss_show_read(&show);
+
+    if (decision == BSS_DECISION_NONE)
+        return;
+
+    bss_journal_decision(&journal, micros(), input_us, decision, state.winner, state.seq, lock);
+
+    switch (decision)
+    {
+    case BSS_DECISION_LOCKOUT:
+    case BSS_DECISION_RIGHT:
+    case BSS_DECISION_WRONG:
+    case BSS_DECISION_RESET:
+        send_show_broadcast();
+        break;
+
+    case BSS_DECISION_PAIRING_TOGGLE:
+        toggle_pairing_mode();
+        break;
+
+    default:
+        break;
+    }
+}
+
+// Checks a received frame and classifies it as bss_journal_frame_status.
+uint8_t open_frame(const uint8_t *mac, const uint8_t *data, int len, const uint8_t **record, bss_client *client, int *slot)
+{
+    bss_auth_trailer_t trailer;
+
+    if (!bss_auth_parse(data, len, &trailer) || (*record = bss_frame_first(data, trailer.body_len)) == NULL)
+        return BSS_FRAME_MALFORMED;
+
+    if (trailer.key_id == BSS_AUTH_KEY_FLEET)
+    {
+        // only a pairing request can come from a buzzer we do not know yet
+        if (bss_record_type(*record) != BSS_MSG_PAIRING_REQUEST || !bss_auth_verify(data, len, mac, bss_fleet_key))
+            return BSS_FRAME_REJECTED;
+
+        return BSS_FRAME_PAIRING;
+    }
+
+    BSS_TRACE_BEGIN(BSS_TRACE_LOOKUP);
+    *slot = bss_registry_find(&clients, bss_record_id(*record), mac, client);
+    BSS_TRACE_END(BSS_TRACE_LOOKUP);
+
+    if (*slot == BSS_REGISTRY_NO_SLOT)
+        return BSS_FRAME_UNKNOWN;
+
+    if (trailer.key_id != BSS_AUTH_KEY_SESSION || !bss_auth_verify(data, len, mac, client->key) ||
+        !bss_registry_accept_counter(&clients, *slot, trailer.counter))
+        return BSS_FRAME_REJECTED;
+
+    return BSS_FRAME_ACCEPTED;
+}
+
+void persist_uplink()
+{
+    uint8_t link[MAC_SIZE + 2 * BSS_AUTH_KEY_SIZE];
+
+    mac_copy(link, uplink.controller_mac);
+    memcpy(&link[MAC_SIZE], uplink.session_key, BSS_AUTH_KEY_SIZE);
+    memcpy(&link[MAC_SIZE + BSS_AUTH_KEY_SIZE], uplink.group_key, BSS_AUTH_KEY_SIZE);
+
+    esp_err_t err = nvs_open("bss_ctrl", NVS_READWRITE, &nvs_bss_handle);
+    if (err == ESP_OK)
+    {
+        nvs_set_blob(nvs_bss_handle, "uplink", link, sizeof(link));
+
+        nvs_commit(nvs_bss_handle);
+        nvs_close(nvs_bss_handle);
+    }
+}
+
+// A standby only listens to the primary: its heartbeats, show colors and
+// the mirror frames addressed to BSS_STANDBY_ID.
+void standby_recv(const uint8_t *mac, const uint8_t *data, int len)
+{
+    bss_auth_trailer_t trailer;
+    const uint8_t *record = bss_buzzer_open_frame(&uplink, my_mac, BSS_STANDBY_ID, mac, data, len);
+
+    if (record == NULL || !bss_auth_parse(data, len, &trailer))
+        return;
+
+    for (; record != NULL; record = bss_frame_next(data, trailer.body_len, record, BSS_STANDBY_ID))
+    {
+        uint8_t msg_type = bss_record_type(record);
+
+        if (msg_type == BSS_MSG_MIRROR_STATE || msg_type == BSS_MSG_MIRROR_CLIENT)
+        {
+            // the primary mirrors round robin, a skipped record comes again
+            if (!xSemaphoreTake(xMutex, 0))
+                continue;
+
+            if (msg_type == BSS_MSG_MIRROR_STATE)
+                bss_mirror_apply_state(record, &primary_counter, &show, &config);
+            else
+                bss_mirror_apply_client(&clients, record, uplink.session_key);
+
+            xSemaphoreGive(xMutex);
+            continue;
+        }
+
+        switch (bss_buzzer_handle_record(&uplink, mac, record))
+        {
+        case BSS_BUZZER_PAIRED:
+            Serial.println("paired as standby");
+            persist_uplink();
+            add_client_peer(mac);
+            break;
+
+        case BSS_BUZZER_HEARTBEAT:
+            bss_show_restore(&show, {(bss_show_phase)uplink.heartbeat.phase, uplink.heartbeat.winner,
+                                     uplink.heartbeat.seq});
+            break;
+
+        default:
+            break;
+        }
+    }
+
+    primary_heard = millis();
+}
+
+void take_over(uint32_t now)
 {
-    uint8_t id;
-    uint8_t mac[6];
-    ulong last_msg;
-    esp_now_peer_info_t peer;
-    client_struct *next;
-} client_struct;
+    Serial.printf("primary silent for %lu ms, taking over\n", (unsigned long)(now - primary_heard));
 
-typedef struct
+    // no registry write here, the mirror never gave the standby a slot of its
+    // own, and the receive path reads the group key only once standby is off
+    memcpy(group_key, uplink.group_key, BSS_AUTH_KEY_SIZE);
+    config_version = config.version;
+
+    // above every counter the primary may have used
+    uint32_t counter = raise_tx_counter(
+        (uplink.controller_counter > primary_counter ? uplink.controller_counter : primary_counter) +
+        BSS_AUTH_COUNTER_BLOCK);
+
+    esp_err_t err = nvs_open("bss_ctrl", NVS_READWRITE, &nvs_bss_handle);
+    if (err == ESP_OK)
+    {
+        nvs_set_u8(nvs_bss_handle, "standby", false);
+        nvs_set_blob(nvs_bss_handle, "group_key", group_key, BSS_AUTH_KEY_SIZE);
+
+        nvs_commit(nvs_bss_handle);
+        nvs_close(nvs_bss_handle);
+    }
+
+    for (int slot = 0; slot < BSS_REGISTRY_MAX_CLIENTS; slot++)
+    {
+        bss_client client;
+
+        if (bss_registry_get(&clients, slot, &client))
+            add_client_peer(client.mac);
+    }
+
+    standby = false;
+
+    takeover_counter = counter;
+    takeover_repeats = BSS_STANDBY_SILENT_PERIODS;
+
+    send_takeover(counter);
+    send_show_broadcast();
+    start_heartbeat();
+}
+
+// Runs every few milliseconds on a standby: pairing requests, pings to the
+// primary and the watch for its silence.
+void standby_tick()
 {
-    uint8_t r;
-    uint8_t g;
-    uint8_t b;
-} rgb_t;
+    static uint32_t last_request = 0;
+    static uint32_t last_ping = 0;
+    uint32_t now = millis();
 
-client_struct *clients = NULL;
+    if (!standby)
+        return;
 
-SemaphoreHandle_t xMutex = NULL;
+    if (uplink.pairing_state == PAIRING_MODE)
+    {
+        if (now - last_request >= 1000)
+        {
+            uint8_t request[BSS_AUTH_NONCE_SIZE + 1];
 
-bool buzzer_pressed = false;
+            memcpy(request, uplink.pairing_nonce, BSS_AUTH_NONCE_SIZE);
+            request[BSS_AUTH_NONCE_SIZE] = BSS_CLIENT_STANDBY;
+            send_record(broadcast_mac, BSS_STANDBY_ID, BSS_MSG_PAIRING_REQUEST, request, sizeof(request),
+                        BSS_AUTH_KEY_FLEET, bss_fleet_key, BSS_TX_NORMAL, BSS_TXQ_KEY(BSS_MSG_PAIRING_REQUEST, 0));
+            last_request = now;
+        }
 
-#define RIGHT_BUTTON D9
-#define RESET_BUTTON D8
-#define WRONG_BUTTON D7
+        return;
+    }
+
+    if (uplink.pairing_state != PAIRED)
+        return;
+
+    if (now - last_ping >= config.ping_ms)
+    {
+        uint8_t version[BSS_CONFIG_VERSION_SIZE];
 
-enum bss_button_state
+        bss_put_u16(version, uplink.config.version);
+        send_record(uplink.controller_mac, BSS_STANDBY_ID, BSS_MSG_PING, version, sizeof(version),
+                    BSS_AUTH_KEY_SESSION, uplink.session_key, BSS_TX_BACKGROUND, BSS_TXQ_KEY(BSS_MSG_PING, 0));
+        last_ping = now;
+    }
+
+    if (primary_heard != 0 && bss_standby_silent(primary_heard, now, config.ping_ms))
+        take_over(now);
+}
+
+void start_standby_pairing()
+{
+    if (!standby)
+        return;
+
+    esp_fill_random(uplink.pairing_nonce, BSS_AUTH_NONCE_SIZE);
+    uplink.pairing_state = PAIRING_MODE;
+}
+
+void set_role(bool role)
 {
-    UNPRESSED = 0,
-    PRESSED = 2,
-    HOLD = 1,
-    RELEASED = 3,
-};
+    esp_err_t err = nvs_open("bss_ctrl", NVS_READWRITE, &nvs_bss_handle);
+    if (err == ESP_OK)
+    {
+        nvs_set_u8(nvs_bss_handle, "standby", role);
+
+        nvs_commit(nvs_bss_handle);
+        nvs_close(nvs_bss_handle);
+    }
 
-class BssButton
+    ESP.restart();
+}
+
+// Handles a frame of 'mac', received directly or unwrapped from a RELAY
+// record.
+void receive_frame(const uint8_t *mac, const uint8_t *data, int len, bool direct)
 {
-private:
-    bool pin_state = false;
-    bool pin_state_old = false;
-    uint8_t pin;
+    uint32_t arrival = micros();
+    uint32_t now = millis();
+    const uint8_t *record = NULL;
+    bss_client client;
+    int slot = BSS_REGISTRY_NO_SLOT;
+
+    BSS_TRACE_BEGIN(BSS_TRACE_OPEN_FRAME);
+    uint8_t status = open_frame(mac, data, len, &record, &client, &slot);
+    BSS_TRACE_END(BSS_TRACE_OPEN_FRAME);
+
+    bss_journal_frame(&journal, arrival, now, mac, data, len, status);
 
-public:
-    ulong last_pressed = 0;
-    ulong last_released = 0;
-    bss_button_state state = UNPRESSED;
-    bool locked = false;
+    if (status == BSS_FRAME_MALFORMED || status == BSS_FRAME_REJECTED)
+        return;
+
+    if (status == BSS_FRAME_ACCEPTED && direct)
+        bss_links_touch(&links, slot);
+
+    uint8_t id = bss_record_id(record);
+    uint8_t msg_type = bss_record_type(record);
+
+    if (status == BSS_FRAME_PAIRING)
+    {
+        if (pairing_mode)
+        {
+            Serial.println("Pairing Request");
+            accept_pairing(mac, id, record);
+        }
+    }
+    else if (status == BSS_FRAME_UNKNOWN)
+    {
+        // A buzzer that is paired with a controller that forgot it. It only
+        // accepts an unpairing under its session key, it recovers by a long
+        // hold of its button, see bss_buzzer_handle_button.
+        if (msg_type == BSS_MSG_WAKEUP_REQUEST && bss_registry_find_mac(&clients, mac) == BSS_REGISTRY_NO_SLOT)
+        {
+            Serial.println("declined");
+            print_mac(mac);
+        }
+    }
+    else if (msg_type == BSS_MSG_BUZZER_PRESSED)
+    {
+        bss_registry_touch(&clients, slot, now);
+
+        BSS_TRACE_BEGIN(BSS_TRACE_DECISION);
+        bss_decision decision =
+            bss_controller_timed_press(&show, &arbiter, id, bss_controller_press_time(record, now), now,
+                                       relay_mode ? BSS_CONTROLLER_FAIRNESS_MS : 0);
+        BSS_TRACE_END(BSS_TRACE_DECISION);
 
-    BssButton(uint8_t pin) : pin(pin) {}
+        apply_decision(decision, arrival, &arbiter);
 
-    // This function does not return the current state, as this would encourage
-    // multiple calls in the loop, skipping the 'PRESSED' or 'RELEASED' states
-    // after the second call.
-    void read()
+        Serial.println("Buzzer Pressed");
+        print_mac(mac);
+    }
+    else if (msg_type == BSS_MSG_WAKEUP_REQUEST)
     {
-        pin_state_old = pin_state;
-        pin_state = !digitalRead(pin);
+        bss_registry_touch(&clients, slot, millis());
 
-        if (pin_state && !pin_state_old)
+        Serial.println("wakeup request");
+
+        retarget_config(slot, record);
+
+        if (pairing_mode)
         {
-            if ((millis() - last_pressed) >= 10)
-                state = PRESSED;
+            uint8_t time[BSS_SLOT_TIME_SIZE];
+            bss_put_u32(time, millis());
 
-            last_pressed = millis();
+            Serial.println("accepted");
+            send_record(mac, id, BSS_MSG_WAKEUP_ACCEPTED, time, sizeof(time), BSS_AUTH_KEY_SESSION, client.key);
         }
-        else if (!pin_state && pin_state_old)
+    }
+    else if (msg_type == BSS_MSG_RELAY)
+    {
+        uint8_t ttl;
+        const uint8_t *origin;
+        const uint8_t *frame;
+        int frame_len;
+
+        bss_registry_touch(&clients, slot, millis());
+
+        if (bss_relay_open(record, &ttl, &origin, &frame, &frame_len))
         {
-            if ((millis() - last_released) >= 10)
-                state = RELEASED;
+            int far_slot = bss_registry_find_mac(&clients, origin);
 
-            last_released = millis();
+            if (far_slot != BSS_REGISTRY_NO_SLOT)
+                bss_relay_delivered(&relay_plan, far_slot, slot);
+
+            receive_frame(origin, frame, frame_len, false);
         }
-        else if (pin_state && pin_state_old)
-            state = HOLD;
-        else // !pin_state && !pin_state_old
-            state = UNPRESSED;
     }
-};
+    else if (msg_type == BSS_MSG_PAIRING_REMOVE)
+    {
+        // dropped while the mutex is held, the slot stays until the buzzer pairs again
+        BSS_TRACE_BEGIN(BSS_TRACE_MUTEX_WAIT);
+        bool locked = xSemaphoreTake(xMutex, 0);
+        BSS_TRACE_END(BSS_TRACE_MUTEX_WAIT);
 
-bool pairing_mode = false;
+        if (locked)
+        {
+            if (bss_registry_remove(&clients, id, mac) && esp_now_is_peer_exist(mac))
+                esp_now_del_peer(mac);
 
-uint8_t msg_buf[250];
+            xSemaphoreGive(xMutex);
+        }
+    }
+    else
+    {
+        bss_registry_touch(&clients, slot, millis());
 
-reactesp::ReactESP app;
+        if (msg_type == BSS_MSG_PING)
+            retarget_config(slot, record);
+    }
+}
 
-inline void blink(uint8_t pin, bool initial_state)
+// Primary after a takeover: notes a group keyed frame of the controller it
+// took over from, see send_heartbeat.
+void rival_recv(const uint8_t *mac, const uint8_t *data, int len)
 {
-    static bool state = !initial_state;
+    bss_auth_trailer_t trailer;
 
-    digitalWrite(pin, state = !state);
-}
+    if (uplink.pairing_state != PAIRED || !mac_equal(mac, uplink.controller_mac) ||
+        !bss_auth_parse(data, len, &trailer) || trailer.key_id != BSS_AUTH_KEY_GROUP ||
+        !bss_auth_verify(data, len, mac, group_key))
+        return;
 
-void send_msg(const uint8_t *mac_addr, const uint8_t *data, const uint8_t size)
-{
-    esp_err_t result = esp_now_send(mac_addr, data, size);
+    uint32_t counter = rival_counter.load();
 
-    Serial.println(millis());
+    while (counter < trailer.counter && !rival_counter.compare_exchange_weak(counter, trailer.counter))
+        ;
+}
 
-    if (result == ESP_OK)
+void on_data_recv(const uint8_t *mac, const uint8_t *data, int len)
+{
+    if (standby)
     {
-        Serial.println("Sent with success\n");
+        standby_recv(mac, data, len);
+        return;
     }
-    else
+
+    if (taken_over)
+        return;
+
+    if (bss_standby_taken_over(&clients, group_key, tx_counter, mac, data, len))
     {
-        Serial.println("Error sending the data\n");
+        taken_over = true;
+        return;
     }
+
+    rival_recv(mac, data, len);
+    receive_frame(mac, data, len, true);
 }
 
-void print_mac(const uint8_t *mac)
+void print_journal_entry(const bss_journal_entry_t *entry, void *context)
 {
-    Serial.printf("%02X:%02X:%02X:%02X:%02X:%02X\n", mac[0], mac[1], mac[2], mac[3], mac[4], mac[5], mac[6]);
+    char line[96];
+
+    bss_journal_format(entry, line, sizeof(line));
+    Serial.println(line);
 }
 
-void fill_msg_buf(uint8_t *buf, uint8_t id, rgb_t rgb)
+void dump_journal()
 {
-    buf[0] = id;
-    buf[1] = 4;
-    buf[2] = BSS_MSG_SET_NEOPIXEL_COLOR;
-    buf[3] = rgb.r;
-    buf[4] = rgb.g;
-    buf[5] = rgb.b;
+    Serial.println("journal begin");
+    bss_journal_for_each(&journal, print_journal_entry, NULL);
+    Serial.println("journal end");
 }
 
-void on_data_recv(const uint8_t *mac, const uint8_t *data, int len)
+void print_config()
 {
-    if (xSemaphoreTake(xMutex, portMAX_DELAY))
-    {
-        uint8_t id = data[0];
-        client_struct *current_client = clients;
-        client_struct *last_client = NULL;
+    char line[160];
 
-        while (current_client != NULL)
-        {
-            if (current_client->id == id && mac_equal(mac, current_client->mac))
-            {
-                current_client->last_msg = millis();
-                break;
-            }
+    bss_config_format(&config, line, sizeof(line));
+    Serial.println(line);
+}
 
-            last_client = current_client;
-            current_client = current_client->next;
-        }
+// Changes one field of the fleet configuration, persists it as one blob and
+// pushes it to all buzzers. The lock only covers the copy, a standby's
+// mirror may write 'config' from the receive path.
+void set_config(const char *name, unsigned long value)
+{
+    bss_config_t changed;
+    uint8_t buf[BSS_CONFIG_WIRE_SIZE];
 
-        print_mac(mac);
-        Serial.println(id);
+    if (!xSemaphoreTake(xMutex, portMAX_DELAY))
+        return;
 
-        if (current_client != NULL)
-        {
-            Serial.println(mac_equal(mac, current_client->mac));
-            print_mac(current_client->mac);
-            Serial.println(current_client->id);
-        }
+    changed = config;
+    bool valid = bss_config_set(&changed, name, value);
 
-        if (data[2] == BSS_MSG_BUZZER_PRESSED)
-        {
-            Serial.println("Buzzer Pressed");
+    if (valid)
+    {
+        changed.version++;
+        config = changed;
+    }
 
-            if (current_client != NULL && !buzzer_pressed)
-            {
-                buzzer_pressed = true;
+    xSemaphoreGive(xMutex);
 
-                uint8_t i = 0;
-                client_struct *tmp_client = clients;
+    if (!valid)
+    {
+        Serial.println("invalid config");
+        return;
+    }
 
-                for (; tmp_client != NULL; i += 6)
-                {
-                    // Serial.print("add msg with id: ");
-                    fill_msg_buf(&msg_buf[i], tmp_client->id, {255, 255, 255});
-                    tmp_client = tmp_client->next;
-                }
+    config_version.store(changed.version, std::memory_order_release);
+    bss_config_encode(&changed, buf);
 
-                send_msg(broadcast_mac, msg_buf, i);
-            }
-        }
-        else if (data[2] == BSS_MSG_PAIRING_REQUEST)
-        {
-            if (pairing_mode)
-            {
-                Serial.println("Pairing Request");
+    esp_err_t err = nvs_open("bss_ctrl", NVS_READWRITE, &nvs_bss_handle);
+    if (err == ESP_OK)
+    {
+        nvs_set_blob(nvs_bss_handle, "config", buf, sizeof(buf));
 
-                msg_buf[0] = id;
-                msg_buf[1] = 1;
-                msg_buf[2] = BSS_MSG_PAIRING_ACCEPTED;
+        nvs_commit(nvs_bss_handle);
+        nvs_close(nvs_bss_handle);
+    }
 
-                if (current_client == NULL)
-                {
-                    client_struct *new_client = (client_struct *)malloc(sizeof(client_struct));
-                    new_client->id = id;
-                    mac_copy(new_client->mac, mac);
-                    new_client->last_msg = millis();
-                    new_client->next = NULL;
+    send_config_broadcast(&changed);
+    start_heartbeat();
+    print_config();
+}
 
-                    memset(&new_client->peer, 0, sizeof(esp_now_peer_info_t));
+void print_links()
+{
+    for (int slot = 0; slot < BSS_REGISTRY_MAX_CLIENTS; slot++)
+    {
+        bss_client client;
 
-                    print_mac(new_client->mac);
+        if (!bss_registry_get(&clients, slot, &client))
+            continue;
 
-                    mac_copy(new_client->peer.peer_addr, mac);
-                    new_client->peer.channel = BSS_ESP_NOW_CHANNEL;
-                    new_client->peer.encrypt = BSS_ESP_NOW_ENCRYPT;
+        Serial.printf("id=%u quality=%u far=%u relays=%u,%u role=%u\n", client.id, links.quality[slot],
+                      relay_plan.far[slot], relay_plan.relays[slot][0].load(), relay_plan.relays[slot][1].load(),
+                      relay_roles[slot]);
+    }
+}
 
-                    if (clients == NULL)
-                    {
-                        clients = new_client;
-                    }
-                    else
-                    {
-                        client_struct *head = clients;
+void set_relay_mode(bool mode)
+{
+    esp_err_t err = nvs_open("bss_ctrl", NVS_READWRITE, &nvs_bss_handle);
+    if (err == ESP_OK)
+    {
+        nvs_set_u8(nvs_bss_handle, "relay", mode);
 
-                        while (head->next != NULL)
-                            head = head->next;
+        nvs_commit(nvs_bss_handle);
+        nvs_close(nvs_bss_handle);
+    }
 
-                        head->next = new_client;
-                    }
+    relay_mode = mode;
+    Serial.printf("relay %s\n", mode ? "on" : "off");
+}
 
-                    current_client = new_client;
-                }
+void print_trace_line(const char *line, void *context)
+{
+    Serial.println(line);
+}
 
-                Serial.println("Add peer: ");
-                if (!esp_now_is_peer_exist(mac))
-                    esp_now_add_peer(&current_client->peer);
+void print_trace()
+{
+    Serial.println("trace begin");
+    bss_trace_summary(print_trace_line, NULL);
+    Serial.println("trace end");
 
-                Serial.println("add client");
-                send_msg(current_client->mac, msg_buf, 3);
-            }
-        }
-        else if (data[2] == BSS_MSG_WAKEUP_REQUEST)
-        {
-            Serial.println("wakeup request");
+    bss_trace_reset();
+}
 
-            if (pairing_mode && current_client != NULL)
-            {
-                Serial.println("accepted");
-                msg_buf[0] = id;
-                msg_buf[1] = 1;
-                msg_buf[2] = BSS_MSG_WAKEUP_ACCEPTED;
+void print_txq()
+{
+    bss_txq_stats_t stats;
 
-                send_msg(current_client->mac, msg_buf, 3);
-            }
-            else if (current_client == NULL && !mac_equal(mac, broadcast_mac))
-            {
-                Serial.println("declined");
-                print_mac(mac);
+    bss_txq_get_stats(&txq, &stats);
+    Serial.printf("txq depth=%u max=%u in_flight=%u sent=%lu superseded=%lu dropped=%lu failed=%lu\n", stats.depth,
+                  stats.max_depth, stats.in_flight, (unsigned long)stats.sent, (unsigned long)stats.superseded,
+                  (unsigned long)stats.dropped, (unsigned long)stats.failed);
+}
 
-                msg_buf[0] = id;
-                msg_buf[1] = 1;
-                msg_buf[2] = BSS_MSG_PAIRING_REMOVE;
+// Serial console, one command per line:
+//   j                  dump the event journal
+//   config             print the fleet configuration
+//   set <name> <value> change a field of the fleet configuration
+//   t                  print the stage trace summary (-DBSS_TRACE)
+//   q                  print the transmit queue counters
+//   role <primary|standby> switch the role and restart
+//   pair               pair a standby with the primary in pairing mode
+//   links              print the link quality and relays of every client
+//   relay <on|off>     switch relaying for poor links, persisted
+void handle_serial()
+{
+    static char line[64];
+    static size_t len = 0;
 
-                send_msg(mac, msg_buf, 3);
-            }
-        }
-        else if (data[2] == BSS_MSG_PAIRING_REMOVE)
-        {
-            if (current_client != NULL)
-            {
-                if (esp_now_is_peer_exist(mac))
-                    esp_now_del_peer(mac);
+    while (Serial.available() > 0)
+    {
+        char c = Serial.read();
 
-                if (last_client != NULL)
-                    last_client->next = current_client->next;
-                else
-                    clients = current_client->next;
+        if (c != '\n' && c != '\r')
+        {
+            if (len < sizeof(line) - 1)
+                line[len++] = c;
 
-                free(current_client);
-            }
+            continue;
         }
 
-        xSemaphoreGive(xMutex);
+        line[len] = '\0';
+        len = 0;
+
+        char name[24];
+        unsigned long value;
+
+        if (strcmp(line, "j") == 0)
+            dump_journal();
+        else if (strcmp(line, "config") == 0)
+            print_config();
+        else if (sscanf(line, "set %23s %lu", name, &value) == 2)
+            set_config(name, value);
+        else if (strcmp(line, "t") == 0)
+            print_trace();
+        else if (strcmp(line, "q") == 0)
+            print_txq();
+        else if (strcmp(line, "role primary") == 0)
+            set_role(false);
+        else if (strcmp(line, "role standby") == 0)
+            set_role(true);
+        else if (strcmp(line, "pair") == 0)
+            start_standby_pairing();
+        else if (strcmp(line, "links") == 0)
+            print_links();
+        else if (strcmp(line, "relay on") == 0)
+            set_relay_mode(true);
+        else if (strcmp(line, "relay off") == 0)
+            set_relay_mode(false);
     }
 }
 
+// Runs on the WiFi task, sealing and sending the next frame is left to tx_task.
 void on_data_sent(const uint8_t *mac_addr, esp_now_send_status_t status)
 {
-    // Serial.print("\r\nLast Packet Send Status:\n");
-    //  Serial.printf("time needed to send: %i\n", millis() - send_time);
-    // Serial.println(status == ESP_NOW_SEND_SUCCESS ? "Delivery Success" : "Delivery Fail");
+    if (bss_txq_sent(&txq))
+        xTaskNotifyGive(tx_task);
+}
+
+void pump_frames(void *)
+{
+    for (;;)
+    {
+        ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        bss_txq_pump(&txq);
+    }
+}
+
+// Runs every BSS_INPUT_SCAN_MS on the esp_timer task, independent of loop()
+// and of the radio load.
+void scan_buttons(void *)
+{
+    uint32_t pressed = 0;
+
+    BSS_TRACE_BEGIN(BSS_TRACE_DEBOUNCE);
+    for (uint8_t i = 0; i < sizeof(button_pins); i++)
+    {
+        if (!digitalRead(button_pins[i]))
+            pressed |= 1 << i;
+    }
+
+    bss_input_scan(&input, pressed, millis(), micros());
+    BSS_TRACE_END(BSS_TRACE_DEBOUNCE);
+}
+
+void start_scanner()
+{
+    esp_timer_create_args_t args = {};
+
+    args.callback = scan_buttons;
+    args.dispatch_method = ESP_TIMER_TASK;
+    args.name = "buttons";
 
-    // Serial.printf("msg delivered: %i\n", millis() - send_time);
+    bss_input_init(&input, buttons, sizeof(buttons) / sizeof(buttons[0]), BSS_CONTROLLER_PAIRING_HOLD_MS);
+
+    if (esp_timer_create(&args, &scan_timer) == ESP_OK)
+        esp_timer_start_periodic(scan_timer, BSS_INPUT_SCAN_MS * 1000);
 }
 
 void setup()
@@ -301,6 +1328,61 @@ void setup()
     WiFi.setSleep(false);
     esp_wifi_set_protocol(WIFI_IF_STA, WIFI_PROTOCOL_LR);
 
+    WiFi.macAddress(my_mac);
+
+    nvs_flash_init();
+
+    bss_config_default(&config);
+    bss_buzzer_init(&uplink);
+
+    esp_err_t err = nvs_open("bss_ctrl", NVS_READWRITE, &nvs_bss_handle);
+    if (err == ESP_OK)
+    {
+        size_t key_size = BSS_AUTH_KEY_SIZE;
+
+        if (nvs_get_blob(nvs_bss_handle, "group_key", group_key, &key_size) != ESP_OK)
+        {
+            esp_fill_random(group_key, BSS_AUTH_KEY_SIZE);
+            nvs_set_blob(nvs_bss_handle, "group_key", group_key, BSS_AUTH_KEY_SIZE);
+            nvs_commit(nvs_bss_handle);
+        }
+
+        uint32_t counter = 1;
+        nvs_get_u32(nvs_bss_handle, "tx_counter", &counter);
+        tx_counter = counter;
+
+        uint8_t buf[BSS_CONFIG_WIRE_SIZE];
+        size_t config_size = sizeof(buf);
+
+        if (nvs_get_blob(nvs_bss_handle, "config", buf, &config_size) == ESP_OK)
+            bss_config_decode(buf, config_size, &config);
+
+        config_version = config.version;
+
+        uint8_t role = false;
+        nvs_get_u8(nvs_bss_handle, "standby", &role);
+        standby = role;
+
+        uint8_t mode = false;
+        nvs_get_u8(nvs_bss_handle, "relay", &mode);
+        relay_mode = mode;
+
+        uint8_t link[MAC_SIZE + 2 * BSS_AUTH_KEY_SIZE];
+        size_t link_size = sizeof(link);
+
+        if (standby && nvs_get_blob(nvs_bss_handle, "uplink", link, &link_size) == ESP_OK)
+        {
+            mac_copy(uplink.controller_mac, link);
+            memcpy(uplink.session_key, &link[MAC_SIZE], BSS_AUTH_KEY_SIZE);
+            memcpy(uplink.group_key, &link[MAC_SIZE + BSS_AUTH_KEY_SIZE], BSS_AUTH_KEY_SIZE);
+            uplink.pairing_state = PAIRED;
+        }
+
+        nvs_close(nvs_bss_handle);
+    }
+
+    reserve_tx_counter();
+
     if (esp_now_init() != ESP_OK)
     {
         Serial.println("Error initializing ESP-NOW");
@@ -312,6 +1394,17 @@ void setup()
     pinMode(RIGHT_BUTTON, INPUT_PULLUP);
     pinMode(RESET_BUTTON, INPUT_PULLUP);
     pinMode(WRONG_BUTTON, INPUT_PULLUP);
+    start_scanner();
+
+    bss_registry_init(&clients);
+    restore_clients();
+    bss_show_init(&show);
+    bss_links_init(&links);
+    bss_relay_plan_init(&relay_plan);
+    bss_journal_init(&journal);
+    bss_txq_init(&txq, send_msg, seal_frame);
+    // above loop() and below the WiFi task
+    xTaskCreate(pump_frames, "tx", 4096, NULL, 5, &tx_task);
 
     xMutex = xSemaphoreCreateMutex();
 
@@ -323,112 +1416,44 @@ void setup()
     broadcast_peer.encrypt = BSS_ESP_NOW_ENCRYPT;
     esp_now_add_peer(&broadcast_peer);
 
+    if (standby)
+    {
+        if (uplink.pairing_state == PAIRED)
+            add_client_peer(uplink.controller_mac);
+
+        app.onRepeat(10, standby_tick);
+        Serial.println("running as standby");
+    }
+    else
+        start_heartbeat();
+
     Serial.println("Starting now...");
 }
 
 void loop()
 {
-    if (xSemaphoreTake(xMutex, 10))
-    {
-        static BssButton rightButton(RIGHT_BUTTON);
-        static BssButton resetButton(RESET_BUTTON);
-        static BssButton wrongButton(WRONG_BUTTON);
-
-        rightButton.read();
-        resetButton.read();
-        wrongButton.read();
-
-        if (rightButton.state == PRESSED)
-        {
-            if (buzzer_pressed)
-            {
-                uint8_t i = 0;
-                client_struct *client = clients;
-
-                for (; client != NULL; i += 6)
-                {
-                    fill_msg_buf(&msg_buf[i], client->id, {0, 255, 0});
-                    client = client->next;
-                }
-
-                send_msg(broadcast_mac, msg_buf, i);
-            }
-        }
-        else if (rightButton.state == HOLD && (millis() - rightButton.last_pressed) >= 2 sec && !rightButton.locked)
-        {
-            rightButton.locked = true;
-
-            static reactesp::RepeatReaction *react_blink = NULL;
-            pairing_mode = !pairing_mode;
-
-            if (pairing_mode && react_blink == NULL)
-            {
-                digitalWrite(D10, true);
-                react_blink = app.onRepeat(1000, []()
-                                           { blink(D10, false); });
-            }
-            else if (!pairing_mode && react_blink != NULL)
-            {
-                digitalWrite(D10, false);
-
-                react_blink->remove();
-                react_blink = NULL;
-            }
-        }
-        else if (rightButton.state == RELEASED)
-        {
-            rightButton.locked = false;
-        }
-        else if (resetButton.state == PRESSED)
-        {
-            if (buzzer_pressed)
-            {
-                buzzer_pressed = false;
-
-                uint8_t i = 0;
-                client_struct *client = clients;
-
-                for (; client != NULL; i += 6)
-                {
-                    fill_msg_buf(&msg_buf[i], client->id, {0, 0, 0});
-                    client = client->next;
-                }
-
-                send_msg(broadcast_mac, msg_buf, i);
-            }
-        }
-        else if (wrongButton.state == PRESSED)
-        {
-            if (buzzer_pressed)
-            {
-                uint8_t i = 0;
-                client_struct *client = clients;
+    bss_input_event_t event;
 
-                for (; client != NULL; i += 6)
-                {
-                    fill_msg_buf(&msg_buf[i], client->id, {255, 0, 0});
-                    client = client->next;
-                }
-
-                send_msg(broadcast_mac, msg_buf, i);
-            }
-        }
+    if (taken_over)
+    {
+        Serial.println("taken over by another controller, restarting as standby");
+        set_role(true);
+    }
 
-        app.tick();
+    while (bss_input_pop(&input, &event))
+    {
+        if (standby)
+            continue;
 
-        client_struct *current_client = clients;
+        bss_journal_button(&journal, event.time_us, event.button, event.event);
+        apply_decision(bss_controller_moderator(&show, event.button, event.event), event.time_us, NULL);
+    }
 
-        while (current_client != NULL)
-        {
-            /*if ((millis() - current_client->last_msg) >= MAX_ALLOED_TIMEOUT)
-            {
-                Serial.println("lost the connection to:");
-                print_mac(current_client->mac);
-            }*/
+    handle_serial();
+    send_wanted_config();
 
-            current_client = current_client->next;
-        }
+    app.tick();
 
-        xSemaphoreGive(xMutex);
-    }
+    reserve_tx_counter();
+    persist_clients();
 }
@@ -0,0 +1,150 @@
+/*
+  Copyright © 2024 Leonard Sebastian Schwennesen. All rights reserved.
+*/
+
+#include <unity.h>
+#include "bss_shared.h"
+#include "bss_frame.h"
+#include "bss_auth.h"
+
+static const uint8_t key[BSS_AUTH_KEY_SIZE] = {0x00, 0x01, 0x02, 0x03, 0x04, 0x05, 0x06, 0x07,
+                                               0x08, 0x09, 0x0a, 0x0b, 0x0c, 0x0d, 0x0e, 0x0f};
+static const uint8_t sender_mac[6] = {0x60, 0, 0, 0, 0, 0x01};
+
+static uint8_t frame[BSS_FRAME_MAX_SIZE];
+static size_t frame_len;
+
+void setUp()
+{
+    const uint8_t color[3] = {1, 2, 3};
+
+    frame_len = bss_record_put(frame, sizeof(frame), 0, 5, BSS_MSG_SET_NEOPIXEL_COLOR, color, sizeof(color));
+    frame_len = bss_record_put(frame, sizeof(frame), frame_len, 6, BSS_MSG_SET_NEOPIXEL_COLOR, color, sizeof(color));
+}
+
+void tearDown() {}
+
+// reference vectors of SipHash-2-4 for the messages 00, 00 01, ...
+void test_siphash_reference_vectors()
+{
+    uint8_t message[15];
+
+    for (uint8_t i = 0; i < sizeof(message); i++)
+        message[i] = i;
+
+    TEST_ASSERT_EQUAL_UINT64(0x726fdb47dd0e0e31ULL, bss_siphash(key, message, 0));
+    TEST_ASSERT_EQUAL_UINT64(0x74f839c593dc67fdULL, bss_siphash(key, message, 1));
+    TEST_ASSERT_EQUAL_UINT64(0xa129ca6149be45e5ULL, bss_siphash(key, message, 15));
+}
+
+void test_seal_and_verify()
+{
+    bss_auth_trailer_t trailer;
+
+    size_t len = bss_auth_seal(frame, frame_len, sizeof(frame), sender_mac, BSS_AUTH_KEY_GROUP, key, 0x01020304);
+    TEST_ASSERT_EQUAL(frame_len + BSS_AUTH_TRAILER_SIZE, len);
+
+    TEST_ASSERT_TRUE(bss_auth_parse(frame, len, &trailer));
+    TEST_ASSERT_EQUAL_UINT8(BSS_AUTH_KEY_GROUP, trailer.key_id);
+    TEST_ASSERT_EQUAL_UINT32(0x01020304, trailer.counter);
+    TEST_ASSERT_EQUAL(frame_len, trailer.body_len);
+
+    TEST_ASSERT_TRUE(bss_auth_verify(frame, len, sender_mac, key));
+}
+
+void test_verify_rejects_tampering()
+{
+    const uint8_t other_mac[6] = {0x60, 0, 0, 0, 0, 0x02};
+    uint8_t other_key[BSS_AUTH_KEY_SIZE] = {0};
+
+    size_t len = bss_auth_seal(frame, frame_len, sizeof(frame), sender_mac, BSS_AUTH_KEY_SESSION, key, 1);
+
+    TEST_ASSERT_FALSE(bss_auth_verify(frame, len, other_mac, key));
+    TEST_ASSERT_FALSE(bss_auth_verify(frame, len, sender_mac, other_key));
+
+    for (size_t i = 0; i < len; i++)
+    {
+        frame[i] ^= 0x01;
+        TEST_ASSERT_FALSE(bss_auth_verify(frame, len, sender_mac, key));
+        frame[i] ^= 0x01;
+    }
+
+    TEST_ASSERT_FALSE(bss_auth_verify(frame, len - 1, sender_mac, key));
+}
+
+void test_seal_rejects_overflow()
+{
+    TEST_ASSERT_EQUAL(0, bss_auth_seal(frame, frame_len, frame_len + BSS_AUTH_TRAILER_SIZE - 1, sender_mac, 0, key, 1));
+    TEST_ASSERT_FALSE(bss_auth_parse(frame, BSS_AUTH_TRAILER_SIZE - 1, NULL));
+}
+
+void test_accept_counter()
+{
+    uint32_t last = 0;
+
+    TEST_ASSERT_FALSE(bss_auth_accept_counter(&last, 0));
+    TEST_ASSERT_TRUE(bss_auth_accept_counter(&last, 3));
+    TEST_ASSERT_FALSE(bss_auth_accept_counter(&last, 3));
+    TEST_ASSERT_FALSE(bss_auth_accept_counter(&last, 2));
+    TEST_ASSERT_TRUE(bss_auth_accept_counter(&last, 4));
+}
+
+void test_session_key_depends_on_both_nonces()
+{
+    const uint8_t buzzer_mac[6] = {0x60, 0, 0, 0, 0, 0x03};
+    uint8_t nonce_a[BSS_AUTH_NONCE_SIZE] = {1};
+    uint8_t nonce_b[BSS_AUTH_NONCE_SIZE] = {2};
+    uint8_t key_1[BSS_AUTH_KEY_SIZE], key_2[BSS_AUTH_KEY_SIZE], key_3[BSS_AUTH_KEY_SIZE];
+
+    bss_auth_derive_session_key(key_1, buzzer_mac, sender_mac, nonce_a, nonce_b);
+    bss_auth_derive_session_key(key_2, buzzer_mac, sender_mac, nonce_a, nonce_b);
+    TEST_ASSERT_EQUAL_MEMORY(key_1, key_2, BSS_AUTH_KEY_SIZE);
+
+    bss_auth_derive_session_key(key_3, buzzer_mac, sender_mac, nonce_b, nonce_a);
+    TEST_ASSERT_FALSE(bss_auth_equal(key_1, key_3, BSS_AUTH_KEY_SIZE));
+}
+
+void test_crypt_round_trip()
+{
+    const uint8_t nonce[BSS_AUTH_NONCE_SIZE] = {9, 8, 7};
+    uint8_t secret[BSS_AUTH_KEY_SIZE] = {0xAA, 0xBB, 0xCC};
+    uint8_t data[BSS_AUTH_KEY_SIZE];
+
+    memcpy(data, secret, sizeof(data));
+
+    bss_auth_crypt(data, sizeof(data), key, nonce);
+    TEST_ASSERT_FALSE(bss_auth_equal(data, secret, sizeof(data)));
+
+    bss_auth_crypt(data, sizeof(data), key, nonce);
+    TEST_ASSERT_EQUAL_MEMORY(secret, data, sizeof(data));
+}
+
+int run_tests()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_siphash_reference_vectors);
+    RUN_TEST(test_seal_and_verify);
+    RUN_TEST(test_verify_rejects_tampering);
+    RUN_TEST(test_seal_rejects_overflow);
+    RUN_TEST(test_accept_counter);
+    RUN_TEST(test_session_key_depends_on_both_nonces);
+    RUN_TEST(test_crypt_round_trip);
+    return UNITY_END();
+}
+
+#ifdef ARDUINO
+#include <Arduino.h>
+
+void setup()
+{
+    delay(2000);
+    run_tests();
+}
+
+void loop() {}
+#else
+int main()
+{
+    return run_tests();
+}
+#endif
@@ -0,0 +1,170 @@
+/*
+  Copyright © 2024 Leonard Sebastian Schwennesen. All rights reserved.
+*/
+
+// Microbenchmarks of the controller's per-packet work. Run them before and
+// after every protocol or hot-path change and compare the reported numbers:
+//   pio test -e native -f test_bench -v
+
+#include <unity.h>
+#include <stdio.h>
+#include "bss_shared.h"
+#include "bss_frame.h"
+#include "bss_registry.h"
+#include "bss_show.h"
+#include "bss_auth.h"
+
+#ifdef ARDUINO
+#include <Arduino.h>
+
+static uint64_t bench_now_ns()
+{
+    return (uint64_t)micros() * 1000;
+}
+#else
+#include <chrono>
+
+static uint64_t bench_now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+#endif
+
+#define BENCH_ITERATIONS 100000
+#define BENCH_CLIENTS 32
+
+static bss_registry_t registry;
+static uint8_t frame[BSS_FRAME_MAX_SIZE];
+static volatile size_t sink;
+
+static void bench_report(const char *name, uint64_t start, uint64_t end)
+{
+    char msg[96];
+
+    snprintf(msg, sizeof(msg), "%s: %.1f ns/op", name, (double)(end - start) / BENCH_ITERATIONS);
+    TEST_MESSAGE(msg);
+}
+
+void setUp()
+{
+    uint8_t mac[6] = {0x30, 0, 0, 0, 0, 0};
+    const uint8_t key[BSS_AUTH_KEY_SIZE] = {1};
+
+    bss_registry_init(&registry);
+
+    for (uint8_t id = 0; id < BENCH_CLIENTS; id++)
+    {
+        mac[5] = id;
+        bss_registry_add(&registry, id, mac, key, 0);
+    }
+}
+
+void tearDown() {}
+
+// Receive path of a press from the last registered client: parse the frame
+// and look the sender up.
+void bench_press_lookup()
+{
+    const uint8_t mac[6] = {0x30, 0, 0, 0, 0, BENCH_CLIENTS - 1};
+    const uint8_t press[3] = {BENCH_CLIENTS - 1, 1, BSS_MSG_BUZZER_PRESSED};
+
+    sink = 0;
+
+    uint64_t start = bench_now_ns();
+
+    for (uint32_t i = 0; i < BENCH_ITERATIONS; i++)
+    {
+        const uint8_t *record = bss_frame_first(press, sizeof(press));
+
+        sink += bss_registry_find(&registry, bss_record_id(record), mac) != BSS_REGISTRY_NO_SLOT;
+    }
+
+    bench_report("press lookup (32 clients)", start, bench_now_ns());
+    TEST_ASSERT_EQUAL(BENCH_ITERATIONS, sink);
+}
+
+// Full lockout decision of a press without taking a lock: lookup, touch and
+// the arbitration itself.
+void bench_press_decision()
+{
+    const uint8_t mac[6] = {0x30, 0, 0, 0, 0, BENCH_CLIENTS - 1};
+    const uint8_t press[3] = {BENCH_CLIENTS - 1, 1, BSS_MSG_BUZZER_PRESSED};
+    bss_show_t show;
+
+    bss_show_init(&show);
+    sink = 0;
+
+    uint64_t start = bench_now_ns();
+
+    for (uint32_t i = 0; i < BENCH_ITERATIONS; i++)
+    {
+        const uint8_t *record = bss_frame_first(press, sizeof(press));
+        int slot = bss_registry_find(&registry, bss_record_id(record), mac);
+
+        bss_registry_touch(&registry, slot, i);
+        sink += bss_show_try_lock(&show, bss_record_id(record));
+        bss_show_reset(&show);
+    }
+
+    bench_report("press decision (32 clients)", start, bench_now_ns());
+    TEST_ASSERT_EQUAL(BENCH_ITERATIONS, sink);
+}
+
+// Authenticating a press before it is dispatched.
+void bench_press_verify()
+{
+    const uint8_t mac[6] = {0x30, 0, 0, 0, 0, 1};
+    const uint8_t key[BSS_AUTH_KEY_SIZE] = {1};
+    uint8_t press[BSS_FRAME_MAX_SIZE];
+    size_t len = bss_record_put(press, sizeof(press), 0, 1, BSS_MSG_BUZZER_PRESSED, NULL, 0);
+
+    len = bss_auth_seal(press, len, sizeof(press), mac, BSS_AUTH_KEY_SESSION, key, 1);
+    sink = 0;
+
+    uint64_t start = bench_now_ns();
+
+    for (uint32_t i = 0; i < BENCH_ITERATIONS; i++)
+        sink += bss_auth_verify(press, len, mac, key);
+
+    bench_report("press verify", start, bench_now_ns());
+    TEST_ASSERT_EQUAL(BENCH_ITERATIONS, sink);
+}
+
+// Building the lockout broadcast that answers a press.
+void bench_lockout_broadcast()
+{
+    const uint8_t color[3] = {255, 255, 255};
+
+    uint64_t start = bench_now_ns();
+
+    for (uint32_t i = 0; i < BENCH_ITERATIONS; i++)
+        sink = bss_registry_build_broadcast(&registry, frame, sizeof(frame), BSS_MSG_SET_NEOPIXEL_COLOR, color, sizeof(color));
+
+    bench_report("lockout broadcast (32 clients)", start, bench_now_ns());
+    TEST_ASSERT_EQUAL(BENCH_CLIENTS * 6, sink);
+}
+
+int run_tests()
+{
+    UNITY_BEGIN();
+    RUN_TEST(bench_press_lookup);
+    RUN_TEST(bench_press_decision);
+    RUN_TEST(bench_press_verify);
+    RUN_TEST(bench_lockout_broadcast);
+    return UNITY_END();
+}
+
+#ifdef ARDUINO
+void setup()
+{
+    delay(2000);
+    run_tests();
+}
+
+void loop() {}
+#else
+int main()
+{
+    return run_tests();
+}
+#endif
@@ -0,0 +1,117 @@
+/*
+  Copyright © 2024 Leonard Sebastian Schwennesen. All rights reserved.
+*/
+
+#include <unity.h>
+#include "bss_button.h"
+
+void setUp() {}
+void tearDown() {}
+
+void test_press_hold_release()
+{
+    BssButton button(0);
+
+    button.update(false, 100);
+    TEST_ASSERT_EQUAL(UNPRESSED, button.state);
+
+    button.update(true, 110);
+    TEST_ASSERT_EQUAL(PRESSED, button.state);
+    TEST_ASSERT_EQUAL(110, button.last_pressed);
+
+    button.update(true, 111);
+    TEST_ASSERT_EQUAL(HOLD, button.state);
+
+    button.update(false, 200);
+    TEST_ASSERT_EQUAL(RELEASED, button.state);
+    TEST_ASSERT_EQUAL(200, button.last_released);
+
+    button.update(false, 201);
+    TEST_ASSERT_EQUAL(UNPRESSED, button.state);
+}
+
+void test_pressed_is_reported_once()
+{
+    BssButton button(0);
+
+    button.update(true, 100);
+    TEST_ASSERT_EQUAL(PRESSED, button.state);
+
+    for (unsigned long now = 101; now < 110; now++)
+    {
+        button.update(true, now);
+        TEST_ASSERT_EQUAL(HOLD, button.state);
+    }
+}
+
+void test_bounce_within_debounce_time_is_ignored()
+{
+    BssButton button(0);
+
+    button.update(true, 100);
+    button.update(false, 200);
+    button.update(false, 201);
+    TEST_ASSERT_EQUAL(UNPRESSED, button.state);
+
+    // contact bounce on release, re-press 5 ms after the last release edge
+    button.update(true, 300);
+    TEST_ASSERT_EQUAL(PRESSED, button.state);
+    button.update(false, 302);
+    TEST_ASSERT_EQUAL(RELEASED, button.state);
+    button.update(true, 305);
+    TEST_ASSERT_EQUAL(RELEASED, button.state);
+    TEST_ASSERT_EQUAL(305, button.last_pressed);
+    button.update(false, 307);
+    TEST_ASSERT_EQUAL(RELEASED, button.state);
+}
+
+void test_press_after_debounce_time_is_reported()
+{
+    BssButton button(0);
+
+    button.update(true, 100);
+    button.update(false, 105);
+    button.update(true, 100 + BSS_BUTTON_DEBOUNCE_MS);
+    TEST_ASSERT_EQUAL(PRESSED, button.state);
+}
+
+void test_configured_debounce_time()
+{
+    BssButton button(0);
+    button.debounce_ms = 50;
+
+    button.update(true, 100);
+    button.update(false, 120);
+    button.update(true, 140);
+    TEST_ASSERT_NOT_EQUAL(PRESSED, button.state);
+
+    button.update(false, 200);
+    button.update(true, 250);
+    TEST_ASSERT_EQUAL(PRESSED, button.state);
+}
+
+int run_tests()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_press_hold_release);
+    RUN_TEST(test_pressed_is_reported_once);
+    RUN_TEST(test_bounce_within_debounce_time_is_ignored);
+    RUN_TEST(test_press_after_debounce_time_is_reported);
+    RUN_TEST(test_configured_debounce_time);
+    return UNITY_END();
+}
+
+#ifdef ARDUINO
+void setup()
+{
+    delay(2000);
+    run_tests();
+}
+
+void loop() {}
+#else
+int main()
+{
+    return run_tests();
+}
+#endif
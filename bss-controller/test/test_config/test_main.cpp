@@ -0,0 +1,127 @@
+/*
+  Copyright © 2024 Leonard Sebastian Schwennesen. All rights reserved.
+*/
+
+#include <unity.h>
+#include <string.h>
+#include "bss_config.h"
+#include "bss_frame.h"
+
+static bss_config_t config;
+
+void setUp()
+{
+    bss_config_default(&config);
+}
+
+void tearDown() {}
+
+void test_default_is_valid()
+{
+    TEST_ASSERT_TRUE(bss_config_valid(&config));
+    TEST_ASSERT_EQUAL_UINT16(0, config.version);
+    TEST_ASSERT_EQUAL_UINT16(2000, config.ping_ms);
+}
+
+void test_encode_decode_round_trip()
+{
+    uint8_t buf[BSS_CONFIG_WIRE_SIZE];
+    bss_config_t decoded;
+
+    config.version = 0x1234;
+    config.brightness = 200;
+    config.led_num = 24;
+    config.ping_ms = 500;
+    config.pairing_ms = 30000;
+    config.provisional_ms = 800;
+
+    bss_config_encode(&config, buf);
+    TEST_ASSERT_EQUAL_UINT16(0x1234, bss_get_u16(buf));
+
+    TEST_ASSERT_TRUE(bss_config_decode(buf, sizeof(buf), &decoded));
+    TEST_ASSERT_EQUAL_UINT16(0x1234, decoded.version);
+    TEST_ASSERT_EQUAL_UINT8(200, decoded.brightness);
+    TEST_ASSERT_EQUAL_UINT8(24, decoded.led_num);
+    TEST_ASSERT_EQUAL_UINT16(config.sleep_s, decoded.sleep_s);
+    TEST_ASSERT_EQUAL_UINT16(500, decoded.ping_ms);
+    TEST_ASSERT_EQUAL_UINT8(config.debounce_ms, decoded.debounce_ms);
+    TEST_ASSERT_EQUAL_UINT16(30000, decoded.pairing_ms);
+    TEST_ASSERT_EQUAL_UINT16(config.pairing_hold_ms, decoded.pairing_hold_ms);
+    TEST_ASSERT_EQUAL_UINT16(config.idle_sleep_ms, decoded.idle_sleep_ms);
+    TEST_ASSERT_EQUAL_UINT16(800, decoded.provisional_ms);
+
+    // an older controller knows no provisional feedback
+    TEST_ASSERT_TRUE(bss_config_decode(buf, BSS_CONFIG_MIN_WIRE_SIZE, &decoded));
+    TEST_ASSERT_EQUAL_UINT16(0, decoded.provisional_ms);
+}
+
+void test_decode_rejects_short_and_invalid()
+{
+    uint8_t buf[BSS_CONFIG_WIRE_SIZE + 4] = {0};
+    bss_config_t decoded = config;
+
+    bss_config_encode(&config, buf);
+    TEST_ASSERT_FALSE(bss_config_decode(buf, BSS_CONFIG_MIN_WIRE_SIZE - 1, &decoded));
+
+    // fields appended by a newer controller are ignored
+    TEST_ASSERT_TRUE(bss_config_decode(buf, sizeof(buf), &decoded));
+
+    config.led_num = BSS_CONFIG_MAX_LEDS + 1;
+    bss_config_encode(&config, buf);
+    decoded.brightness = 77;
+    TEST_ASSERT_FALSE(bss_config_decode(buf, sizeof(buf), &decoded));
+    TEST_ASSERT_EQUAL_UINT8(77, decoded.brightness);
+}
+
+void test_set_by_name()
+{
+    TEST_ASSERT_TRUE(bss_config_set(&config, "brightness", 80));
+    TEST_ASSERT_EQUAL_UINT8(80, config.brightness);
+
+    TEST_ASSERT_TRUE(bss_config_set(&config, "ping_ms", 750));
+    TEST_ASSERT_EQUAL_UINT16(750, config.ping_ms);
+
+    TEST_ASSERT_FALSE(bss_config_set(&config, "version", 3));
+    TEST_ASSERT_FALSE(bss_config_set(&config, "colour", 3));
+    TEST_ASSERT_FALSE(bss_config_set(&config, "brightness", 256));
+    TEST_ASSERT_FALSE(bss_config_set(&config, "led_num", 0));
+    TEST_ASSERT_EQUAL_UINT8(80, config.brightness);
+    TEST_ASSERT_EQUAL_UINT8(12, config.led_num);
+}
+
+void test_format()
+{
+    char buf[160];
+
+    bss_config_format(&config, buf, sizeof(buf));
+    TEST_ASSERT_NOT_NULL(strstr(buf, "version=0 brightness=10 led_num=12"));
+    TEST_ASSERT_NOT_NULL(strstr(buf, "idle_sleep_ms=1000"));
+}
+
+int run_tests()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_default_is_valid);
+    RUN_TEST(test_encode_decode_round_trip);
+    RUN_TEST(test_decode_rejects_short_and_invalid);
+    RUN_TEST(test_set_by_name);
+    RUN_TEST(test_format);
+    return UNITY_END();
+}
+
+#ifdef ARDUINO
+#include <Arduino.h>
+
+void setup()
+{
+    delay(2000);
+    run_tests();
+}
+
+void loop() {}
+#else
+int main()
+{
+    return run_tests();
+}
+#endif
@@ -0,0 +1,177 @@
+/*
+  Copyright © 2024 Leonard Sebastian Schwennesen. All rights reserved.
+*/
+
+#include <unity.h>
+#include "bss_input.h"
+
+#ifndef ARDUINO
+#include <thread>
+#endif
+
+static BssButton buttons[] = {BssButton(0), BssButton(1), BssButton(2)};
+static bss_input_t input;
+
+// the buttons as the scanner sees them every millisecond from 'from' on
+static void scan(uint32_t pressed, unsigned long from, unsigned long to)
+{
+    for (unsigned long now = from; now < to; now++)
+        bss_input_scan(&input, pressed, now, now * 1000);
+}
+
+void setUp()
+{
+    for (int i = 0; i < 3; i++)
+        buttons[i] = BssButton(i);
+
+    bss_input_init(&input, buttons, 3, BSS_CONTROLLER_PAIRING_HOLD_MS);
+    scan(0, 100, 110);
+}
+
+void tearDown() {}
+
+void test_press_and_release_are_stamped()
+{
+    bss_input_event_t event;
+
+    scan(1 << BSS_BUTTON_RESET, 110, 150);
+    scan(0, 150, 160);
+
+    TEST_ASSERT_TRUE(bss_input_pop(&input, &event));
+    TEST_ASSERT_EQUAL_UINT8(BSS_BUTTON_RESET, event.button);
+    TEST_ASSERT_EQUAL_UINT8(BSS_EVENT_PRESS, event.event);
+    TEST_ASSERT_EQUAL_UINT32(110000, event.time_us);
+
+    TEST_ASSERT_TRUE(bss_input_pop(&input, &event));
+    TEST_ASSERT_EQUAL_UINT8(BSS_EVENT_RELEASE, event.event);
+    TEST_ASSERT_EQUAL_UINT32(150000, event.time_us);
+
+    TEST_ASSERT_FALSE(bss_input_pop(&input, &event));
+}
+
+void test_simultaneous_presses_are_all_reported()
+{
+    bss_input_event_t event;
+
+    scan(1 << BSS_BUTTON_RIGHT | 1 << BSS_BUTTON_WRONG, 110, 111);
+
+    TEST_ASSERT_TRUE(bss_input_pop(&input, &event));
+    TEST_ASSERT_EQUAL_UINT8(BSS_BUTTON_RIGHT, event.button);
+    TEST_ASSERT_TRUE(bss_input_pop(&input, &event));
+    TEST_ASSERT_EQUAL_UINT8(BSS_BUTTON_WRONG, event.button);
+    TEST_ASSERT_EQUAL_UINT32(110000, event.time_us);
+}
+
+void test_hold_is_reported_once_on_time()
+{
+    bss_input_event_t event;
+
+    scan(1 << BSS_BUTTON_RIGHT, 110, 110 + BSS_CONTROLLER_PAIRING_HOLD_MS + 500);
+    scan(0, 110 + BSS_CONTROLLER_PAIRING_HOLD_MS + 500, 110 + BSS_CONTROLLER_PAIRING_HOLD_MS + 510);
+
+    bss_input_pop(&input, &event);
+    TEST_ASSERT_EQUAL_UINT8(BSS_EVENT_PRESS, event.event);
+
+    TEST_ASSERT_TRUE(bss_input_pop(&input, &event));
+    TEST_ASSERT_EQUAL_UINT8(BSS_EVENT_HOLD, event.event);
+    TEST_ASSERT_EQUAL_UINT32((110 + BSS_CONTROLLER_PAIRING_HOLD_MS) * 1000, event.time_us);
+
+    TEST_ASSERT_TRUE(bss_input_pop(&input, &event));
+    TEST_ASSERT_EQUAL_UINT8(BSS_EVENT_RELEASE, event.event);
+    TEST_ASSERT_FALSE(bss_input_pop(&input, &event));
+}
+
+void test_full_queue_drops_new_events()
+{
+    bss_input_event_t event;
+
+    for (int i = 0; i < BSS_INPUT_QUEUE_SIZE; i++)
+    {
+        unsigned long now = 200 + i * 2 * BSS_BUTTON_DEBOUNCE_MS;
+
+        scan(1, now, now + BSS_BUTTON_DEBOUNCE_MS);
+        scan(0, now + BSS_BUTTON_DEBOUNCE_MS, now + 2 * BSS_BUTTON_DEBOUNCE_MS);
+    }
+
+    TEST_ASSERT_EQUAL_UINT32(BSS_INPUT_QUEUE_SIZE, input.dropped.load());
+
+    for (int i = 0; i < BSS_INPUT_QUEUE_SIZE; i++)
+    {
+        TEST_ASSERT_TRUE(bss_input_pop(&input, &event));
+        TEST_ASSERT_EQUAL_UINT8(i % 2 ? BSS_EVENT_RELEASE : BSS_EVENT_PRESS, event.event);
+    }
+
+    TEST_ASSERT_FALSE(bss_input_pop(&input, &event));
+}
+
+#ifndef ARDUINO
+// The scanner runs on its own task: every event arrives once and in order.
+void test_events_cross_threads_in_order()
+{
+    const int presses = 2000;
+    int received = 0;
+    bool ordered = true;
+    uint32_t last = 0;
+
+    std::thread scanner([]()
+                        {
+                            for (int i = 0; i < presses; i++)
+                            {
+                                unsigned long now = 200 + i * 2 * BSS_BUTTON_DEBOUNCE_MS;
+
+                                // waits for room instead of dropping
+                                while (input.head.load() - input.tail.load() > BSS_INPUT_QUEUE_SIZE - 2)
+                                    std::this_thread::yield();
+
+                                scan(1, now, now + 1);
+                                scan(0, now + BSS_BUTTON_DEBOUNCE_MS, now + BSS_BUTTON_DEBOUNCE_MS + 1);
+                            } });
+
+    while (received < 2 * presses)
+    {
+        bss_input_event_t event;
+
+        if (!bss_input_pop(&input, &event))
+            continue;
+
+        ordered &= received == 0 || event.time_us > last;
+        last = event.time_us;
+        received++;
+    }
+
+    scanner.join();
+
+    TEST_ASSERT_TRUE(ordered);
+    TEST_ASSERT_EQUAL_UINT32(0, input.dropped.load());
+}
+#endif
+
+int run_tests()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_press_and_release_are_stamped);
+    RUN_TEST(test_simultaneous_presses_are_all_reported);
+    RUN_TEST(test_hold_is_reported_once_on_time);
+    RUN_TEST(test_full_queue_drops_new_events);
+#ifndef ARDUINO
+    RUN_TEST(test_events_cross_threads_in_order);
+#endif
+    return UNITY_END();
+}
+
+#ifdef ARDUINO
+#include <Arduino.h>
+
+void setup()
+{
+    delay(2000);
+    run_tests();
+}
+
+void loop() {}
+#else
+int main()
+{
+    return run_tests();
+}
+#endif
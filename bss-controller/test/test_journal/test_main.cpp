@@ -0,0 +1,171 @@
+/*
+  Copyright © 2024 Leonard Sebastian Schwennesen. All rights reserved.
+*/
+
+#include <unity.h>
+#include <string.h>
+#include "bss_shared.h"
+#include "bss_frame.h"
+#include "bss_controller.h"
+#include "bss_journal.h"
+
+static bss_journal_t journal;
+
+static const uint8_t mac[] = {0x24, 0x6F, 0x28, 0x01, 0x02, 0x03};
+
+void setUp()
+{
+    bss_journal_init(&journal);
+}
+
+void tearDown() {}
+
+typedef struct
+{
+    int count;
+    uint32_t first;
+    uint32_t last;
+} collect_t;
+
+static void collect(const bss_journal_entry_t *entry, void *context)
+{
+    collect_t *c = (collect_t *)context;
+
+    if (c->count == 0)
+        c->first = entry->time_us;
+
+    TEST_ASSERT_TRUE(c->count == 0 || entry->time_us == c->last + 1);
+    c->last = entry->time_us;
+    c->count++;
+}
+
+void test_empty_journal()
+{
+    collect_t c = {0, 0, 0};
+
+    bss_journal_for_each(&journal, collect, &c);
+    TEST_ASSERT_EQUAL(0, c.count);
+}
+
+void test_oldest_first()
+{
+    collect_t c = {0, 0, 0};
+
+    for (uint32_t t = 1; t <= 10; t++)
+        bss_journal_button(&journal, t, BSS_BUTTON_RIGHT, BSS_EVENT_PRESS);
+
+    bss_journal_for_each(&journal, collect, &c);
+    TEST_ASSERT_EQUAL(10, c.count);
+    TEST_ASSERT_EQUAL_UINT32(1, c.first);
+    TEST_ASSERT_EQUAL_UINT32(10, c.last);
+}
+
+void test_ring_keeps_the_newest()
+{
+    collect_t c = {0, 0, 0};
+
+    for (uint32_t t = 1; t <= BSS_JOURNAL_ENTRIES + 50; t++)
+        bss_journal_decision(&journal, t, t - 1, BSS_DECISION_LOCKOUT, 1, t, NULL);
+
+    bss_journal_for_each(&journal, collect, &c);
+    TEST_ASSERT_EQUAL(BSS_JOURNAL_ENTRIES, c.count);
+    TEST_ASSERT_EQUAL_UINT32(51, c.first);
+    TEST_ASSERT_EQUAL_UINT32(BSS_JOURNAL_ENTRIES + 50, c.last);
+}
+
+static void copy_entry(const bss_journal_entry_t *entry, void *context)
+{
+    *(bss_journal_entry_t *)context = *entry;
+}
+
+void test_frame_head_is_kept()
+{
+    uint8_t frame[BSS_FRAME_MAX_SIZE];
+    size_t len = bss_record_put(frame, sizeof(frame), 0, 9, BSS_MSG_BUZZER_PRESSED, NULL, 0);
+    memset(frame + len, 0xAB, 30);
+    len += 30;
+
+    bss_journal_frame(&journal, 42, 7, mac, frame, len, BSS_FRAME_ACCEPTED);
+
+    bss_journal_entry_t entry;
+    bss_journal_for_each(&journal, copy_entry, &entry);
+
+    TEST_ASSERT_EQUAL(BSS_JOURNAL_FRAME, entry.kind);
+    TEST_ASSERT_EQUAL(BSS_FRAME_ACCEPTED, entry.status);
+    TEST_ASSERT_EQUAL_UINT8(9, entry.id);
+    TEST_ASSERT_EQUAL_UINT8(len, entry.len);
+    TEST_ASSERT_EQUAL_UINT8(BSS_MSG_BUZZER_PRESSED, bss_record_type(entry.data));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(mac, entry.mac, MAC_SIZE);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(frame, entry.data, BSS_JOURNAL_DATA_SIZE);
+    TEST_ASSERT_EQUAL_UINT32(7, entry.now_ms);
+}
+
+void test_decision_refers_to_its_input()
+{
+    bss_arbiter_t arbiter = {12, 4000000000u, 4000000003u, BSS_CONTROLLER_FAIRNESS_MS}, lock;
+    bss_journal_decision(&journal, 900, 850, BSS_DECISION_LOCKOUT, 3, 12, &arbiter);
+
+    bss_journal_entry_t entry;
+    bss_journal_for_each(&journal, copy_entry, &entry);
+    bss_journal_lock(&entry, &lock);
+
+    TEST_ASSERT_EQUAL(BSS_JOURNAL_DECISION, entry.kind);
+    TEST_ASSERT_EQUAL(BSS_DECISION_LOCKOUT, entry.status);
+    TEST_ASSERT_EQUAL_UINT8(3, entry.id);
+    TEST_ASSERT_EQUAL_UINT16(12, entry.seq);
+    TEST_ASSERT_EQUAL_UINT32(850, bss_journal_input_us(&entry));
+    TEST_ASSERT_EQUAL_UINT16(12, lock.seq);
+    TEST_ASSERT_EQUAL_UINT32(4000000000u, lock.press_time);
+    TEST_ASSERT_EQUAL_UINT32(4000000003u, lock.locked_at);
+    TEST_ASSERT_EQUAL_UINT32(BSS_CONTROLLER_FAIRNESS_MS, lock.window);
+}
+
+void test_format_parse_round_trip()
+{
+    uint8_t frame[] = {5, 1, BSS_MSG_PING, 0x10, 0x20};
+    bss_journal_frame(&journal, 4000000000u, 4000000u, mac, frame, sizeof(frame), BSS_FRAME_REJECTED);
+
+    bss_journal_entry_t entry, parsed;
+    char line[96];
+    bss_journal_for_each(&journal, copy_entry, &entry);
+
+    int n = bss_journal_format(&entry, line, sizeof(line));
+    TEST_ASSERT_EQUAL((int)strlen(line), n);
+    TEST_ASSERT_TRUE(bss_journal_parse(line, &parsed));
+    TEST_ASSERT_EQUAL_MEMORY(&entry, &parsed, sizeof(entry));
+
+    TEST_ASSERT_FALSE(bss_journal_parse("journal begin", &parsed));
+    TEST_ASSERT_FALSE(bss_journal_parse("J 1 0 0 0 0 0 0102 00", &parsed));
+    // without the arrival in millis(), as written before it was kept
+    line[strlen(line) - strlen(" 4000000")] = 0;
+    TEST_ASSERT_FALSE(bss_journal_parse(line, &parsed));
+}
+
+int run_tests()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_empty_journal);
+    RUN_TEST(test_oldest_first);
+    RUN_TEST(test_ring_keeps_the_newest);
+    RUN_TEST(test_frame_head_is_kept);
+    RUN_TEST(test_decision_refers_to_its_input);
+    RUN_TEST(test_format_parse_round_trip);
+    return UNITY_END();
+}
+
+#ifdef ARDUINO
+#include <Arduino.h>
+
+void setup()
+{
+    delay(2000);
+    run_tests();
+}
+
+void loop() {}
+#else
+int main()
+{
+    return run_tests();
+}
+#endif
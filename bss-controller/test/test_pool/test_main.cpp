@@ -0,0 +1,210 @@
+/*
+  Copyright © 2024 Leonard Sebastian Schwennesen. All rights reserved.
+*/
+
+#include <unity.h>
+#include <string.h>
+#include <atomic>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "bss_frame.h"
+#include "bss_pool.h"
+
+static bss_pool_t pool;
+
+static const uint8_t mac[] = {0x24, 0x6F, 0x28, 0x01, 0x02, 0x03};
+
+// the radio: frames queued by send, read when they complete
+typedef struct
+{
+    const uint8_t *data;
+    size_t len;
+    uint8_t first;
+} radio_frame_t;
+
+static std::deque<radio_frame_t> radio;
+static std::mutex radio_lock;
+static bool radio_fails = false;
+
+static bool radio_send(const uint8_t *, const uint8_t *data, size_t len)
+{
+    if (radio_fails)
+        return false;
+
+    std::lock_guard<std::mutex> guard(radio_lock);
+    radio.push_back({data, len, data[0]});
+    return true;
+}
+
+static bool radio_pending()
+{
+    std::lock_guard<std::mutex> guard(radio_lock);
+    return !radio.empty();
+}
+
+// Completes the oldest frame, false if its buffer was reused before.
+static bool radio_complete()
+{
+    radio_frame_t frame;
+    {
+        std::lock_guard<std::mutex> guard(radio_lock);
+
+        if (radio.empty())
+            return true;
+
+        frame = radio.front();
+        radio.pop_front();
+    }
+
+    bool intact = frame.data[0] == frame.first;
+    bss_pool_complete(&pool);
+    return intact;
+}
+
+void setUp()
+{
+    bss_pool_init(&pool);
+    radio.clear();
+    radio_fails = false;
+}
+
+void tearDown() {}
+
+static bss_pool_buffer_t *frame(uint8_t first)
+{
+    bss_pool_buffer_t *buffer = bss_pool_acquire(&pool);
+
+    buffer->data[0] = first;
+    buffer->len = 1;
+    return buffer;
+}
+
+void test_acquire_until_exhausted()
+{
+    bss_pool_buffer_t *buffers[BSS_POOL_BUFFERS];
+
+    for (int i = 0; i < BSS_POOL_BUFFERS; i++)
+        buffers[i] = frame(i);
+
+    TEST_ASSERT_NULL(bss_pool_acquire(&pool));
+    TEST_ASSERT_EQUAL(1, pool.exhausted.load());
+    TEST_ASSERT_EQUAL(0, bss_pool_available(&pool));
+
+    bss_pool_release(&pool, buffers[3]);
+    TEST_ASSERT_EQUAL(1, bss_pool_available(&pool));
+    TEST_ASSERT_EQUAL_PTR(buffers[3], bss_pool_acquire(&pool));
+}
+
+void test_completions_free_in_submission_order()
+{
+    bss_pool_buffer_t *a = frame(1);
+    bss_pool_buffer_t *b = frame(2);
+    bss_pool_buffer_t *c = frame(3);
+
+    // submitted out of acquisition order
+    TEST_ASSERT_TRUE(bss_pool_submit(&pool, c, mac, radio_send));
+    TEST_ASSERT_TRUE(bss_pool_submit(&pool, a, mac, radio_send));
+    TEST_ASSERT_TRUE(bss_pool_submit(&pool, b, mac, radio_send));
+    TEST_ASSERT_EQUAL(3, bss_pool_in_flight(&pool));
+
+    TEST_ASSERT_TRUE(radio_complete());
+    TEST_ASSERT_EQUAL(BSS_POOL_FREE, pool.state[c - pool.buffers].load());
+    TEST_ASSERT_EQUAL(BSS_POOL_IN_FLIGHT, pool.state[a - pool.buffers].load());
+
+    TEST_ASSERT_TRUE(radio_complete());
+    TEST_ASSERT_TRUE(radio_complete());
+    TEST_ASSERT_EQUAL(0, bss_pool_in_flight(&pool));
+    TEST_ASSERT_EQUAL(BSS_POOL_BUFFERS, bss_pool_available(&pool));
+}
+
+void test_failed_send_frees_the_buffer()
+{
+    bss_pool_buffer_t *a = frame(1);
+    bss_pool_buffer_t *b = frame(2);
+    bss_pool_buffer_t *c = frame(3);
+
+    TEST_ASSERT_TRUE(bss_pool_submit(&pool, a, mac, radio_send));
+
+    radio_fails = true;
+    TEST_ASSERT_FALSE(bss_pool_submit(&pool, b, mac, radio_send));
+    TEST_ASSERT_EQUAL(BSS_POOL_FREE, pool.state[b - pool.buffers].load());
+
+    radio_fails = false;
+    TEST_ASSERT_TRUE(bss_pool_submit(&pool, c, mac, radio_send));
+
+    // the failed frame takes no completion
+    TEST_ASSERT_TRUE(radio_complete());
+    TEST_ASSERT_EQUAL(BSS_POOL_FREE, pool.state[a - pool.buffers].load());
+    TEST_ASSERT_EQUAL(BSS_POOL_IN_FLIGHT, pool.state[c - pool.buffers].load());
+    TEST_ASSERT_TRUE(radio_complete());
+    TEST_ASSERT_EQUAL(BSS_POOL_BUFFERS, bss_pool_available(&pool));
+}
+
+void test_frames_stay_intact_while_in_flight()
+{
+    std::atomic<bool> done(false);
+    std::atomic<int> sent(0);
+    bool intact = true;
+
+    std::thread completions([&]()
+                            {
+                                while (!done || radio_pending())
+                                    intact &= radio_complete(); });
+
+    std::vector<std::thread> senders;
+    for (int t = 0; t < 3; t++)
+    {
+        senders.emplace_back([&sent, t]()
+                             {
+                                 for (int n = 0; n < 20000; n++)
+                                 {
+                                     bss_pool_buffer_t *buffer = bss_pool_acquire(&pool);
+
+                                     if (buffer == NULL)
+                                         continue;
+
+                                     buffer->data[0] = t * 64 + n % 64;
+                                     buffer->len = 1;
+                                     sent += bss_pool_submit(&pool, buffer, mac, radio_send);
+                                 } });
+    }
+
+    for (std::thread &sender : senders)
+        sender.join();
+    done = true;
+    completions.join();
+
+    TEST_ASSERT_TRUE(intact);
+    TEST_ASSERT_TRUE(sent > 0);
+    TEST_ASSERT_EQUAL((uint32_t)sent.load(), pool.completed.load());
+    TEST_ASSERT_EQUAL(BSS_POOL_BUFFERS, bss_pool_available(&pool));
+}
+
+int run_tests()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_acquire_until_exhausted);
+    RUN_TEST(test_completions_free_in_submission_order);
+    RUN_TEST(test_failed_send_frees_the_buffer);
+    RUN_TEST(test_frames_stay_intact_while_in_flight);
+    return UNITY_END();
+}
+
+#ifdef ARDUINO
+#include <Arduino.h>
+
+void setup()
+{
+    delay(2000);
+    run_tests();
+}
+
+void loop() {}
+#else
+int main()
+{
+    return run_tests();
+}
+#endif
@@ -0,0 +1,124 @@
+/*
+  Copyright © 2024 Leonard Sebastian Schwennesen. All rights reserved.
+*/
+
+#include <unity.h>
+#include "bss_shared.h"
+#include "bss_frame.h"
+
+void setUp() {}
+void tearDown() {}
+
+void test_record_put_encodes_header_and_payload()
+{
+    uint8_t buf[BSS_FRAME_MAX_SIZE];
+    const uint8_t color[3] = {1, 2, 3};
+
+    size_t size = bss_record_put(buf, sizeof(buf), 0, 42, BSS_MSG_SET_NEOPIXEL_COLOR, color, sizeof(color));
+
+    TEST_ASSERT_EQUAL(6, size);
+    TEST_ASSERT_EQUAL_UINT8(42, buf[0]);
+    TEST_ASSERT_EQUAL_UINT8(4, buf[1]);
+    TEST_ASSERT_EQUAL_UINT8(BSS_MSG_SET_NEOPIXEL_COLOR, buf[2]);
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(color, &buf[3], 3);
+}
+
+void test_record_put_without_payload()
+{
+    uint8_t buf[3];
+
+    TEST_ASSERT_EQUAL(3, bss_record_put(buf, sizeof(buf), 0, 7, BSS_MSG_PING, NULL, 0));
+    TEST_ASSERT_EQUAL_UINT8(1, buf[1]);
+    TEST_ASSERT_EQUAL_UINT8(BSS_MSG_PING, bss_record_type(buf));
+    TEST_ASSERT_EQUAL_UINT8(0, bss_record_payload_len(buf));
+}
+
+void test_record_put_rejects_overflow()
+{
+    uint8_t buf[8] = {0};
+    const uint8_t color[3] = {1, 2, 3};
+
+    size_t size = bss_record_put(buf, sizeof(buf), 0, 1, BSS_MSG_SET_NEOPIXEL_COLOR, color, sizeof(color));
+    TEST_ASSERT_EQUAL(6, size);
+
+    TEST_ASSERT_EQUAL(6, bss_record_put(buf, sizeof(buf), size, 2, BSS_MSG_SET_NEOPIXEL_COLOR, color, sizeof(color)));
+    TEST_ASSERT_EQUAL_UINT8(0, buf[6]);
+}
+
+void test_frame_first_rejects_short_frames()
+{
+    const uint8_t too_short[] = {1, 1};
+    const uint8_t zero_len[] = {1, 0, BSS_MSG_PING};
+    const uint8_t truncated[] = {1, 4, BSS_MSG_SET_NEOPIXEL_COLOR, 255};
+    const uint8_t ping[] = {1, 1, BSS_MSG_PING};
+
+    TEST_ASSERT_NULL(bss_frame_first(too_short, sizeof(too_short)));
+    TEST_ASSERT_NULL(bss_frame_first(zero_len, sizeof(zero_len)));
+    TEST_ASSERT_NULL(bss_frame_first(truncated, sizeof(truncated)));
+    TEST_ASSERT_EQUAL_PTR(ping, bss_frame_first(ping, sizeof(ping)));
+}
+
+void test_frame_find_walks_multiple_records()
+{
+    uint8_t buf[BSS_FRAME_MAX_SIZE];
+    const uint8_t color[3] = {9, 8, 7};
+    size_t size = 0;
+
+    size = bss_record_put(buf, sizeof(buf), size, 10, BSS_MSG_SET_NEOPIXEL_COLOR, color, sizeof(color));
+    size = bss_record_put(buf, sizeof(buf), size, 20, BSS_MSG_PING, NULL, 0);
+    size = bss_record_put(buf, sizeof(buf), size, 30, BSS_MSG_SET_NEOPIXEL_COLOR, color, sizeof(color));
+
+    const uint8_t *record = bss_frame_find(buf, size, 30);
+    TEST_ASSERT_EQUAL_PTR(&buf[9], record);
+    TEST_ASSERT_EQUAL_UINT8(BSS_MSG_SET_NEOPIXEL_COLOR, bss_record_type(record));
+    TEST_ASSERT_EQUAL_UINT8_ARRAY(color, bss_record_payload(record), 3);
+
+    TEST_ASSERT_EQUAL_PTR(&buf[6], bss_frame_find(buf, size, 20));
+    TEST_ASSERT_NULL(bss_frame_find(buf, size, 40));
+}
+
+void test_frame_find_stops_at_truncated_record()
+{
+    // the second record claims more bytes than the frame holds
+    const uint8_t frame[] = {1, 1, BSS_MSG_PING, 2, 200, BSS_MSG_PING, 3, 1, BSS_MSG_PING};
+
+    TEST_ASSERT_NULL(bss_frame_find(frame, sizeof(frame), 3));
+    TEST_ASSERT_EQUAL_PTR(frame, bss_frame_find(frame, sizeof(frame), 1));
+}
+
+void test_frame_find_stops_at_zero_length_record()
+{
+    const uint8_t frame[] = {1, 0, 2, 1, BSS_MSG_PING};
+
+    TEST_ASSERT_NULL(bss_frame_find(frame, sizeof(frame), 2));
+}
+
+int run_tests()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_record_put_encodes_header_and_payload);
+    RUN_TEST(test_record_put_without_payload);
+    RUN_TEST(test_record_put_rejects_overflow);
+    RUN_TEST(test_frame_first_rejects_short_frames);
+    RUN_TEST(test_frame_find_walks_multiple_records);
+    RUN_TEST(test_frame_find_stops_at_truncated_record);
+    RUN_TEST(test_frame_find_stops_at_zero_length_record);
+    return UNITY_END();
+}
+
+#ifdef ARDUINO
+#include <Arduino.h>
+
+void setup()
+{
+    delay(2000);
+    run_tests();
+}
+
+void loop() {}
+#else
+int main()
+{
+    return run_tests();
+}
+#endif
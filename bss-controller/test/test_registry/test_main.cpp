@@ -0,0 +1,426 @@
+/*
+  Copyright © 2024 Leonard Sebastian Schwennesen. All rights reserved.
+*/
+
+#include <unity.h>
+#include "bss_shared.h"
+#include "bss_frame.h"
+#include "bss_registry.h"
+
+#ifndef ARDUINO
+#include <thread>
+#endif
+
+static bss_registry_t registry;
+
+static const uint8_t mac_a[6] = {0x10, 0, 0, 0, 0, 0x01};
+static const uint8_t mac_b[6] = {0x10, 0, 0, 0, 0, 0x02};
+static const uint8_t mac_c[6] = {0x10, 0, 0, 0, 0, 0x03};
+static const uint8_t key[BSS_AUTH_KEY_SIZE] = {1};
+
+void setUp()
+{
+    bss_registry_init(&registry);
+}
+
+void tearDown() {}
+
+void test_add_and_find()
+{
+    TEST_ASSERT_NOT_EQUAL(BSS_REGISTRY_NO_SLOT, bss_registry_add(&registry, 1, mac_a, key, 100));
+    TEST_ASSERT_NOT_EQUAL(BSS_REGISTRY_NO_SLOT, bss_registry_add(&registry, 2, mac_b, key, 200));
+
+    bss_client client;
+    int slot = bss_registry_find(&registry, 2, mac_b, &client);
+    TEST_ASSERT_NOT_EQUAL(BSS_REGISTRY_NO_SLOT, slot);
+    TEST_ASSERT_EQUAL_UINT8(2, client.id);
+    TEST_ASSERT_EQUAL_MEMORY(mac_b, client.mac, 6);
+    TEST_ASSERT_EQUAL(200, bss_registry_last_msg(&registry, slot));
+    TEST_ASSERT_EQUAL_UINT8(2, bss_registry_count(&registry));
+}
+
+void test_find_requires_id_and_mac()
+{
+    bss_registry_add(&registry, 1, mac_a, key, 0);
+
+    TEST_ASSERT_EQUAL(BSS_REGISTRY_NO_SLOT, bss_registry_find(&registry, 1, mac_b));
+    TEST_ASSERT_EQUAL(BSS_REGISTRY_NO_SLOT, bss_registry_find(&registry, 2, mac_a));
+}
+
+void test_touch_updates_last_msg()
+{
+    int slot = bss_registry_add(&registry, 1, mac_a, key, 0);
+
+    bss_registry_touch(&registry, slot, 1234);
+    TEST_ASSERT_EQUAL(1234, bss_registry_last_msg(&registry, slot));
+}
+
+void test_readd_replaces_key_and_resets_counter()
+{
+    const uint8_t new_key[BSS_AUTH_KEY_SIZE] = {2};
+    bss_client client;
+
+    int slot = bss_registry_add(&registry, 1, mac_a, key, 0);
+    TEST_ASSERT_TRUE(bss_registry_accept_counter(&registry, slot, 10));
+
+    // the same session again keeps its counter
+    TEST_ASSERT_EQUAL(slot, bss_registry_add(&registry, 1, mac_a, key, 0));
+    TEST_ASSERT_FALSE(bss_registry_accept_counter(&registry, slot, 10));
+
+    TEST_ASSERT_EQUAL(slot, bss_registry_add(&registry, 1, mac_a, new_key, 0));
+    TEST_ASSERT_EQUAL_UINT8(1, bss_registry_count(&registry));
+    TEST_ASSERT_TRUE(bss_registry_get(&registry, slot, &client));
+    TEST_ASSERT_EQUAL_MEMORY(new_key, client.key, BSS_AUTH_KEY_SIZE);
+    TEST_ASSERT_TRUE(bss_registry_accept_counter(&registry, slot, 1));
+}
+
+void test_accept_counter_rejects_replays()
+{
+    int slot = bss_registry_add(&registry, 1, mac_a, key, 0);
+
+    TEST_ASSERT_TRUE(bss_registry_accept_counter(&registry, slot, 5));
+    TEST_ASSERT_FALSE(bss_registry_accept_counter(&registry, slot, 5));
+    TEST_ASSERT_FALSE(bss_registry_accept_counter(&registry, slot, 4));
+    TEST_ASSERT_TRUE(bss_registry_accept_counter(&registry, slot, 6));
+}
+
+void test_find_mac_ignores_id()
+{
+    int slot = bss_registry_add(&registry, 1, mac_a, key, 0);
+
+    TEST_ASSERT_EQUAL(slot, bss_registry_find_mac(&registry, mac_a));
+    TEST_ASSERT_EQUAL(BSS_REGISTRY_NO_SLOT, bss_registry_find_mac(&registry, mac_b));
+}
+
+void test_remove_reuses_slot()
+{
+    bss_registry_add(&registry, 1, mac_a, key, 0);
+    int slot_b = bss_registry_add(&registry, 2, mac_b, key, 0);
+    bss_registry_add(&registry, 3, mac_c, key, 0);
+
+    TEST_ASSERT_TRUE(bss_registry_remove(&registry, 2, mac_b));
+    TEST_ASSERT_EQUAL(BSS_REGISTRY_NO_SLOT, bss_registry_find(&registry, 2, mac_b));
+    TEST_ASSERT_NOT_EQUAL(BSS_REGISTRY_NO_SLOT, bss_registry_find(&registry, 3, mac_c));
+    TEST_ASSERT_FALSE(bss_registry_remove(&registry, 2, mac_b));
+
+    bss_client client;
+    TEST_ASSERT_FALSE(bss_registry_get(&registry, slot_b, &client));
+
+    TEST_ASSERT_EQUAL(slot_b, bss_registry_add(&registry, 2, mac_b, key, 0));
+    TEST_ASSERT_EQUAL_UINT8(3, bss_registry_count(&registry));
+}
+
+void test_add_fails_when_full()
+{
+    uint8_t mac[6] = {0x20, 0, 0, 0, 0, 0};
+
+    for (int id = 0; id < BSS_REGISTRY_MAX_CLIENTS; id++)
+    {
+        mac[5] = id;
+        TEST_ASSERT_NOT_EQUAL(BSS_REGISTRY_NO_SLOT, bss_registry_add(&registry, id, mac, key, 0));
+    }
+
+    mac[4] = 1;
+    TEST_ASSERT_EQUAL(BSS_REGISTRY_NO_SLOT, bss_registry_add(&registry, 0, mac, key, 0));
+}
+
+void test_build_broadcast_addresses_every_client()
+{
+    uint8_t buf[BSS_FRAME_MAX_SIZE];
+    const uint8_t color[3] = {255, 0, 0};
+
+    bss_registry_add(&registry, 1, mac_a, key, 0);
+    bss_registry_add(&registry, 2, mac_b, key, 0);
+    bss_registry_add(&registry, 3, mac_c, key, 0);
+
+    size_t size = bss_registry_build_broadcast(&registry, buf, sizeof(buf), BSS_MSG_SET_NEOPIXEL_COLOR, color, sizeof(color));
+    TEST_ASSERT_EQUAL(18, size);
+
+    for (uint8_t id = 1; id <= 3; id++)
+    {
+        const uint8_t *record = bss_frame_find(buf, size, id);
+
+        TEST_ASSERT_NOT_NULL(record);
+        TEST_ASSERT_EQUAL_UINT8_ARRAY(color, bss_record_payload(record), 3);
+    }
+}
+
+void test_build_broadcast_respects_capacity()
+{
+    uint8_t buf[BSS_FRAME_MAX_SIZE];
+    const uint8_t color[3] = {0, 0, 0};
+    uint8_t mac[6] = {0x20, 0, 0, 0, 0, 0};
+
+    // more clients than fit into one frame with 6 byte records
+    for (uint8_t id = 0; id < 50; id++)
+    {
+        mac[5] = id;
+        bss_registry_add(&registry, id, mac, key, 0);
+    }
+
+    size_t size = bss_registry_build_broadcast(&registry, buf, sizeof(buf), BSS_MSG_SET_NEOPIXEL_COLOR, color, sizeof(color));
+    TEST_ASSERT_EQUAL(41 * 6, size);
+}
+
+void test_build_broadcast_continues_at_next_slot()
+{
+    uint8_t buf[BSS_FRAME_MAX_SIZE];
+    const uint8_t payload[15] = {0};
+    uint8_t mac[6] = {0x20, 0, 0, 0, 0, 0};
+    int addressed = 0, frames = 0, next_slot = 0;
+
+    for (uint8_t id = 0; id < BSS_REGISTRY_MAX_CLIENTS; id++)
+    {
+        mac[5] = id;
+        bss_registry_add(&registry, id, mac, key, 0);
+    }
+
+    while (next_slot < BSS_REGISTRY_MAX_CLIENTS)
+    {
+        size_t size = bss_registry_build_broadcast(&registry, buf, sizeof(buf), BSS_MSG_CONFIG, payload, sizeof(payload), &next_slot);
+
+        TEST_ASSERT_TRUE(size > 0);
+        addressed += size / 18;
+        frames++;
+    }
+
+    TEST_ASSERT_EQUAL(BSS_REGISTRY_MAX_CLIENTS, addressed);
+    TEST_ASSERT_EQUAL(5, frames);
+}
+
+void test_heard_bitmap()
+{
+    uint8_t heard[BSS_REGISTRY_MAX_CLIENTS / 8];
+
+    int slot_a = bss_registry_add(&registry, 1, mac_a, key, 1000);
+    int slot_b = bss_registry_add(&registry, 2, mac_b, key, 1000);
+    int slot_c = bss_registry_add(&registry, 3, mac_c, key, 1000);
+
+    bss_registry_touch(&registry, slot_a, 4500);
+    bss_registry_touch(&registry, slot_c, 3000);
+
+    bss_registry_heard(&registry, 5000, 2000, heard);
+
+    TEST_ASSERT_TRUE(heard[slot_a / 8] >> (slot_a % 8) & 1);
+    TEST_ASSERT_FALSE(heard[slot_b / 8] >> (slot_b % 8) & 1);
+    TEST_ASSERT_TRUE(heard[slot_c / 8] >> (slot_c % 8) & 1);
+    TEST_ASSERT_EQUAL_UINT8(0, heard[7]);
+}
+
+void test_writers_mark_slots_dirty()
+{
+    TEST_ASSERT_EQUAL(BSS_REGISTRY_NO_SLOT, bss_registry_take_dirty(&registry));
+
+    int slot_a = bss_registry_add(&registry, 1, mac_a, key, 0);
+    int slot_b = bss_registry_add(&registry, 2, mac_b, key, 0);
+
+    TEST_ASSERT_EQUAL(slot_a, bss_registry_take_dirty(&registry));
+    TEST_ASSERT_EQUAL(slot_b, bss_registry_take_dirty(&registry));
+    TEST_ASSERT_EQUAL(BSS_REGISTRY_NO_SLOT, bss_registry_take_dirty(&registry));
+
+    bss_registry_remove(&registry, 1, mac_a);
+    TEST_ASSERT_EQUAL(slot_a, bss_registry_take_dirty(&registry));
+
+    uint8_t record[BSS_REGISTRY_RECORD_SIZE];
+    TEST_ASSERT_EQUAL(0, bss_registry_encode(&registry, slot_a, record));
+}
+
+void test_counter_marks_dirty_once_a_block_ahead()
+{
+    uint8_t record[BSS_REGISTRY_RECORD_SIZE];
+    int slot = bss_registry_add(&registry, 1, mac_a, key, 0);
+
+    bss_registry_take_dirty(&registry);
+    TEST_ASSERT_TRUE(bss_registry_accept_counter(&registry, slot, BSS_AUTH_COUNTER_BLOCK - 1));
+    TEST_ASSERT_EQUAL(BSS_REGISTRY_NO_SLOT, bss_registry_take_dirty(&registry));
+
+    TEST_ASSERT_TRUE(bss_registry_accept_counter(&registry, slot, BSS_AUTH_COUNTER_BLOCK));
+    TEST_ASSERT_EQUAL(slot, bss_registry_take_dirty(&registry));
+    TEST_ASSERT_EQUAL(BSS_REGISTRY_RECORD_SIZE, bss_registry_encode(&registry, slot, record));
+
+    // encoding alone, as for the standby, stores nothing
+    TEST_ASSERT_TRUE(bss_registry_accept_counter(&registry, slot, BSS_AUTH_COUNTER_BLOCK + 1));
+    TEST_ASSERT_EQUAL(slot, bss_registry_take_dirty(&registry));
+    bss_registry_persisted(&registry, slot, record);
+
+    TEST_ASSERT_TRUE(bss_registry_accept_counter(&registry, slot, BSS_AUTH_COUNTER_BLOCK + 2));
+    TEST_ASSERT_EQUAL(BSS_REGISTRY_NO_SLOT, bss_registry_take_dirty(&registry));
+}
+
+void test_restore_keeps_slot_key_and_counter()
+{
+    uint8_t record[BSS_REGISTRY_RECORD_SIZE];
+    uint8_t other_key[BSS_AUTH_KEY_SIZE] = {7, 7};
+
+    bss_registry_add(&registry, 1, mac_a, key, 0);
+    int slot = bss_registry_add(&registry, 2, mac_b, other_key, 0);
+    bss_registry_accept_counter(&registry, slot, 500);
+    TEST_ASSERT_EQUAL(BSS_REGISTRY_RECORD_SIZE, bss_registry_encode(&registry, slot, record));
+
+    bss_registry_init(&registry);
+    TEST_ASSERT_TRUE(bss_registry_restore(&registry, slot, record, sizeof(record)));
+
+    bss_client client;
+    TEST_ASSERT_EQUAL(slot, bss_registry_find(&registry, 2, mac_b, &client));
+    TEST_ASSERT_EQUAL_MEMORY(other_key, client.key, BSS_AUTH_KEY_SIZE);
+    TEST_ASSERT_EQUAL_UINT8(1, bss_registry_count(&registry));
+    TEST_ASSERT_FALSE(bss_registry_accept_counter(&registry, slot, 500));
+    TEST_ASSERT_TRUE(bss_registry_accept_counter(&registry, slot, 501));
+
+    // restoring is no change to persist
+    TEST_ASSERT_EQUAL(BSS_REGISTRY_NO_SLOT, bss_registry_take_dirty(&registry));
+
+    // a new client goes around the restored slot
+    TEST_ASSERT_NOT_EQUAL(slot, bss_registry_add(&registry, 3, mac_c, key, 0));
+}
+
+void test_restore_rejects_other_versions()
+{
+    uint8_t record[BSS_REGISTRY_RECORD_SIZE];
+    int slot = bss_registry_add(&registry, 1, mac_a, key, 0);
+
+    bss_registry_encode(&registry, slot, record);
+    bss_registry_init(&registry);
+
+    TEST_ASSERT_FALSE(bss_registry_restore(&registry, slot, record, sizeof(record) - 1));
+    record[0]++;
+    TEST_ASSERT_FALSE(bss_registry_restore(&registry, slot, record, sizeof(record)));
+    TEST_ASSERT_EQUAL_UINT8(0, bss_registry_count(&registry));
+}
+
+void test_restore_keeps_the_role()
+{
+    uint8_t record[BSS_REGISTRY_RECORD_SIZE];
+    int slot = bss_registry_add(&registry, 0xFE, mac_a, key, 0, BSS_CLIENT_STANDBY);
+
+    bss_registry_encode(&registry, slot, record);
+    bss_registry_init(&registry);
+    TEST_ASSERT_TRUE(bss_registry_restore(&registry, slot, record, sizeof(record)));
+
+    bss_client client;
+    TEST_ASSERT_TRUE(bss_registry_get(&registry, slot, &client));
+    TEST_ASSERT_EQUAL_UINT8(BSS_CLIENT_STANDBY, client.role);
+
+    // pairing again as a buzzer is a change
+    bss_registry_take_dirty(&registry);
+    TEST_ASSERT_EQUAL(slot, bss_registry_add(&registry, 0xFE, mac_a, key, 0));
+    TEST_ASSERT_EQUAL(slot, bss_registry_take_dirty(&registry));
+    TEST_ASSERT_TRUE(bss_registry_get(&registry, slot, &client));
+    TEST_ASSERT_EQUAL_UINT8(BSS_CLIENT_BUZZER, client.role);
+}
+
+void test_restore_takes_version_1_records_as_buzzers()
+{
+    uint8_t record[BSS_REGISTRY_RECORD_SIZE];
+    int slot = bss_registry_add(&registry, 1, mac_a, key, 0, BSS_CLIENT_STANDBY);
+
+    bss_registry_encode(&registry, slot, record);
+    bss_registry_init(&registry);
+    record[0] = 1;
+
+    TEST_ASSERT_TRUE(bss_registry_restore(&registry, slot, record, BSS_REGISTRY_RECORD_ROLE));
+
+    bss_client client;
+    TEST_ASSERT_TRUE(bss_registry_get(&registry, slot, &client));
+    TEST_ASSERT_EQUAL_UINT8(BSS_CLIENT_BUZZER, client.role);
+
+    // but not under a reserved id
+    bss_registry_init(&registry);
+    record[1] = 0xFE;
+    TEST_ASSERT_FALSE(bss_registry_restore(&registry, slot, record, BSS_REGISTRY_RECORD_ROLE));
+    record[1] = 0xFF;
+    TEST_ASSERT_FALSE(bss_registry_restore(&registry, slot, record, BSS_REGISTRY_RECORD_ROLE));
+    TEST_ASSERT_EQUAL_UINT8(0, bss_registry_count(&registry));
+}
+
+#ifndef ARDUINO
+// A reader must never observe a half written client, while a writer keeps
+// replacing them. Every client is written with mac[5] == id.
+void test_snapshots_are_consistent_under_writes()
+{
+    std::atomic<bool> done(false);
+    uint8_t mac[6] = {0x50, 0, 0, 0, 0, 0};
+
+    for (uint8_t id = 0; id < 8; id++)
+    {
+        mac[5] = id;
+        bss_registry_add(&registry, id, mac, key, 0);
+    }
+
+    std::thread writer([&done]()
+                       {
+                           uint8_t mac[6] = {0x50, 0, 0, 0, 0, 0};
+
+                           for (uint32_t i = 0; i < 200000; i++)
+                           {
+                               uint8_t id = i % 8;
+                               mac[5] = id;
+
+                               bss_registry_remove(&registry, id, mac);
+                               bss_registry_add(&registry, id, mac, key, i);
+                           }
+
+                           done = true; });
+
+    uint32_t torn = 0;
+
+    while (!done)
+    {
+        for (int slot = 0; slot < 8; slot++)
+        {
+            bss_client client;
+
+            if (bss_registry_get(&registry, slot, &client) && client.mac[5] != client.id)
+                torn++;
+        }
+    }
+
+    writer.join();
+    TEST_ASSERT_EQUAL(0, torn);
+    TEST_ASSERT_EQUAL_UINT8(8, bss_registry_count(&registry));
+}
+#endif
+
+int run_tests()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_add_and_find);
+    RUN_TEST(test_find_requires_id_and_mac);
+    RUN_TEST(test_touch_updates_last_msg);
+    RUN_TEST(test_readd_replaces_key_and_resets_counter);
+    RUN_TEST(test_accept_counter_rejects_replays);
+    RUN_TEST(test_find_mac_ignores_id);
+    RUN_TEST(test_remove_reuses_slot);
+    RUN_TEST(test_add_fails_when_full);
+    RUN_TEST(test_build_broadcast_addresses_every_client);
+    RUN_TEST(test_build_broadcast_respects_capacity);
+    RUN_TEST(test_build_broadcast_continues_at_next_slot);
+    RUN_TEST(test_heard_bitmap);
+    RUN_TEST(test_writers_mark_slots_dirty);
+    RUN_TEST(test_counter_marks_dirty_once_a_block_ahead);
+    RUN_TEST(test_restore_keeps_slot_key_and_counter);
+    RUN_TEST(test_restore_rejects_other_versions);
+    RUN_TEST(test_restore_keeps_the_role);
+    RUN_TEST(test_restore_takes_version_1_records_as_buzzers);
+#ifndef ARDUINO
+    RUN_TEST(test_snapshots_are_consistent_under_writes);
+#endif
+    return UNITY_END();
+}
+
+#ifdef ARDUINO
+#include <Arduino.h>
+
+void setup()
+{
+    delay(2000);
+    run_tests();
+}
+
+void loop() {}
+#else
+int main()
+{
+    return run_tests();
+}
+#endif
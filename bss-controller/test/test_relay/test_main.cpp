@@ -0,0 +1,274 @@
+/*
+  Copyright © 2024 Leonard Sebastian Schwennesen. All rights reserved.
+*/
+
+#include <unity.h>
+#include <string.h>
+#include "bss_shared.h"
+#include "bss_frame.h"
+#include "bss_auth.h"
+#include "bss_txq.h"
+#include "bss_relay.h"
+
+static const uint8_t controller_mac[6] = {0x10, 0, 0, 0, 0, 0x00};
+static const uint8_t far_mac[6] = {0x10, 0, 0, 0, 0, 0x09};
+static const uint8_t other_mac[6] = {0x10, 0, 0, 0, 0, 0x0A};
+static const uint8_t far_key[BSS_AUTH_KEY_SIZE] = {0xF1};
+static const uint8_t group_key[BSS_AUTH_KEY_SIZE] = {0x61};
+
+static bss_relay_t relay;
+static bss_registry_t registry;
+static bss_links_t links;
+static bss_relay_plan_t plan;
+
+// a relay for the client 9 at far_mac
+static void forward_for_far()
+{
+    uint8_t role[1 + BSS_RELAY_ROLE_ENTRY_SIZE] = {BSS_RELAY_FORWARD, 9};
+
+    mac_copy(&role[2], far_mac);
+    TEST_ASSERT_TRUE(bss_relay_set_role(&relay, role, sizeof(role)));
+}
+
+static size_t make_frame(uint8_t *frame, const uint8_t *mac, uint8_t id, uint8_t type, uint8_t key_id,
+                         const uint8_t *key, uint32_t counter)
+{
+    uint8_t payload[4] = {0};
+    size_t len = bss_record_put(frame, BSS_FRAME_MAX_SIZE, 0, id, type, payload, sizeof(payload));
+
+    return bss_auth_seal(frame, len, BSS_FRAME_MAX_SIZE, mac, key_id, key, counter);
+}
+
+void setUp()
+{
+    bss_relay_init(&relay);
+    bss_registry_init(&registry);
+    bss_links_init(&links);
+    bss_relay_plan_init(&plan);
+}
+
+void tearDown() {}
+
+void test_relayed_frame_opens_unchanged()
+{
+    uint8_t frame[BSS_FRAME_MAX_SIZE];
+    uint8_t wrapped[BSS_FRAME_MAX_SIZE];
+    uint8_t ttl;
+    const uint8_t *origin;
+    const uint8_t *inner;
+    int inner_len;
+
+    size_t len = make_frame(frame, far_mac, 9, BSS_MSG_BUZZER_PRESSED, BSS_AUTH_KEY_SESSION, far_key, 40);
+    size_t wrapped_len = bss_relay_put(wrapped, sizeof(wrapped), 0, 3, 1, far_mac, frame, len);
+    TEST_ASSERT_EQUAL(BSS_RECORD_HEADER_SIZE + 1 + BSS_RELAY_HEADER_SIZE + len, wrapped_len);
+
+    TEST_ASSERT_TRUE(bss_relay_open(wrapped, &ttl, &origin, &inner, &inner_len));
+    TEST_ASSERT_EQUAL_UINT8(1, ttl);
+    TEST_ASSERT_EQUAL_MEMORY(far_mac, origin, 6);
+    TEST_ASSERT_EQUAL(len, inner_len);
+    // still authentic as coming from the far client
+    TEST_ASSERT_TRUE(bss_auth_verify(inner, inner_len, origin, far_key));
+
+    // the priority of the press survives the wrapping
+    bss_auth_seal(wrapped, wrapped_len, sizeof(wrapped), other_mac, BSS_AUTH_KEY_SESSION, group_key, 1);
+    TEST_ASSERT_EQUAL(BSS_TX_URGENT, bss_relay_priority(wrapped, wrapped_len + BSS_AUTH_TRAILER_SIZE));
+
+    len = make_frame(frame, far_mac, 9, BSS_MSG_PING, BSS_AUTH_KEY_SESSION, far_key, 41);
+    TEST_ASSERT_EQUAL(BSS_TX_BACKGROUND, bss_relay_priority(frame, len));
+}
+
+void test_only_far_clients_are_forwarded_once()
+{
+    uint8_t frame[BSS_FRAME_MAX_SIZE];
+    uint8_t ttl;
+
+    size_t len = make_frame(frame, far_mac, 9, BSS_MSG_PING, BSS_AUTH_KEY_SESSION, far_key, 40);
+    TEST_ASSERT_FALSE(bss_relay_accept(&relay, far_mac, frame, len, &ttl));
+
+    forward_for_far();
+    TEST_ASSERT_TRUE(bss_relay_accept(&relay, far_mac, frame, len, &ttl));
+    TEST_ASSERT_EQUAL_UINT8(BSS_RELAY_TTL - 1, ttl);
+
+    // heard twice, or from a client that is not ours
+    TEST_ASSERT_FALSE(bss_relay_accept(&relay, far_mac, frame, len, &ttl));
+    TEST_ASSERT_FALSE(bss_relay_accept(&relay, other_mac, frame, len, &ttl));
+}
+
+void test_ttl_bounds_the_hops()
+{
+    uint8_t frame[BSS_FRAME_MAX_SIZE];
+    uint8_t wrapped[BSS_FRAME_MAX_SIZE];
+    uint8_t ttl;
+
+    forward_for_far();
+
+    size_t len = make_frame(frame, other_mac, 10, BSS_MSG_PING, BSS_AUTH_KEY_SESSION, far_key, 40);
+
+    // a far relay that forwarded the frame of 'other_mac'
+    size_t wrapped_len = bss_relay_put(wrapped, sizeof(wrapped), 0, 9, 0, other_mac, frame, len);
+    wrapped_len = bss_auth_seal(wrapped, wrapped_len, sizeof(wrapped), far_mac, BSS_AUTH_KEY_SESSION, far_key, 50);
+    TEST_ASSERT_FALSE(bss_relay_accept(&relay, far_mac, wrapped, wrapped_len, &ttl));
+
+    wrapped_len = bss_relay_put(wrapped, sizeof(wrapped), 0, 9, 1, other_mac, frame, len);
+    wrapped_len = bss_auth_seal(wrapped, wrapped_len, sizeof(wrapped), far_mac, BSS_AUTH_KEY_SESSION, far_key, 51);
+    TEST_ASSERT_TRUE(bss_relay_accept(&relay, far_mac, wrapped, wrapped_len, &ttl));
+    TEST_ASSERT_EQUAL_UINT8(0, ttl);
+}
+
+void test_controller_frames_are_repeated_for_far_clients()
+{
+    uint8_t frame[BSS_FRAME_MAX_SIZE];
+
+    forward_for_far();
+
+    size_t len = make_frame(frame, controller_mac, 9, BSS_MSG_SET_NEOPIXEL_COLOR, BSS_AUTH_KEY_GROUP, group_key, 70);
+    TEST_ASSERT_FALSE(bss_relay_repeat(&relay, controller_mac, group_key, other_mac, frame, len));
+    TEST_ASSERT_TRUE(bss_relay_repeat(&relay, controller_mac, group_key, controller_mac, frame, len));
+    TEST_ASSERT_FALSE(bss_relay_repeat(&relay, controller_mac, group_key, controller_mac, frame, len));
+
+    // and taken as frames of the controller
+    TEST_ASSERT_TRUE(bss_relay_repeated(controller_mac, group_key, other_mac, frame, len));
+
+    // frames for no far client stay
+    len = make_frame(frame, controller_mac, 4, BSS_MSG_SET_NEOPIXEL_COLOR, BSS_AUTH_KEY_GROUP, group_key, 71);
+    TEST_ASSERT_FALSE(bss_relay_repeat(&relay, controller_mac, group_key, controller_mac, frame, len));
+
+    // and forgeries
+    const uint8_t guessed_key[BSS_AUTH_KEY_SIZE] = {0};
+
+    len = make_frame(frame, controller_mac, 9, BSS_MSG_SET_NEOPIXEL_COLOR, BSS_AUTH_KEY_GROUP, guessed_key, 72);
+    TEST_ASSERT_FALSE(bss_relay_repeat(&relay, controller_mac, group_key, controller_mac, frame, len));
+    TEST_ASSERT_FALSE(bss_relay_repeated(controller_mac, group_key, other_mac, frame, len));
+}
+
+void test_link_quality_has_hysteresis()
+{
+    int slot = bss_registry_add(&registry, 1, far_mac, far_key, 0);
+    int periods = 0;
+
+    bss_links_update(&links, &registry);
+    TEST_ASSERT_TRUE(links.quality[slot] < BSS_LINK_NEAR);
+
+    while (links.quality[slot] >= BSS_LINK_FAR)
+    {
+        bss_links_update(&links, &registry);
+        periods++;
+    }
+
+    TEST_ASSERT_TRUE(periods > 0 && periods <= BSS_RELAY_PLAN_PERIODS);
+
+    for (periods = 0; links.quality[slot] < BSS_LINK_GOOD; periods++)
+    {
+        bss_links_touch(&links, slot);
+        bss_links_update(&links, &registry);
+    }
+
+    TEST_ASSERT_TRUE(periods < 20);
+
+    bss_registry_remove_slot(&registry, slot);
+    bss_links_update(&links, &registry);
+    TEST_ASSERT_EQUAL_UINT8(0, links.quality[slot]);
+}
+
+// Clients 1 to 'count', 'quality' of each, all heard at 1000.
+static void fleet(const uint8_t *quality, int count)
+{
+    for (int i = 0; i < count; i++)
+    {
+        uint8_t mac[6] = {0x10, 0, 0, 0, 1, (uint8_t)i};
+        int slot = bss_registry_add(&registry, i + 1, mac, far_key, 1000);
+
+        bss_registry_touch(&registry, slot, 1000);
+        links.quality[slot] = quality[i];
+    }
+}
+
+void test_plan_keeps_relays_that_deliver()
+{
+    const uint8_t quality[] = {255, 230, 240, 50, 200};
+    uint8_t role[BSS_RELAY_ROLE_MAX_SIZE];
+
+    fleet(quality, 5);
+    bss_relay_plan(&plan, &registry, &links, 1100, 1000);
+
+    TEST_ASSERT_TRUE(plan.far[3]);
+    TEST_ASSERT_FALSE(plan.far[4]);
+
+    // weakest good links first, the moderate link is no relay
+    TEST_ASSERT_EQUAL_UINT8(1, plan.relays[3][0].load());
+    TEST_ASSERT_EQUAL_UINT8(2, plan.relays[3][1].load());
+
+    TEST_ASSERT_EQUAL(1 + BSS_RELAY_ROLE_ENTRY_SIZE, bss_relay_role(&plan, &registry, 1, role));
+    TEST_ASSERT_EQUAL_UINT8(BSS_RELAY_FORWARD, role[0]);
+    TEST_ASSERT_EQUAL_UINT8(4, role[1]);
+    TEST_ASSERT_EQUAL(1, bss_relay_role(&plan, &registry, 3, role));
+    TEST_ASSERT_EQUAL_UINT8(BSS_RELAY_BROADCAST, role[0]);
+    TEST_ASSERT_EQUAL(1, bss_relay_role(&plan, &registry, 4, role));
+    TEST_ASSERT_EQUAL_UINT8(0, role[0]);
+
+    // only the second one hears it, the first is replaced
+    bss_relay_delivered(&plan, 3, 2);
+    bss_relay_plan(&plan, &registry, &links, 1200, 1000);
+    TEST_ASSERT_EQUAL_UINT8(0, plan.relays[3][0].load());
+    TEST_ASSERT_EQUAL_UINT8(2, plan.relays[3][1].load());
+
+    // near again only above BSS_LINK_NEAR
+    links.quality[3] = BSS_LINK_NEAR - 1;
+    bss_relay_plan(&plan, &registry, &links, 1300, 1000);
+    TEST_ASSERT_TRUE(plan.far[3]);
+
+    links.quality[3] = BSS_LINK_NEAR;
+    bss_relay_plan(&plan, &registry, &links, 1300, 1000);
+    TEST_ASSERT_FALSE(plan.far[3]);
+    TEST_ASSERT_EQUAL_UINT8(BSS_RELAY_NONE, plan.relays[3][0].load());
+}
+
+void test_plan_bounds_the_load_and_skips_silent_clients()
+{
+    const uint8_t quality[] = {255, 10, 10, 10, 10, 10, 10};
+
+    fleet(quality, 7);
+
+    // client 7 is asleep
+    bss_registry_touch(&registry, 6, 0);
+    bss_relay_plan(&plan, &registry, &links, 1100, 1000);
+
+    TEST_ASSERT_FALSE(plan.far[6]);
+
+    int relayed = 0;
+
+    for (int slot = 1; slot < 6; slot++)
+        relayed += plan.relays[slot][0].load() == 0;
+
+    TEST_ASSERT_EQUAL(BSS_RELAY_MAX_FAR, relayed);
+}
+
+int run_tests()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_relayed_frame_opens_unchanged);
+    RUN_TEST(test_only_far_clients_are_forwarded_once);
+    RUN_TEST(test_ttl_bounds_the_hops);
+    RUN_TEST(test_controller_frames_are_repeated_for_far_clients);
+    RUN_TEST(test_link_quality_has_hysteresis);
+    RUN_TEST(test_plan_keeps_relays_that_deliver);
+    RUN_TEST(test_plan_bounds_the_load_and_skips_silent_clients);
+    return UNITY_END();
+}
+
+#ifdef ARDUINO
+#include <Arduino.h>
+
+void setup()
+{
+    delay(2000);
+    run_tests();
+}
+
+void loop() {}
+#else
+int main()
+{
+    return run_tests();
+}
+#endif
@@ -0,0 +1,214 @@
+/*
+  Copyright © 2024 Leonard Sebastian Schwennesen. All rights reserved.
+*/
+
+#include <unity.h>
+#include "bss_show.h"
+#include "bss_controller.h"
+
+#ifndef ARDUINO
+#include <thread>
+#endif
+
+static bss_show_t show;
+// relay mode
+static const uint32_t window = BSS_CONTROLLER_FAIRNESS_MS;
+
+void setUp()
+{
+    bss_show_init(&show);
+}
+
+void tearDown() {}
+
+void test_first_press_wins()
+{
+    TEST_ASSERT_TRUE(bss_show_try_lock(&show, 7));
+    TEST_ASSERT_FALSE(bss_show_try_lock(&show, 8));
+
+    bss_show_snapshot_t state = bss_show_read(&show);
+    TEST_ASSERT_EQUAL(BSS_SHOW_LOCKED, state.phase);
+    TEST_ASSERT_EQUAL_UINT8(7, state.winner);
+    TEST_ASSERT_EQUAL_UINT16(1, state.seq);
+}
+
+void test_reset_opens_the_show()
+{
+    TEST_ASSERT_FALSE(bss_show_reset(&show));
+
+    bss_show_try_lock(&show, 7);
+    TEST_ASSERT_TRUE(bss_show_reset(&show));
+
+    bss_show_snapshot_t state = bss_show_read(&show);
+    TEST_ASSERT_EQUAL(BSS_SHOW_OPEN, state.phase);
+    TEST_ASSERT_EQUAL_UINT16(2, state.seq);
+
+    TEST_ASSERT_TRUE(bss_show_try_lock(&show, 8));
+}
+
+void test_seq_wraps()
+{
+    show.word.store(bss_show_pack(BSS_SHOW_OPEN, 0, 0xFFFF));
+
+    bss_show_try_lock(&show, 1);
+    TEST_ASSERT_EQUAL_UINT16(0, bss_show_read(&show).seq);
+    TEST_ASSERT_EQUAL_UINT8(1, bss_show_read(&show).winner);
+}
+
+void test_verdict_of_a_locked_show()
+{
+    TEST_ASSERT_FALSE(bss_show_judge(&show, BSS_SHOW_RIGHT));
+
+    bss_show_try_lock(&show, 7);
+    TEST_ASSERT_TRUE(bss_show_judge(&show, BSS_SHOW_WRONG));
+    TEST_ASSERT_FALSE(bss_show_judge(&show, BSS_SHOW_WRONG));
+    TEST_ASSERT_TRUE(bss_show_judge(&show, BSS_SHOW_RIGHT));
+
+    bss_show_snapshot_t state = bss_show_read(&show);
+    TEST_ASSERT_EQUAL(BSS_SHOW_RIGHT, state.phase);
+    TEST_ASSERT_EQUAL_UINT8(7, state.winner);
+    TEST_ASSERT_EQUAL_UINT16(3, state.seq);
+
+    TEST_ASSERT_FALSE(bss_show_try_lock(&show, 8));
+    TEST_ASSERT_TRUE(bss_show_reset(&show));
+    TEST_ASSERT_EQUAL(BSS_SHOW_OPEN, bss_show_read(&show).phase);
+}
+
+void test_press_decisions()
+{
+    TEST_ASSERT_EQUAL(BSS_DECISION_LOCKOUT, bss_controller_press(&show, 3));
+    TEST_ASSERT_EQUAL(BSS_DECISION_PRESS_LATE, bss_controller_press(&show, 4));
+    TEST_ASSERT_EQUAL_UINT8(3, bss_show_read(&show).winner);
+}
+
+void test_earlier_press_takes_the_lock_over()
+{
+    bss_arbiter_t arbiter = {};
+
+    TEST_ASSERT_EQUAL(BSS_DECISION_LOCKOUT, bss_controller_timed_press(&show, &arbiter, 3, 1000, 1005, window));
+    // relayed, arrives later but was pressed first
+    TEST_ASSERT_EQUAL(BSS_DECISION_LOCKOUT, bss_controller_timed_press(&show, &arbiter, 4, 990, 1030, window));
+    TEST_ASSERT_EQUAL(BSS_DECISION_PRESS_LATE, bss_controller_timed_press(&show, &arbiter, 3, 1000, 1040, window));
+    TEST_ASSERT_EQUAL(BSS_DECISION_PRESS_LATE, bss_controller_timed_press(&show, &arbiter, 5, 995, 1045, window));
+
+    bss_show_snapshot_t state = bss_show_read(&show);
+    TEST_ASSERT_EQUAL(BSS_SHOW_LOCKED, state.phase);
+    TEST_ASSERT_EQUAL_UINT8(4, state.winner);
+    TEST_ASSERT_EQUAL_UINT16(2, state.seq);
+}
+
+void test_lock_is_final_after_the_window()
+{
+    bss_arbiter_t arbiter = {};
+
+    bss_controller_timed_press(&show, &arbiter, 3, 1000, 1000, window);
+    TEST_ASSERT_EQUAL(BSS_DECISION_PRESS_LATE,
+                      bss_controller_timed_press(&show, &arbiter, 4, 999, 1001 + window, window));
+
+    // nor after the verdict
+    bss_show_judge(&show, BSS_SHOW_WRONG);
+    TEST_ASSERT_EQUAL(BSS_DECISION_PRESS_LATE, bss_controller_timed_press(&show, &arbiter, 4, 999, 1010, window));
+    TEST_ASSERT_EQUAL_UINT8(3, bss_show_read(&show).winner);
+}
+
+void test_without_relays_the_first_arrival_wins()
+{
+    bss_arbiter_t arbiter = {};
+
+    TEST_ASSERT_EQUAL(BSS_DECISION_LOCKOUT, bss_controller_timed_press(&show, &arbiter, 3, 1000, 1005, 0));
+    TEST_ASSERT_EQUAL(BSS_DECISION_PRESS_LATE, bss_controller_timed_press(&show, &arbiter, 4, 990, 1005, 0));
+    // a lock taken in direct mode stays, even if relay mode is on meanwhile
+    TEST_ASSERT_EQUAL(BSS_DECISION_PRESS_LATE, bss_controller_timed_press(&show, &arbiter, 4, 990, 1030, window));
+
+    bss_show_snapshot_t state = bss_show_read(&show);
+    TEST_ASSERT_EQUAL_UINT8(3, state.winner);
+    TEST_ASSERT_EQUAL_UINT16(1, state.seq);
+}
+
+void test_press_times_out_of_the_window_count_as_arrival()
+{
+    bss_arbiter_t arbiter = {};
+
+    bss_controller_timed_press(&show, &arbiter, 3, 5000, 5000, window);
+
+    // a clock far behind or ahead
+    TEST_ASSERT_EQUAL(BSS_DECISION_PRESS_LATE, bss_controller_timed_press(&show, &arbiter, 4, 100, 5010, window));
+    TEST_ASSERT_EQUAL(BSS_DECISION_PRESS_LATE, bss_controller_timed_press(&show, &arbiter, 4, 9000, 5010, window));
+    TEST_ASSERT_EQUAL_UINT8(3, bss_show_read(&show).winner);
+
+    uint8_t record[8];
+    bss_record_put(record, sizeof(record), 0, 3, BSS_MSG_BUZZER_PRESSED, NULL, 0);
+    TEST_ASSERT_EQUAL_UINT32(5000, bss_controller_press_time(record, 5000));
+}
+
+void test_moderator_decisions()
+{
+    TEST_ASSERT_EQUAL(BSS_DECISION_NONE, bss_controller_moderator(&show, BSS_BUTTON_RIGHT, BSS_EVENT_PRESS));
+    TEST_ASSERT_EQUAL(BSS_DECISION_NONE, bss_controller_moderator(&show, BSS_BUTTON_WRONG, BSS_EVENT_PRESS));
+    TEST_ASSERT_EQUAL(BSS_DECISION_NONE, bss_controller_moderator(&show, BSS_BUTTON_RESET, BSS_EVENT_PRESS));
+
+    bss_controller_press(&show, 3);
+    TEST_ASSERT_EQUAL(BSS_DECISION_RIGHT, bss_controller_moderator(&show, BSS_BUTTON_RIGHT, BSS_EVENT_PRESS));
+    TEST_ASSERT_EQUAL(BSS_DECISION_WRONG, bss_controller_moderator(&show, BSS_BUTTON_WRONG, BSS_EVENT_PRESS));
+    TEST_ASSERT_EQUAL(BSS_DECISION_NONE, bss_controller_moderator(&show, BSS_BUTTON_WRONG, BSS_EVENT_RELEASE));
+    TEST_ASSERT_EQUAL(BSS_DECISION_RESET, bss_controller_moderator(&show, BSS_BUTTON_RESET, BSS_EVENT_PRESS));
+    TEST_ASSERT_EQUAL(BSS_SHOW_OPEN, bss_show_read(&show).phase);
+
+    TEST_ASSERT_EQUAL(BSS_DECISION_PAIRING_TOGGLE, bss_controller_moderator(&show, BSS_BUTTON_RIGHT, BSS_EVENT_HOLD));
+}
+
+#ifndef ARDUINO
+void test_exactly_one_concurrent_press_wins()
+{
+    for (int round = 0; round < 1000; round++)
+    {
+        std::atomic<int> winners(0);
+        std::thread a([&winners]()
+                      { winners += bss_show_try_lock(&show, 1); });
+        std::thread b([&winners]()
+                      { winners += bss_show_try_lock(&show, 2); });
+
+        a.join();
+        b.join();
+
+        TEST_ASSERT_EQUAL(1, winners.load());
+        bss_show_reset(&show);
+    }
+}
+#endif
+
+int run_tests()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_first_press_wins);
+    RUN_TEST(test_reset_opens_the_show);
+    RUN_TEST(test_seq_wraps);
+    RUN_TEST(test_verdict_of_a_locked_show);
+    RUN_TEST(test_press_decisions);
+    RUN_TEST(test_earlier_press_takes_the_lock_over);
+    RUN_TEST(test_lock_is_final_after_the_window);
+    RUN_TEST(test_without_relays_the_first_arrival_wins);
+    RUN_TEST(test_press_times_out_of_the_window_count_as_arrival);
+    RUN_TEST(test_moderator_decisions);
+#ifndef ARDUINO
+    RUN_TEST(test_exactly_one_concurrent_press_wins);
+#endif
+    return UNITY_END();
+}
+
+#ifdef ARDUINO
+#include <Arduino.h>
+
+void setup()
+{
+    delay(2000);
+    run_tests();
+}
+
+void loop() {}
+#else
+int main()
+{
+    return run_tests();
+}
+#endif
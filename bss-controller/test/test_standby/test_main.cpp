@@ -0,0 +1,214 @@
+/*
+  Copyright © 2024 Leonard Sebastian Schwennesen. All rights reserved.
+*/
+
+#include <unity.h>
+#include <string.h>
+#include "bss_shared.h"
+#include "bss_frame.h"
+#include "bss_standby.h"
+
+static bss_registry_t primary;
+static bss_registry_t standby;
+
+static const uint8_t mac_a[6] = {0x10, 0, 0, 0, 0, 0x01};
+static const uint8_t mac_b[6] = {0x10, 0, 0, 0, 0, 0x02};
+static const uint8_t standby_mac[6] = {0x10, 0, 0, 0, 0, 0xFE};
+static const uint8_t key_a[BSS_AUTH_KEY_SIZE] = {0xA1, 0xA2};
+static const uint8_t key_b[BSS_AUTH_KEY_SIZE] = {0xB1, 0xB2};
+// session key of the standby, protects the mirror
+static const uint8_t uplink_key[BSS_AUTH_KEY_SIZE] = {0x5E};
+
+void setUp()
+{
+    bss_registry_init(&primary);
+    bss_registry_init(&standby);
+}
+
+void tearDown() {}
+
+void test_mirror_state_round_trip()
+{
+    uint8_t frame[BSS_FRAME_MAX_SIZE];
+    bss_config_t config;
+    bss_config_t mirrored;
+    bss_show_t show;
+    uint32_t counter = 0;
+
+    bss_config_default(&config);
+    config.version = 3;
+    config.ping_ms = 750;
+    bss_config_default(&mirrored);
+    bss_show_init(&show);
+
+    size_t len = bss_mirror_put_state(frame, sizeof(frame), 0, 9000, {BSS_SHOW_LOCKED, 4, 77}, &config);
+    TEST_ASSERT_TRUE(len > 0);
+
+    TEST_ASSERT_TRUE(bss_mirror_apply_state(frame, &counter, &show, &mirrored));
+    TEST_ASSERT_EQUAL_UINT32(9000, counter);
+    TEST_ASSERT_EQUAL_UINT16(3, mirrored.version);
+    TEST_ASSERT_EQUAL_UINT16(750, mirrored.ping_ms);
+
+    bss_show_snapshot_t state = bss_show_read(&show);
+    TEST_ASSERT_EQUAL(BSS_SHOW_LOCKED, state.phase);
+    TEST_ASSERT_EQUAL_UINT8(4, state.winner);
+    TEST_ASSERT_EQUAL_UINT16(77, state.seq);
+
+    // a late mirror never lowers the counter
+    bss_mirror_put_state(frame, sizeof(frame), 0, 8000, {BSS_SHOW_OPEN, 0, 76}, &config);
+    bss_mirror_apply_state(frame, &counter, &show, &mirrored);
+    TEST_ASSERT_EQUAL_UINT32(9000, counter);
+}
+
+void test_mirror_client_hides_the_key()
+{
+    uint8_t frame[BSS_FRAME_MAX_SIZE];
+    int slot = bss_registry_add(&primary, 1, mac_a, key_a, 0);
+
+    size_t len = bss_mirror_put_client(frame, sizeof(frame), 0, &primary, slot, uplink_key, 1);
+    TEST_ASSERT_EQUAL(BSS_MIRROR_CLIENT_SIZE + 3, len);
+
+    // nowhere in the record in the clear
+    for (size_t i = 0; i + BSS_AUTH_KEY_SIZE <= len; i++)
+        TEST_ASSERT_NOT_EQUAL(0, memcmp(&frame[i], key_a, BSS_AUTH_KEY_SIZE));
+
+    // and the wrong key gives a wrong session key
+    const uint8_t guessed_key[BSS_AUTH_KEY_SIZE] = {0};
+    bss_client client;
+
+    TEST_ASSERT_TRUE(bss_mirror_apply_client(&standby, frame, guessed_key));
+    TEST_ASSERT_TRUE(bss_registry_get(&standby, slot, &client));
+    TEST_ASSERT_NOT_EQUAL(0, memcmp(key_a, client.key, BSS_AUTH_KEY_SIZE));
+}
+
+void test_mirror_client_round_trip()
+{
+    uint8_t frame[BSS_FRAME_MAX_SIZE];
+    bss_client client;
+
+    bss_registry_add(&primary, 1, mac_a, key_a, 0);
+    int slot = bss_registry_add(&primary, 2, mac_b, key_b, 0);
+    bss_registry_accept_counter(&primary, slot, 300);
+
+    bss_mirror_put_client(frame, sizeof(frame), 0, &primary, slot, uplink_key, 2);
+    TEST_ASSERT_TRUE(bss_mirror_apply_client(&standby, frame, uplink_key));
+
+    // same slot, same key, same replay protection
+    TEST_ASSERT_EQUAL(slot, bss_registry_find(&standby, 2, mac_b, &client));
+    TEST_ASSERT_EQUAL_MEMORY(key_b, client.key, BSS_AUTH_KEY_SIZE);
+    TEST_ASSERT_FALSE(bss_registry_accept_counter(&standby, slot, 300));
+    TEST_ASSERT_TRUE(bss_registry_accept_counter(&standby, slot, 301));
+
+    // persisted on the standby as well
+    TEST_ASSERT_EQUAL(slot, bss_registry_take_dirty(&standby));
+
+    bss_registry_remove(&primary, 2, mac_b);
+    bss_mirror_put_client(frame, sizeof(frame), 0, &primary, slot, uplink_key, 3);
+    TEST_ASSERT_TRUE(bss_mirror_apply_client(&standby, frame, uplink_key));
+    TEST_ASSERT_EQUAL(BSS_REGISTRY_NO_SLOT, bss_registry_find(&standby, 2, mac_b));
+}
+
+void test_mirror_never_adds_the_standby()
+{
+    uint8_t frame[BSS_FRAME_MAX_SIZE];
+    int slot = bss_registry_add(&primary, BSS_STANDBY_ID, standby_mac, uplink_key, 0, BSS_CLIENT_STANDBY);
+
+    // left over from before
+    bss_registry_add(&standby, 1, mac_a, key_a, 0);
+
+    bss_mirror_put_client(frame, sizeof(frame), 0, &primary, slot, uplink_key, 4);
+    TEST_ASSERT_TRUE(bss_mirror_apply_client(&standby, frame, uplink_key));
+    TEST_ASSERT_EQUAL_UINT8(0, bss_registry_count(&standby));
+}
+
+void test_takeover_addresses_every_client()
+{
+    uint8_t frame[BSS_FRAME_MAX_SIZE];
+    int next_slot = 0;
+
+    bss_registry_add(&standby, 1, mac_a, key_a, 0);
+    bss_registry_add(&standby, BSS_STANDBY_ID, standby_mac, uplink_key, 0, BSS_CLIENT_STANDBY);
+    bss_registry_add(&standby, 2, mac_b, key_b, 0);
+
+    size_t len = bss_standby_build_takeover(&standby, frame, sizeof(frame), standby_mac, 5000, &next_slot);
+    TEST_ASSERT_EQUAL(BSS_REGISTRY_MAX_CLIENTS, next_slot);
+
+    TEST_ASSERT_NULL(bss_frame_find(frame, len, BSS_STANDBY_ID));
+
+    for (uint8_t id = 1; id <= 2; id++)
+    {
+        uint8_t tag[4];
+        const uint8_t *record = bss_frame_find(frame, len, id);
+
+        TEST_ASSERT_NOT_NULL(record);
+        TEST_ASSERT_EQUAL_UINT8(BSS_MSG_TAKEOVER, bss_record_type(record));
+        TEST_ASSERT_EQUAL_UINT32(5000, bss_get_u32(bss_record_payload(record)));
+
+        bss_takeover_tag(tag, id == 1 ? key_a : key_b, standby_mac, 5000);
+        TEST_ASSERT_EQUAL_MEMORY(tag, &bss_record_payload(record)[4], sizeof(tag));
+    }
+}
+
+void test_takeover_stops_the_old_primary()
+{
+    uint8_t frame[BSS_FRAME_MAX_SIZE];
+    const uint8_t group_key[BSS_AUTH_KEY_SIZE] = {0x61};
+    const uint8_t other_key[BSS_AUTH_KEY_SIZE] = {0x62};
+    int next_slot = 0;
+
+    // both hold the same clients
+    bss_registry_add(&primary, 1, mac_a, key_a, 0);
+    bss_registry_add(&primary, 2, mac_b, key_b, 0);
+    bss_registry_add(&standby, 2, mac_b, key_b, 0);
+
+    size_t len = bss_standby_build_takeover(&standby, frame, sizeof(frame), standby_mac, 5000, &next_slot);
+    len = bss_auth_seal(frame, len, sizeof(frame), standby_mac, BSS_AUTH_KEY_GROUP, group_key, 5001);
+
+    TEST_ASSERT_TRUE(bss_standby_taken_over(&primary, group_key, 4999, standby_mac, frame, len));
+
+    // not below our own counter, not without the group key or a client key
+    TEST_ASSERT_FALSE(bss_standby_taken_over(&primary, group_key, 5000, standby_mac, frame, len));
+    TEST_ASSERT_FALSE(bss_standby_taken_over(&primary, other_key, 4999, standby_mac, frame, len));
+
+    bss_registry_remove(&primary, 2, mac_b);
+    TEST_ASSERT_FALSE(bss_standby_taken_over(&primary, group_key, 4999, standby_mac, frame, len));
+}
+
+void test_silence_is_bounded_by_the_ping_period()
+{
+    TEST_ASSERT_FALSE(bss_standby_silent(1000, 1000 + BSS_STANDBY_SILENT_PERIODS * 500, 500));
+    TEST_ASSERT_TRUE(bss_standby_silent(1000, 1001 + BSS_STANDBY_SILENT_PERIODS * 500, 500));
+
+    // across the wrap of millis()
+    TEST_ASSERT_FALSE(bss_standby_silent(UINT32_MAX - 100, 200, 500));
+}
+
+int run_tests()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_mirror_state_round_trip);
+    RUN_TEST(test_mirror_client_hides_the_key);
+    RUN_TEST(test_mirror_client_round_trip);
+    RUN_TEST(test_mirror_never_adds_the_standby);
+    RUN_TEST(test_takeover_addresses_every_client);
+    RUN_TEST(test_takeover_stops_the_old_primary);
+    RUN_TEST(test_silence_is_bounded_by_the_ping_period);
+    return UNITY_END();
+}
+
+#ifdef ARDUINO
+#include <Arduino.h>
+
+void setup()
+{
+    delay(2000);
+    run_tests();
+}
+
+void loop() {}
+#else
+int main()
+{
+    return run_tests();
+}
+#endif
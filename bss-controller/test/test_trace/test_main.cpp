@@ -0,0 +1,138 @@
+/*
+  Copyright © 2024 Leonard Sebastian Schwennesen. All rights reserved.
+*/
+
+#define BSS_TRACE
+
+#include <unity.h>
+#include <string.h>
+#include "bss_trace.h"
+
+#ifndef ARDUINO
+#include <thread>
+#endif
+
+void setUp()
+{
+    bss_trace_reset();
+}
+
+void tearDown() {}
+
+void test_min_avg_max()
+{
+    bss_trace_stat_t stat;
+
+    TEST_ASSERT_FALSE(bss_trace_get(0, BSS_TRACE_SEND, &stat));
+
+    bss_trace_record(BSS_TRACE_SEND, 300);
+    bss_trace_record(BSS_TRACE_SEND, 100);
+    bss_trace_record(BSS_TRACE_SEND, 200);
+
+    uint8_t core;
+    for (core = 0; core < BSS_TRACE_CORES; core++)
+    {
+        if (bss_trace_get(core, BSS_TRACE_SEND, &stat))
+            break;
+    }
+
+    TEST_ASSERT_TRUE(core < BSS_TRACE_CORES);
+    TEST_ASSERT_EQUAL_UINT32(3, stat.count);
+    TEST_ASSERT_EQUAL_UINT32(100, stat.min);
+    TEST_ASSERT_EQUAL_UINT32(300, stat.max);
+    TEST_ASSERT_EQUAL_UINT32(600, (uint32_t)stat.sum);
+    TEST_ASSERT_FALSE(bss_trace_get(core, BSS_TRACE_SEAL, &stat));
+}
+
+void test_macros_measure_the_stage()
+{
+    bss_trace_stat_t stat = {0, 0, 0, 0};
+    volatile uint32_t sink = 0;
+
+    for (int i = 0; i < 10; i++)
+    {
+        BSS_TRACE_BEGIN(BSS_TRACE_LOOKUP);
+        for (uint32_t j = 0; j < 1000; j++)
+            sink = sink + j;
+        BSS_TRACE_END(BSS_TRACE_LOOKUP);
+    }
+
+    for (uint8_t core = 0; core < BSS_TRACE_CORES && stat.count == 0; core++)
+        bss_trace_get(core, BSS_TRACE_LOOKUP, &stat);
+
+    TEST_ASSERT_EQUAL_UINT32(10, stat.count);
+    TEST_ASSERT_TRUE(stat.max > 0);
+    TEST_ASSERT_TRUE(stat.min <= stat.max);
+}
+
+static void collect(const char *line, void *context)
+{
+    strncat((char *)context, line, 255 - strlen((char *)context));
+    strncat((char *)context, "\n", 255 - strlen((char *)context));
+}
+
+void test_summary()
+{
+    char out[256] = "";
+
+    bss_trace_summary(collect, out);
+    TEST_ASSERT_EQUAL_STRING("", out);
+
+    bss_trace_record(BSS_TRACE_LED_SHOW, 2 * bss_trace_cycles_per_us());
+    bss_trace_record(BSS_TRACE_LED_SHOW, 4 * bss_trace_cycles_per_us());
+
+    bss_trace_summary(collect, out);
+    TEST_ASSERT_NOT_NULL(strstr(out, " led_show n=2 min=2.00 avg=3.00 max=4.00\n"));
+}
+
+#ifndef ARDUINO
+void test_threads_record_to_their_own_core()
+{
+    bss_trace_stat_t stat;
+    uint32_t total = 0;
+    std::thread a([]()
+                  { for (int i = 0; i < 1000; i++) bss_trace_record(BSS_TRACE_DECISION, 1); });
+    std::thread b([]()
+                  { for (int i = 0; i < 1000; i++) bss_trace_record(BSS_TRACE_DECISION, 1); });
+
+    a.join();
+    b.join();
+
+    for (uint8_t core = 0; core < BSS_TRACE_CORES; core++)
+    {
+        if (bss_trace_get(core, BSS_TRACE_DECISION, &stat))
+            total += stat.count;
+    }
+
+    TEST_ASSERT_EQUAL_UINT32(2000, total);
+}
+#endif
+
+int run_tests()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_min_avg_max);
+    RUN_TEST(test_macros_measure_the_stage);
+    RUN_TEST(test_summary);
+#ifndef ARDUINO
+    RUN_TEST(test_threads_record_to_their_own_core);
+#endif
+    return UNITY_END();
+}
+
+#ifdef ARDUINO
+#include <Arduino.h>
+
+void setup()
+{
+    delay(2000);
+    run_tests();
+}
+
+void loop() {}
+#else
+int main()
+{
+    return run_tests();
+}
+#endif
@@ -0,0 +1,259 @@
+/*
+  Copyright © 2024 Leonard Sebastian Schwennesen. All rights reserved.
+*/
+
+#include <unity.h>
+#include <string.h>
+#include "bss_shared.h"
+#include "bss_frame.h"
+#include "bss_auth.h"
+#include "bss_txq.h"
+
+static bss_txq_t txq;
+
+static const uint8_t mac_a[] = {0x24, 0x6F, 0x28, 0x01, 0x02, 0x03};
+static const uint8_t mac_b[] = {0x24, 0x6F, 0x28, 0x01, 0x02, 0x04};
+static const uint8_t key[BSS_AUTH_KEY_SIZE] = {1};
+
+// the radio: first byte of every frame handed to it, and the counter the
+// frame was sealed with
+#define RADIO_MAX 64
+
+static uint8_t radio_first[RADIO_MAX];
+static uint32_t radio_counter[RADIO_MAX];
+static int radio_count;
+static uint32_t counter;
+// pushed from within the next seal, like a press that preempts the sender
+static int push_while_sealing;
+
+static bool push(uint8_t first, const uint8_t *mac, uint8_t priority, uint16_t supersede = BSS_TXQ_KEEP);
+
+static bool radio_send(const uint8_t *, const uint8_t *data, size_t)
+{
+    radio_first[radio_count] = data[0];
+    radio_counter[radio_count] = bss_get_u32(&data[1]);
+    radio_count++;
+    return true;
+}
+
+// stands in for the authentication trailer: the counter right behind the
+// first byte
+static size_t seal(uint8_t *buf, size_t len, uint8_t, const uint8_t *)
+{
+    if (push_while_sealing >= 0)
+    {
+        uint8_t first = push_while_sealing;
+
+        push_while_sealing = -1;
+        push(first, mac_b, BSS_TX_URGENT);
+    }
+
+    bss_put_u32(&buf[1], counter++);
+    return len + 4;
+}
+
+void setUp()
+{
+    bss_txq_init(&txq, radio_send, seal);
+    radio_count = 0;
+    counter = 1;
+    push_while_sealing = -1;
+}
+
+void tearDown() {}
+
+static bool push(uint8_t first, const uint8_t *mac, uint8_t priority, uint16_t supersede)
+{
+    bss_pool_buffer_t *buffer = bss_txq_acquire(&txq, priority);
+
+    if (buffer == NULL)
+        return false;
+
+    buffer->data[0] = first;
+    buffer->len = 1;
+    bss_txq_push(&txq, buffer, mac, priority, supersede, BSS_AUTH_KEY_GROUP, key);
+    return true;
+}
+
+// the send callback of the firmware and the task it wakes
+static void complete()
+{
+    if (bss_txq_sent(&txq))
+        bss_txq_pump(&txq);
+}
+
+void test_window_paces_the_radio()
+{
+    for (uint8_t i = 0; i < 5; i++)
+        push(i, mac_a, BSS_TX_NORMAL);
+
+    TEST_ASSERT_EQUAL(BSS_TXQ_WINDOW, radio_count);
+
+    bss_txq_stats_t stats;
+    bss_txq_get_stats(&txq, &stats);
+    TEST_ASSERT_EQUAL(5 - BSS_TXQ_WINDOW, stats.depth);
+    TEST_ASSERT_EQUAL(BSS_TXQ_WINDOW, stats.in_flight);
+
+    // the callback itself sends nothing
+    TEST_ASSERT_TRUE(bss_txq_sent(&txq));
+    TEST_ASSERT_EQUAL(BSS_TXQ_WINDOW, radio_count);
+    bss_txq_pump(&txq);
+    TEST_ASSERT_EQUAL(BSS_TXQ_WINDOW + 1, radio_count);
+
+    while (radio_count < 5)
+        complete();
+
+    for (uint8_t i = 0; i < 5; i++)
+        TEST_ASSERT_EQUAL_UINT8(i, radio_first[i]);
+}
+
+void test_urgent_frames_overtake()
+{
+    // fill the window
+    push(0, mac_a, BSS_TX_BACKGROUND);
+    push(1, mac_a, BSS_TX_BACKGROUND);
+
+    push(2, mac_a, BSS_TX_BACKGROUND);
+    push(3, mac_a, BSS_TX_NORMAL);
+    push(4, mac_a, BSS_TX_URGENT);
+
+    while (radio_count < 5)
+        complete();
+
+    TEST_ASSERT_EQUAL_UINT8(4, radio_first[2]);
+    TEST_ASSERT_EQUAL_UINT8(3, radio_first[3]);
+    TEST_ASSERT_EQUAL_UINT8(2, radio_first[4]);
+}
+
+void test_counters_rise_in_air_order()
+{
+    push(0, mac_a, BSS_TX_BACKGROUND);
+    push(1, mac_a, BSS_TX_BACKGROUND);
+    push(2, mac_a, BSS_TX_BACKGROUND);
+    push(3, mac_a, BSS_TX_URGENT);
+
+    while (radio_count < 4)
+        complete();
+
+    for (int i = 1; i < radio_count; i++)
+        TEST_ASSERT_TRUE(radio_counter[i] > radio_counter[i - 1]);
+}
+
+void test_latest_state_wins()
+{
+    push(0, mac_a, BSS_TX_NORMAL);
+    push(1, mac_a, BSS_TX_NORMAL);
+
+    // wrong, then reset before the wrong went out
+    push(10, mac_a, BSS_TX_URGENT, BSS_TXQ_KEY(BSS_MSG_SET_NEOPIXEL_COLOR, 0));
+    push(2, mac_a, BSS_TX_URGENT);
+    push(11, mac_a, BSS_TX_URGENT, BSS_TXQ_KEY(BSS_MSG_SET_NEOPIXEL_COLOR, 0));
+    // another chunk and another destination are no state of the same kind
+    push(12, mac_a, BSS_TX_URGENT, BSS_TXQ_KEY(BSS_MSG_SET_NEOPIXEL_COLOR, 1));
+    push(13, mac_b, BSS_TX_URGENT, BSS_TXQ_KEY(BSS_MSG_SET_NEOPIXEL_COLOR, 0));
+
+    for (int i = 0; i < 10; i++)
+        complete();
+
+    TEST_ASSERT_EQUAL(6, radio_count);
+    // at the place of the superseded frame
+    TEST_ASSERT_EQUAL_UINT8(11, radio_first[2]);
+    TEST_ASSERT_EQUAL_UINT8(2, radio_first[3]);
+    TEST_ASSERT_EQUAL_UINT8(12, radio_first[4]);
+    TEST_ASSERT_EQUAL_UINT8(13, radio_first[5]);
+
+    bss_txq_stats_t stats;
+    bss_txq_get_stats(&txq, &stats);
+    TEST_ASSERT_EQUAL(1, stats.superseded);
+    TEST_ASSERT_EQUAL(6, stats.sent);
+    TEST_ASSERT_EQUAL(0, stats.depth);
+    TEST_ASSERT_EQUAL(4, stats.max_depth);
+}
+
+void test_full_queue_drops_lower_priorities()
+{
+    for (uint8_t i = 0; i < BSS_POOL_BUFFERS; i++)
+        TEST_ASSERT_TRUE(push(i, mac_a, BSS_TX_BACKGROUND));
+
+    // every buffer is in flight or pending, pings can not displace pings
+    TEST_ASSERT_FALSE(push(100, mac_a, BSS_TX_BACKGROUND));
+    TEST_ASSERT_TRUE(push(101, mac_a, BSS_TX_URGENT));
+
+    for (int i = 0; i < 2 * BSS_POOL_BUFFERS; i++)
+        complete();
+
+    TEST_ASSERT_EQUAL(BSS_POOL_BUFFERS, radio_count);
+
+    // the oldest pending ping made room for the press
+    TEST_ASSERT_EQUAL_UINT8(101, radio_first[BSS_TXQ_WINDOW]);
+    for (int i = BSS_TXQ_WINDOW + 1; i < radio_count; i++)
+        TEST_ASSERT_NOT_EQUAL(BSS_TXQ_WINDOW, radio_first[i]);
+
+    bss_txq_stats_t stats;
+    bss_txq_get_stats(&txq, &stats);
+    TEST_ASSERT_EQUAL(2, stats.dropped);
+}
+
+void test_sealed_frames_go_out_unchanged()
+{
+    bss_pool_buffer_t *buffer = bss_txq_acquire(&txq, BSS_TX_URGENT);
+
+    buffer->data[0] = 7;
+    bss_put_u32(&buffer->data[1], 900);
+    buffer->len = 5;
+    bss_txq_push(&txq, buffer, mac_b, BSS_TX_URGENT, BSS_TXQ_KEEP, BSS_TXQ_SEALED, NULL);
+    push(8, mac_a, BSS_TX_URGENT);
+
+    TEST_ASSERT_EQUAL(2, radio_count);
+    TEST_ASSERT_EQUAL_UINT8(7, radio_first[0]);
+    TEST_ASSERT_EQUAL_UINT32(900, radio_counter[0]);
+    // the own counter is not used up by it
+    TEST_ASSERT_EQUAL_UINT32(1, radio_counter[1]);
+}
+
+void test_push_while_sending_leaves_the_frame_to_the_sender()
+{
+    push_while_sealing = 9;
+    push(0, mac_a, BSS_TX_BACKGROUND);
+
+    // sent by the caller that was sealing, right behind its own frame
+    TEST_ASSERT_EQUAL(2, radio_count);
+    TEST_ASSERT_EQUAL_UINT8(0, radio_first[0]);
+    TEST_ASSERT_EQUAL_UINT8(9, radio_first[1]);
+    TEST_ASSERT_TRUE(radio_counter[1] > radio_counter[0]);
+
+    bss_txq_stats_t stats;
+    bss_txq_get_stats(&txq, &stats);
+    TEST_ASSERT_EQUAL(2, stats.sent);
+    TEST_ASSERT_EQUAL(0, stats.depth);
+}
+
+int run_tests()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_window_paces_the_radio);
+    RUN_TEST(test_urgent_frames_overtake);
+    RUN_TEST(test_counters_rise_in_air_order);
+    RUN_TEST(test_latest_state_wins);
+    RUN_TEST(test_full_queue_drops_lower_priorities);
+    RUN_TEST(test_sealed_frames_go_out_unchanged);
+    RUN_TEST(test_push_while_sending_leaves_the_frame_to_the_sender);
+    return UNITY_END();
+}
+
+#ifdef ARDUINO
+#include <Arduino.h>
+
+void setup()
+{
+    delay(2000);
+    run_tests();
+}
+
+void loop() {}
+#else
+int main()
+{
+    return run_tests();
+}
+#endif
@@ -0,0 +1,525 @@
+/*
+  Copyright © 2024 Leonard Sebastian Schwennesen. All rights reserved.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <random>
+#include <vector>
+
+#include "bss_shared.h"
+#include "bss_frame.h"
+#include "bss_auth.h"
+#include "bss_buzzer.h"
+#include "bss_heartbeat.h"
+#include "bss_standby.h"
+
+// Runs a primary, a hot standby and a fleet of buzzers on a virtual
+// millisecond clock over a lossy radio, stops the primary and measures how
+// long the standby needs to notice and how long until every buzzer follows
+// it. Then the primary comes back, long after the takeover, and has to give
+// way. The controllers send the same frames as the firmware; the buzzers run
+// the firmware's bss_buzzer code.
+//
+//   failover [clients] [loss percent] [runs]
+
+#define PING_MS 500
+#define KILL_MS (60 * PING_MS)
+#define RETURN_MS (KILL_MS + 10 * PING_MS)
+#define END_MS (RETURN_MS + 10 * PING_MS)
+// the firmware checks for silence this often
+#define STANDBY_TICK_MS 10
+
+enum
+{
+    PRIMARY,
+    STANDBY,
+    FIRST_BUZZER,
+};
+
+typedef struct
+{
+    uint32_t at;
+    int from;
+    // -1 for broadcast
+    int to;
+    std::vector<uint8_t> data;
+} packet_t;
+
+typedef struct
+{
+    uint8_t mac[6];
+    bool alive;
+    bool standby;
+    bss_registry_t registry;
+    uint8_t group_key[BSS_AUTH_KEY_SIZE];
+    uint32_t counter;
+    bss_show_t show;
+    bss_config_t config;
+    uint32_t next_heartbeat;
+    int mirror_cursor;
+    uint32_t takeover_counter;
+    uint8_t takeover_repeats;
+    // the standby's view of the primary
+    bss_buzzer_t uplink;
+    uint32_t primary_heard;
+    uint32_t primary_counter;
+    // the new primary's view of the old one
+    uint32_t rival_counter;
+} controller_t;
+
+typedef struct
+{
+    unsigned long count;
+    double sum;
+    double min;
+    double max;
+} stat_t;
+
+static controller_t controllers[2];
+static std::vector<bss_buzzer_t> buzzers;
+static std::vector<uint8_t> buzzer_ids;
+static std::vector<long> switched_at;
+static std::vector<packet_t> air;
+static std::mt19937 rng;
+static int loss_percent;
+static uint32_t now;
+static long demoted_at;
+
+static void stat_add(stat_t *stat, double value)
+{
+    if (stat->count == 0 || value < stat->min)
+        stat->min = value;
+    if (stat->count == 0 || value > stat->max)
+        stat->max = value;
+
+    stat->sum += value;
+    stat->count++;
+}
+
+static void stat_print(const char *name, const stat_t *stat, const char *unit)
+{
+    if (stat->count == 0)
+        printf("%-28s -\n", name);
+    else
+        printf("%-28s min %.1f avg %.1f max %.1f %s (%lu)\n", name, stat->min, stat->sum / stat->count, stat->max,
+               unit, stat->count);
+}
+
+static void node_mac(uint8_t *mac, int node)
+{
+    const uint8_t base[6] = {0x40, 0, 0, 0, 0, 0};
+
+    mac_copy(mac, base);
+    mac[4] = node >> 8;
+    mac[5] = node;
+}
+
+static int mac_node(const uint8_t *mac)
+{
+    return mac[4] << 8 | mac[5];
+}
+
+// Every receiver loses the frame on its own, like unacknowledged ESP-NOW
+// broadcasts.
+static void radio_send(int from, int to, uint8_t *frame, size_t len)
+{
+    int nodes = FIRST_BUZZER + (int)buzzers.size();
+
+    for (int node = 0; node < nodes; node++)
+    {
+        if (node == from || (to >= 0 && node != to) || (int)(rng() % 100) < loss_percent)
+            continue;
+
+        air.push_back({now + 1 + (uint32_t)(rng() % 3), from, node, std::vector<uint8_t>(frame, frame + len)});
+    }
+}
+
+static void controller_send(controller_t *controller, int node, int to, uint8_t *frame, size_t len, uint8_t key_id,
+                            const uint8_t *key)
+{
+    len = bss_auth_seal(frame, len, BSS_FRAME_MAX_SIZE, controller->mac, key_id, key, controller->counter++);
+
+    if (len > 0)
+        radio_send(node, to, frame, len);
+}
+
+static void send_takeover(controller_t *controller, int node)
+{
+    int next_slot = 0;
+
+    while (next_slot < BSS_REGISTRY_MAX_CLIENTS)
+    {
+        uint8_t frame[BSS_FRAME_MAX_SIZE];
+        size_t len = bss_standby_build_takeover(&controller->registry, frame, BSS_FRAME_MAX_SIZE - BSS_AUTH_TRAILER_SIZE,
+                                                controller->mac, controller->takeover_counter, &next_slot);
+
+        if (len > 0)
+            controller_send(controller, node, -1, frame, len, BSS_AUTH_KEY_GROUP, controller->group_key);
+    }
+}
+
+// find_standby of the controller
+static int find_standby(controller_t *controller, bss_client *client)
+{
+    for (int slot = 0; slot < BSS_REGISTRY_MAX_CLIENTS; slot++)
+    {
+        if (bss_registry_get(&controller->registry, slot, client) && client->role == BSS_CLIENT_STANDBY)
+            return slot;
+    }
+
+    return BSS_REGISTRY_NO_SLOT;
+}
+
+// mirror_client of the controller, for every registry change
+static void mirror_changes(controller_t *controller, int node)
+{
+    bss_client target;
+    int slot;
+
+    while ((slot = bss_registry_take_dirty(&controller->registry)) != BSS_REGISTRY_NO_SLOT)
+    {
+        uint8_t frame[BSS_FRAME_MAX_SIZE];
+
+        if (find_standby(controller, &target) == BSS_REGISTRY_NO_SLOT)
+            continue;
+
+        size_t len = bss_mirror_put_client(frame, BSS_FRAME_MAX_SIZE - BSS_AUTH_TRAILER_SIZE, 0, &controller->registry,
+                                           slot, target.key, controller->counter++);
+        controller_send(controller, node, mac_node(target.mac), frame, len, BSS_AUTH_KEY_SESSION, target.key);
+    }
+}
+
+static void send_heartbeat(controller_t *controller, int node)
+{
+    uint8_t frame[BSS_FRAME_MAX_SIZE];
+    uint8_t payload[BSS_HEARTBEAT_SIZE];
+    bss_heartbeat_t heartbeat;
+    bss_show_snapshot_t state = bss_show_read(&controller->show);
+
+    memset(&heartbeat, 0, sizeof(heartbeat));
+    heartbeat.phase = state.phase;
+    heartbeat.winner = state.winner;
+    heartbeat.seq = state.seq;
+    heartbeat.time = now;
+    heartbeat.config_version = controller->config.version;
+    bss_heartbeat_encode(&heartbeat, payload);
+
+    size_t len = bss_record_put(frame, sizeof(frame), 0, BSS_FRAME_ID_ALL, BSS_MSG_HEARTBEAT, payload, sizeof(payload));
+    controller_send(controller, node, -1, frame, len, BSS_AUTH_KEY_GROUP, controller->group_key);
+
+    // the mirror, as in send_mirror of the controller
+    bss_client target;
+    bss_client client;
+    int standby_slot = find_standby(controller, &target);
+
+    if (standby_slot != BSS_REGISTRY_NO_SLOT)
+    {
+        size_t capacity = BSS_FRAME_MAX_SIZE - BSS_AUTH_TRAILER_SIZE;
+
+        len = bss_mirror_put_state(frame, capacity, 0, controller->counter, state, &controller->config);
+
+        for (int n = 0; n < BSS_REGISTRY_MAX_CLIENTS; n++)
+        {
+            int cursor = controller->mirror_cursor;
+
+            if (cursor != standby_slot && bss_registry_get(&controller->registry, cursor, &client))
+            {
+                size_t end = bss_mirror_put_client(frame, capacity, len, &controller->registry, cursor, target.key,
+                                                   controller->counter++);
+
+                if (end == len)
+                    break;
+
+                len = end;
+            }
+
+            controller->mirror_cursor = (cursor + 1) % BSS_REGISTRY_MAX_CLIENTS;
+        }
+
+        controller_send(controller, node, mac_node(target.mac), frame, len, BSS_AUTH_KEY_SESSION, target.key);
+    }
+
+    if (controller->rival_counter != 0)
+    {
+        // raise_tx_counter
+        if (controller->counter < controller->rival_counter + BSS_AUTH_COUNTER_BLOCK)
+            controller->counter = controller->rival_counter + BSS_AUTH_COUNTER_BLOCK;
+
+        controller->takeover_counter = controller->counter;
+        controller->rival_counter = 0;
+        send_takeover(controller, node);
+    }
+    else if (controller->takeover_repeats > 0)
+    {
+        controller->takeover_repeats--;
+        send_takeover(controller, node);
+    }
+}
+
+// take_over of the controller
+static void take_over(controller_t *controller, int node)
+{
+    memcpy(controller->group_key, controller->uplink.group_key, BSS_AUTH_KEY_SIZE);
+
+    uint32_t counter = controller->uplink.controller_counter > controller->primary_counter
+                           ? controller->uplink.controller_counter
+                           : controller->primary_counter;
+
+    controller->counter = counter + BSS_AUTH_COUNTER_BLOCK;
+    controller->takeover_counter = controller->counter;
+    controller->takeover_repeats = BSS_STANDBY_SILENT_PERIODS;
+    controller->standby = false;
+
+    send_takeover(controller, node);
+    controller->next_heartbeat = now + controller->config.ping_ms;
+}
+
+static void standby_recv(controller_t *controller, const uint8_t *mac, const uint8_t *data, int len)
+{
+    bss_auth_trailer_t trailer;
+    const uint8_t *record = bss_buzzer_open_frame(&controller->uplink, controller->mac, BSS_STANDBY_ID, mac, data, len);
+
+    if (record == NULL || !bss_auth_parse(data, len, &trailer))
+        return;
+
+    for (; record != NULL; record = bss_frame_next(data, trailer.body_len, record, BSS_STANDBY_ID))
+    {
+        if (bss_record_type(record) == BSS_MSG_MIRROR_STATE)
+            bss_mirror_apply_state(record, &controller->primary_counter, &controller->show, &controller->config);
+        else if (bss_record_type(record) == BSS_MSG_MIRROR_CLIENT)
+            bss_mirror_apply_client(&controller->registry, record, controller->uplink.session_key);
+        else
+            bss_buzzer_handle_record(&controller->uplink, mac, record);
+    }
+
+    controller->primary_heard = now;
+}
+
+// on_data_recv of a primary
+static void primary_recv(controller_t *controller, const uint8_t *mac, const uint8_t *data, int len)
+{
+    bss_auth_trailer_t trailer;
+
+    if (bss_standby_taken_over(&controller->registry, controller->group_key, controller->counter, mac, data, len))
+    {
+        // set_role(true), a restart as standby without a pairing
+        controller->standby = true;
+        demoted_at = now;
+        return;
+    }
+
+    // rival_recv
+    if (controller->uplink.pairing_state == PAIRED && mac_equal(mac, controller->uplink.controller_mac) &&
+        bss_auth_parse(data, len, &trailer) && trailer.key_id == BSS_AUTH_KEY_GROUP &&
+        bss_auth_verify(data, len, mac, controller->group_key) && trailer.counter > controller->rival_counter)
+        controller->rival_counter = trailer.counter;
+}
+
+static void deliver(const packet_t *packet)
+{
+    uint8_t mac[6];
+
+    node_mac(mac, packet->from);
+
+    if (packet->to < FIRST_BUZZER)
+    {
+        controller_t *controller = &controllers[packet->to];
+
+        if (controller->alive && controller->standby)
+            standby_recv(controller, mac, packet->data.data(), packet->data.size());
+        else if (controller->alive)
+            primary_recv(controller, mac, packet->data.data(), packet->data.size());
+        return;
+    }
+
+    int i = packet->to - FIRST_BUZZER;
+    uint8_t my_mac[6];
+
+    node_mac(my_mac, packet->to);
+
+    const uint8_t *record =
+        bss_buzzer_open_frame(&buzzers[i], my_mac, buzzer_ids[i], mac, packet->data.data(), packet->data.size());
+
+    if (record != NULL && bss_buzzer_handle_record(&buzzers[i], mac, record) == BSS_BUZZER_TAKEOVER)
+        switched_at[i] = now;
+}
+
+static void setup(int clients, unsigned seed)
+{
+    uint8_t uplink_key[BSS_AUTH_KEY_SIZE];
+
+    rng.seed(seed);
+    air.clear();
+    buzzers.assign(clients, bss_buzzer_t());
+    buzzer_ids.assign(clients, 0);
+    switched_at.assign(clients, -1);
+
+    for (int c = 0; c < 2; c++)
+    {
+        controller_t *controller = &controllers[c];
+
+        node_mac(controller->mac, c);
+        controller->alive = true;
+        controller->standby = c == STANDBY;
+        bss_registry_init(&controller->registry);
+        bss_show_init(&controller->show);
+        bss_config_default(&controller->config);
+        controller->config.ping_ms = PING_MS;
+        controller->counter = 1;
+        controller->next_heartbeat = PING_MS;
+        controller->mirror_cursor = 0;
+        controller->takeover_repeats = 0;
+        controller->primary_heard = 0;
+        controller->primary_counter = 0;
+        controller->rival_counter = 0;
+        bss_buzzer_init(&controller->uplink);
+    }
+
+    controller_t *primary = &controllers[PRIMARY];
+    controller_t *standby = &controllers[STANDBY];
+
+    for (int i = 0; i < BSS_AUTH_KEY_SIZE; i++)
+    {
+        primary->group_key[i] = rng();
+        standby->group_key[i] = rng();
+        uplink_key[i] = rng();
+    }
+
+    // as if the standby had paired with the primary
+    bss_registry_add(&primary->registry, BSS_STANDBY_ID, standby->mac, uplink_key, 0, BSS_CLIENT_STANDBY);
+    standby->uplink.pairing_state = PAIRED;
+    mac_copy(standby->uplink.controller_mac, primary->mac);
+    memcpy(standby->uplink.session_key, uplink_key, BSS_AUTH_KEY_SIZE);
+    memcpy(standby->uplink.group_key, primary->group_key, BSS_AUTH_KEY_SIZE);
+
+    for (int i = 0; i < clients; i++)
+    {
+        bss_buzzer_t *buzzer = &buzzers[i];
+        uint8_t mac[6];
+
+        bss_buzzer_init(buzzer);
+        buzzer_ids[i] = i + 1;
+        node_mac(mac, FIRST_BUZZER + i);
+
+        for (int k = 0; k < BSS_AUTH_KEY_SIZE; k++)
+            buzzer->session_key[k] = rng();
+
+        buzzer->pairing_state = PAIRED;
+        mac_copy(buzzer->controller_mac, primary->mac);
+        memcpy(buzzer->group_key, primary->group_key, BSS_AUTH_KEY_SIZE);
+
+        bss_registry_add(&primary->registry, buzzer_ids[i], mac, buzzer->session_key, 0);
+    }
+}
+
+int main(int argc, char **argv)
+{
+    int clients = argc > 1 ? atoi(argv[1]) : 32;
+    int runs = argc > 3 ? atoi(argv[3]) : 20;
+    stat_t detect = {};
+    stat_t follow = {};
+    stat_t demote = {};
+    unsigned long lost = 0;
+    unsigned long rivals = 0;
+
+    loss_percent = argc > 2 ? atoi(argv[2]) : 10;
+
+    if (clients < 1 || clients >= BSS_REGISTRY_MAX_CLIENTS || runs < 1)
+    {
+        fprintf(stderr, "usage: %s [clients < %d] [loss percent] [runs]\n", argv[0], BSS_REGISTRY_MAX_CLIENTS);
+        return 1;
+    }
+
+    for (int run = 0; run < runs; run++)
+    {
+        long detected_at = -1;
+
+        demoted_at = -1;
+        setup(clients, run + 1);
+
+        for (now = 0; now < END_MS; now++)
+        {
+            if (now == KILL_MS)
+                controllers[PRIMARY].alive = false;
+
+            // as after a restart, with the counter it reserved
+            if (now == RETURN_MS)
+            {
+                controllers[PRIMARY].alive = true;
+                controllers[PRIMARY].counter += BSS_AUTH_COUNTER_BLOCK;
+                controllers[PRIMARY].next_heartbeat = now;
+            }
+
+            for (size_t i = 0; i < air.size();)
+            {
+                if (air[i].at <= now)
+                {
+                    packet_t packet = air[i];
+
+                    air.erase(air.begin() + i);
+                    deliver(&packet);
+                }
+                else
+                    i++;
+            }
+
+            for (int c = 0; c < 2; c++)
+            {
+                controller_t *controller = &controllers[c];
+
+                if (!controller->alive)
+                    continue;
+
+                if (!controller->standby)
+                    mirror_changes(controller, c);
+
+                if (!controller->standby && now >= controller->next_heartbeat)
+                {
+                    send_heartbeat(controller, c);
+                    controller->next_heartbeat += controller->config.ping_ms;
+                }
+
+                if (controller->standby && now % STANDBY_TICK_MS == 0 && controller->primary_heard != 0 &&
+                    bss_standby_silent(controller->primary_heard, now, controller->config.ping_ms))
+                {
+                    // a takeover while the primary is alive is a false alarm
+                    detected_at = now;
+                    take_over(controller, c);
+                }
+            }
+        }
+
+        if (detected_at < KILL_MS)
+        {
+            printf("run %d: %s\n", run, detected_at < 0 ? "no takeover" : "takeover while the primary was alive");
+            continue;
+        }
+
+        stat_add(&detect, detected_at - KILL_MS);
+
+        if (demoted_at < 0)
+            rivals++;
+        else
+            stat_add(&demote, demoted_at - RETURN_MS);
+
+        for (int i = 0; i < clients; i++)
+        {
+            if (switched_at[i] < 0)
+                lost++;
+            else
+                stat_add(&follow, switched_at[i] - KILL_MS);
+        }
+    }
+
+    printf("%d clients, %d%% loss, ping %d ms, silence bound %d ms, %d runs\n", clients, loss_percent, PING_MS,
+           BSS_STANDBY_SILENT_PERIODS * PING_MS, runs);
+    stat_print("primary lost -> takeover", &detect, "ms");
+    stat_print("primary lost -> buzzer moved", &follow, "ms");
+    printf("%-28s %lu\n", "buzzers left behind", lost);
+    stat_print("primary back -> stopped", &demote, "ms");
+    printf("%-28s %lu\n", "primaries still sending", rivals);
+
+    return 0;
+}
@@ -0,0 +1,652 @@
+/*
+  Copyright © 2024 Leonard Sebastian Schwennesen. All rights reserved.
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <queue>
+#include <random>
+#include <vector>
+
+#include "bss_shared.h"
+#include "bss_frame.h"
+#include "bss_auth.h"
+#include "bss_buzzer.h"
+#include "bss_controller.h"
+#include "bss_heartbeat.h"
+#include "bss_registry.h"
+#include "bss_relay.h"
+
+// Runs a controller and a fleet of buzzers spread over a hall on a virtual
+// millisecond clock. Frames are delivered with a probability that falls with
+// the distance, unicasts are retried like ESP-NOW does until they are
+// acknowledged. Every few seconds the show is reset and some buzzers press
+// within a few milliseconds. The same venue runs once without and once with
+// relays, measuring how many presses arrive, how late, whether the first
+// presser wins and how many buzzers show the current state.
+//
+//   relay [clients] [depth m] [runs]
+
+#define PING_MS 1000
+// time for the links and the relay plan to settle
+#define WARMUP_MS (40 * PING_MS)
+#define END_MS (WARMUP_MS + 200 * ROUND_MS)
+#define ROUND_MS 3000
+// presses start this long after the reset, within PRESS_SPREAD_MS
+#define PRESS_MS 1000
+#define PRESS_SPREAD_MS 20
+#define PRESSERS 3
+// buzzers are checked for the current state this long after the presses
+#define CHECK_MS 500
+
+// The controller stands at the front of a hall of WIDTH_M, buzzers from
+// 2 m to the given depth. Half of the frames arrive at RANGE_M.
+#define WIDTH_M 30.0
+#define RANGE_M 40.0
+#define SLOPE_M 4.0
+#define UNICAST_ATTEMPTS 5
+
+#define CONTROLLER 0
+
+typedef struct
+{
+    uint32_t at;
+    uint32_t order;
+    int from;
+    int to;
+    std::vector<uint8_t> data;
+} packet_t;
+
+struct later
+{
+    bool operator()(const packet_t &a, const packet_t &b) const
+    {
+        return a.at != b.at ? a.at > b.at : a.order > b.order;
+    }
+};
+
+typedef struct
+{
+    double x;
+    double y;
+    uint8_t mac[6];
+    uint32_t counter;
+    // buzzers only
+    bss_buzzer_t buzzer;
+    uint8_t id;
+    uint32_t skew;
+    uint32_t next_ping;
+    uint32_t last_heartbeat;
+} node_t;
+
+typedef struct
+{
+    int node;
+    uint32_t at;
+    long arrived;
+} press_t;
+
+typedef struct
+{
+    unsigned long presses;
+    unsigned long arrived;
+    std::vector<uint32_t> latency;
+    unsigned long rounds;
+    unsigned long fair;
+    unsigned long checked;
+    unsigned long in_sync;
+    unsigned long dropped_out;
+    unsigned long attempts;
+    unsigned long ms;
+} result_t;
+
+static std::vector<node_t> nodes;
+static std::priority_queue<packet_t, std::vector<packet_t>, later> air;
+static uint32_t air_order;
+static std::mt19937 rng;
+static uint32_t now;
+static result_t *result;
+
+// the controller, as in its firmware
+static bool relay_mode;
+static bss_registry_t registry;
+static bss_links_t links;
+static bss_relay_plan_t plan;
+static uint8_t relay_roles[BSS_REGISTRY_MAX_CLIENTS];
+static bss_show_t show;
+static bss_arbiter_t arbiter;
+static uint8_t group_key[BSS_AUTH_KEY_SIZE];
+static uint16_t config_version;
+static int heartbeats;
+
+// presses of the current round, and those still to be made
+static std::vector<press_t> presses;
+static std::vector<press_t> pending;
+
+static void node_mac(uint8_t *mac, int node)
+{
+    const uint8_t base[6] = {0x40, 0, 0, 0, 0, 0};
+
+    mac_copy(mac, base);
+    mac[4] = node >> 8;
+    mac[5] = node;
+}
+
+static int mac_node(const uint8_t *mac)
+{
+    return mac[4] << 8 | mac[5];
+}
+
+static double delivery(int a, int b)
+{
+    double d = hypot(nodes[a].x - nodes[b].x, nodes[a].y - nodes[b].y);
+
+    return 1 / (1 + exp((d - RANGE_M) / SLOPE_M));
+}
+
+static bool chance(double p)
+{
+    return std::uniform_real_distribution<double>(0, 1)(rng) < p;
+}
+
+static void queue(uint32_t at, int from, int to, const uint8_t *frame, size_t len)
+{
+    air.push({at, air_order++, from, to, std::vector<uint8_t>(frame, frame + len)});
+}
+
+// One attempt, every receiver on its own.
+static void radio_broadcast(int from, const uint8_t *frame, size_t len)
+{
+    result->attempts++;
+
+    for (int node = 0; node < (int)nodes.size(); node++)
+    {
+        if (node != from && chance(delivery(from, node)))
+            queue(now + 1, from, node, frame, len);
+    }
+}
+
+// Retried with a growing backoff until acknowledged. A lost acknowledgement
+// makes the receiver see the frame again.
+static void radio_unicast(int from, int to, const uint8_t *frame, size_t len)
+{
+    double p = delivery(from, to);
+    uint32_t at = now;
+
+    for (int attempt = 0; attempt < UNICAST_ATTEMPTS; attempt++)
+    {
+        result->attempts++;
+        at += 1 + rng() % (2u << attempt);
+
+        if (!chance(p))
+            continue;
+
+        queue(at, from, to, frame, len);
+
+        if (chance(p))
+            return;
+    }
+}
+
+static void send_frame(int from, int to, uint8_t *frame, size_t len, uint8_t key_id, const uint8_t *key)
+{
+    len = bss_auth_seal(frame, len, BSS_FRAME_MAX_SIZE, nodes[from].mac, key_id, key, nodes[from].counter++);
+
+    if (len == 0)
+        return;
+
+    if (to < 0)
+        radio_broadcast(from, frame, len);
+    else
+        radio_unicast(from, to, frame, len);
+}
+
+static void send_show()
+{
+    bss_show_snapshot_t state = bss_show_read(&show);
+    uint8_t payload[6] = {0, 0, 0};
+    int next_slot = 0;
+
+    bss_put_u16(&payload[3], state.seq);
+    payload[5] = state.phase;
+
+    while (next_slot < BSS_REGISTRY_MAX_CLIENTS)
+    {
+        uint8_t frame[BSS_FRAME_MAX_SIZE];
+        size_t len = bss_registry_build_broadcast(&registry, frame, BSS_FRAME_MAX_SIZE - BSS_AUTH_TRAILER_SIZE,
+                                                  BSS_MSG_SET_NEOPIXEL_COLOR, payload, sizeof(payload), &next_slot);
+
+        if (len > 0)
+            send_frame(CONTROLLER, -1, frame, len, BSS_AUTH_KEY_GROUP, group_key);
+    }
+}
+
+// plan_relays of the controller
+static void plan_relays()
+{
+    if (++heartbeats % BSS_RELAY_PLAN_PERIODS != 0)
+        return;
+
+    if (relay_mode)
+        bss_relay_plan(&plan, &registry, &links, now, BSS_RELAY_ALIVE_PERIODS * PING_MS);
+    else
+        bss_relay_plan_init(&plan);
+
+    for (int slot = 0; slot < BSS_REGISTRY_MAX_CLIENTS; slot++)
+    {
+        bss_client client;
+        uint8_t payload[BSS_RELAY_ROLE_MAX_SIZE];
+        uint8_t frame[BSS_FRAME_MAX_SIZE];
+
+        if (!bss_registry_get(&registry, slot, &client))
+            continue;
+
+        size_t len = bss_relay_role(&plan, &registry, slot, payload);
+
+        if (payload[0] == 0 && relay_roles[slot] == 0)
+            continue;
+
+        relay_roles[slot] = payload[0];
+        len = bss_record_put(frame, sizeof(frame), 0, client.id, BSS_MSG_RELAY_ROLE, payload, len);
+        send_frame(CONTROLLER, mac_node(client.mac), frame, len, BSS_AUTH_KEY_SESSION, client.key);
+    }
+}
+
+static void send_heartbeat()
+{
+    uint8_t frame[BSS_FRAME_MAX_SIZE];
+    uint8_t payload[BSS_HEARTBEAT_SIZE];
+    bss_heartbeat_t heartbeat;
+    bss_show_snapshot_t state = bss_show_read(&show);
+
+    memset(&heartbeat, 0, sizeof(heartbeat));
+    heartbeat.phase = state.phase;
+    heartbeat.winner = state.winner;
+    heartbeat.seq = state.seq;
+    heartbeat.time = now;
+    heartbeat.config_version = config_version;
+    bss_registry_heard(&registry, now, BSS_HEARTBEAT_HEARD_PERIODS * PING_MS, heartbeat.heard);
+    bss_heartbeat_encode(&heartbeat, payload);
+
+    size_t len = bss_record_put(frame, sizeof(frame), 0, BSS_FRAME_ID_ALL, BSS_MSG_HEARTBEAT, payload, sizeof(payload));
+    send_frame(CONTROLLER, -1, frame, len, BSS_AUTH_KEY_GROUP, group_key);
+
+    bss_links_update(&links, &registry);
+    plan_relays();
+}
+
+static void on_press(int node, uint32_t press_time)
+{
+    for (size_t i = 0; i < presses.size(); i++)
+    {
+        if (presses[i].node == node && presses[i].arrived < 0)
+            presses[i].arrived = now;
+    }
+
+    uint32_t window = relay_mode ? BSS_CONTROLLER_FAIRNESS_MS : 0;
+
+    if (bss_controller_timed_press(&show, &arbiter, nodes[node].id, press_time, now, window) == BSS_DECISION_LOCKOUT)
+        send_show();
+}
+
+// receive_frame of the controller
+static void controller_recv(const uint8_t *mac, const uint8_t *data, int len, bool direct)
+{
+    bss_auth_trailer_t trailer;
+    const uint8_t *record;
+    bss_client client;
+
+    if (!bss_auth_parse(data, len, &trailer) || (record = bss_frame_first(data, trailer.body_len)) == NULL)
+        return;
+
+    int slot = bss_registry_find(&registry, bss_record_id(record), mac, &client);
+
+    if (slot == BSS_REGISTRY_NO_SLOT || trailer.key_id != BSS_AUTH_KEY_SESSION ||
+        !bss_auth_verify(data, len, mac, client.key) || !bss_registry_accept_counter(&registry, slot, trailer.counter))
+        return;
+
+    bss_registry_touch(&registry, slot, now);
+
+    if (direct)
+        bss_links_touch(&links, slot);
+
+    if (bss_record_type(record) == BSS_MSG_BUZZER_PRESSED)
+        on_press(mac_node(mac), bss_controller_press_time(record, now));
+    else if (bss_record_type(record) == BSS_MSG_RELAY)
+    {
+        uint8_t ttl;
+        const uint8_t *origin;
+        const uint8_t *frame;
+        int frame_len;
+
+        if (bss_relay_open(record, &ttl, &origin, &frame, &frame_len))
+        {
+            int far_slot = bss_registry_find_mac(&registry, origin);
+
+            if (far_slot != BSS_REGISTRY_NO_SLOT)
+                bss_relay_delivered(&plan, far_slot, slot);
+
+            controller_recv(origin, frame, frame_len, false);
+        }
+    }
+}
+
+static int uplink(const node_t *node)
+{
+    return node->buzzer.relay.flags & BSS_RELAY_BROADCAST ? -1 : CONTROLLER;
+}
+
+static void buzzer_send(int i, uint8_t type, const uint8_t *payload, uint8_t payload_len)
+{
+    node_t *node = &nodes[i];
+    uint8_t frame[BSS_FRAME_MAX_SIZE];
+    size_t len = bss_record_put(frame, sizeof(frame), 0, node->id, type, payload, payload_len);
+
+    send_frame(i, uplink(node), frame, len, BSS_AUTH_KEY_SESSION, node->buzzer.session_key);
+}
+
+// relay_frame of the buzzer
+static void relay_frame(int i, const uint8_t *mac, const uint8_t *data, int len)
+{
+    node_t *node = &nodes[i];
+    uint8_t frame[BSS_FRAME_MAX_SIZE];
+    uint8_t ttl;
+
+    if (bss_relay_accept(&node->buzzer.relay, mac, data, len, &ttl))
+    {
+        size_t wrapped = bss_relay_put(frame, BSS_FRAME_MAX_SIZE - BSS_AUTH_TRAILER_SIZE, 0, node->id, ttl, mac, data,
+                                       len);
+
+        if (wrapped > 0)
+            send_frame(i, uplink(node), frame, wrapped, BSS_AUTH_KEY_SESSION, node->buzzer.session_key);
+    }
+    else if (bss_relay_repeat(&node->buzzer.relay, node->buzzer.controller_mac, node->buzzer.group_key, mac, data,
+                              len))
+        radio_broadcast(i, data, len);
+}
+
+static void buzzer_recv(int i, const uint8_t *mac, const uint8_t *data, int len)
+{
+    node_t *node = &nodes[i];
+    bss_buzzer_t *buzzer = &node->buzzer;
+    const uint8_t *sender = mac;
+
+    relay_frame(i, mac, data, len);
+
+    if (bss_relay_repeated(buzzer->controller_mac, buzzer->group_key, mac, data, len))
+        sender = buzzer->controller_mac;
+
+    const uint8_t *record = bss_buzzer_open_frame(buzzer, node->mac, node->id, sender, data, len);
+
+    if (record != NULL && bss_buzzer_handle_record(buzzer, sender, record) == BSS_BUZZER_HEARTBEAT)
+    {
+        node->last_heartbeat = now;
+        bss_buzzer_sync_clock(buzzer, record, now + node->skew);
+        bss_buzzer_resync_show(buzzer);
+    }
+}
+
+static void press(int i)
+{
+    node_t *node = &nodes[i];
+    uint8_t time[4];
+
+    bss_put_u32(time, now + node->skew + node->buzzer.clock_offset);
+    buzzer_send(i, BSS_MSG_BUZZER_PRESSED, time, sizeof(time));
+
+    presses.push_back({i, now, -1});
+}
+
+static void setup(int clients, double depth, unsigned seed, bool mode)
+{
+    rng.seed(seed);
+    air = decltype(air)();
+    air_order = 0;
+    presses.clear();
+    pending.clear();
+    nodes.assign(clients + 1, node_t());
+
+    relay_mode = mode;
+    heartbeats = 0;
+    bss_registry_init(&registry);
+    bss_links_init(&links);
+    bss_relay_plan_init(&plan);
+    memset(relay_roles, 0, sizeof(relay_roles));
+    bss_show_init(&show);
+    arbiter = {};
+
+    for (int k = 0; k < BSS_AUTH_KEY_SIZE; k++)
+        group_key[k] = rng();
+
+    nodes[CONTROLLER].x = WIDTH_M / 2;
+    nodes[CONTROLLER].y = 0;
+
+    for (int i = 0; i < (int)nodes.size(); i++)
+    {
+        node_t *node = &nodes[i];
+
+        node_mac(node->mac, i);
+        node->counter = 1;
+
+        if (i == CONTROLLER)
+            continue;
+
+        bss_buzzer_t *buzzer = &node->buzzer;
+
+        node->x = std::uniform_real_distribution<double>(0, WIDTH_M)(rng);
+        node->y = std::uniform_real_distribution<double>(2, depth)(rng);
+        node->id = i;
+        node->skew = rng();
+        node->next_ping = (uint32_t)i * PING_MS / clients;
+        node->last_heartbeat = 0;
+
+        bss_buzzer_init(buzzer);
+        config_version = buzzer->config.version;
+
+        for (int k = 0; k < BSS_AUTH_KEY_SIZE; k++)
+            buzzer->session_key[k] = rng();
+
+        buzzer->pairing_state = PAIRED;
+        mac_copy(buzzer->controller_mac, nodes[CONTROLLER].mac);
+        memcpy(buzzer->group_key, group_key, BSS_AUTH_KEY_SIZE);
+
+        int slot = bss_registry_add(&registry, node->id, node->mac, buzzer->session_key, 0);
+        bss_registry_touch(&registry, slot, 0);
+    }
+}
+
+// Scores the presses of the round that ends.
+static void end_round()
+{
+    if (presses.empty())
+        return;
+
+    const press_t *first = &presses[0];
+
+    for (size_t i = 0; i < presses.size(); i++)
+    {
+        result->presses++;
+
+        if (presses[i].arrived >= 0)
+        {
+            result->arrived++;
+            result->latency.push_back(presses[i].arrived - presses[i].at);
+        }
+
+        if (presses[i].at < first->at)
+            first = &presses[i];
+    }
+
+    bss_show_snapshot_t state = bss_show_read(&show);
+
+    result->rounds++;
+
+    // a tie is fair either way
+    for (size_t i = 0; i < presses.size(); i++)
+    {
+        if (state.phase == BSS_SHOW_LOCKED && presses[i].at == first->at && nodes[presses[i].node].id == state.winner)
+        {
+            result->fair++;
+            break;
+        }
+    }
+
+    presses.clear();
+}
+
+static void check_sync()
+{
+    uint16_t seq = bss_show_read(&show).seq;
+
+    for (int i = 1; i < (int)nodes.size(); i++)
+    {
+        const bss_buzzer_t *buzzer = &nodes[i].buzzer;
+
+        result->checked++;
+
+        if (!buzzer->show_stale && buzzer->show_seq == seq)
+            result->in_sync++;
+
+        if (now - nodes[i].last_heartbeat >= BSS_HEARTBEAT_LOST_PERIODS * PING_MS)
+            result->dropped_out++;
+    }
+}
+
+static void run(int clients, double depth, unsigned seed, bool mode)
+{
+    uint32_t next_heartbeat = PING_MS;
+
+    setup(clients, depth, seed, mode);
+
+    for (now = 0; now < END_MS; now++)
+    {
+        while (!air.empty() && air.top().at <= now)
+        {
+            packet_t packet = air.top();
+            uint8_t mac[6];
+
+            air.pop();
+            node_mac(mac, packet.from);
+
+            if (packet.to == CONTROLLER)
+                controller_recv(mac, packet.data.data(), packet.data.size(), true);
+            else
+                buzzer_recv(packet.to, mac, packet.data.data(), packet.data.size());
+        }
+
+        if (now >= next_heartbeat)
+        {
+            send_heartbeat();
+            next_heartbeat += PING_MS;
+        }
+
+        for (int i = 1; i < (int)nodes.size(); i++)
+        {
+            if (now < nodes[i].next_ping)
+                continue;
+
+            uint8_t version[BSS_CONFIG_VERSION_SIZE];
+
+            bss_put_u16(version, nodes[i].buzzer.config.version);
+            buzzer_send(i, BSS_MSG_PING, version, sizeof(version));
+            nodes[i].next_ping += PING_MS;
+        }
+
+        if (now < WARMUP_MS)
+            continue;
+
+        uint32_t round = (now - WARMUP_MS) % ROUND_MS;
+
+        if (round == 0)
+        {
+            end_round();
+
+            if (bss_show_reset(&show))
+                send_show();
+        }
+        else if (round == PRESS_MS)
+        {
+            std::vector<int> pressers;
+
+            while ((int)pressers.size() < PRESSERS && (int)pressers.size() < clients)
+            {
+                int i = 1 + rng() % clients;
+
+                if (std::find(pressers.begin(), pressers.end(), i) == pressers.end())
+                    pressers.push_back(i);
+            }
+
+            for (int i : pressers)
+                pending.push_back({i, now + (uint32_t)(rng() % PRESS_SPREAD_MS), -1});
+        }
+        else if (round == PRESS_MS + PRESS_SPREAD_MS + CHECK_MS)
+            check_sync();
+
+        for (size_t i = 0; i < pending.size();)
+        {
+            if (pending[i].at == now)
+            {
+                press(pending[i].node);
+                pending.erase(pending.begin() + i);
+            }
+            else
+                i++;
+        }
+    }
+
+    end_round();
+    result->ms += END_MS;
+}
+
+static uint32_t percentile(std::vector<uint32_t> *values, int percent)
+{
+    if (values->empty())
+        return 0;
+
+    std::sort(values->begin(), values->end());
+    return (*values)[(values->size() - 1) * percent / 100];
+}
+
+static void print_result(const char *name, result_t *r)
+{
+    printf("%s\n", name);
+    printf("  %-26s %.2f %% (%lu)\n", "presses arrived", 100.0 * r->arrived / r->presses, r->presses);
+    printf("  %-26s p50 %u p99 %u max %u ms\n", "press latency", percentile(&r->latency, 50),
+           percentile(&r->latency, 99), percentile(&r->latency, 100));
+    printf("  %-26s %.2f %% (%lu)\n", "first presser won", 100.0 * r->fair / r->rounds, r->rounds);
+    printf("  %-26s %.2f %%\n", "buzzers in sync", 100.0 * r->in_sync / r->checked);
+    printf("  %-26s %.2f %%\n", "buzzers without heartbeat", 100.0 * r->dropped_out / r->checked);
+    printf("  %-26s %.1f\n", "transmissions per second", r->attempts * 1000.0 / r->ms);
+}
+
+int main(int argc, char **argv)
+{
+    int clients = argc > 1 ? atoi(argv[1]) : 60;
+    double depth = argc > 2 ? atof(argv[2]) : 60;
+    int runs = argc > 3 ? atoi(argv[3]) : 5;
+    result_t results[2] = {};
+
+    if (clients < 1 || clients >= BSS_REGISTRY_MAX_CLIENTS || depth < 2 || runs < 1)
+    {
+        fprintf(stderr, "usage: %s [clients < %d] [depth m] [runs]\n", argv[0], BSS_REGISTRY_MAX_CLIENTS);
+        return 1;
+    }
+
+    for (int mode = 0; mode < 2; mode++)
+    {
+        result = &results[mode];
+
+        for (int r = 0; r < runs; r++)
+            run(clients, depth, r + 1, mode);
+    }
+
+    printf("%d clients, %.0f x %.0f m hall, half the frames lost at %.0f m, %d runs\n", clients, WIDTH_M, depth,
+           RANGE_M, runs);
+    print_result("without relays", &results[0]);
+    print_result("with relays", &results[1]);
+
+    return 0;
+}
@@ -0,0 +1,252 @@
+/*
+  Copyright © 2024 Leonard Sebastian Schwennesen. All rights reserved.
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <chrono>
+#include <map>
+#include <set>
+#include <vector>
+
+#include "bss_shared.h"
+#include "bss_frame.h"
+#include "bss_show.h"
+#include "bss_controller.h"
+#include "bss_journal.h"
+
+// Feeds the inputs of a controller journal (authentic presses and moderator
+// button events) through the same decision code as the firmware and compares
+// the outcome with the decisions the controller recorded.
+//
+// Frames are journaled on the WiFi task and buttons on loop(), so inputs and
+// decisions interleave. Every recorded decision names its input, and inputs
+// are replayed in the order of their decisions. Presses are arbitrated with
+// the millis() the controller journaled at their arrival, as it did.
+//
+// Only the time from an input to its decision is taken from the journal,
+// the stages in between (opening the frame, deciding, sending) are timed by
+// BSS_TRACE on the device.
+
+typedef struct
+{
+    unsigned long count;
+    double sum;
+    double min;
+    double max;
+} stat_t;
+
+static void stat_add(stat_t *stat, double value)
+{
+    if (stat->count == 0 || value < stat->min)
+        stat->min = value;
+    if (stat->count == 0 || value > stat->max)
+        stat->max = value;
+
+    stat->sum += value;
+    stat->count++;
+}
+
+static void stat_print(const char *name, const stat_t *stat, const char *unit)
+{
+    if (stat->count == 0)
+        printf("%-28s -\n", name);
+    else
+        printf("%-28s min %.1f avg %.1f max %.1f %s (%lu)\n", name, stat->min, stat->sum / stat->count, stat->max,
+               unit, stat->count);
+}
+
+static bool is_press(const bss_journal_entry_t *entry)
+{
+    return entry->kind == BSS_JOURNAL_FRAME && entry->status == BSS_FRAME_ACCEPTED &&
+           entry->len > BSS_RECORD_HEADER_SIZE && bss_record_type(entry->data) == BSS_MSG_BUZZER_PRESSED;
+}
+
+// The show state right after a recorded decision, if the decision tells it.
+static bool show_after(const bss_journal_entry_t *entry, uint32_t *word)
+{
+    switch (entry->status)
+    {
+    case BSS_DECISION_LOCKOUT:
+        *word = bss_show_pack(BSS_SHOW_LOCKED, entry->id, entry->seq);
+        return true;
+
+    case BSS_DECISION_RIGHT:
+        *word = bss_show_pack(BSS_SHOW_RIGHT, entry->id, entry->seq);
+        return true;
+
+    case BSS_DECISION_WRONG:
+        *word = bss_show_pack(BSS_SHOW_WRONG, entry->id, entry->seq);
+        return true;
+
+    case BSS_DECISION_RESET:
+        *word = bss_show_pack(BSS_SHOW_OPEN, 0, entry->seq);
+        return true;
+
+    default:
+        return false;
+    }
+}
+
+// Sets the state a recorded decision tells, a lockout with its arbiter.
+static void seed(const bss_journal_entry_t *entry, bss_show_t *show, bss_arbiter_t *arbiter)
+{
+    uint32_t word;
+
+    if (!show_after(entry, &word))
+        return;
+
+    show->word.store(word);
+
+    if (entry->status == BSS_DECISION_LOCKOUT)
+        bss_journal_lock(entry, arbiter);
+}
+
+static bool is_input(const bss_journal_entry_t *entry)
+{
+    return is_press(entry) || entry->kind == BSS_JOURNAL_BUTTON;
+}
+
+// 'window' is the fairness window the controller decided a press with.
+static bss_decision replay(const bss_journal_entry_t *entry, uint32_t window, bss_show_t *show,
+                           bss_arbiter_t *arbiter, stat_t *cost)
+{
+    if (entry->kind == BSS_JOURNAL_BUTTON)
+        return bss_controller_moderator(show, entry->id, entry->status);
+
+    uint32_t press_time = bss_controller_press_time(entry->data, entry->now_ms);
+
+    auto begin = std::chrono::steady_clock::now();
+    bss_decision decision = bss_controller_timed_press(show, arbiter, entry->id, press_time, entry->now_ms, window);
+    auto end = std::chrono::steady_clock::now();
+
+    stat_add(cost, std::chrono::duration<double, std::nano>(end - begin).count());
+    return decision;
+}
+
+int main(int argc, char **argv)
+{
+    FILE *in = stdin;
+
+    if (argc > 1 && (in = fopen(argv[1], "r")) == NULL)
+    {
+        perror(argv[1]);
+        return 2;
+    }
+
+    std::vector<bss_journal_entry_t> entries;
+    char line[256];
+
+    while (fgets(line, sizeof(line), in) != NULL)
+    {
+        bss_journal_entry_t entry;
+
+        if (bss_journal_parse(line, &entry))
+            entries.push_back(entry);
+    }
+
+    if (in != stdin)
+        fclose(in);
+
+    // The ring only holds the tail of a show. Replay starts after the first
+    // decision that tells the complete show state.
+    size_t start = 0;
+    uint32_t word = 0;
+
+    while (start < entries.size() && !(entries[start].kind == BSS_JOURNAL_DECISION && show_after(&entries[start], &word)))
+        start++;
+
+    if (start == entries.size())
+    {
+        printf("%zu entries, no show decision to start from\n", entries.size());
+        return 2;
+    }
+
+    // inputs a later decision names, by their journal time
+    std::set<uint32_t> decided;
+    size_t last_decision = start;
+
+    for (size_t i = start + 1; i < entries.size(); i++)
+    {
+        if (entries[i].kind == BSS_JOURNAL_DECISION)
+        {
+            decided.insert(bss_journal_input_us(&entries[i]));
+            last_decision = i;
+        }
+    }
+
+    bss_show_t show;
+    bss_arbiter_t arbiter = {};
+    seed(&entries[start], &show, &arbiter);
+
+    std::map<uint32_t, const bss_journal_entry_t *> pending;
+    unsigned long matched = 0, mismatched = 0, unreplayed = 0;
+    stat_t latency = {0, 0, 0, 0}, cost = {0, 0, 0, 0};
+
+    for (size_t i = start + 1; i < entries.size(); i++)
+    {
+        const bss_journal_entry_t *entry = &entries[i];
+
+        if (is_input(entry))
+        {
+            if (decided.count(entry->time_us) != 0)
+            {
+                pending[entry->time_us] = entry;
+                continue;
+            }
+
+            // the controller decided nothing, or its decision is past the dump
+            bss_decision decision = replay(entry, arbiter.window, &show, &arbiter, &cost);
+
+            if (decision != BSS_DECISION_NONE && i < last_decision)
+            {
+                printf("%lu: replayed decision %u without a recorded one\n", (unsigned long)entry->time_us, decision);
+                mismatched++;
+            }
+
+            continue;
+        }
+
+        if (entry->kind != BSS_JOURNAL_DECISION)
+            continue;
+
+        auto input = pending.find(bss_journal_input_us(entry));
+
+        if (input == pending.end())
+        {
+            // its input is older than the ring
+            seed(entry, &show, &arbiter);
+            unreplayed++;
+            continue;
+        }
+
+        bss_arbiter_t lock;
+        bool press = is_press(input->second);
+        bss_journal_lock(entry, &lock);
+
+        bss_decision decision = replay(input->second, lock.window, &show, &arbiter, &cost);
+        bss_show_snapshot_t state = bss_show_read(&show);
+        pending.erase(input);
+
+        if (decision != entry->status || state.winner != entry->id || state.seq != entry->seq)
+        {
+            printf("%lu: recorded decision %u winner %u seq %u, replayed %u winner %u seq %u\n",
+                   (unsigned long)entry->time_us, entry->status, entry->id, entry->seq, decision, state.winner,
+                   state.seq);
+            mismatched++;
+            continue;
+        }
+
+        matched++;
+
+        if (press)
+            stat_add(&latency, (uint32_t)(entry->time_us - bss_journal_input_us(entry)));
+    }
+
+    printf("%zu entries, replay from %zu: %lu decisions matched, %lu mismatched, %lu without input\n", entries.size(),
+           start, matched, mismatched, unreplayed);
+    stat_print("press to decision (device)", &latency, "us");
+    stat_print("press decision (replay)", &cost, "ns");
+
+    return mismatched == 0 ? 0 : 1;
+}
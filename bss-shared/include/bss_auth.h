@@ -0,0 +1,90 @@
+/*
+  Copyright © 2024 Leonard Sebastian Schwennesen. All rights reserved.
+*/
+
+#ifndef BSS_AUTH_H
+#define BSS_AUTH_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "bss_siphash.h"
+
+// Frame authentication on top of unencrypted ESP-NOW peers.
+//
+// Every frame ends with a trailer
+//
+//   [key id][counter:4][tag:4]
+//
+// where 'tag' is the truncated SipHash of the sender MAC and everything in
+// front of it. Counters are per sender and strictly increasing, so a
+// receiver rejects replays by remembering the last accepted one.
+//
+// Keys:
+//  - fleet:   compiled into every device of one fleet (BSS_FLEET_KEY, there
+//             is no default), only used for pairing requests
+//  - session: per pairing, derived from the fleet key and the nonces of
+//             PAIRING_REQUEST and PAIRING_ACCEPTED
+//  - group:   the controller's broadcast key, handed out encrypted with the
+//             session key in PAIRING_ACCEPTED
+//
+// The nonces and MACs of the key exchange are sent in clear, so it is only
+// as secret as the fleet key: whoever knows it and records a pairing can
+// derive that session key and with it the group key.
+
+#define BSS_AUTH_KEY_SIZE BSS_SIPHASH_KEY_SIZE
+#define BSS_AUTH_NONCE_SIZE 8
+#define BSS_AUTH_TAG_SIZE 4
+#define BSS_AUTH_TRAILER_SIZE (1 + 4 + BSS_AUTH_TAG_SIZE)
+
+// Counters are persisted in blocks of this size, so a reboot continues
+// above every counter that could have been sent before.
+#define BSS_AUTH_COUNTER_BLOCK 4096
+
+enum bss_auth_key_id
+{
+  BSS_AUTH_KEY_FLEET = 0,
+  BSS_AUTH_KEY_SESSION = 1,
+  BSS_AUTH_KEY_GROUP = 2,
+};
+
+extern const uint8_t bss_fleet_key[BSS_AUTH_KEY_SIZE];
+
+typedef struct
+{
+  uint8_t key_id;
+  uint32_t counter;
+  int body_len;
+} bss_auth_trailer_t;
+
+// Appends the trailer to the 'len' bytes of 'frame'. Returns the sealed
+// length, or 0 if the trailer does not fit into 'capacity'.
+size_t bss_auth_seal(uint8_t *frame, size_t len, size_t capacity, const uint8_t *sender_mac,
+                     uint8_t key_id, const uint8_t *key, uint32_t counter);
+
+// Reads the trailer without verifying it. Returns false if the frame is too
+// short to carry one.
+bool bss_auth_parse(const uint8_t *frame, int len, bss_auth_trailer_t *trailer);
+
+// Checks the tag in constant time.
+bool bss_auth_verify(const uint8_t *frame, int len, const uint8_t *sender_mac, const uint8_t *key);
+
+// Accepts 'counter' if it is newer than '*last' and advances '*last'.
+inline bool bss_auth_accept_counter(uint32_t *last, uint32_t counter)
+{
+  if (counter <= *last)
+    return false;
+
+  *last = counter;
+  return true;
+}
+
+void bss_auth_derive_session_key(uint8_t *key, const uint8_t *buzzer_mac, const uint8_t *controller_mac,
+                                 const uint8_t *buzzer_nonce, const uint8_t *controller_nonce);
+
+// Encrypts or decrypts 'data' in place with a SipHash keystream. A key and
+// nonce pair must never be used for two different messages.
+void bss_auth_crypt(uint8_t *data, size_t len, const uint8_t *key, const uint8_t *nonce);
+
+bool bss_auth_equal(const uint8_t *a, const uint8_t *b, size_t len);
+
+#endif
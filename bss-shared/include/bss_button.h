@@ -0,0 +1,80 @@
+/*
+  Copyright © 2024 Leonard Sebastian Schwennesen. All rights reserved.
+*/
+
+#ifndef BSS_BUTTON_H
+#define BSS_BUTTON_H
+
+#include <stdint.h>
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#endif
+
+// default of BssButton::debounce_ms
+#define BSS_BUTTON_DEBOUNCE_MS 10
+
+enum bss_button_state
+{
+  UNPRESSED = 0,
+  PRESSED = 2,
+  HOLD = 1,
+  RELEASED = 3,
+};
+
+class BssButton
+{
+private:
+  bool pin_state = false;
+  bool pin_state_old = false;
+  uint8_t pin;
+
+public:
+  unsigned long last_pressed = 0;
+  unsigned long last_released = 0;
+  bss_button_state state = UNPRESSED;
+  bool locked = false;
+  unsigned long debounce_ms = BSS_BUTTON_DEBOUNCE_MS;
+
+  BssButton(uint8_t pin) : pin(pin) {}
+
+  // Feeds one sample of the (active high) button level into the debounce
+  // state machine. Kept free of any hardware access so it can be driven from
+  // the native tests.
+  void update(bool pressed, unsigned long now)
+  {
+    pin_state_old = pin_state;
+    pin_state = pressed;
+
+    if (pin_state && !pin_state_old)
+    {
+      if ((now - last_pressed) >= debounce_ms)
+        state = PRESSED;
+
+      last_pressed = now;
+    }
+    else if (!pin_state && pin_state_old)
+    {
+      if ((now - last_released) >= debounce_ms)
+        state = RELEASED;
+
+      last_released = now;
+    }
+    else if (pin_state && pin_state_old)
+      state = HOLD;
+    else // !pin_state && !pin_state_old
+      state = UNPRESSED;
+  }
+
+#ifdef ARDUINO
+  // This function does not return the current state, as this would encourage
+  // multiple calls in the loop, skipping the 'PRESSED' or 'RELEASED' states
+  // after the second call.
+  void read()
+  {
+    update(!digitalRead(pin), millis());
+  }
+#endif
+};
+
+#endif
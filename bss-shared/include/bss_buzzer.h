@@ -0,0 +1,161 @@
+/*
+  Copyright © 2024 Leonard Sebastian Schwennesen. All rights reserved.
+*/
+
+#ifndef BSS_BUZZER_H
+#define BSS_BUZZER_H
+
+#include <stdint.h>
+#include "bss_shared.h"
+#include "bss_button.h"
+#include "bss_auth.h"
+#include "bss_config.h"
+#include "bss_slot.h"
+#include "bss_heartbeat.h"
+#include "bss_relay.h"
+
+// Pairing and show state of a buzzer. The firmware owns all side effects
+// (LEDs, NVS, timers), these functions only decide what has to happen.
+
+// defaults of bss_config_t
+#define BSS_BUZZER_PAIRING_HOLD_MS 3000
+#define BSS_BUZZER_IDLE_SLEEP_MS 1000
+// a paired buzzer held this many times pairing_hold_ms drops its pairing, far
+// longer than any press in a show
+#define BSS_BUZZER_UNPAIR_HOLDS 4
+
+// 'show_phase' before the controller told it
+#define BSS_BUZZER_PHASE_UNKNOWN 0xFF
+
+enum bss_client_pairing_state
+{
+  UNPAIRED,
+  PAIRING_MODE,
+  PAIRED,
+};
+
+enum bss_client_show_state
+{
+  UNINITIALIZED,
+  INIT,
+  SHOW,
+};
+
+typedef struct
+{
+  bss_client_pairing_state pairing_state;
+  bss_client_show_state show_state;
+  uint8_t controller_mac[6];
+  uint8_t session_key[BSS_AUTH_KEY_SIZE];
+  uint8_t group_key[BSS_AUTH_KEY_SIZE];
+  // sent with every PAIRING_REQUEST of the current pairing attempt
+  uint8_t pairing_nonce[BSS_AUTH_NONCE_SIZE];
+  // last frame counter accepted from the controller
+  uint32_t controller_counter;
+  bss_config_t config;
+  // uplink slot assigned at pairing, or BSS_SLOT_NONE
+  uint8_t slot;
+  // controller time minus own millis()
+  uint32_t clock_offset;
+  // show seq of the displayed color
+  uint16_t show_seq;
+  // the displayed color has no show seq, after boot, a lost or restarted
+  // controller and a takeover
+  bool show_stale;
+  // bss_show_phase of 'show_seq'
+  uint8_t show_phase;
+  // a press is displayed before the controller decided on it, see
+  // bss_buzzer_speculate
+  bool provisional;
+  uint32_t provisional_since;
+  // the last heartbeat received
+  bss_heartbeat_t heartbeat;
+  // assigned by the controller, see bss_relay.h
+  bss_relay_t relay;
+} bss_buzzer_t;
+
+enum bss_buzzer_action
+{
+  BSS_BUZZER_NONE,
+  // accepted by the controller, show the idle color
+  BSS_BUZZER_SHOW_INIT,
+  // the record payload carries r, g, b
+  BSS_BUZZER_SET_COLOR,
+  // newly paired, controller_mac has to be persisted and added as peer
+  BSS_BUZZER_PAIRED,
+  // pairing was removed and has to be persisted
+  BSS_BUZZER_UNPAIRED,
+  // the pairing state did not change, only stop the pairing broadcast
+  BSS_BUZZER_PAIRING_STOP,
+  BSS_BUZZER_SEND_PRESS,
+  BSS_BUZZER_SLEEP,
+  BSS_BUZZER_PAIRING_START,
+  // the pairing was dropped by hand: tell the controller with a session keyed
+  // PAIRING_REMOVE, then start pairing as for BSS_BUZZER_PAIRING_START
+  BSS_BUZZER_UNPAIR,
+  // a new configuration was applied to 'config' and has to be persisted
+  BSS_BUZZER_CONFIG,
+  // a heartbeat was stored in 'heartbeat'
+  BSS_BUZZER_HEARTBEAT,
+  // a standby controller took over, the new controller_mac has to be
+  // persisted and added as peer
+  BSS_BUZZER_TAKEOVER,
+  // a new relay role was applied to 'relay'
+  BSS_BUZZER_RELAY_ROLE,
+};
+
+// Resets the state and loads the default configuration.
+void bss_buzzer_init(bss_buzzer_t *buzzer);
+
+// Returns the id of the buzzer with this MAC: the low byte of the sum of its
+// bytes, moved out of the reserved ids (bss_frame_id_reserved).
+uint8_t bss_buzzer_id(const uint8_t *mac);
+
+// Authenticates a frame received from 'mac' and returns the record addressed
+// to 'my_id', or NULL if there is none or the frame must be dropped. An
+// authentic PAIRING_ACCEPTED during pairing installs the new session and
+// group key. A TAKEOVER from another controller is accepted if its record
+// carries the tag of our session key, see bss_standby.h.
+const uint8_t *bss_buzzer_open_frame(bss_buzzer_t *buzzer, const uint8_t *my_mac, uint8_t my_id,
+                                     const uint8_t *mac, const uint8_t *data, int len);
+
+// Applies a record addressed to this buzzer and received from 'mac'.
+bss_buzzer_action bss_buzzer_handle_record(bss_buzzer_t *buzzer, const uint8_t *mac, const uint8_t *record);
+
+// Takes the controller time of a PAIRING_ACCEPTED or WAKEUP_ACCEPTED record
+// received at 'now'. Returns false if the record carries none.
+bool bss_buzzer_sync_clock(bss_buzzer_t *buzzer, const uint8_t *record, uint32_t now);
+
+// Returns true if the displayed color is outdated by the last heartbeat: it
+// is stale, or the heartbeat carries a newer show seq. The color of the
+// heartbeat has to be displayed then, it is taken as current. Older and
+// equal seqs are ignored, so a heartbeat of the state a provisional press is
+// based on does not revert the press. A heartbeat with an earlier controller
+// time than the one before, a pairing and a takeover make the color stale.
+bool bss_buzzer_resync_show(bss_buzzer_t *buzzer);
+
+// Called on a press that is sent. Returns true if the provisional press
+// effect has to be displayed: config.provisional_ms is set and the show is
+// known to be open. The next color of a newer show seq replaces it, repeats
+// of the current seq do not.
+bool bss_buzzer_speculate(bss_buzzer_t *buzzer, uint32_t now);
+
+// Returns true once a provisional press was not decided within
+// config.provisional_ms. The color of 'show_seq' has to be displayed again.
+bool bss_buzzer_provisional_expired(bss_buzzer_t *buzzer, uint32_t now);
+
+// Returns false if the last heartbeat shows that the controller did not hear
+// this buzzer recently or that it missed a configuration. The next slot ping
+// has to go out then, the controller answers an outdated configuration.
+bool bss_buzzer_heard(const bss_buzzer_t *buzzer);
+
+// Time from 'now' to the start of the next own uplink slot. Without a slot
+// this is a full ping period.
+uint32_t bss_buzzer_slot_wait(const bss_buzzer_t *buzzer, uint32_t now);
+
+// Evaluates the buzzer button once per loop iteration. A paired buzzer that
+// the controller forgot recovers by a hold of BSS_BUZZER_UNPAIR_HOLDS times
+// pairing_hold_ms, which goes straight into pairing mode.
+bss_buzzer_action bss_buzzer_handle_button(bss_buzzer_t *buzzer, const BssButton *button, unsigned long now);
+
+#endif
@@ -0,0 +1,70 @@
+/*
+  Copyright © 2024 Leonard Sebastian Schwennesen. All rights reserved.
+*/
+
+#ifndef BSS_CONFIG_H
+#define BSS_CONFIG_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Runtime configuration of the buzzers. The controller owns the fleet's
+// configuration and pushes it with BSS_MSG_CONFIG, the buzzers persist it as
+// one NVS blob and echo its version in every ping, so the controller can
+// retarget buzzers that missed an update.
+
+// upper bound of 'led_num', the size of the LED buffer
+#define BSS_CONFIG_MAX_LEDS 64
+
+// [version:2][brightness][led_num][sleep_s:2][ping_ms:2][debounce_ms]
+// [pairing_ms:2][pairing_hold_ms:2][idle_sleep_ms:2][provisional_ms:2],
+// little endian
+#define BSS_CONFIG_WIRE_SIZE 17
+// payload of controllers from before 'provisional_ms'
+#define BSS_CONFIG_MIN_WIRE_SIZE 15
+
+// PING and WAKEUP_REQUEST payload: [config version:2]
+#define BSS_CONFIG_VERSION_SIZE 2
+
+typedef struct
+{
+  // 0 is the built in default, the controller counts up from there
+  uint16_t version;
+  uint8_t brightness;
+  uint8_t led_num;
+  // deep sleep between wake up requests
+  uint16_t sleep_s;
+  uint16_t ping_ms;
+  uint8_t debounce_ms;
+  // how long a buzzer stays in pairing mode
+  uint16_t pairing_ms;
+  // how long the buzzer button is held to start pairing
+  uint16_t pairing_hold_ms;
+  // an unpaired buzzer goes back to sleep after this time without a press
+  uint16_t idle_sleep_ms;
+  // a pressed buzzer shows a provisional effect until the controller decides,
+  // at most this long; 0 waits for the controller
+  uint16_t provisional_ms;
+} bss_config_t;
+
+void bss_config_default(bss_config_t *config);
+
+void bss_config_encode(const bss_config_t *config, uint8_t *buf);
+
+// Decodes and validates a configuration. Longer payloads of newer
+// controllers are accepted, their additional fields are ignored. Shorter
+// ones of older controllers leave 'provisional_ms' at 0. Returns
+// false and leaves 'config' unchanged if the payload is short or invalid.
+bool bss_config_decode(const uint8_t *buf, size_t len, bss_config_t *config);
+
+bool bss_config_valid(const bss_config_t *config);
+
+// Sets the field 'name' (as in bss_config_t) to 'value'. Returns false if
+// there is no such field or the result is invalid, 'config' is left
+// unchanged then.
+bool bss_config_set(bss_config_t *config, const char *name, unsigned long value);
+
+// Writes "name=value" pairs of all fields. Returns the length like snprintf.
+int bss_config_format(const bss_config_t *config, char *buf, size_t size);
+
+#endif
@@ -0,0 +1,133 @@
+/*
+  Copyright © 2024 Leonard Sebastian Schwennesen. All rights reserved.
+*/
+
+#ifndef BSS_CONTROLLER_H
+#define BSS_CONTROLLER_H
+
+#include <stdint.h>
+#include "bss_show.h"
+#include "bss_frame.h"
+#include "bss_shared.h"
+
+// The controller's show decisions. Kept free of radio and GPIO access, so
+// the firmware and the host side journal replay run the same code.
+
+#define BSS_CONTROLLER_PAIRING_HOLD_MS 2000
+
+// With relays a press that arrives later still wins the lockout if it
+// happened earlier and the lock is at most this old, see
+// bss_controller_timed_press.
+#define BSS_CONTROLLER_FAIRNESS_MS 100
+
+enum bss_moderator_button
+{
+  BSS_BUTTON_RIGHT = 0,
+  BSS_BUTTON_RESET = 1,
+  BSS_BUTTON_WRONG = 2,
+};
+
+enum bss_moderator_event
+{
+  BSS_EVENT_PRESS = 0,
+  // the button is held for BSS_CONTROLLER_PAIRING_HOLD_MS, once per press
+  BSS_EVENT_HOLD = 1,
+  BSS_EVENT_RELEASE = 2,
+};
+
+enum bss_decision
+{
+  BSS_DECISION_NONE = 0,
+  // the press won, all buzzers show white
+  BSS_DECISION_LOCKOUT = 1,
+  // the show was already locked
+  BSS_DECISION_PRESS_LATE = 2,
+  BSS_DECISION_RIGHT = 3,
+  BSS_DECISION_WRONG = 4,
+  BSS_DECISION_RESET = 5,
+  BSS_DECISION_PAIRING_TOGGLE = 6,
+};
+
+// An authentic press of a registered client.
+inline bss_decision bss_controller_press(bss_show_t *show, uint8_t id)
+{
+  return bss_show_try_lock(show, id) ? BSS_DECISION_LOCKOUT : BSS_DECISION_PRESS_LATE;
+}
+
+// The press that holds the lockout, see bss_controller_timed_press.
+typedef struct
+{
+  // show seq of the lock
+  uint16_t seq;
+  uint32_t press_time;
+  uint32_t locked_at;
+  // fairness window of the lock, 0 if the first press to arrive wins
+  uint32_t window;
+} bss_arbiter_t;
+
+// The controller time of a PRESSED record, 'now' for buzzers that send none.
+inline uint32_t bss_controller_press_time(const uint8_t *record, uint32_t now)
+{
+  if (bss_record_type(record) != BSS_MSG_BUZZER_PRESSED || bss_record_payload_len(record) < 4)
+    return now;
+
+  return bss_get_u32(bss_record_payload(record));
+}
+
+// An authentic press that happened at 'press_time' and arrived at 'now'. The
+// first press locks the show, an earlier one arriving within 'window' takes
+// the lock over. The first winner was broadcast already, so its buzzer
+// shows the lock, or its provisional press, until the new winner replaces
+// it: a visible flip, which is why only relay mode, where relayed presses
+// arrive late, passes BSS_CONTROLLER_FAIRNESS_MS and direct mode passes 0.
+// Press times in the future or older than the window are taken as 'now', so
+// a buzzer with a wrong clock can not win by it.
+inline bss_decision bss_controller_timed_press(bss_show_t *show, bss_arbiter_t *arbiter, uint8_t id,
+                                               uint32_t press_time, uint32_t now, uint32_t window)
+{
+  if (now - press_time > window)
+    press_time = now;
+
+  if (bss_show_try_lock(show, id))
+  {
+    *arbiter = {bss_show_read(show).seq, press_time, now, window};
+    return BSS_DECISION_LOCKOUT;
+  }
+
+  bss_show_snapshot_t state = bss_show_read(show);
+
+  if (state.winner == id || state.seq != arbiter->seq || now - arbiter->locked_at > arbiter->window ||
+      (int32_t)(press_time - arbiter->press_time) >= 0 || !bss_show_transfer(show, arbiter->seq, id))
+    return BSS_DECISION_PRESS_LATE;
+
+  arbiter->seq++;
+  arbiter->press_time = press_time;
+  return BSS_DECISION_LOCKOUT;
+}
+
+inline bss_decision bss_controller_moderator(bss_show_t *show, uint8_t button, uint8_t event)
+{
+  switch (button)
+  {
+  case BSS_BUTTON_RIGHT:
+    if (event == BSS_EVENT_PRESS && bss_show_judge(show, BSS_SHOW_RIGHT))
+      return BSS_DECISION_RIGHT;
+    if (event == BSS_EVENT_HOLD)
+      return BSS_DECISION_PAIRING_TOGGLE;
+    break;
+
+  case BSS_BUTTON_RESET:
+    if (event == BSS_EVENT_PRESS && bss_show_reset(show))
+      return BSS_DECISION_RESET;
+    break;
+
+  case BSS_BUTTON_WRONG:
+    if (event == BSS_EVENT_PRESS && bss_show_judge(show, BSS_SHOW_WRONG))
+      return BSS_DECISION_WRONG;
+    break;
+  }
+
+  return BSS_DECISION_NONE;
+}
+
+#endif
@@ -0,0 +1,93 @@
+/*
+  Copyright © 2024 Leonard Sebastian Schwennesen. All rights reserved.
+*/
+
+#ifndef BSS_FRAME_H
+#define BSS_FRAME_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+// ESP-NOW payload limit
+#define BSS_FRAME_MAX_SIZE 250
+
+// A frame is a sequence of records, one per addressed client:
+//
+//   [id][len][type][payload ...]
+//
+// where 'len' counts the type byte and the payload.
+#define BSS_RECORD_HEADER_SIZE 2
+
+// A record for every client, only used by frames that address no client
+// individually (heartbeat).
+#define BSS_FRAME_ID_ALL 0xFF
+
+// Ids from here on are never a buzzer's: the standby controller
+// (BSS_STANDBY_ID) and BSS_FRAME_ID_ALL.
+#define BSS_FRAME_ID_RESERVED 0xFE
+
+inline bool bss_frame_id_reserved(uint8_t id)
+{
+  return id >= BSS_FRAME_ID_RESERVED;
+}
+
+inline uint8_t bss_record_id(const uint8_t *record)
+{
+  return record[0];
+}
+
+inline uint8_t bss_record_type(const uint8_t *record)
+{
+  return record[2];
+}
+
+inline const uint8_t *bss_record_payload(const uint8_t *record)
+{
+  return &record[3];
+}
+
+inline uint8_t bss_record_payload_len(const uint8_t *record)
+{
+  return record[1] - 1;
+}
+
+// Little endian fields of payloads
+inline void bss_put_u16(uint8_t *buf, uint16_t value)
+{
+  buf[0] = value;
+  buf[1] = value >> 8;
+}
+
+inline uint16_t bss_get_u16(const uint8_t *buf)
+{
+  return buf[0] | buf[1] << 8;
+}
+
+inline void bss_put_u32(uint8_t *buf, uint32_t value)
+{
+  bss_put_u16(buf, value);
+  bss_put_u16(&buf[2], value >> 16);
+}
+
+inline uint32_t bss_get_u32(const uint8_t *buf)
+{
+  return bss_get_u16(buf) | (uint32_t)bss_get_u16(&buf[2]) << 16;
+}
+
+// Appends a record at 'offset' and returns the offset behind it. If the
+// record does not fit into 'capacity', nothing is written and 'offset' is
+// returned unchanged.
+size_t bss_record_put(uint8_t *buf, size_t capacity, size_t offset, uint8_t id,
+                      uint8_t type, const uint8_t *payload, uint8_t payload_len);
+
+// Returns the first well formed record in the frame, or NULL.
+const uint8_t *bss_frame_first(const uint8_t *data, int len);
+
+// Walks the records of a frame and returns the first one addressed to 'id'.
+// Returns NULL if there is none or the frame is truncated before it.
+const uint8_t *bss_frame_find(const uint8_t *data, int len, uint8_t id);
+
+// Returns the next record addressed to 'id' behind 'record', or NULL.
+const uint8_t *bss_frame_next(const uint8_t *data, int len, const uint8_t *record, uint8_t id);
+
+#endif
@@ -0,0 +1,62 @@
+/*
+  Copyright © 2024 Leonard Sebastian Schwennesen. All rights reserved.
+*/
+
+#ifndef BSS_HEARTBEAT_H
+#define BSS_HEARTBEAT_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "bss_slot.h"
+
+// The controller broadcasts one heartbeat per ping period to the whole fleet
+// (record id BSS_FRAME_ID_ALL). From it every buzzer learns that the
+// controller is alive, whether its own pings arrive, which show state and
+// color it should display and the controller clock for its uplink slot.
+
+#define BSS_HEARTBEAT_HEARD_SIZE (BSS_SLOT_COUNT / 8)
+
+// [phase][winner][seq:2][r][g][b][controller time:4][config version:2]
+// [heard:8], little endian
+#define BSS_HEARTBEAT_SIZE (13 + BSS_HEARTBEAT_HEARD_SIZE)
+#define BSS_HEARTBEAT_TIME_OFFSET 7
+
+// a client counts as heard if a frame arrived within this many periods
+#define BSS_HEARTBEAT_HEARD_PERIODS 2
+// a buzzer considers the controller lost after this many missing heartbeats
+#define BSS_HEARTBEAT_LOST_PERIODS 3
+
+typedef struct
+{
+  // bss_show_phase
+  uint8_t phase;
+  uint8_t winner;
+  uint16_t seq;
+  uint8_t color[3];
+  uint32_t time;
+  uint16_t config_version;
+  // bit 'slot % 8' of byte 'slot / 8' is set for every client heard recently
+  uint8_t heard[BSS_HEARTBEAT_HEARD_SIZE];
+} bss_heartbeat_t;
+
+void bss_heartbeat_encode(const bss_heartbeat_t *heartbeat, uint8_t *buf);
+
+// Offset of the controller time in the payload of a HEARTBEAT,
+// PAIRING_ACCEPTED or WAKEUP_ACCEPTED record, -1 for other types. The
+// controller stamps it when the frame is sealed, after any queueing.
+int bss_controller_time_offset(uint8_t type);
+
+// Returns false if the payload is too short.
+bool bss_heartbeat_decode(const uint8_t *buf, size_t len, bss_heartbeat_t *heartbeat);
+
+inline bool bss_heartbeat_heard(const bss_heartbeat_t *heartbeat, uint8_t slot)
+{
+  return slot < BSS_SLOT_COUNT && (heartbeat->heard[slot / 8] >> (slot % 8) & 1);
+}
+
+inline void bss_heartbeat_set_heard(uint8_t *heard, uint8_t slot)
+{
+  heard[slot / 8] |= 1 << (slot % 8);
+}
+
+#endif
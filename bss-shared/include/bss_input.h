@@ -0,0 +1,59 @@
+/*
+  Copyright © 2024 Leonard Sebastian Schwennesen. All rights reserved.
+*/
+
+#ifndef BSS_INPUT_H
+#define BSS_INPUT_H
+
+#include <stdint.h>
+#include <atomic>
+#include "bss_button.h"
+#include "bss_controller.h"
+
+// Input scanner of the moderator buttons. A periodic timer samples every
+// button each BSS_INPUT_SCAN_MS, runs the BssButton debouncing and turns the
+// result into bss_moderator_event entries stamped with the sample time. The
+// show logic consumes them from a queue in loop(), so neither the latency of
+// a press nor the pairing hold depends on how long a loop iteration takes.
+//
+// The queue has a single producer (the scanner) and a single consumer, and
+// takes no lock. A full queue drops the new event and counts it.
+
+#define BSS_INPUT_SCAN_MS 1
+#define BSS_INPUT_MAX_BUTTONS 8
+// power of two
+#define BSS_INPUT_QUEUE_SIZE 16
+
+typedef struct
+{
+  uint32_t time_us;
+  // index of the button, bss_moderator_button for the controller
+  uint8_t button;
+  // bss_moderator_event
+  uint8_t event;
+} bss_input_event_t;
+
+typedef struct
+{
+  BssButton *buttons;
+  uint8_t count;
+  // a held button reports BSS_EVENT_HOLD once after this time
+  unsigned long hold_ms;
+  std::atomic<uint32_t> head;
+  std::atomic<uint32_t> tail;
+  std::atomic<uint32_t> dropped;
+  bss_input_event_t events[BSS_INPUT_QUEUE_SIZE];
+} bss_input_t;
+
+// 'buttons' stays owned by the caller, at most BSS_INPUT_MAX_BUTTONS.
+void bss_input_init(bss_input_t *input, BssButton *buttons, uint8_t count, unsigned long hold_ms);
+
+// Scanner: one sample of all buttons, bit i of 'pressed' is set while
+// button i is down. 'now_ms' drives the debouncing, 'time_us' stamps the
+// events.
+void bss_input_scan(bss_input_t *input, uint32_t pressed, unsigned long now_ms, uint32_t time_us);
+
+// Consumer: takes the oldest event, false if there is none.
+bool bss_input_pop(bss_input_t *input, bss_input_event_t *event);
+
+#endif
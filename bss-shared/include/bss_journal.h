@@ -0,0 +1,102 @@
+/*
+  Copyright © 2024 Leonard Sebastian Schwennesen. All rights reserved.
+*/
+
+#ifndef BSS_JOURNAL_H
+#define BSS_JOURNAL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include "bss_controller.h"
+
+// Fixed size ring of the controller's recent events: every received frame,
+// every show decision and every moderator button event, stamped in
+// microseconds. Recording is lock free and cheap enough to stay always on.
+// The ring is dumped as text lines on request and replayed on the host by
+// bss-host's journal replay.
+
+#define BSS_JOURNAL_ENTRIES 256
+// head of a frame that is kept, enough for the first record and a trailer
+// of short frames
+#define BSS_JOURNAL_DATA_SIZE 16
+
+enum bss_journal_kind
+{
+  BSS_JOURNAL_FRAME = 0,
+  BSS_JOURNAL_DECISION = 1,
+  BSS_JOURNAL_BUTTON = 2,
+};
+
+enum bss_journal_frame_status
+{
+  // authentic frame of a registered client
+  BSS_FRAME_ACCEPTED = 0,
+  // authentic pairing request
+  BSS_FRAME_PAIRING = 1,
+  BSS_FRAME_MALFORMED = 2,
+  BSS_FRAME_UNKNOWN = 3,
+  // wrong tag, key or replayed counter
+  BSS_FRAME_REJECTED = 4,
+};
+
+typedef struct
+{
+  uint32_t time_us;
+  uint8_t kind;
+  // frame: bss_journal_frame_status, decision: bss_decision,
+  // button: bss_moderator_event
+  uint8_t status;
+  // frame: sender id, decision: winner, button: bss_moderator_button
+  uint8_t id;
+  // frame: length
+  uint8_t len;
+  // decision: show sequence number afterwards
+  uint16_t seq;
+  uint8_t mac[6];
+  // frame: head of the frame, decision: see bss_journal_decision
+  uint8_t data[BSS_JOURNAL_DATA_SIZE];
+  // frame: millis() at the arrival, the 'now' a press was decided with,
+  // decision: locked_at of the arbiter
+  uint32_t now_ms;
+} bss_journal_entry_t;
+
+typedef struct
+{
+  std::atomic<uint32_t> head;
+  // index + 1 of the entry completely written to a slot, 0 while writing
+  std::atomic<uint32_t> committed[BSS_JOURNAL_ENTRIES];
+  bss_journal_entry_t entries[BSS_JOURNAL_ENTRIES];
+} bss_journal_t;
+
+typedef void (*bss_journal_callback_t)(const bss_journal_entry_t *entry, void *context);
+
+void bss_journal_init(bss_journal_t *journal);
+
+void bss_journal_record(bss_journal_t *journal, const bss_journal_entry_t *entry);
+
+void bss_journal_frame(bss_journal_t *journal, uint32_t time_us, uint32_t now_ms, const uint8_t *mac,
+                       const uint8_t *data, int len, uint8_t status);
+// A decision refers to its input by the time_us the input was journaled with,
+// frames and button events interleave in the ring. A press decision also
+// keeps the arbiter 'lock', which a replay starts from, NULL for buttons.
+void bss_journal_decision(bss_journal_t *journal, uint32_t time_us, uint32_t input_us, uint8_t decision,
+                          uint8_t winner, uint16_t seq, const bss_arbiter_t *lock);
+uint32_t bss_journal_input_us(const bss_journal_entry_t *entry);
+// The arbiter after a lockout decision.
+void bss_journal_lock(const bss_journal_entry_t *entry, bss_arbiter_t *lock);
+void bss_journal_button(bss_journal_t *journal, uint32_t time_us, uint8_t button, uint8_t event);
+
+// Calls 'callback' for every complete entry, oldest first. Entries that are
+// overwritten meanwhile are skipped.
+void bss_journal_for_each(const bss_journal_t *journal, bss_journal_callback_t callback, void *context);
+
+// One entry per line:
+//   J <time_us> <kind> <status> <id> <len> <seq> <mac> <data> <now_ms>
+// with mac and data as hex. Returns the length written like snprintf.
+int bss_journal_format(const bss_journal_entry_t *entry, char *buf, size_t size);
+
+// Parses a line written by bss_journal_format.
+bool bss_journal_parse(const char *line, bss_journal_entry_t *entry);
+
+#endif
@@ -0,0 +1,85 @@
+/*
+  Copyright © 2024 Leonard Sebastian Schwennesen. All rights reserved.
+*/
+
+#ifndef BSS_POOL_H
+#define BSS_POOL_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include "bss_frame.h"
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#else
+#include <mutex>
+#endif
+
+// Fixed pool of frame buffers with explicit ownership, so several frames can
+// be in flight at once without copies or heap allocation.
+//
+//   acquire  FREE -> OWNED        the caller builds and seals a frame in it
+//   release  OWNED -> FREE        the frame is not sent after all
+//   submit   OWNED -> IN_FLIGHT   the frame is handed to the radio
+//   complete IN_FLIGHT -> FREE    from the radio's send callback
+//
+// The send callback does not tell which frame it is for, but the radio
+// completes frames in the order they were handed to it. Submissions are
+// numbered under a lock around the radio call, and every completion frees
+// the buffer of the next number. Acquire, release and complete take no lock.
+
+#define BSS_POOL_BUFFERS 8
+
+enum bss_pool_state
+{
+  BSS_POOL_FREE = 0,
+  BSS_POOL_OWNED = 1,
+  BSS_POOL_IN_FLIGHT = 2,
+};
+
+typedef struct
+{
+  uint8_t data[BSS_FRAME_MAX_SIZE];
+  size_t len;
+} bss_pool_buffer_t;
+
+// Hands a frame to the radio, true if a completion will follow.
+typedef bool (*bss_pool_send_t)(const uint8_t *mac, const uint8_t *data, size_t len);
+
+typedef struct
+{
+  std::atomic<uint8_t> state[BSS_POOL_BUFFERS];
+  // submission number of an in flight buffer
+  std::atomic<uint32_t> ticket[BSS_POOL_BUFFERS];
+  // guarded by send_lock
+  uint32_t submitted;
+  std::atomic<uint32_t> completed;
+  // acquires that found no free buffer
+  std::atomic<uint32_t> exhausted;
+#ifdef ARDUINO
+  SemaphoreHandle_t send_lock;
+#else
+  std::mutex send_lock;
+#endif
+  bss_pool_buffer_t buffers[BSS_POOL_BUFFERS];
+} bss_pool_t;
+
+void bss_pool_init(bss_pool_t *pool);
+
+// NULL if all buffers are owned or in flight.
+bss_pool_buffer_t *bss_pool_acquire(bss_pool_t *pool);
+
+void bss_pool_release(bss_pool_t *pool, bss_pool_buffer_t *buffer);
+
+// Sends buffer->len bytes of the buffer through 'send'. The pool owns the
+// buffer afterwards, it is freed right away if 'send' fails.
+bool bss_pool_submit(bss_pool_t *pool, bss_pool_buffer_t *buffer, const uint8_t *mac, bss_pool_send_t send);
+
+// Frees the oldest buffer in flight, called once per send callback.
+void bss_pool_complete(bss_pool_t *pool);
+
+uint8_t bss_pool_in_flight(bss_pool_t *pool);
+uint8_t bss_pool_available(bss_pool_t *pool);
+
+#endif
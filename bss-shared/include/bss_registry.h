@@ -0,0 +1,147 @@
+/*
+  Copyright © 2024 Leonard Sebastian Schwennesen. All rights reserved.
+*/
+
+#ifndef BSS_REGISTRY_H
+#define BSS_REGISTRY_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include "bss_shared.h"
+#include "bss_auth.h"
+
+// The controller's table of paired clients.
+//
+// Readers never lock: they take a versioned snapshot (seqlock) and retry if
+// a writer was active meanwhile. Writers (pairing and removal) have to be
+// serialised by the caller and must not run below the priority of a reader
+// on the same core, as readers spin while a write is in progress. The time
+// of the last message and the last accepted frame counter are kept outside
+// the versioned part, so the receive path can update them without becoming
+// a writer.
+//
+// For persistence every slot encodes to a small record of its own. Writers
+// and advancing frame counters mark their slots dirty, and the owner of the
+// storage rewrites just those, so a pairing costs one record and not the
+// whole table.
+
+#define BSS_REGISTRY_MAX_CLIENTS 64
+#define BSS_REGISTRY_NO_SLOT -1
+
+// [format version][id][mac:6][key:16][rx counter:4][role]
+#define BSS_REGISTRY_RECORD_VERSION 2
+#define BSS_REGISTRY_RECORD_SIZE 29
+#define BSS_REGISTRY_RECORD_ROLE 28
+
+// What a client paired as, from the role byte of its PAIRING_REQUEST.
+enum
+{
+  BSS_CLIENT_BUZZER = 0,
+  // a standby controller, see bss_standby.h
+  BSS_CLIENT_STANDBY = 1,
+};
+
+typedef struct
+{
+  uint8_t id;
+  uint8_t mac[6];
+  uint8_t key[BSS_AUTH_KEY_SIZE];
+  uint8_t role;
+  bool used;
+} bss_client;
+
+typedef struct
+{
+  std::atomic<uint32_t> seq;
+  uint8_t count;
+  bss_client clients[BSS_REGISTRY_MAX_CLIENTS];
+  std::atomic<uint32_t> last_msg[BSS_REGISTRY_MAX_CLIENTS];
+  std::atomic<uint32_t> rx_counter[BSS_REGISTRY_MAX_CLIENTS];
+  // rx counter in the last encoded record
+  std::atomic<uint32_t> persisted_counter[BSS_REGISTRY_MAX_CLIENTS];
+  // one bit per slot whose record is out of date
+  std::atomic<uint32_t> dirty[BSS_REGISTRY_MAX_CLIENTS / 32];
+} bss_registry_t;
+
+void bss_registry_init(bss_registry_t *registry);
+
+// Returns the slot of the client with this id and mac, or
+// BSS_REGISTRY_NO_SLOT. If 'client' is given, it receives a consistent copy.
+int bss_registry_find(const bss_registry_t *registry, uint8_t id, const uint8_t *mac, bss_client *client = NULL);
+
+// Returns the slot of any client with this mac, or BSS_REGISTRY_NO_SLOT.
+int bss_registry_find_mac(const bss_registry_t *registry, const uint8_t *mac);
+
+// Copies the client in 'slot'. Returns false if the slot is unused.
+bool bss_registry_get(const bss_registry_t *registry, int slot, bss_client *client);
+
+uint8_t bss_registry_count(const bss_registry_t *registry);
+
+// Records the time of the last message of the client in 'slot'.
+inline void bss_registry_touch(bss_registry_t *registry, int slot, uint32_t now)
+{
+  registry->last_msg[slot].store(now, std::memory_order_relaxed);
+}
+
+inline uint32_t bss_registry_last_msg(const bss_registry_t *registry, int slot)
+{
+  return registry->last_msg[slot].load(std::memory_order_relaxed);
+}
+
+// Sets the bit of every client in 'heard' (BSS_REGISTRY_MAX_CLIENTS bits)
+// that sent a frame within 'max_age' before 'now'.
+void bss_registry_heard(const bss_registry_t *registry, uint32_t now, uint32_t max_age, uint8_t *heard);
+
+// Accepts the frame counter of the client in 'slot' if it is newer than the
+// last accepted one. Rejects replays. Marks the slot dirty once the counter
+// moved BSS_AUTH_COUNTER_BLOCK past its record, which bounds the replay
+// window after a restore.
+bool bss_registry_accept_counter(bss_registry_t *registry, int slot, uint32_t counter);
+
+// Writer: adds a client, or replaces the session key and role of an existing
+// one, and returns its slot. Returns BSS_REGISTRY_NO_SLOT if the table is
+// full.
+int bss_registry_add(bss_registry_t *registry, uint8_t id, const uint8_t *mac, const uint8_t *key, uint32_t now,
+                     uint8_t role = BSS_CLIENT_BUZZER);
+
+// Writer: removes the client with this id and mac. Returns false if there
+// was none.
+bool bss_registry_remove(bss_registry_t *registry, uint8_t id, const uint8_t *mac);
+
+// Writer: empties 'slot'. Returns false if it was unused.
+bool bss_registry_remove_slot(bss_registry_t *registry, int slot);
+
+// Writer
+void bss_registry_clear(bss_registry_t *registry);
+
+void bss_registry_mark_dirty(bss_registry_t *registry, int slot);
+
+// Returns a dirty slot and clears its mark, or BSS_REGISTRY_NO_SLOT if all
+// records are up to date.
+int bss_registry_take_dirty(bss_registry_t *registry);
+
+// Encodes the record of 'slot' into 'buf' (BSS_REGISTRY_RECORD_SIZE) and
+// returns its size, 0 if the slot is unused and its record is to be deleted.
+size_t bss_registry_encode(const bss_registry_t *registry, int slot, uint8_t *buf);
+
+// Notes that the record of 'slot' was stored, its rx counter is the base for
+// marking the slot dirty again.
+void bss_registry_persisted(bss_registry_t *registry, int slot, const uint8_t *buf);
+
+// Writer: puts the client of a record back into 'slot', which keeps its
+// uplink slot. Records of format version 1 come back as buzzers, unless their
+// id is reserved (bss_frame_id_reserved). Returns false for records of
+// another format version and for those it does not take back.
+bool bss_registry_restore(bss_registry_t *registry, int slot, const uint8_t *buf, size_t len);
+
+// Builds one broadcast frame with a record of 'type' for every client from a
+// consistent snapshot and returns its size. Clients that do not fit into
+// 'capacity' are left out, unless 'next_slot' is given: the frame then starts
+// at that slot and 'next_slot' receives the first slot left out, or
+// BSS_REGISTRY_MAX_CLIENTS if all remaining clients fit.
+size_t bss_registry_build_broadcast(const bss_registry_t *registry, uint8_t *buf, size_t capacity,
+                                    uint8_t type, const uint8_t *payload, uint8_t payload_len,
+                                    int *next_slot = NULL);
+
+#endif
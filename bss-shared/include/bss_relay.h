@@ -0,0 +1,174 @@
+/*
+  Copyright © 2024 Leonard Sebastian Schwennesen. All rights reserved.
+*/
+
+#ifndef BSS_RELAY_H
+#define BSS_RELAY_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include "bss_shared.h"
+#include "bss_registry.h"
+
+// Relaying for buzzers at the edge of the radio range.
+//
+// The controller rates the link of every client by the share of ping
+// periods in which a frame of it arrived directly (bss_links_t). A client
+// with a poor link is told to send its uplink as broadcast, and buzzers with
+// a good link are told to forward it (RELAY_ROLE). A relay wraps the sealed
+// frame of the far client into a RELAY record of its own:
+//
+//   [ttl][origin mac:6][frame of origin]
+//
+// and the controller opens the inner frame as coming from 'origin', so its
+// authentication, replay protection and press time stay those of the far
+// client. A relay that is far itself sends the wrapped frame as broadcast
+// again, which is forwarded while 'ttl' is above 0. Every relay forwards a
+// frame once.
+//
+// The other way, a relay repeats the group frames of the controller that
+// address its far clients unchanged. Their tag binds the controller MAC, so
+// any buzzer opens them as coming from the controller, and its counter
+// check drops the copy it already has.
+//
+// The controller can not tell which buzzers hear a far client, it learns
+// it: every far client gets BSS_RELAY_PER_FAR relays, and a relay that
+// delivered nothing of it within a plan period is replaced by the next
+// candidate. Candidates with the weakest good link come first, as they tend
+// to be the ones farther out.
+
+// hops a frame may take behind the first relay
+#define BSS_RELAY_TTL 2
+// far clients per relay
+#define BSS_RELAY_MAX_FAR 4
+#define BSS_RELAY_PER_FAR 2
+// frames remembered for duplicate suppression
+#define BSS_RELAY_SEEN 16
+#define BSS_RELAY_NONE 0xFF
+
+// [ttl][origin mac:6] in front of the relayed frame
+#define BSS_RELAY_HEADER_SIZE 7
+#define BSS_RELAY_ROLE_ENTRY_SIZE 7
+#define BSS_RELAY_ROLE_MAX_SIZE (1 + BSS_RELAY_MAX_FAR * BSS_RELAY_ROLE_ENTRY_SIZE)
+
+// Link quality, 0-255: a client turns far below BSS_LINK_FAR and is near
+// again above BSS_LINK_NEAR, relays need BSS_LINK_GOOD.
+#define BSS_LINK_FAR 96
+#define BSS_LINK_NEAR 160
+#define BSS_LINK_GOOD 224
+
+// the relays are planned once in this many ping periods
+#define BSS_RELAY_PLAN_PERIODS 4
+// clients not heard at all for this many ping periods are left out
+#define BSS_RELAY_ALIVE_PERIODS 8
+
+enum bss_relay_flags
+{
+  // forward the frames of the listed clients
+  BSS_RELAY_FORWARD = 1,
+  // send the own uplink as broadcast, for the relays to hear it
+  BSS_RELAY_BROADCAST = 2,
+};
+
+// The relay role of a buzzer.
+
+typedef struct
+{
+  uint8_t mac[6];
+  uint32_t counter;
+} bss_relay_seen_t;
+
+typedef struct
+{
+  uint8_t flags;
+  uint8_t far_count;
+  uint8_t far_id[BSS_RELAY_MAX_FAR];
+  uint8_t far_mac[BSS_RELAY_MAX_FAR][6];
+  bss_relay_seen_t seen[BSS_RELAY_SEEN];
+  uint8_t seen_next;
+} bss_relay_t;
+
+void bss_relay_init(bss_relay_t *relay);
+
+// Applies a RELAY_ROLE payload. Returns false if it is malformed.
+bool bss_relay_set_role(bss_relay_t *relay, const uint8_t *payload, uint8_t len);
+
+// Returns true if the frame received from 'mac' has to be forwarded with
+// '*ttl': it comes from a listed far client, it was not forwarded before
+// and a RELAY frame has hops left.
+bool bss_relay_accept(bss_relay_t *relay, const uint8_t *mac, const uint8_t *data, int len, uint8_t *ttl);
+
+// Returns true if a frame of the controller has to be repeated: a group
+// frame that verifies and addresses a listed far client or the fleet.
+bool bss_relay_repeat(bss_relay_t *relay, const uint8_t *controller_mac, const uint8_t *group_key,
+                      const uint8_t *mac, const uint8_t *data, int len);
+
+// Returns true if 'data' from 'mac' is a group frame of the controller
+// repeated by a relay.
+bool bss_relay_repeated(const uint8_t *controller_mac, const uint8_t *group_key, const uint8_t *mac,
+                        const uint8_t *data, int len);
+
+// Appends a RELAY record with the sealed 'frame' of 'origin', see
+// bss_record_put.
+size_t bss_relay_put(uint8_t *buf, size_t capacity, size_t offset, uint8_t id, uint8_t ttl, const uint8_t *origin,
+                     const uint8_t *frame, int len);
+
+// Splits a RELAY record. Returns false if it is malformed.
+bool bss_relay_open(const uint8_t *record, uint8_t *ttl, const uint8_t **origin, const uint8_t **frame, int *len);
+
+// bss_tx_priority of a forwarded frame: presses and show state are urgent.
+uint8_t bss_relay_priority(const uint8_t *data, int len);
+
+// Link quality on the controller.
+
+typedef struct
+{
+  // a frame arrived directly since the last update
+  std::atomic<bool> direct[BSS_REGISTRY_MAX_CLIENTS];
+  uint8_t quality[BSS_REGISTRY_MAX_CLIENTS];
+} bss_links_t;
+
+void bss_links_init(bss_links_t *links);
+
+// A frame of the client in 'slot' arrived directly.
+inline void bss_links_touch(bss_links_t *links, int slot)
+{
+  links->direct[slot].store(true, std::memory_order_relaxed);
+}
+
+// Once per ping period: moves the quality of every client towards 255 if
+// it was heard directly, towards 0 if not. New clients start at
+// BSS_LINK_NEAR.
+void bss_links_update(bss_links_t *links, const bss_registry_t *registry);
+
+// The relay plan of the controller.
+
+typedef struct
+{
+  bool far[BSS_REGISTRY_MAX_CLIENTS];
+  // relay slots of every far client, BSS_RELAY_NONE if unused
+  std::atomic<uint8_t> relays[BSS_REGISTRY_MAX_CLIENTS][BSS_RELAY_PER_FAR];
+  // frames each relay delivered in the current plan period
+  std::atomic<uint8_t> delivered[BSS_REGISTRY_MAX_CLIENTS][BSS_RELAY_PER_FAR];
+  // rank of the next candidate to try
+  uint8_t cursor[BSS_REGISTRY_MAX_CLIENTS];
+} bss_relay_plan_t;
+
+void bss_relay_plan_init(bss_relay_plan_t *plan);
+
+// The relay in 'relay_slot' delivered a frame of the client in 'far_slot'.
+// Called from the receive path.
+void bss_relay_delivered(bss_relay_plan_t *plan, int far_slot, int relay_slot);
+
+// Once in BSS_RELAY_PLAN_PERIODS: marks the far clients, keeps the relays
+// that delivered and tries new ones for the others. Clients whose last
+// frame is older than 'max_age' take no part.
+void bss_relay_plan(bss_relay_plan_t *plan, const bss_registry_t *registry, const bss_links_t *links, uint32_t now,
+                    uint32_t max_age);
+
+// Builds the RELAY_ROLE payload (BSS_RELAY_ROLE_MAX_SIZE) of the client in
+// 'slot' and returns its size.
+size_t bss_relay_role(const bss_relay_plan_t *plan, const bss_registry_t *registry, int slot, uint8_t *payload);
+
+#endif
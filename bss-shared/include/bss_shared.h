@@ -18,9 +18,35 @@
 #define BSS_MSG_PING 0x06
 #define BSS_MSG_SET_NEOPIXEL_COLOR 0x07
 #define BSS_MSG_RESET_NEOPIXEL 0x08
+#define BSS_MSG_CONFIG 0x09
+#define BSS_MSG_HEARTBEAT 0x0A
+#define BSS_MSG_MIRROR_STATE 0x0B
+#define BSS_MSG_MIRROR_CLIENT 0x0C
+#define BSS_MSG_TAKEOVER 0x0D
+#define BSS_MSG_RELAY 0x0E
+#define BSS_MSG_RELAY_ROLE 0x0F
+
+// Payloads
+//  PAIRING_REQUEST:    [buzzer nonce:8][role, see bss_registry.h, a buzzer if missing]
+//  PAIRING_ACCEPTED:   [controller nonce:8][group key:16, encrypted with the session key]
+//                      [uplink slot][controller time:4], see bss_slot.h
+//  WAKEUP_ACCEPTED:    [controller time:4]
+//  BUZZER_PRESSED:     [press time:4], controller time
+//  SET_NEOPIXEL_COLOR: [r][g][b][show seq:2][show phase]
+//  WAKEUP_REQUEST:     [config version:2]
+//  PING:               [config version:2]
+//  CONFIG:             bss_config_t, see bss_config.h
+//  HEARTBEAT:          bss_heartbeat_t, see bss_heartbeat.h
+//  MIRROR_STATE:       [counter:4][phase][winner][show seq:2][bss_config_t]
+//  MIRROR_CLIENT:      [slot][nonce:4][registry record], or [slot] if removed
+//  TAKEOVER:           [counter:4][tag:4], see bss_standby.h
+//  RELAY:              [ttl][origin mac:6][frame of origin], see bss_relay.h
+//  RELAY_ROLE:         [flags]([id][mac:6])*, see bss_relay.h
 
 // ESP NOW Config
 #define BSS_ESP_NOW_CHANNEL 0
+// Frames are authenticated by bss_auth instead, which is not limited in the
+// number of peers.
 #define BSS_ESP_NOW_ENCRYPT false
 
 // MAC Utils
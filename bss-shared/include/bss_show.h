@@ -0,0 +1,140 @@
+/*
+  Copyright © 2024 Leonard Sebastian Schwennesen. All rights reserved.
+*/
+
+#ifndef BSS_SHOW_H
+#define BSS_SHOW_H
+
+#include <stdint.h>
+#include <atomic>
+
+// The controller's show state, packed into one atomic word so the receive
+// path and the moderator buttons can read and change it without a lock:
+//
+//   [seq:16][winner:8][phase:8]
+//
+// Every change increments 'seq'.
+
+enum bss_show_phase
+{
+  BSS_SHOW_OPEN = 0,
+  BSS_SHOW_LOCKED = 1,
+  // the moderator judged the winner's answer, the show stays locked
+  BSS_SHOW_RIGHT = 2,
+  BSS_SHOW_WRONG = 3,
+};
+
+typedef struct
+{
+  std::atomic<uint32_t> word;
+} bss_show_t;
+
+typedef struct
+{
+  bss_show_phase phase;
+  uint8_t winner;
+  uint16_t seq;
+} bss_show_snapshot_t;
+
+inline bss_show_snapshot_t bss_show_unpack(uint32_t word)
+{
+  return {(bss_show_phase)(word & 0xFF), (uint8_t)(word >> 8), (uint16_t)(word >> 16)};
+}
+
+inline uint32_t bss_show_pack(bss_show_phase phase, uint8_t winner, uint16_t seq)
+{
+  return (uint32_t)seq << 16 | (uint32_t)winner << 8 | phase;
+}
+
+inline void bss_show_init(bss_show_t *show)
+{
+  show->word.store(bss_show_pack(BSS_SHOW_OPEN, 0, 0), std::memory_order_relaxed);
+}
+
+inline bss_show_snapshot_t bss_show_read(const bss_show_t *show)
+{
+  return bss_show_unpack(show->word.load(std::memory_order_acquire));
+}
+
+// Locks the show for the client 'id' if it is open. Returns true if this
+// press won the lockout.
+inline bool bss_show_try_lock(bss_show_t *show, uint8_t id)
+{
+  uint32_t word = show->word.load(std::memory_order_relaxed);
+  bss_show_snapshot_t state;
+
+  do
+  {
+    state = bss_show_unpack(word);
+
+    if (state.phase != BSS_SHOW_OPEN)
+      return false;
+  } while (!show->word.compare_exchange_weak(word, bss_show_pack(BSS_SHOW_LOCKED, id, state.seq + 1),
+                                             std::memory_order_acq_rel, std::memory_order_relaxed));
+
+  return true;
+}
+
+// Hands the lockout of the locked state 'seq' to the client 'id'. Returns
+// false if the show changed since.
+inline bool bss_show_transfer(bss_show_t *show, uint16_t seq, uint8_t id)
+{
+  uint32_t word = show->word.load(std::memory_order_relaxed);
+  bss_show_snapshot_t state;
+
+  do
+  {
+    state = bss_show_unpack(word);
+
+    if (state.phase != BSS_SHOW_LOCKED || state.seq != seq)
+      return false;
+  } while (!show->word.compare_exchange_weak(word, bss_show_pack(BSS_SHOW_LOCKED, id, seq + 1),
+                                             std::memory_order_acq_rel, std::memory_order_relaxed));
+
+  return true;
+}
+
+// Sets the verdict (BSS_SHOW_RIGHT or BSS_SHOW_WRONG) of a locked show.
+// Returns false if the show is open or already has this verdict.
+inline bool bss_show_judge(bss_show_t *show, bss_show_phase verdict)
+{
+  uint32_t word = show->word.load(std::memory_order_relaxed);
+  bss_show_snapshot_t state;
+
+  do
+  {
+    state = bss_show_unpack(word);
+
+    if (state.phase == BSS_SHOW_OPEN || state.phase == verdict)
+      return false;
+  } while (!show->word.compare_exchange_weak(word, bss_show_pack(verdict, state.winner, state.seq + 1),
+                                             std::memory_order_acq_rel, std::memory_order_relaxed));
+
+  return true;
+}
+
+// Opens a locked show again. Returns false if it was not locked.
+inline bool bss_show_reset(bss_show_t *show)
+{
+  uint32_t word = show->word.load(std::memory_order_relaxed);
+  bss_show_snapshot_t state;
+
+  do
+  {
+    state = bss_show_unpack(word);
+
+    if (state.phase == BSS_SHOW_OPEN)
+      return false;
+  } while (!show->word.compare_exchange_weak(word, bss_show_pack(BSS_SHOW_OPEN, 0, state.seq + 1),
+                                             std::memory_order_acq_rel, std::memory_order_relaxed));
+
+  return true;
+}
+
+// Continues the show of another controller, see bss_standby.h.
+inline void bss_show_restore(bss_show_t *show, bss_show_snapshot_t state)
+{
+  show->word.store(bss_show_pack(state.phase, state.winner, state.seq), std::memory_order_release);
+}
+
+#endif
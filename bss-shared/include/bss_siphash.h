@@ -0,0 +1,16 @@
+/*
+  Copyright © 2024 Leonard Sebastian Schwennesen. All rights reserved.
+*/
+
+#ifndef BSS_SIPHASH_H
+#define BSS_SIPHASH_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define BSS_SIPHASH_KEY_SIZE 16
+
+// SipHash-2-4 with a 128 bit key, see https://www.aumasson.jp/siphash/
+uint64_t bss_siphash(const uint8_t *key, const uint8_t *data, size_t len);
+
+#endif
@@ -0,0 +1,41 @@
+/*
+  Copyright © 2024 Leonard Sebastian Schwennesen. All rights reserved.
+*/
+
+#ifndef BSS_SLOT_H
+#define BSS_SLOT_H
+
+#include <stdint.h>
+
+// Slotted uplink for the periodic buzzer traffic. The ping period is split
+// into BSS_SLOT_COUNT slots, the controller hands every buzzer its registry
+// slot at pairing together with its clock. Pings and wakeup requests are
+// sent at the start of the own slot, so background traffic is spread evenly
+// over the period. Presses are sent at once and never wait for a slot.
+//
+// Times are the controller's millis(). Buzzers keep the offset of their own
+// clock to it.
+
+#define BSS_SLOT_COUNT 64
+#define BSS_SLOT_NONE 0xFF
+
+// PAIRING_ACCEPTED: [slot][controller time:4] after nonce and group key,
+// WAKEUP_ACCEPTED:  [controller time:4]
+#define BSS_SLOT_TIME_SIZE 4
+
+// Start of 'slot' within a period.
+inline uint32_t bss_slot_offset(uint8_t slot, uint32_t period_ms)
+{
+  return (uint64_t)slot * period_ms / BSS_SLOT_COUNT;
+}
+
+// Time from 'controller_now' to the next start of 'slot', in (0, period_ms].
+inline uint32_t bss_slot_wait(uint32_t controller_now, uint8_t slot, uint32_t period_ms)
+{
+  uint32_t phase = controller_now % period_ms;
+  uint32_t wait = (bss_slot_offset(slot, period_ms) + period_ms - phase) % period_ms;
+
+  return wait == 0 ? period_ms : wait;
+}
+
+#endif
@@ -0,0 +1,90 @@
+/*
+  Copyright © 2024 Leonard Sebastian Schwennesen. All rights reserved.
+*/
+
+#ifndef BSS_STANDBY_H
+#define BSS_STANDBY_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include "bss_registry.h"
+#include "bss_frame.h"
+#include "bss_show.h"
+#include "bss_config.h"
+
+// Hot standby of a second controller.
+//
+// The standby pairs with the primary like a buzzer, under the reserved id
+// BSS_STANDBY_ID and with the role BSS_CLIENT_STANDBY, which is what marks
+// it in the registry. The primary then mirrors its state to it with the
+// standby's session key:
+//  - MIRROR_STATE with every heartbeat: its frame counter, the show state
+//    and the fleet configuration
+//  - MIRROR_CLIENT for every registry slot that changed, and a few slots per
+//    heartbeat round robin. The session key in the record is encrypted.
+// The group key is the one the standby received when pairing.
+//
+// After BSS_STANDBY_SILENT_PERIODS heartbeat periods without a frame of the
+// primary the standby takes over: it continues the frame counter a block
+// above the last one of the primary and broadcasts TAKEOVER with the group
+// key. Every client gets its own record whose tag is keyed with the client's
+// session key, so only a holder of the registry can move a buzzer to a new
+// controller. Buzzers switch to the sender and keep their pairing. The
+// takeover is repeated with the next BSS_STANDBY_SILENT_PERIODS heartbeats
+// for buzzers that missed it.
+//
+// A primary that comes back after a takeover stops transmitting as soon as
+// it hears a TAKEOVER above its own frame counter, and restarts as a standby.
+// Unless it took over itself before, it has to be paired with the new
+// primary then. The new primary repeats the takeover, above the counter
+// of the old one, whenever it hears a group keyed frame of the controller it
+// took over from.
+
+#define BSS_STANDBY_ID 0xFE
+static_assert(BSS_STANDBY_ID >= BSS_FRAME_ID_RESERVED, "no buzzer may pair as the standby");
+#define BSS_STANDBY_SILENT_PERIODS 3
+
+#define BSS_MIRROR_STATE_SIZE (8 + BSS_CONFIG_WIRE_SIZE)
+#define BSS_MIRROR_CLIENT_SIZE (5 + BSS_REGISTRY_RECORD_SIZE)
+#define BSS_TAKEOVER_SIZE 8
+
+// Appends a MIRROR_STATE record for the standby to the frame in 'buf'.
+// Returns the new frame length, 'i' if the record does not fit.
+size_t bss_mirror_put_state(uint8_t *buf, size_t capacity, size_t i, uint32_t counter, bss_show_snapshot_t show,
+                            const bss_config_t *config);
+
+// Appends a MIRROR_CLIENT record of 'slot', encrypted with 'key' under
+// 'nonce', which must never repeat for this key.
+size_t bss_mirror_put_client(uint8_t *buf, size_t capacity, size_t i, const bss_registry_t *registry, int slot,
+                             const uint8_t *key, uint32_t nonce);
+
+// Standby: applies a MIRROR_STATE record.
+bool bss_mirror_apply_state(const uint8_t *record, uint32_t *counter, bss_show_t *show, bss_config_t *config);
+
+// Standby, writer: applies a MIRROR_CLIENT record to its registry and marks
+// the slot dirty. The record of a standby, the receiver itself, empties its
+// slot, so a takeover has no client to remove.
+bool bss_mirror_apply_client(bss_registry_t *registry, const uint8_t *record, const uint8_t *key);
+
+// True once the primary was silent for too long.
+inline bool bss_standby_silent(uint32_t last_heard, uint32_t now, uint16_t ping_ms)
+{
+  return now - last_heard > (uint32_t)BSS_STANDBY_SILENT_PERIODS * ping_ms;
+}
+
+// Tag of a client's TAKEOVER record: SipHash with the client's session key
+// over the new controller's MAC and the takeover counter.
+void bss_takeover_tag(uint8_t *tag, const uint8_t *session_key, const uint8_t *controller_mac, uint32_t counter);
+
+// Builds one TAKEOVER frame like bss_registry_build_broadcast, with a record
+// for every client but the standby itself.
+size_t bss_standby_build_takeover(const bss_registry_t *registry, uint8_t *buf, size_t capacity,
+                                  const uint8_t *my_mac, uint32_t counter, int *next_slot);
+
+// Primary: true if 'data' of 'mac' is a TAKEOVER of another controller that
+// holds the group key and the registry (a record tag matches the session key
+// of one of our clients) and continues above our frame 'counter'.
+bool bss_standby_taken_over(const bss_registry_t *registry, const uint8_t *group_key, uint32_t counter,
+                            const uint8_t *mac, const uint8_t *data, int len);
+
+#endif
@@ -0,0 +1,100 @@
+/*
+  Copyright © 2024 Leonard Sebastian Schwennesen. All rights reserved.
+*/
+
+#ifndef BSS_TRACE_H
+#define BSS_TRACE_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+#ifdef ARDUINO
+#include <Arduino.h>
+#else
+#include <chrono>
+#endif
+
+// Stage tracing of the press to light path. A stage is stamped with the CPU
+// cycle counter on entry and exit, the duration goes into min/avg/max
+// statistics of the current core. Tracing is compiled in with -DBSS_TRACE,
+// without it BSS_TRACE_BEGIN and BSS_TRACE_END expand to nothing.
+//
+// Every core only writes its own statistics, so recording takes no lock. A
+// stage interrupted by another stage on the same core may lose its sample.
+// On the host the counter runs in nanoseconds and threads stand in for
+// cores.
+
+enum bss_trace_stage
+{
+  // one scan of the moderator buttons, see bss_input.h
+  BSS_TRACE_DEBOUNCE,
+  BSS_TRACE_MUTEX_WAIT,
+  // parsing and authenticating a received frame
+  BSS_TRACE_OPEN_FRAME,
+  // registry lookup of the sender
+  BSS_TRACE_LOOKUP,
+  BSS_TRACE_DECISION,
+  BSS_TRACE_BROADCAST_BUILD,
+  BSS_TRACE_SEAL,
+  // esp_now_send, until the frame is queued
+  BSS_TRACE_SEND,
+  BSS_TRACE_LED_SHOW,
+  BSS_TRACE_STAGES,
+};
+
+#ifdef ARDUINO
+#define BSS_TRACE_CORES portNUM_PROCESSORS
+#else
+#define BSS_TRACE_CORES 4
+#endif
+
+typedef struct
+{
+  uint32_t count;
+  uint32_t min;
+  uint32_t max;
+  uint64_t sum;
+} bss_trace_stat_t;
+
+inline uint32_t bss_trace_cycles()
+{
+#ifdef ARDUINO
+  return ESP.getCycleCount();
+#else
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+inline uint32_t bss_trace_cycles_per_us()
+{
+#ifdef ARDUINO
+  return getCpuFrequencyMhz();
+#else
+  return 1000;
+#endif
+}
+
+void bss_trace_record(uint8_t stage, uint32_t cycles);
+
+// Statistics of 'stage' on 'core'. Returns false if nothing was recorded.
+bool bss_trace_get(uint8_t core, uint8_t stage, bss_trace_stat_t *stat);
+
+void bss_trace_reset();
+
+const char *bss_trace_name(uint8_t stage);
+
+typedef void (*bss_trace_callback_t)(const char *line, void *context);
+
+// Calls 'callback' with one line per recorded stage and core:
+//   T <core> <stage> n=<count> min=<us> avg=<us> max=<us>
+void bss_trace_summary(bss_trace_callback_t callback, void *context);
+
+#ifdef BSS_TRACE
+#define BSS_TRACE_BEGIN(stage) uint32_t bss_trace_begin_##stage = bss_trace_cycles()
+#define BSS_TRACE_END(stage) bss_trace_record(stage, bss_trace_cycles() - bss_trace_begin_##stage)
+#else
+#define BSS_TRACE_BEGIN(stage) ((void)0)
+#define BSS_TRACE_END(stage) ((void)0)
+#endif
+
+#endif
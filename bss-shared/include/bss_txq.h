@@ -0,0 +1,127 @@
+/*
+  Copyright © 2024 Leonard Sebastian Schwennesen. All rights reserved.
+*/
+
+#ifndef BSS_TXQ_H
+#define BSS_TXQ_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include "bss_auth.h"
+#include "bss_pool.h"
+
+#ifndef ARDUINO
+#include <mutex>
+#endif
+
+// Transmit queue in front of the radio. Frames wait as unsealed records in
+// pool buffers and go out by priority, oldest first within a priority, with
+// at most BSS_TXQ_WINDOW frames handed to the radio before its send
+// callbacks come back.
+//
+// Frames are sealed when they leave the queue, so frame counters still rise
+// in the order frames go on air and reordering never looks like a replay.
+// The lock only guards the entries: one caller at a time seals and sends
+// without it, and a push that finds that going on leaves its frame to it.
+// So a push never waits for a seal or the radio. The radio's send callback
+// only completes its frame, the frames it makes room for are sent by
+// bss_txq_pump from a task of the firmware.
+//
+// A frame pushed with a supersede key replaces a pending frame with the same
+// key and destination in place: only the latest state goes out, at the
+// position of the first one. When the pool runs dry, a pending frame of a
+// lower priority is dropped for the new one.
+
+#define BSS_TXQ_WINDOW 2
+
+// never superseded
+#define BSS_TXQ_KEEP 0
+#define BSS_TXQ_KEY(type, index) ((uint16_t)(0x8000 | (type) << 8 | (index)))
+
+// key id of a buffer that holds a complete frame of another sender, which is
+// sent as it is
+#define BSS_TXQ_SEALED 0xFF
+
+enum bss_tx_priority
+{
+  // presses and show state
+  BSS_TX_URGENT = 0,
+  // pairing, wakeup and configuration
+  BSS_TX_NORMAL = 1,
+  // pings and heartbeats
+  BSS_TX_BACKGROUND = 2,
+};
+
+// Seals 'len' bytes of records in 'buf' (BSS_FRAME_MAX_SIZE) and returns
+// the frame size, 0 on failure.
+typedef size_t (*bss_txq_seal_t)(uint8_t *buf, size_t len, uint8_t key_id, const uint8_t *key);
+
+typedef struct
+{
+  bss_pool_buffer_t *buffer;
+  uint8_t mac[6];
+  uint8_t priority;
+  uint8_t key_id;
+  uint8_t key[BSS_AUTH_KEY_SIZE];
+  uint16_t supersede;
+  uint32_t order;
+} bss_txq_entry_t;
+
+typedef struct
+{
+  // frames waiting in the queue
+  uint8_t depth;
+  uint8_t max_depth;
+  uint8_t in_flight;
+  uint32_t sent;
+  // replaced by a newer frame of the same state
+  uint32_t superseded;
+  // dropped for a frame of a higher priority or for lack of buffers
+  uint32_t dropped;
+  // sealing or the radio failed
+  uint32_t failed;
+} bss_txq_stats_t;
+
+typedef struct
+{
+  bss_pool_t pool;
+  bss_pool_send_t send;
+  bss_txq_seal_t seal;
+  bss_txq_entry_t entries[BSS_POOL_BUFFERS];
+  uint32_t next_order;
+  // a caller is sealing and sending, see pump
+  std::atomic<bool> pumping;
+  bss_txq_stats_t stats;
+#ifdef ARDUINO
+  SemaphoreHandle_t lock;
+#else
+  std::mutex lock;
+#endif
+} bss_txq_t;
+
+void bss_txq_init(bss_txq_t *txq, bss_pool_send_t send, bss_txq_seal_t seal);
+
+// A buffer for a frame of 'priority', NULL if every buffer is in flight or
+// holds a frame of the same or a higher priority.
+bss_pool_buffer_t *bss_txq_acquire(bss_txq_t *txq, uint8_t priority);
+
+// Returns an acquired buffer that is not pushed.
+void bss_txq_release(bss_txq_t *txq, bss_pool_buffer_t *buffer);
+
+// Queues the buffer->len bytes of records in 'buffer' for 'mac', sealed with
+// 'key' when they are sent, or unchanged for BSS_TXQ_SEALED and a NULL key.
+// The queue owns the buffer afterwards.
+void bss_txq_push(bss_txq_t *txq, bss_pool_buffer_t *buffer, const uint8_t *mac, uint8_t priority,
+                  uint16_t supersede, uint8_t key_id, const uint8_t *key);
+
+// Called once per send callback of the radio. Seals and sends nothing, it
+// returns true if frames wait for bss_txq_pump.
+bool bss_txq_sent(bss_txq_t *txq);
+
+// Hands waiting frames to the radio while the window allows it.
+void bss_txq_pump(bss_txq_t *txq);
+
+void bss_txq_get_stats(bss_txq_t *txq, bss_txq_stats_t *stats);
+
+#endif
@@ -0,0 +1,131 @@
+/*
+  Copyright © 2024 Leonard Sebastian Schwennesen. All rights reserved.
+*/
+
+#include "bss_auth.h"
+#include "bss_shared.h"
+#include "bss_frame.h"
+
+#include <string.h>
+
+// Every fleet needs its own key: set BSS_FLEET_KEY to 16 comma separated
+// bytes, the same in both projects, see platformio.ini.
+#ifndef BSS_FLEET_KEY
+#error "BSS_FLEET_KEY is not set, every fleet needs its own key, see platformio.ini"
+#endif
+
+const uint8_t bss_fleet_key[BSS_AUTH_KEY_SIZE] = {BSS_FLEET_KEY};
+
+static constexpr uint8_t fleet_key_bytes[] = {BSS_FLEET_KEY};
+static_assert(sizeof(fleet_key_bytes) == BSS_AUTH_KEY_SIZE, "BSS_FLEET_KEY needs 16 bytes");
+
+static void write_u32(uint8_t *p, uint32_t v)
+{
+  for (int i = 0; i < 4; i++)
+    p[i] = v >> (8 * i);
+}
+
+static uint32_t read_u32(const uint8_t *p)
+{
+  return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+static uint64_t compute_tag(const uint8_t *frame, size_t len, const uint8_t *sender_mac, const uint8_t *key)
+{
+  uint8_t buf[MAC_SIZE + BSS_FRAME_MAX_SIZE];
+
+  mac_copy(buf, sender_mac);
+  memcpy(&buf[MAC_SIZE], frame, len);
+
+  return bss_siphash(key, buf, MAC_SIZE + len);
+}
+
+size_t bss_auth_seal(uint8_t *frame, size_t len, size_t capacity, const uint8_t *sender_mac,
+                     uint8_t key_id, const uint8_t *key, uint32_t counter)
+{
+  if (len + BSS_AUTH_TRAILER_SIZE > capacity || len + BSS_AUTH_TRAILER_SIZE > BSS_FRAME_MAX_SIZE)
+    return 0;
+
+  frame[len] = key_id;
+  write_u32(&frame[len + 1], counter);
+
+  uint64_t tag = compute_tag(frame, len + 5, sender_mac, key);
+
+  for (int i = 0; i < BSS_AUTH_TAG_SIZE; i++)
+    frame[len + 5 + i] = tag >> (8 * i);
+
+  return len + BSS_AUTH_TRAILER_SIZE;
+}
+
+bool bss_auth_parse(const uint8_t *frame, int len, bss_auth_trailer_t *trailer)
+{
+  if (len < BSS_AUTH_TRAILER_SIZE || len > BSS_FRAME_MAX_SIZE)
+    return false;
+
+  trailer->body_len = len - BSS_AUTH_TRAILER_SIZE;
+  trailer->key_id = frame[trailer->body_len];
+  trailer->counter = read_u32(&frame[trailer->body_len + 1]);
+
+  return true;
+}
+
+bool bss_auth_verify(const uint8_t *frame, int len, const uint8_t *sender_mac, const uint8_t *key)
+{
+  uint8_t expected[BSS_AUTH_TAG_SIZE];
+
+  if (len < BSS_AUTH_TRAILER_SIZE || len > BSS_FRAME_MAX_SIZE)
+    return false;
+
+  uint64_t tag = compute_tag(frame, len - BSS_AUTH_TAG_SIZE, sender_mac, key);
+
+  for (int i = 0; i < BSS_AUTH_TAG_SIZE; i++)
+    expected[i] = tag >> (8 * i);
+
+  return bss_auth_equal(expected, &frame[len - BSS_AUTH_TAG_SIZE], BSS_AUTH_TAG_SIZE);
+}
+
+void bss_auth_derive_session_key(uint8_t *key, const uint8_t *buzzer_mac, const uint8_t *controller_mac,
+                                 const uint8_t *buzzer_nonce, const uint8_t *controller_nonce)
+{
+  uint8_t buf[1 + 2 * MAC_SIZE + 2 * BSS_AUTH_NONCE_SIZE];
+
+  mac_copy(&buf[1], buzzer_mac);
+  mac_copy(&buf[1 + MAC_SIZE], controller_mac);
+  memcpy(&buf[1 + 2 * MAC_SIZE], buzzer_nonce, BSS_AUTH_NONCE_SIZE);
+  memcpy(&buf[1 + 2 * MAC_SIZE + BSS_AUTH_NONCE_SIZE], controller_nonce, BSS_AUTH_NONCE_SIZE);
+
+  for (uint8_t half = 0; half < 2; half++)
+  {
+    buf[0] = half;
+    uint64_t out = bss_siphash(bss_fleet_key, buf, sizeof(buf));
+
+    for (int i = 0; i < 8; i++)
+      key[8 * half + i] = out >> (8 * i);
+  }
+}
+
+void bss_auth_crypt(uint8_t *data, size_t len, const uint8_t *key, const uint8_t *nonce)
+{
+  uint8_t block[BSS_AUTH_NONCE_SIZE + 1];
+
+  memcpy(block, nonce, BSS_AUTH_NONCE_SIZE);
+
+  for (size_t i = 0; i < len; i += 8)
+  {
+    block[BSS_AUTH_NONCE_SIZE] = i / 8;
+    uint64_t stream = bss_siphash(key, block, sizeof(block));
+
+    for (size_t j = i; j < len && j < i + 8; j++)
+      data[j] ^= stream >> (8 * (j - i));
+  }
+}
+
+bool bss_auth_equal(const uint8_t *a, const uint8_t *b, size_t len)
+{
+  uint8_t diff = 0;
+
+  for (size_t i = 0; i < len; i++)
+    diff |= a[i] ^ b[i];
+
+  return diff == 0;
+}
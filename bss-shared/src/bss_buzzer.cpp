@@ -0,0 +1,337 @@
+/*
+  Copyright © 2024 Leonard Sebastian Schwennesen. All rights reserved.
+*/
+
+#include "bss_buzzer.h"
+#include "bss_frame.h"
+#include "bss_standby.h"
+#include "bss_show.h"
+
+#include <string.h>
+
+#define BSS_PAIRING_ACCEPTED_SIZE (BSS_AUTH_NONCE_SIZE + BSS_AUTH_KEY_SIZE)
+
+// A stale color takes any show state, a current one only newer ones, so a
+// state that was overtaken on air can not bring back an older one.
+static bool newer_show(const bss_buzzer_t *buzzer, uint16_t seq)
+{
+  return buzzer->show_stale || (int16_t)(seq - buzzer->show_seq) > 0;
+}
+
+void bss_buzzer_init(bss_buzzer_t *buzzer)
+{
+  memset(buzzer, 0, sizeof(bss_buzzer_t));
+
+  buzzer->pairing_state = UNPAIRED;
+  buzzer->show_state = UNINITIALIZED;
+  buzzer->slot = BSS_SLOT_NONE;
+  buzzer->show_stale = true;
+  buzzer->show_phase = BSS_BUZZER_PHASE_UNKNOWN;
+
+  bss_config_default(&buzzer->config);
+  bss_relay_init(&buzzer->relay);
+}
+
+uint8_t bss_buzzer_id(const uint8_t *mac)
+{
+  uint8_t id = 0;
+
+  for (size_t i = 0; i < MAC_SIZE; i++)
+    id += mac[i];
+
+  return bss_frame_id_reserved(id) ? id - 0x80 : id;
+}
+
+static const uint8_t *open_pairing_accepted(bss_buzzer_t *buzzer, const uint8_t *my_mac, const uint8_t *mac,
+                                            const uint8_t *data, int len, const uint8_t *record, uint32_t counter)
+{
+  uint8_t session_key[BSS_AUTH_KEY_SIZE];
+  const uint8_t *controller_nonce = bss_record_payload(record);
+
+  if (bss_record_payload_len(record) < BSS_PAIRING_ACCEPTED_SIZE)
+    return NULL;
+
+  bss_auth_derive_session_key(session_key, my_mac, mac, buzzer->pairing_nonce, controller_nonce);
+
+  if (!bss_auth_verify(data, len, mac, session_key))
+    return NULL;
+
+  memcpy(buzzer->session_key, session_key, BSS_AUTH_KEY_SIZE);
+  memcpy(buzzer->group_key, &controller_nonce[BSS_AUTH_NONCE_SIZE], BSS_AUTH_KEY_SIZE);
+  bss_auth_crypt(buzzer->group_key, BSS_AUTH_KEY_SIZE, session_key, controller_nonce);
+  buzzer->controller_counter = counter;
+
+  return record;
+}
+
+static const uint8_t *open_takeover(bss_buzzer_t *buzzer, const uint8_t *mac, const uint8_t *data, int len,
+                                    const uint8_t *record, const bss_auth_trailer_t *trailer)
+{
+  uint8_t tag[4];
+  const uint8_t *payload = bss_record_payload(record);
+
+  if (trailer->key_id != BSS_AUTH_KEY_GROUP || bss_record_payload_len(record) < BSS_TAKEOVER_SIZE ||
+      !bss_auth_verify(data, len, mac, buzzer->group_key))
+    return NULL;
+
+  uint32_t counter = bss_get_u32(payload);
+
+  bss_takeover_tag(tag, buzzer->session_key, mac, counter);
+
+  // the new controller continues above the counters of the old one
+  if (!bss_auth_equal(tag, &payload[4], sizeof(tag)) || counter <= buzzer->controller_counter ||
+      trailer->counter < counter)
+    return NULL;
+
+  buzzer->controller_counter = trailer->counter;
+  return record;
+}
+
+const uint8_t *bss_buzzer_open_frame(bss_buzzer_t *buzzer, const uint8_t *my_mac, uint8_t my_id,
+                                     const uint8_t *mac, const uint8_t *data, int len)
+{
+  bss_auth_trailer_t trailer;
+  const uint8_t *key;
+
+  if (!bss_auth_parse(data, len, &trailer))
+    return NULL;
+
+  const uint8_t *record = bss_frame_find(data, trailer.body_len, my_id);
+
+  // a record for every client is only taken from frames made for the fleet
+  if (record == NULL && (record = bss_frame_find(data, trailer.body_len, BSS_FRAME_ID_ALL)) != NULL &&
+      bss_record_type(record) != BSS_MSG_HEARTBEAT)
+    return NULL;
+
+  if (record == NULL)
+    return NULL;
+
+  if (buzzer->pairing_state == PAIRING_MODE)
+  {
+    if (trailer.key_id != BSS_AUTH_KEY_SESSION || bss_record_type(record) != BSS_MSG_PAIRING_ACCEPTED)
+      return NULL;
+
+    return open_pairing_accepted(buzzer, my_mac, mac, data, len, record, trailer.counter);
+  }
+
+  if (buzzer->pairing_state != PAIRED)
+    return NULL;
+
+  if (!mac_equal(mac, buzzer->controller_mac))
+    return bss_record_type(record) == BSS_MSG_TAKEOVER ? open_takeover(buzzer, mac, data, len, record, &trailer)
+                                                       : NULL;
+
+  switch (trailer.key_id)
+  {
+  case BSS_AUTH_KEY_SESSION:
+    key = buzzer->session_key;
+    break;
+
+  case BSS_AUTH_KEY_GROUP:
+    key = buzzer->group_key;
+    break;
+
+  // the fleet key is not enough to unpair a paired buzzer
+  default:
+    return NULL;
+  }
+
+  if (!bss_auth_verify(data, len, mac, key) || !bss_auth_accept_counter(&buzzer->controller_counter, trailer.counter))
+    return NULL;
+
+  return record;
+}
+
+bss_buzzer_action bss_buzzer_handle_record(bss_buzzer_t *buzzer, const uint8_t *mac, const uint8_t *record)
+{
+  switch (bss_record_type(record))
+  {
+  case BSS_MSG_WAKEUP_ACCEPTED:
+    if (!mac_equal(mac, buzzer->controller_mac))
+      return BSS_BUZZER_NONE;
+
+    buzzer->show_state = INIT;
+    return BSS_BUZZER_SHOW_INIT;
+
+  case BSS_MSG_SET_NEOPIXEL_COLOR:
+    if (!mac_equal(mac, buzzer->controller_mac) || bss_record_payload_len(record) < 3)
+      return BSS_BUZZER_NONE;
+
+    if (bss_record_payload_len(record) >= 5)
+    {
+      uint16_t seq = bss_get_u16(&bss_record_payload(record)[3]);
+
+      // a repeat of the state our press is based on, or an older state
+      if (!newer_show(buzzer, seq) && (buzzer->provisional || seq != buzzer->show_seq))
+        return BSS_BUZZER_NONE;
+
+      buzzer->show_seq = seq;
+      buzzer->show_stale = false;
+    }
+
+    buzzer->show_phase =
+        bss_record_payload_len(record) >= 6 ? bss_record_payload(record)[5] : BSS_BUZZER_PHASE_UNKNOWN;
+    buzzer->provisional = false;
+
+    return BSS_BUZZER_SET_COLOR;
+
+  case BSS_MSG_HEARTBEAT:
+  {
+    uint32_t last_time = buzzer->heartbeat.time;
+
+    if (!mac_equal(mac, buzzer->controller_mac) ||
+        !bss_heartbeat_decode(bss_record_payload(record), bss_record_payload_len(record), &buzzer->heartbeat))
+      return BSS_BUZZER_NONE;
+
+    // the controller restarted and counts its show seq from 0 again
+    if ((int32_t)(buzzer->heartbeat.time - last_time) < 0)
+      buzzer->show_stale = true;
+
+    return BSS_BUZZER_HEARTBEAT;
+  }
+
+  case BSS_MSG_CONFIG:
+  {
+    bss_config_t config;
+
+    if (!mac_equal(mac, buzzer->controller_mac) ||
+        !bss_config_decode(bss_record_payload(record), bss_record_payload_len(record), &config) ||
+        config.version == buzzer->config.version)
+      return BSS_BUZZER_NONE;
+
+    buzzer->config = config;
+    return BSS_BUZZER_CONFIG;
+  }
+
+  case BSS_MSG_RELAY_ROLE:
+    if (!mac_equal(mac, buzzer->controller_mac) ||
+        !bss_relay_set_role(&buzzer->relay, bss_record_payload(record), bss_record_payload_len(record)))
+      return BSS_BUZZER_NONE;
+
+    return BSS_BUZZER_RELAY_ROLE;
+
+  case BSS_MSG_PAIRING_ACCEPTED:
+    if (buzzer->pairing_state == PAIRED)
+      return BSS_BUZZER_PAIRING_STOP;
+
+    buzzer->pairing_state = PAIRED;
+    buzzer->show_state = INIT;
+    buzzer->show_stale = true;
+    mac_copy(buzzer->controller_mac, mac);
+
+    if (bss_record_payload_len(record) > BSS_PAIRING_ACCEPTED_SIZE)
+      buzzer->slot = bss_record_payload(record)[BSS_PAIRING_ACCEPTED_SIZE];
+    else
+      buzzer->slot = BSS_SLOT_NONE;
+
+    return BSS_BUZZER_PAIRED;
+
+  case BSS_MSG_TAKEOVER:
+    if (buzzer->pairing_state != PAIRED || mac_equal(mac, buzzer->controller_mac))
+      return BSS_BUZZER_NONE;
+
+    // the show seq of the new controller comes from its mirror
+    mac_copy(buzzer->controller_mac, mac);
+    buzzer->show_stale = true;
+    return BSS_BUZZER_TAKEOVER;
+
+  case BSS_MSG_PAIRING_REMOVE:
+    if (buzzer->pairing_state == UNPAIRED)
+      return BSS_BUZZER_PAIRING_STOP;
+
+    buzzer->pairing_state = UNPAIRED;
+    return BSS_BUZZER_UNPAIRED;
+
+  default:
+    return BSS_BUZZER_NONE;
+  }
+}
+
+bool bss_buzzer_sync_clock(bss_buzzer_t *buzzer, const uint8_t *record, uint32_t now)
+{
+  int offset = bss_controller_time_offset(bss_record_type(record));
+
+  if (offset < 0 || bss_record_payload_len(record) < offset + BSS_SLOT_TIME_SIZE)
+    return false;
+
+  buzzer->clock_offset = bss_get_u32(&bss_record_payload(record)[offset]) - now;
+  return true;
+}
+
+bool bss_buzzer_resync_show(bss_buzzer_t *buzzer)
+{
+  if (!newer_show(buzzer, buzzer->heartbeat.seq))
+    return false;
+
+  buzzer->show_phase = buzzer->heartbeat.phase;
+  buzzer->show_seq = buzzer->heartbeat.seq;
+  buzzer->show_stale = false;
+  buzzer->provisional = false;
+  return true;
+}
+
+bool bss_buzzer_speculate(bss_buzzer_t *buzzer, uint32_t now)
+{
+  if (buzzer->config.provisional_ms == 0 || buzzer->show_stale || buzzer->show_phase != BSS_SHOW_OPEN ||
+      buzzer->provisional)
+    return false;
+
+  buzzer->provisional = true;
+  buzzer->provisional_since = now;
+  return true;
+}
+
+bool bss_buzzer_provisional_expired(bss_buzzer_t *buzzer, uint32_t now)
+{
+  if (!buzzer->provisional || now - buzzer->provisional_since < buzzer->config.provisional_ms)
+    return false;
+
+  buzzer->provisional = false;
+  return true;
+}
+
+bool bss_buzzer_heard(const bss_buzzer_t *buzzer)
+{
+  if (buzzer->heartbeat.config_version != buzzer->config.version)
+    return false;
+
+  return buzzer->slot == BSS_SLOT_NONE || bss_heartbeat_heard(&buzzer->heartbeat, buzzer->slot);
+}
+
+uint32_t bss_buzzer_slot_wait(const bss_buzzer_t *buzzer, uint32_t now)
+{
+  if (buzzer->slot == BSS_SLOT_NONE)
+    return buzzer->config.ping_ms;
+
+  return bss_slot_wait(now + buzzer->clock_offset, buzzer->slot, buzzer->config.ping_ms);
+}
+
+bss_buzzer_action bss_buzzer_handle_button(bss_buzzer_t *buzzer, const BssButton *button, unsigned long now)
+{
+  if (buzzer->pairing_state == PAIRED)
+  {
+    if (button->state == PRESSED)
+      return BSS_BUZZER_SEND_PRESS;
+
+    if (button->state == HOLD &&
+        (now - button->last_pressed) >= (unsigned long)BSS_BUZZER_UNPAIR_HOLDS * buzzer->config.pairing_hold_ms)
+    {
+      buzzer->pairing_state = PAIRING_MODE;
+      buzzer->show_stale = true;
+      return BSS_BUZZER_UNPAIR;
+    }
+  }
+  else if (buzzer->pairing_state != PAIRING_MODE)
+  {
+    if (buzzer->show_state == UNINITIALIZED && button->state == UNPRESSED && (now - button->last_pressed) > buzzer->config.idle_sleep_ms)
+      return BSS_BUZZER_SLEEP;
+
+    if (button->state == HOLD && (now - button->last_pressed) >= buzzer->config.pairing_hold_ms)
+    {
+      buzzer->pairing_state = PAIRING_MODE;
+      return BSS_BUZZER_PAIRING_START;
+    }
+  }
+
+  return BSS_BUZZER_NONE;
+}
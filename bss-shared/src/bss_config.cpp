@@ -0,0 +1,113 @@
+/*
+  Copyright © 2024 Leonard Sebastian Schwennesen. All rights reserved.
+*/
+
+#include "bss_config.h"
+#include "bss_frame.h"
+#include "bss_button.h"
+#include "bss_buzzer.h"
+
+#include <stdio.h>
+#include <string.h>
+
+void bss_config_default(bss_config_t *config)
+{
+  config->version = 0;
+  config->brightness = 10;
+  config->led_num = 12;
+  config->sleep_s = 5;
+  config->ping_ms = 2000;
+  config->debounce_ms = BSS_BUTTON_DEBOUNCE_MS;
+  config->pairing_ms = 10000;
+  config->pairing_hold_ms = BSS_BUZZER_PAIRING_HOLD_MS;
+  config->idle_sleep_ms = BSS_BUZZER_IDLE_SLEEP_MS;
+  config->provisional_ms = 0;
+}
+
+void bss_config_encode(const bss_config_t *config, uint8_t *buf)
+{
+  bss_put_u16(&buf[0], config->version);
+  buf[2] = config->brightness;
+  buf[3] = config->led_num;
+  bss_put_u16(&buf[4], config->sleep_s);
+  bss_put_u16(&buf[6], config->ping_ms);
+  buf[8] = config->debounce_ms;
+  bss_put_u16(&buf[9], config->pairing_ms);
+  bss_put_u16(&buf[11], config->pairing_hold_ms);
+  bss_put_u16(&buf[13], config->idle_sleep_ms);
+  bss_put_u16(&buf[15], config->provisional_ms);
+}
+
+bool bss_config_decode(const uint8_t *buf, size_t len, bss_config_t *config)
+{
+  bss_config_t decoded;
+
+  if (len < BSS_CONFIG_MIN_WIRE_SIZE)
+    return false;
+
+  decoded.version = bss_get_u16(&buf[0]);
+  decoded.brightness = buf[2];
+  decoded.led_num = buf[3];
+  decoded.sleep_s = bss_get_u16(&buf[4]);
+  decoded.ping_ms = bss_get_u16(&buf[6]);
+  decoded.debounce_ms = buf[8];
+  decoded.pairing_ms = bss_get_u16(&buf[9]);
+  decoded.pairing_hold_ms = bss_get_u16(&buf[11]);
+  decoded.idle_sleep_ms = bss_get_u16(&buf[13]);
+  decoded.provisional_ms = len >= BSS_CONFIG_WIRE_SIZE ? bss_get_u16(&buf[15]) : 0;
+
+  if (!bss_config_valid(&decoded))
+    return false;
+
+  *config = decoded;
+  return true;
+}
+
+bool bss_config_valid(const bss_config_t *config)
+{
+  return config->led_num >= 1 && config->led_num <= BSS_CONFIG_MAX_LEDS && config->sleep_s >= 1 &&
+         config->ping_ms >= 100 && config->pairing_ms >= 1000 && config->pairing_hold_ms >= 100 &&
+         config->idle_sleep_ms >= 100;
+}
+
+bool bss_config_set(bss_config_t *config, const char *name, unsigned long value)
+{
+  bss_config_t changed = *config;
+
+  if (strcmp(name, "brightness") == 0 && value <= UINT8_MAX)
+    changed.brightness = value;
+  else if (strcmp(name, "led_num") == 0 && value <= UINT8_MAX)
+    changed.led_num = value;
+  else if (strcmp(name, "sleep_s") == 0 && value <= UINT16_MAX)
+    changed.sleep_s = value;
+  else if (strcmp(name, "ping_ms") == 0 && value <= UINT16_MAX)
+    changed.ping_ms = value;
+  else if (strcmp(name, "debounce_ms") == 0 && value <= UINT8_MAX)
+    changed.debounce_ms = value;
+  else if (strcmp(name, "pairing_ms") == 0 && value <= UINT16_MAX)
+    changed.pairing_ms = value;
+  else if (strcmp(name, "pairing_hold_ms") == 0 && value <= UINT16_MAX)
+    changed.pairing_hold_ms = value;
+  else if (strcmp(name, "idle_sleep_ms") == 0 && value <= UINT16_MAX)
+    changed.idle_sleep_ms = value;
+  else if (strcmp(name, "provisional_ms") == 0 && value <= UINT16_MAX)
+    changed.provisional_ms = value;
+  else
+    return false;
+
+  if (!bss_config_valid(&changed))
+    return false;
+
+  *config = changed;
+  return true;
+}
+
+int bss_config_format(const bss_config_t *config, char *buf, size_t size)
+{
+  return snprintf(buf, size,
+                  "version=%u brightness=%u led_num=%u sleep_s=%u ping_ms=%u debounce_ms=%u pairing_ms=%u "
+                  "pairing_hold_ms=%u idle_sleep_ms=%u provisional_ms=%u",
+                  config->version, config->brightness, config->led_num, config->sleep_s, config->ping_ms,
+                  config->debounce_ms, config->pairing_ms, config->pairing_hold_ms, config->idle_sleep_ms,
+                  config->provisional_ms);
+}
@@ -0,0 +1,58 @@
+/*
+  Copyright © 2024 Leonard Sebastian Schwennesen. All rights reserved.
+*/
+
+#include "bss_frame.h"
+
+#include <string.h>
+
+size_t bss_record_put(uint8_t *buf, size_t capacity, size_t offset, uint8_t id,
+                      uint8_t type, const uint8_t *payload, uint8_t payload_len)
+{
+  size_t record_size = BSS_RECORD_HEADER_SIZE + 1 + payload_len;
+
+  if (offset + record_size > capacity || payload_len > 254)
+    return offset;
+
+  buf[offset] = id;
+  buf[offset + 1] = payload_len + 1;
+  buf[offset + 2] = type;
+
+  if (payload_len > 0)
+    memcpy(&buf[offset + 3], payload, payload_len);
+
+  return offset + record_size;
+}
+
+const uint8_t *bss_frame_first(const uint8_t *data, int len)
+{
+  if (len < BSS_RECORD_HEADER_SIZE + 1 || data[1] < 1 || data[1] + BSS_RECORD_HEADER_SIZE > len)
+    return NULL;
+
+  return data;
+}
+
+const uint8_t *bss_frame_find(const uint8_t *data, int len, uint8_t id)
+{
+  for (int i = 0; i + BSS_RECORD_HEADER_SIZE <= len;)
+  {
+    int record_size = data[i + 1] + BSS_RECORD_HEADER_SIZE;
+
+    if (data[i + 1] < 1 || i + record_size > len)
+      return NULL;
+
+    if (data[i] == id)
+      return &data[i];
+
+    i += record_size;
+  }
+
+  return NULL;
+}
+
+const uint8_t *bss_frame_next(const uint8_t *data, int len, const uint8_t *record, uint8_t id)
+{
+  int offset = record - data + record[1] + BSS_RECORD_HEADER_SIZE;
+
+  return bss_frame_find(&data[offset], len - offset, id);
+}
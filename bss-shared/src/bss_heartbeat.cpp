@@ -0,0 +1,56 @@
+/*
+  Copyright © 2024 Leonard Sebastian Schwennesen. All rights reserved.
+*/
+
+#include "bss_heartbeat.h"
+#include "bss_frame.h"
+#include "bss_auth.h"
+#include "bss_shared.h"
+
+#include <string.h>
+
+void bss_heartbeat_encode(const bss_heartbeat_t *heartbeat, uint8_t *buf)
+{
+  buf[0] = heartbeat->phase;
+  buf[1] = heartbeat->winner;
+  bss_put_u16(&buf[2], heartbeat->seq);
+  memcpy(&buf[4], heartbeat->color, 3);
+  bss_put_u32(&buf[BSS_HEARTBEAT_TIME_OFFSET], heartbeat->time);
+  bss_put_u16(&buf[11], heartbeat->config_version);
+  memcpy(&buf[13], heartbeat->heard, BSS_HEARTBEAT_HEARD_SIZE);
+}
+
+bool bss_heartbeat_decode(const uint8_t *buf, size_t len, bss_heartbeat_t *heartbeat)
+{
+  if (len < BSS_HEARTBEAT_SIZE)
+    return false;
+
+  heartbeat->phase = buf[0];
+  heartbeat->winner = buf[1];
+  heartbeat->seq = bss_get_u16(&buf[2]);
+  memcpy(heartbeat->color, &buf[4], 3);
+  heartbeat->time = bss_get_u32(&buf[BSS_HEARTBEAT_TIME_OFFSET]);
+  heartbeat->config_version = bss_get_u16(&buf[11]);
+  memcpy(heartbeat->heard, &buf[13], BSS_HEARTBEAT_HEARD_SIZE);
+
+  return true;
+}
+
+int bss_controller_time_offset(uint8_t type)
+{
+  switch (type)
+  {
+  case BSS_MSG_PAIRING_ACCEPTED:
+    // after nonce, group key and slot
+    return BSS_AUTH_NONCE_SIZE + BSS_AUTH_KEY_SIZE + 1;
+
+  case BSS_MSG_WAKEUP_ACCEPTED:
+    return 0;
+
+  case BSS_MSG_HEARTBEAT:
+    return BSS_HEARTBEAT_TIME_OFFSET;
+
+  default:
+    return -1;
+  }
+}
@@ -0,0 +1,77 @@
+/*
+  Copyright © 2024 Leonard Sebastian Schwennesen. All rights reserved.
+*/
+
+#include "bss_input.h"
+
+static void push(bss_input_t *input, uint32_t time_us, uint8_t button, uint8_t event)
+{
+  uint32_t head = input->head.load(std::memory_order_relaxed);
+
+  if (head - input->tail.load(std::memory_order_acquire) >= BSS_INPUT_QUEUE_SIZE)
+  {
+    input->dropped.fetch_add(1, std::memory_order_relaxed);
+    return;
+  }
+
+  input->events[head % BSS_INPUT_QUEUE_SIZE] = {time_us, button, event};
+  input->head.store(head + 1, std::memory_order_release);
+}
+
+// The moderator event of the button's current state, or -1.
+static int button_event(BssButton *button, unsigned long now_ms, unsigned long hold_ms)
+{
+  if (button->state == PRESSED)
+    return BSS_EVENT_PRESS;
+
+  if (button->state == RELEASED)
+  {
+    button->locked = false;
+    return BSS_EVENT_RELEASE;
+  }
+
+  if (button->state == HOLD && now_ms - button->last_pressed >= hold_ms && !button->locked)
+  {
+    button->locked = true;
+    return BSS_EVENT_HOLD;
+  }
+
+  return -1;
+}
+
+void bss_input_init(bss_input_t *input, BssButton *buttons, uint8_t count, unsigned long hold_ms)
+{
+  input->buttons = buttons;
+  input->count = count < BSS_INPUT_MAX_BUTTONS ? count : BSS_INPUT_MAX_BUTTONS;
+  input->hold_ms = hold_ms;
+  input->head = 0;
+  input->tail = 0;
+  input->dropped = 0;
+}
+
+void bss_input_scan(bss_input_t *input, uint32_t pressed, unsigned long now_ms, uint32_t time_us)
+{
+  for (uint8_t i = 0; i < input->count; i++)
+  {
+    BssButton *button = &input->buttons[i];
+
+    button->update(pressed >> i & 1, now_ms);
+
+    int event = button_event(button, now_ms, input->hold_ms);
+
+    if (event >= 0)
+      push(input, time_us, i, event);
+  }
+}
+
+bool bss_input_pop(bss_input_t *input, bss_input_event_t *event)
+{
+  uint32_t tail = input->tail.load(std::memory_order_relaxed);
+
+  if (tail == input->head.load(std::memory_order_acquire))
+    return false;
+
+  *event = input->events[tail % BSS_INPUT_QUEUE_SIZE];
+  input->tail.store(tail + 1, std::memory_order_release);
+  return true;
+}
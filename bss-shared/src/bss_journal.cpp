@@ -0,0 +1,161 @@
+/*
+  Copyright © 2024 Leonard Sebastian Schwennesen. All rights reserved.
+*/
+
+#include "bss_journal.h"
+#include "bss_shared.h"
+#include "bss_frame.h"
+
+#include <stdio.h>
+#include <string.h>
+
+void bss_journal_init(bss_journal_t *journal)
+{
+  journal->head.store(0, std::memory_order_relaxed);
+
+  for (int slot = 0; slot < BSS_JOURNAL_ENTRIES; slot++)
+    journal->committed[slot].store(0, std::memory_order_relaxed);
+}
+
+void bss_journal_record(bss_journal_t *journal, const bss_journal_entry_t *entry)
+{
+  uint32_t index = journal->head.fetch_add(1, std::memory_order_relaxed);
+  uint32_t slot = index % BSS_JOURNAL_ENTRIES;
+
+  journal->committed[slot].store(0, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+
+  journal->entries[slot] = *entry;
+
+  journal->committed[slot].store(index + 1, std::memory_order_release);
+}
+
+void bss_journal_frame(bss_journal_t *journal, uint32_t time_us, uint32_t now_ms, const uint8_t *mac,
+                       const uint8_t *data, int len, uint8_t status)
+{
+  bss_journal_entry_t entry = {time_us, BSS_JOURNAL_FRAME, status, 0, (uint8_t)len, 0, {0}, {0}, now_ms};
+
+  if (len > 0)
+    entry.id = data[0];
+
+  mac_copy(entry.mac, mac);
+  memcpy(entry.data, data, len < BSS_JOURNAL_DATA_SIZE ? len : BSS_JOURNAL_DATA_SIZE);
+
+  bss_journal_record(journal, &entry);
+}
+
+void bss_journal_decision(bss_journal_t *journal, uint32_t time_us, uint32_t input_us, uint8_t decision,
+                          uint8_t winner, uint16_t seq, const bss_arbiter_t *lock)
+{
+  bss_journal_entry_t entry = {time_us, BSS_JOURNAL_DECISION, decision, winner, 0, seq, {0}, {0}, 0};
+
+  // [input time_us:4][press time:4][window:4]
+  bss_put_u32(&entry.data[0], input_us);
+
+  if (lock != NULL)
+  {
+    bss_put_u32(&entry.data[4], lock->press_time);
+    bss_put_u32(&entry.data[8], lock->window);
+    entry.now_ms = lock->locked_at;
+  }
+
+  bss_journal_record(journal, &entry);
+}
+
+uint32_t bss_journal_input_us(const bss_journal_entry_t *entry)
+{
+  return bss_get_u32(&entry->data[0]);
+}
+
+void bss_journal_lock(const bss_journal_entry_t *entry, bss_arbiter_t *lock)
+{
+  *lock = {entry->seq, bss_get_u32(&entry->data[4]), entry->now_ms, bss_get_u32(&entry->data[8])};
+}
+
+void bss_journal_button(bss_journal_t *journal, uint32_t time_us, uint8_t button, uint8_t event)
+{
+  bss_journal_entry_t entry = {time_us, BSS_JOURNAL_BUTTON, event, button, 0, 0, {0}, {0}, 0};
+
+  bss_journal_record(journal, &entry);
+}
+
+void bss_journal_for_each(const bss_journal_t *journal, bss_journal_callback_t callback, void *context)
+{
+  uint32_t head = journal->head.load(std::memory_order_acquire);
+  uint32_t index = head > BSS_JOURNAL_ENTRIES ? head - BSS_JOURNAL_ENTRIES : 0;
+
+  for (; index < head; index++)
+  {
+    uint32_t slot = index % BSS_JOURNAL_ENTRIES;
+    bss_journal_entry_t entry;
+
+    if (journal->committed[slot].load(std::memory_order_acquire) != index + 1)
+      continue;
+
+    entry = journal->entries[slot];
+
+    std::atomic_thread_fence(std::memory_order_acquire);
+    if (journal->committed[slot].load(std::memory_order_relaxed) != index + 1)
+      continue;
+
+    callback(&entry, context);
+  }
+}
+
+int bss_journal_format(const bss_journal_entry_t *entry, char *buf, size_t size)
+{
+  int n = snprintf(buf, size, "J %lu %u %u %u %u %u ", (unsigned long)entry->time_us, entry->kind, entry->status,
+                   entry->id, entry->len, entry->seq);
+
+  for (size_t i = 0; i < MAC_SIZE; i++)
+    n += snprintf(buf + n, n < (int)size ? size - n : 0, "%02X", entry->mac[i]);
+
+  n += snprintf(buf + n, n < (int)size ? size - n : 0, " ");
+
+  for (int i = 0; i < BSS_JOURNAL_DATA_SIZE; i++)
+    n += snprintf(buf + n, n < (int)size ? size - n : 0, "%02X", entry->data[i]);
+
+  n += snprintf(buf + n, n < (int)size ? size - n : 0, " %lu", (unsigned long)entry->now_ms);
+
+  return n;
+}
+
+static bool parse_hex(const char *hex, uint8_t *out, size_t len)
+{
+  for (size_t i = 0; i < len; i++)
+  {
+    unsigned int byte;
+
+    if (sscanf(&hex[2 * i], "%2x", &byte) != 1)
+      return false;
+
+    out[i] = byte;
+  }
+
+  return true;
+}
+
+bool bss_journal_parse(const char *line, bss_journal_entry_t *entry)
+{
+  unsigned long time_us, now_ms;
+  unsigned int kind, status, id, len, seq;
+  char mac[2 * MAC_SIZE + 1];
+  char data[2 * BSS_JOURNAL_DATA_SIZE + 1];
+
+  if (sscanf(line, "J %lu %u %u %u %u %u %12s %32s %lu", &time_us, &kind, &status, &id, &len, &seq, mac, data,
+             &now_ms) != 9)
+    return false;
+
+  if (strlen(mac) != 2 * MAC_SIZE || strlen(data) != 2 * BSS_JOURNAL_DATA_SIZE)
+    return false;
+
+  entry->time_us = time_us;
+  entry->kind = kind;
+  entry->status = status;
+  entry->id = id;
+  entry->len = len;
+  entry->seq = seq;
+  entry->now_ms = now_ms;
+
+  return parse_hex(mac, entry->mac, MAC_SIZE) && parse_hex(data, entry->data, BSS_JOURNAL_DATA_SIZE);
+}
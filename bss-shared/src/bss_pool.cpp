@@ -0,0 +1,122 @@
+/*
+  Copyright © 2024 Leonard Sebastian Schwennesen. All rights reserved.
+*/
+
+#include "bss_pool.h"
+
+static void lock_sends(bss_pool_t *pool)
+{
+#ifdef ARDUINO
+  xSemaphoreTake(pool->send_lock, portMAX_DELAY);
+#else
+  pool->send_lock.lock();
+#endif
+}
+
+static void unlock_sends(bss_pool_t *pool)
+{
+#ifdef ARDUINO
+  xSemaphoreGive(pool->send_lock);
+#else
+  pool->send_lock.unlock();
+#endif
+}
+
+void bss_pool_init(bss_pool_t *pool)
+{
+  for (int i = 0; i < BSS_POOL_BUFFERS; i++)
+  {
+    pool->state[i].store(BSS_POOL_FREE);
+    pool->ticket[i].store(0);
+  }
+
+  pool->submitted = 0;
+  pool->completed.store(0);
+  pool->exhausted.store(0);
+
+#ifdef ARDUINO
+  pool->send_lock = xSemaphoreCreateMutex();
+#endif
+}
+
+bss_pool_buffer_t *bss_pool_acquire(bss_pool_t *pool)
+{
+  for (int i = 0; i < BSS_POOL_BUFFERS; i++)
+  {
+    uint8_t expected = BSS_POOL_FREE;
+
+    if (pool->state[i].compare_exchange_strong(expected, BSS_POOL_OWNED, std::memory_order_acquire))
+    {
+      pool->buffers[i].len = 0;
+      return &pool->buffers[i];
+    }
+  }
+
+  pool->exhausted.fetch_add(1, std::memory_order_relaxed);
+  return NULL;
+}
+
+void bss_pool_release(bss_pool_t *pool, bss_pool_buffer_t *buffer)
+{
+  pool->state[buffer - pool->buffers].store(BSS_POOL_FREE, std::memory_order_release);
+}
+
+bool bss_pool_submit(bss_pool_t *pool, bss_pool_buffer_t *buffer, const uint8_t *mac, bss_pool_send_t send)
+{
+  int i = buffer - pool->buffers;
+
+  lock_sends(pool);
+
+  // in flight before the radio sees it, its callback may come first
+  pool->ticket[i].store(pool->submitted, std::memory_order_relaxed);
+  pool->state[i].store(BSS_POOL_IN_FLIGHT, std::memory_order_release);
+  pool->submitted++;
+
+  bool sent = send(mac, buffer->data, buffer->len);
+
+  if (!sent)
+  {
+    // no callback follows, and no later submission took a number meanwhile
+    pool->submitted--;
+    pool->state[i].store(BSS_POOL_FREE, std::memory_order_release);
+  }
+
+  unlock_sends(pool);
+
+  return sent;
+}
+
+void bss_pool_complete(bss_pool_t *pool)
+{
+  uint32_t ticket = pool->completed.fetch_add(1, std::memory_order_relaxed);
+
+  for (int i = 0; i < BSS_POOL_BUFFERS; i++)
+  {
+    if (pool->state[i].load(std::memory_order_acquire) == BSS_POOL_IN_FLIGHT &&
+        pool->ticket[i].load(std::memory_order_relaxed) == ticket)
+    {
+      pool->state[i].store(BSS_POOL_FREE, std::memory_order_release);
+      return;
+    }
+  }
+}
+
+static uint8_t count(bss_pool_t *pool, uint8_t state)
+{
+  uint8_t n = 0;
+
+  for (int i = 0; i < BSS_POOL_BUFFERS; i++)
+    n += pool->state[i].load(std::memory_order_relaxed) == state;
+
+  return n;
+}
+
+uint8_t bss_pool_in_flight(bss_pool_t *pool)
+{
+  return count(pool, BSS_POOL_IN_FLIGHT);
+}
+
+uint8_t bss_pool_available(bss_pool_t *pool)
+{
+  return count(pool, BSS_POOL_FREE);
+}
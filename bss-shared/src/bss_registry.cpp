@@ -0,0 +1,379 @@
+/*
+  Copyright © 2024 Leonard Sebastian Schwennesen. All rights reserved.
+*/
+
+#include "bss_registry.h"
+#include "bss_frame.h"
+
+#include <string.h>
+
+static uint32_t read_begin(const bss_registry_t *registry)
+{
+  uint32_t seq;
+
+  // an odd sequence number means a writer is active
+  while ((seq = registry->seq.load(std::memory_order_acquire)) & 1)
+    ;
+
+  return seq;
+}
+
+static bool read_retry(const bss_registry_t *registry, uint32_t seq)
+{
+  std::atomic_thread_fence(std::memory_order_acquire);
+
+  return registry->seq.load(std::memory_order_relaxed) != seq;
+}
+
+static void write_begin(bss_registry_t *registry)
+{
+  registry->seq.store(registry->seq.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  std::atomic_thread_fence(std::memory_order_release);
+}
+
+static void write_end(bss_registry_t *registry)
+{
+  registry->seq.store(registry->seq.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+}
+
+void bss_registry_mark_dirty(bss_registry_t *registry, int slot)
+{
+  registry->dirty[slot / 32].fetch_or(1u << (slot % 32), std::memory_order_relaxed);
+}
+
+static int find_slot(const bss_registry_t *registry, uint8_t id, const uint8_t *mac)
+{
+  for (int slot = 0; slot < BSS_REGISTRY_MAX_CLIENTS; slot++)
+  {
+    const bss_client *client = &registry->clients[slot];
+
+    if (client->used && client->id == id && mac_equal(mac, client->mac))
+      return slot;
+  }
+
+  return BSS_REGISTRY_NO_SLOT;
+}
+
+void bss_registry_init(bss_registry_t *registry)
+{
+  registry->seq.store(0, std::memory_order_relaxed);
+  registry->count = 0;
+
+  for (int slot = 0; slot < BSS_REGISTRY_MAX_CLIENTS; slot++)
+  {
+    registry->clients[slot].used = false;
+    registry->last_msg[slot].store(0, std::memory_order_relaxed);
+    registry->rx_counter[slot].store(0, std::memory_order_relaxed);
+    registry->persisted_counter[slot].store(0, std::memory_order_relaxed);
+  }
+
+  for (int i = 0; i < BSS_REGISTRY_MAX_CLIENTS / 32; i++)
+    registry->dirty[i].store(0, std::memory_order_relaxed);
+}
+
+int bss_registry_find(const bss_registry_t *registry, uint8_t id, const uint8_t *mac, bss_client *client)
+{
+  uint32_t seq;
+  int slot;
+
+  do
+  {
+    seq = read_begin(registry);
+    slot = find_slot(registry, id, mac);
+
+    if (client != NULL && slot != BSS_REGISTRY_NO_SLOT)
+      *client = registry->clients[slot];
+  } while (read_retry(registry, seq));
+
+  return slot;
+}
+
+int bss_registry_find_mac(const bss_registry_t *registry, const uint8_t *mac)
+{
+  uint32_t seq;
+  int slot;
+
+  do
+  {
+    seq = read_begin(registry);
+
+    for (slot = 0; slot < BSS_REGISTRY_MAX_CLIENTS; slot++)
+    {
+      if (registry->clients[slot].used && mac_equal(mac, registry->clients[slot].mac))
+        break;
+    }
+  } while (read_retry(registry, seq));
+
+  return slot == BSS_REGISTRY_MAX_CLIENTS ? BSS_REGISTRY_NO_SLOT : slot;
+}
+
+bool bss_registry_get(const bss_registry_t *registry, int slot, bss_client *client)
+{
+  uint32_t seq;
+
+  if (slot < 0 || slot >= BSS_REGISTRY_MAX_CLIENTS)
+    return false;
+
+  do
+  {
+    seq = read_begin(registry);
+    *client = registry->clients[slot];
+  } while (read_retry(registry, seq));
+
+  return client->used;
+}
+
+uint8_t bss_registry_count(const bss_registry_t *registry)
+{
+  uint32_t seq;
+  uint8_t count;
+
+  do
+  {
+    seq = read_begin(registry);
+    count = registry->count;
+  } while (read_retry(registry, seq));
+
+  return count;
+}
+
+bool bss_registry_accept_counter(bss_registry_t *registry, int slot, uint32_t counter)
+{
+  uint32_t last = registry->rx_counter[slot].load(std::memory_order_relaxed);
+
+  do
+  {
+    if (counter <= last)
+      return false;
+  } while (!registry->rx_counter[slot].compare_exchange_weak(last, counter, std::memory_order_relaxed));
+
+  if (counter - registry->persisted_counter[slot].load(std::memory_order_relaxed) >= BSS_AUTH_COUNTER_BLOCK)
+    bss_registry_mark_dirty(registry, slot);
+
+  return true;
+}
+
+int bss_registry_add(bss_registry_t *registry, uint8_t id, const uint8_t *mac, const uint8_t *key, uint32_t now,
+                     uint8_t role)
+{
+  int slot = find_slot(registry, id, mac);
+  bool exists = slot != BSS_REGISTRY_NO_SLOT;
+
+  if (exists && registry->clients[slot].role == role &&
+      bss_auth_equal(registry->clients[slot].key, key, BSS_AUTH_KEY_SIZE))
+    return slot;
+
+  if (!exists)
+  {
+    slot = 0;
+
+    while (slot < BSS_REGISTRY_MAX_CLIENTS && registry->clients[slot].used)
+      slot++;
+
+    if (slot == BSS_REGISTRY_MAX_CLIENTS)
+      return BSS_REGISTRY_NO_SLOT;
+  }
+
+  registry->last_msg[slot].store(now, std::memory_order_relaxed);
+
+  write_begin(registry);
+
+  bss_client *client = &registry->clients[slot];
+  client->id = id;
+  mac_copy(client->mac, mac);
+  memcpy(client->key, key, BSS_AUTH_KEY_SIZE);
+  client->role = role;
+  client->used = true;
+
+  if (!exists)
+    registry->count++;
+
+  // a new session starts its counters from scratch
+  registry->rx_counter[slot].store(0, std::memory_order_relaxed);
+  registry->persisted_counter[slot].store(0, std::memory_order_relaxed);
+
+  write_end(registry);
+
+  bss_registry_mark_dirty(registry, slot);
+
+  return slot;
+}
+
+bool bss_registry_remove(bss_registry_t *registry, uint8_t id, const uint8_t *mac)
+{
+  int slot = find_slot(registry, id, mac);
+
+  if (slot == BSS_REGISTRY_NO_SLOT)
+    return false;
+
+  write_begin(registry);
+
+  registry->clients[slot].used = false;
+  registry->count--;
+
+  write_end(registry);
+
+  bss_registry_mark_dirty(registry, slot);
+
+  return true;
+}
+
+bool bss_registry_remove_slot(bss_registry_t *registry, int slot)
+{
+  if (slot < 0 || slot >= BSS_REGISTRY_MAX_CLIENTS || !registry->clients[slot].used)
+    return false;
+
+  write_begin(registry);
+
+  registry->clients[slot].used = false;
+  registry->count--;
+
+  write_end(registry);
+
+  bss_registry_mark_dirty(registry, slot);
+
+  return true;
+}
+
+void bss_registry_clear(bss_registry_t *registry)
+{
+  write_begin(registry);
+
+  for (int slot = 0; slot < BSS_REGISTRY_MAX_CLIENTS; slot++)
+    registry->clients[slot].used = false;
+
+  registry->count = 0;
+
+  write_end(registry);
+
+  for (int i = 0; i < BSS_REGISTRY_MAX_CLIENTS / 32; i++)
+    registry->dirty[i].store(UINT32_MAX, std::memory_order_relaxed);
+}
+
+int bss_registry_take_dirty(bss_registry_t *registry)
+{
+  for (int i = 0; i < BSS_REGISTRY_MAX_CLIENTS / 32; i++)
+  {
+    uint32_t dirty = registry->dirty[i].load(std::memory_order_relaxed);
+
+    while (dirty != 0)
+    {
+      int bit = __builtin_ctz(dirty);
+
+      if (registry->dirty[i].compare_exchange_weak(dirty, dirty & ~(1u << bit), std::memory_order_relaxed))
+        return i * 32 + bit;
+    }
+  }
+
+  return BSS_REGISTRY_NO_SLOT;
+}
+
+size_t bss_registry_encode(const bss_registry_t *registry, int slot, uint8_t *buf)
+{
+  bss_client client;
+
+  if (!bss_registry_get(registry, slot, &client))
+    return 0;
+
+  buf[0] = BSS_REGISTRY_RECORD_VERSION;
+  buf[1] = client.id;
+  mac_copy(&buf[2], client.mac);
+  memcpy(&buf[8], client.key, BSS_AUTH_KEY_SIZE);
+  bss_put_u32(&buf[8 + BSS_AUTH_KEY_SIZE], registry->rx_counter[slot].load(std::memory_order_relaxed));
+  buf[BSS_REGISTRY_RECORD_ROLE] = client.role;
+
+  return BSS_REGISTRY_RECORD_SIZE;
+}
+
+void bss_registry_persisted(bss_registry_t *registry, int slot, const uint8_t *buf)
+{
+  registry->persisted_counter[slot].store(bss_get_u32(&buf[8 + BSS_AUTH_KEY_SIZE]), std::memory_order_relaxed);
+}
+
+bool bss_registry_restore(bss_registry_t *registry, int slot, const uint8_t *buf, size_t len)
+{
+  if (slot < 0 || slot >= BSS_REGISTRY_MAX_CLIENTS)
+    return false;
+
+  uint8_t role;
+
+  if (len == BSS_REGISTRY_RECORD_SIZE && buf[0] == BSS_REGISTRY_RECORD_VERSION)
+    role = buf[BSS_REGISTRY_RECORD_ROLE];
+  // version 1 had no role and could hold buzzers with a reserved id
+  else if (len == BSS_REGISTRY_RECORD_ROLE && buf[0] == 1 && !bss_frame_id_reserved(buf[1]))
+    role = BSS_CLIENT_BUZZER;
+  else
+    return false;
+
+  uint32_t counter = bss_get_u32(&buf[8 + BSS_AUTH_KEY_SIZE]);
+
+  write_begin(registry);
+
+  bss_client *client = &registry->clients[slot];
+
+  if (!client->used)
+    registry->count++;
+
+  client->id = buf[1];
+  mac_copy(client->mac, &buf[2]);
+  memcpy(client->key, &buf[8], BSS_AUTH_KEY_SIZE);
+  client->role = role;
+  client->used = true;
+
+  registry->rx_counter[slot].store(counter, std::memory_order_relaxed);
+  registry->persisted_counter[slot].store(counter, std::memory_order_relaxed);
+
+  write_end(registry);
+
+  return true;
+}
+
+void bss_registry_heard(const bss_registry_t *registry, uint32_t now, uint32_t max_age, uint8_t *heard)
+{
+  uint32_t seq;
+
+  do
+  {
+    seq = read_begin(registry);
+    memset(heard, 0, BSS_REGISTRY_MAX_CLIENTS / 8);
+
+    for (int slot = 0; slot < BSS_REGISTRY_MAX_CLIENTS; slot++)
+    {
+      if (registry->clients[slot].used && now - bss_registry_last_msg(registry, slot) <= max_age)
+        heard[slot / 8] |= 1 << (slot % 8);
+    }
+  } while (read_retry(registry, seq));
+}
+
+size_t bss_registry_build_broadcast(const bss_registry_t *registry, uint8_t *buf, size_t capacity,
+                                    uint8_t type, const uint8_t *payload, uint8_t payload_len,
+                                    int *next_slot)
+{
+  uint32_t seq;
+  size_t i;
+  int slot;
+
+  do
+  {
+    seq = read_begin(registry);
+    i = 0;
+
+    for (slot = next_slot != NULL ? *next_slot : 0; slot < BSS_REGISTRY_MAX_CLIENTS; slot++)
+    {
+      if (!registry->clients[slot].used)
+        continue;
+
+      size_t end = bss_record_put(buf, capacity, i, registry->clients[slot].id, type, payload, payload_len);
+
+      if (end == i && next_slot != NULL)
+        break;
+
+      i = end;
+    }
+  } while (read_retry(registry, seq));
+
+  if (next_slot != NULL)
+    *next_slot = slot;
+
+  return i;
+}
@@ -0,0 +1,381 @@
+/*
+  Copyright © 2024 Leonard Sebastian Schwennesen. All rights reserved.
+*/
+
+#include "bss_relay.h"
+#include "bss_frame.h"
+#include "bss_auth.h"
+#include "bss_txq.h"
+#include "bss_standby.h"
+
+#include <string.h>
+
+void bss_relay_init(bss_relay_t *relay)
+{
+  memset(relay, 0, sizeof(bss_relay_t));
+}
+
+bool bss_relay_set_role(bss_relay_t *relay, const uint8_t *payload, uint8_t len)
+{
+  if (len < 1 || (len - 1) % BSS_RELAY_ROLE_ENTRY_SIZE != 0 ||
+      (len - 1) / BSS_RELAY_ROLE_ENTRY_SIZE > BSS_RELAY_MAX_FAR)
+    return false;
+
+  relay->flags = payload[0];
+  relay->far_count = (len - 1) / BSS_RELAY_ROLE_ENTRY_SIZE;
+
+  for (int i = 0; i < relay->far_count; i++)
+  {
+    const uint8_t *entry = &payload[1 + i * BSS_RELAY_ROLE_ENTRY_SIZE];
+
+    relay->far_id[i] = entry[0];
+    mac_copy(relay->far_mac[i], &entry[1]);
+  }
+
+  return true;
+}
+
+// Remembers the frame, returns false if it was seen before.
+static bool first_seen(bss_relay_t *relay, const uint8_t *mac, uint32_t counter)
+{
+  for (int i = 0; i < BSS_RELAY_SEEN; i++)
+  {
+    if (relay->seen[i].counter == counter && mac_equal(relay->seen[i].mac, mac))
+      return false;
+  }
+
+  bss_relay_seen_t *seen = &relay->seen[relay->seen_next];
+
+  mac_copy(seen->mac, mac);
+  seen->counter = counter;
+  relay->seen_next = (relay->seen_next + 1) % BSS_RELAY_SEEN;
+
+  return true;
+}
+
+static bool is_far(const bss_relay_t *relay, const uint8_t *mac)
+{
+  for (int i = 0; i < relay->far_count; i++)
+  {
+    if (mac_equal(relay->far_mac[i], mac))
+      return true;
+  }
+
+  return false;
+}
+
+bool bss_relay_accept(bss_relay_t *relay, const uint8_t *mac, const uint8_t *data, int len, uint8_t *ttl)
+{
+  bss_auth_trailer_t trailer;
+  const uint8_t *record;
+
+  if (!(relay->flags & BSS_RELAY_FORWARD) || !is_far(relay, mac) || !bss_auth_parse(data, len, &trailer) ||
+      (record = bss_frame_first(data, trailer.body_len)) == NULL)
+    return false;
+
+  if (bss_record_type(record) == BSS_MSG_RELAY)
+  {
+    const uint8_t *origin;
+    const uint8_t *frame;
+    int frame_len;
+
+    if (!bss_relay_open(record, ttl, &origin, &frame, &frame_len) || *ttl == 0)
+      return false;
+
+    (*ttl)--;
+  }
+  else
+    *ttl = BSS_RELAY_TTL - 1;
+
+  return first_seen(relay, mac, trailer.counter);
+}
+
+bool bss_relay_repeat(bss_relay_t *relay, const uint8_t *controller_mac, const uint8_t *group_key,
+                      const uint8_t *mac, const uint8_t *data, int len)
+{
+  bss_auth_trailer_t trailer;
+
+  if (!(relay->flags & BSS_RELAY_FORWARD) || !mac_equal(mac, controller_mac) || !bss_auth_parse(data, len, &trailer) ||
+      trailer.key_id != BSS_AUTH_KEY_GROUP)
+    return false;
+
+  bool addressed = bss_frame_find(data, trailer.body_len, BSS_FRAME_ID_ALL) != NULL;
+
+  for (int i = 0; i < relay->far_count && !addressed; i++)
+    addressed = bss_frame_find(data, trailer.body_len, relay->far_id[i]) != NULL;
+
+  return addressed && bss_auth_verify(data, len, controller_mac, group_key) &&
+         first_seen(relay, controller_mac, trailer.counter);
+}
+
+bool bss_relay_repeated(const uint8_t *controller_mac, const uint8_t *group_key, const uint8_t *mac,
+                        const uint8_t *data, int len)
+{
+  bss_auth_trailer_t trailer;
+
+  return !mac_equal(mac, controller_mac) && bss_auth_parse(data, len, &trailer) &&
+         trailer.key_id == BSS_AUTH_KEY_GROUP && bss_auth_verify(data, len, controller_mac, group_key);
+}
+
+size_t bss_relay_put(uint8_t *buf, size_t capacity, size_t offset, uint8_t id, uint8_t ttl, const uint8_t *origin,
+                     const uint8_t *frame, int len)
+{
+  uint8_t payload[UINT8_MAX - 1];
+
+  if (len < 0 || BSS_RELAY_HEADER_SIZE + len > (int)sizeof(payload))
+    return offset;
+
+  payload[0] = ttl;
+  mac_copy(&payload[1], origin);
+  memcpy(&payload[BSS_RELAY_HEADER_SIZE], frame, len);
+
+  return bss_record_put(buf, capacity, offset, id, BSS_MSG_RELAY, payload, BSS_RELAY_HEADER_SIZE + len);
+}
+
+bool bss_relay_open(const uint8_t *record, uint8_t *ttl, const uint8_t **origin, const uint8_t **frame, int *len)
+{
+  if (bss_record_type(record) != BSS_MSG_RELAY || bss_record_payload_len(record) <= BSS_RELAY_HEADER_SIZE)
+    return false;
+
+  const uint8_t *payload = bss_record_payload(record);
+
+  *ttl = payload[0];
+  *origin = &payload[1];
+  *frame = &payload[BSS_RELAY_HEADER_SIZE];
+  *len = bss_record_payload_len(record) - BSS_RELAY_HEADER_SIZE;
+
+  return true;
+}
+
+uint8_t bss_relay_priority(const uint8_t *data, int len)
+{
+  bss_auth_trailer_t trailer;
+  const uint8_t *record;
+
+  if (!bss_auth_parse(data, len, &trailer) || (record = bss_frame_first(data, trailer.body_len)) == NULL)
+    return BSS_TX_BACKGROUND;
+
+  switch (bss_record_type(record))
+  {
+  case BSS_MSG_BUZZER_PRESSED:
+  case BSS_MSG_SET_NEOPIXEL_COLOR:
+    return BSS_TX_URGENT;
+
+  case BSS_MSG_RELAY:
+  {
+    uint8_t ttl;
+    const uint8_t *origin;
+    const uint8_t *frame;
+    int frame_len;
+
+    if (bss_relay_open(record, &ttl, &origin, &frame, &frame_len))
+      return bss_relay_priority(frame, frame_len);
+
+    return BSS_TX_BACKGROUND;
+  }
+
+  default:
+    return BSS_TX_BACKGROUND;
+  }
+}
+
+void bss_links_init(bss_links_t *links)
+{
+  for (int slot = 0; slot < BSS_REGISTRY_MAX_CLIENTS; slot++)
+  {
+    links->direct[slot].store(false, std::memory_order_relaxed);
+    links->quality[slot] = 0;
+  }
+}
+
+void bss_links_update(bss_links_t *links, const bss_registry_t *registry)
+{
+  for (int slot = 0; slot < BSS_REGISTRY_MAX_CLIENTS; slot++)
+  {
+    bss_client client;
+    bool heard = links->direct[slot].exchange(false, std::memory_order_relaxed);
+    uint8_t quality = links->quality[slot];
+
+    if (!bss_registry_get(registry, slot, &client))
+    {
+      links->quality[slot] = 0;
+      continue;
+    }
+
+    // 0 marks an unused slot
+    if (quality == 0)
+      quality = BSS_LINK_NEAR;
+
+    if (heard)
+      quality += (255 - quality + 7) / 8;
+    else if (quality > 1)
+      quality -= (quality + 7) / 8;
+
+    links->quality[slot] = quality;
+  }
+}
+
+void bss_relay_plan_init(bss_relay_plan_t *plan)
+{
+  for (int slot = 0; slot < BSS_REGISTRY_MAX_CLIENTS; slot++)
+  {
+    plan->far[slot] = false;
+    plan->cursor[slot] = 0;
+
+    for (int k = 0; k < BSS_RELAY_PER_FAR; k++)
+    {
+      plan->relays[slot][k].store(BSS_RELAY_NONE, std::memory_order_relaxed);
+      plan->delivered[slot][k].store(0, std::memory_order_relaxed);
+    }
+  }
+}
+
+void bss_relay_delivered(bss_relay_plan_t *plan, int far_slot, int relay_slot)
+{
+  for (int k = 0; k < BSS_RELAY_PER_FAR; k++)
+  {
+    if (plan->relays[far_slot][k].load(std::memory_order_relaxed) != relay_slot)
+      continue;
+
+    uint8_t delivered = plan->delivered[far_slot][k].load(std::memory_order_relaxed);
+
+    if (delivered < UINT8_MAX)
+      plan->delivered[far_slot][k].store(delivered + 1, std::memory_order_relaxed);
+  }
+}
+
+static void clear_relays(bss_relay_plan_t *plan, int slot)
+{
+  for (int k = 0; k < BSS_RELAY_PER_FAR; k++)
+  {
+    plan->relays[slot][k].store(BSS_RELAY_NONE, std::memory_order_relaxed);
+    plan->delivered[slot][k].store(0, std::memory_order_relaxed);
+  }
+}
+
+static bool has_relay(const bss_relay_plan_t *plan, int slot, int relay)
+{
+  for (int k = 0; k < BSS_RELAY_PER_FAR; k++)
+  {
+    if (plan->relays[slot][k].load(std::memory_order_relaxed) == relay)
+      return true;
+  }
+
+  return false;
+}
+
+void bss_relay_plan(bss_relay_plan_t *plan, const bss_registry_t *registry, const bss_links_t *links, uint32_t now,
+                    uint32_t max_age)
+{
+  bool candidate[BSS_REGISTRY_MAX_CLIENTS];
+  uint8_t load[BSS_REGISTRY_MAX_CLIENTS];
+  uint8_t ranked[BSS_REGISTRY_MAX_CLIENTS];
+  int candidates = 0;
+
+  for (int slot = 0; slot < BSS_REGISTRY_MAX_CLIENTS; slot++)
+  {
+    bss_client client;
+    uint8_t quality = links->quality[slot];
+
+    candidate[slot] = false;
+    load[slot] = 0;
+
+    if (!bss_registry_get(registry, slot, &client) || client.role == BSS_CLIENT_STANDBY ||
+        now - bss_registry_last_msg(registry, slot) > max_age)
+    {
+      plan->far[slot] = false;
+      clear_relays(plan, slot);
+      continue;
+    }
+
+    plan->far[slot] = quality < BSS_LINK_FAR || (plan->far[slot] && quality < BSS_LINK_NEAR);
+
+    if (plan->far[slot])
+      continue;
+
+    clear_relays(plan, slot);
+
+    if (quality < BSS_LINK_GOOD)
+      continue;
+
+    candidate[slot] = true;
+
+    // weakest good link first
+    int i = candidates++;
+
+    for (; i > 0 && links->quality[ranked[i - 1]] > quality; i--)
+      ranked[i] = ranked[i - 1];
+
+    ranked[i] = slot;
+  }
+
+  // keeps the relays that proved to hear their far client
+  for (int slot = 0; slot < BSS_REGISTRY_MAX_CLIENTS; slot++)
+  {
+    if (!plan->far[slot])
+      continue;
+
+    for (int k = 0; k < BSS_RELAY_PER_FAR; k++)
+    {
+      uint8_t relay = plan->relays[slot][k].load(std::memory_order_relaxed);
+
+      if (relay != BSS_RELAY_NONE && candidate[relay] && plan->delivered[slot][k].load(std::memory_order_relaxed) > 0 &&
+          load[relay] < BSS_RELAY_MAX_FAR)
+        load[relay]++;
+      else
+        plan->relays[slot][k].store(BSS_RELAY_NONE, std::memory_order_relaxed);
+
+      plan->delivered[slot][k].store(0, std::memory_order_relaxed);
+    }
+  }
+
+  // and tries the next candidates for the others
+  for (int slot = 0; slot < BSS_REGISTRY_MAX_CLIENTS && candidates > 0; slot++)
+  {
+    if (!plan->far[slot])
+      continue;
+
+    for (int k = 0; k < BSS_RELAY_PER_FAR; k++)
+    {
+      if (plan->relays[slot][k].load(std::memory_order_relaxed) != BSS_RELAY_NONE)
+        continue;
+
+      for (int tries = 0; tries < candidates; tries++)
+      {
+        uint8_t relay = ranked[plan->cursor[slot] % candidates];
+
+        plan->cursor[slot] = (plan->cursor[slot] + 1) % candidates;
+
+        if (load[relay] < BSS_RELAY_MAX_FAR && !has_relay(plan, slot, relay))
+        {
+          plan->relays[slot][k].store(relay, std::memory_order_relaxed);
+          load[relay]++;
+          break;
+        }
+      }
+    }
+  }
+}
+
+size_t bss_relay_role(const bss_relay_plan_t *plan, const bss_registry_t *registry, int slot, uint8_t *payload)
+{
+  size_t len = 1;
+
+  payload[0] = plan->far[slot] ? BSS_RELAY_BROADCAST : 0;
+
+  for (int far = 0; far < BSS_REGISTRY_MAX_CLIENTS; far++)
+  {
+    bss_client client;
+
+    if (!plan->far[far] || !has_relay(plan, far, slot) || !bss_registry_get(registry, far, &client) ||
+        len + BSS_RELAY_ROLE_ENTRY_SIZE > BSS_RELAY_ROLE_MAX_SIZE)
+      continue;
+
+    payload[len] = client.id;
+    mac_copy(&payload[len + 1], client.mac);
+    len += BSS_RELAY_ROLE_ENTRY_SIZE;
+    payload[0] |= BSS_RELAY_FORWARD;
+  }
+
+  return len;
+}
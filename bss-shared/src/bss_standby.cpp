@@ -0,0 +1,177 @@
+/*
+  Copyright © 2024 Leonard Sebastian Schwennesen. All rights reserved.
+*/
+
+#include "bss_standby.h"
+#include "bss_frame.h"
+#include "bss_auth.h"
+
+#include <string.h>
+
+// offset of the session key in a registry record
+#define RECORD_KEY_OFFSET 8
+
+static void client_nonce(uint8_t *nonce, uint32_t counter, uint8_t slot)
+{
+  memset(nonce, 0, BSS_AUTH_NONCE_SIZE);
+  bss_put_u32(nonce, counter);
+  nonce[4] = slot;
+}
+
+size_t bss_mirror_put_state(uint8_t *buf, size_t capacity, size_t i, uint32_t counter, bss_show_snapshot_t show,
+                            const bss_config_t *config)
+{
+  uint8_t payload[BSS_MIRROR_STATE_SIZE];
+
+  bss_put_u32(payload, counter);
+  payload[4] = show.phase;
+  payload[5] = show.winner;
+  bss_put_u16(&payload[6], show.seq);
+  bss_config_encode(config, &payload[8]);
+
+  return bss_record_put(buf, capacity, i, BSS_STANDBY_ID, BSS_MSG_MIRROR_STATE, payload, sizeof(payload));
+}
+
+size_t bss_mirror_put_client(uint8_t *buf, size_t capacity, size_t i, const bss_registry_t *registry, int slot,
+                             const uint8_t *key, uint32_t nonce)
+{
+  uint8_t payload[BSS_MIRROR_CLIENT_SIZE];
+  uint8_t iv[BSS_AUTH_NONCE_SIZE];
+
+  payload[0] = slot;
+  bss_put_u32(&payload[1], nonce);
+
+  if (bss_registry_encode(registry, slot, &payload[5]) == 0)
+    return bss_record_put(buf, capacity, i, BSS_STANDBY_ID, BSS_MSG_MIRROR_CLIENT, payload, 1);
+
+  client_nonce(iv, nonce, slot);
+  bss_auth_crypt(&payload[5 + RECORD_KEY_OFFSET], BSS_AUTH_KEY_SIZE, key, iv);
+
+  return bss_record_put(buf, capacity, i, BSS_STANDBY_ID, BSS_MSG_MIRROR_CLIENT, payload, sizeof(payload));
+}
+
+bool bss_mirror_apply_state(const uint8_t *record, uint32_t *counter, bss_show_t *show, bss_config_t *config)
+{
+  const uint8_t *payload = bss_record_payload(record);
+
+  if (bss_record_type(record) != BSS_MSG_MIRROR_STATE || bss_record_payload_len(record) < BSS_MIRROR_STATE_SIZE ||
+      !bss_config_decode(&payload[8], bss_record_payload_len(record) - 8, config))
+    return false;
+
+  uint32_t mirrored = bss_get_u32(payload);
+
+  if (mirrored > *counter)
+    *counter = mirrored;
+
+  bss_show_restore(show, {(bss_show_phase)payload[4], payload[5], bss_get_u16(&payload[6])});
+  return true;
+}
+
+bool bss_mirror_apply_client(bss_registry_t *registry, const uint8_t *record, const uint8_t *key)
+{
+  uint8_t client[BSS_REGISTRY_RECORD_SIZE];
+  uint8_t iv[BSS_AUTH_NONCE_SIZE];
+  const uint8_t *payload = bss_record_payload(record);
+
+  if (bss_record_type(record) != BSS_MSG_MIRROR_CLIENT || bss_record_payload_len(record) < 1 ||
+      payload[0] >= BSS_REGISTRY_MAX_CLIENTS)
+    return false;
+
+  if (bss_record_payload_len(record) < BSS_MIRROR_CLIENT_SIZE)
+  {
+    bss_registry_remove_slot(registry, payload[0]);
+    return true;
+  }
+
+  memcpy(client, &payload[5], BSS_REGISTRY_RECORD_SIZE);
+  client_nonce(iv, bss_get_u32(&payload[1]), payload[0]);
+  bss_auth_crypt(&client[RECORD_KEY_OFFSET], BSS_AUTH_KEY_SIZE, key, iv);
+
+  if (client[BSS_REGISTRY_RECORD_ROLE] == BSS_CLIENT_STANDBY)
+  {
+    bss_registry_remove_slot(registry, payload[0]);
+    return true;
+  }
+
+  if (!bss_registry_restore(registry, payload[0], client, sizeof(client)))
+    return false;
+
+  bss_registry_mark_dirty(registry, payload[0]);
+  return true;
+}
+
+void bss_takeover_tag(uint8_t *tag, const uint8_t *session_key, const uint8_t *controller_mac, uint32_t counter)
+{
+  uint8_t data[MAC_SIZE + 4];
+
+  mac_copy(data, controller_mac);
+  bss_put_u32(&data[MAC_SIZE], counter);
+
+  uint64_t hash = bss_siphash(session_key, data, sizeof(data));
+
+  for (int i = 0; i < 4; i++)
+    tag[i] = hash >> (8 * i);
+}
+
+size_t bss_standby_build_takeover(const bss_registry_t *registry, uint8_t *buf, size_t capacity,
+                                  const uint8_t *my_mac, uint32_t counter, int *next_slot)
+{
+  size_t i = 0;
+  int slot;
+
+  for (slot = *next_slot; slot < BSS_REGISTRY_MAX_CLIENTS; slot++)
+  {
+    bss_client client;
+    uint8_t payload[BSS_TAKEOVER_SIZE];
+
+    if (!bss_registry_get(registry, slot, &client) || client.role == BSS_CLIENT_STANDBY)
+      continue;
+
+    bss_put_u32(payload, counter);
+    bss_takeover_tag(&payload[4], client.key, my_mac, counter);
+
+    size_t end = bss_record_put(buf, capacity, i, client.id, BSS_MSG_TAKEOVER, payload, sizeof(payload));
+
+    if (end == i)
+      break;
+
+    i = end;
+  }
+
+  *next_slot = slot;
+  return i;
+}
+
+bool bss_standby_taken_over(const bss_registry_t *registry, const uint8_t *group_key, uint32_t counter,
+                            const uint8_t *mac, const uint8_t *data, int len)
+{
+  bss_auth_trailer_t trailer;
+  const uint8_t *record;
+
+  if (!bss_auth_parse(data, len, &trailer) || trailer.key_id != BSS_AUTH_KEY_GROUP ||
+      (record = bss_frame_first(data, trailer.body_len)) == NULL || bss_record_type(record) != BSS_MSG_TAKEOVER ||
+      bss_record_payload_len(record) < BSS_TAKEOVER_SIZE)
+    return false;
+
+  const uint8_t *payload = bss_record_payload(record);
+  uint32_t takeover = bss_get_u32(payload);
+
+  if (takeover <= counter || trailer.counter < takeover || !bss_auth_verify(data, len, mac, group_key))
+    return false;
+
+  for (int slot = 0; slot < BSS_REGISTRY_MAX_CLIENTS; slot++)
+  {
+    bss_client client;
+    uint8_t tag[4];
+
+    if (!bss_registry_get(registry, slot, &client) || client.id != bss_record_id(record))
+      continue;
+
+    bss_takeover_tag(tag, client.key, mac, takeover);
+
+    if (bss_auth_equal(tag, &payload[4], sizeof(tag)))
+      return true;
+  }
+
+  return false;
+}
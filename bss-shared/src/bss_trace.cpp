@@ -0,0 +1,83 @@
+/*
+  Copyright © 2024 Leonard Sebastian Schwennesen. All rights reserved.
+*/
+
+#include "bss_trace.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#ifndef ARDUINO
+#include <atomic>
+#endif
+
+static bss_trace_stat_t stats[BSS_TRACE_CORES][BSS_TRACE_STAGES];
+
+static const char *const names[BSS_TRACE_STAGES] = {
+    "debounce", "mutex_wait", "open_frame", "lookup", "decision", "broadcast_build", "seal", "send", "led_show",
+};
+
+static uint8_t current_core()
+{
+#ifdef ARDUINO
+  return xPortGetCoreID();
+#else
+  static std::atomic<uint8_t> threads(0);
+  static thread_local uint8_t core = threads.fetch_add(1) % BSS_TRACE_CORES;
+
+  return core;
+#endif
+}
+
+void bss_trace_record(uint8_t stage, uint32_t cycles)
+{
+  bss_trace_stat_t *stat = &stats[current_core()][stage];
+
+  if (stat->count == 0 || cycles < stat->min)
+    stat->min = cycles;
+  if (cycles > stat->max)
+    stat->max = cycles;
+
+  stat->sum += cycles;
+  stat->count++;
+}
+
+bool bss_trace_get(uint8_t core, uint8_t stage, bss_trace_stat_t *stat)
+{
+  if (core >= BSS_TRACE_CORES || stage >= BSS_TRACE_STAGES)
+    return false;
+
+  *stat = stats[core][stage];
+  return stat->count > 0;
+}
+
+void bss_trace_reset()
+{
+  memset(stats, 0, sizeof(stats));
+}
+
+const char *bss_trace_name(uint8_t stage)
+{
+  return stage < BSS_TRACE_STAGES ? names[stage] : "?";
+}
+
+void bss_trace_summary(bss_trace_callback_t callback, void *context)
+{
+  char line[96];
+  double per_us = bss_trace_cycles_per_us();
+
+  for (uint8_t core = 0; core < BSS_TRACE_CORES; core++)
+  {
+    for (uint8_t stage = 0; stage < BSS_TRACE_STAGES; stage++)
+    {
+      bss_trace_stat_t stat;
+
+      if (!bss_trace_get(core, stage, &stat))
+        continue;
+
+      snprintf(line, sizeof(line), "T %u %s n=%lu min=%.2f avg=%.2f max=%.2f", core, names[stage],
+               (unsigned long)stat.count, stat.min / per_us, stat.sum / per_us / stat.count, stat.max / per_us);
+      callback(line, context);
+    }
+  }
+}
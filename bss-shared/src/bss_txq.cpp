@@ -0,0 +1,266 @@
+/*
+  Copyright © 2024 Leonard Sebastian Schwennesen. All rights reserved.
+*/
+
+#include "bss_txq.h"
+#include "bss_shared.h"
+
+#include <string.h>
+
+static void lock(bss_txq_t *txq)
+{
+#ifdef ARDUINO
+  xSemaphoreTake(txq->lock, portMAX_DELAY);
+#else
+  txq->lock.lock();
+#endif
+}
+
+static void unlock(bss_txq_t *txq)
+{
+#ifdef ARDUINO
+  xSemaphoreGive(txq->lock);
+#else
+  txq->lock.unlock();
+#endif
+}
+
+// The pending entry that goes out next: highest priority, then oldest.
+static int next_entry(const bss_txq_t *txq)
+{
+  int best = -1;
+
+  for (int i = 0; i < BSS_POOL_BUFFERS; i++)
+  {
+    const bss_txq_entry_t *entry = &txq->entries[i];
+
+    if (entry->buffer == NULL)
+      continue;
+
+    if (best < 0 || entry->priority < txq->entries[best].priority ||
+        (entry->priority == txq->entries[best].priority && entry->order - txq->entries[best].order > UINT32_MAX / 2))
+      best = i;
+  }
+
+  return best;
+}
+
+// The pending entry that is dropped first: lowest priority below 'priority',
+// then oldest.
+static int victim_entry(const bss_txq_t *txq, uint8_t priority)
+{
+  int worst = -1;
+
+  for (int i = 0; i < BSS_POOL_BUFFERS; i++)
+  {
+    const bss_txq_entry_t *entry = &txq->entries[i];
+
+    if (entry->buffer == NULL || entry->priority <= priority)
+      continue;
+
+    if (worst < 0 || entry->priority > txq->entries[worst].priority ||
+        (entry->priority == txq->entries[worst].priority && entry->order - txq->entries[worst].order > UINT32_MAX / 2))
+      worst = i;
+  }
+
+  return worst;
+}
+
+// Takes the entry that goes out next, if the window allows it. Called with
+// the lock held.
+static bool take_next(bss_txq_t *txq, bss_txq_entry_t *next)
+{
+  int i;
+
+  if (bss_pool_in_flight(&txq->pool) >= BSS_TXQ_WINDOW || (i = next_entry(txq)) < 0)
+    return false;
+
+  *next = txq->entries[i];
+  txq->entries[i].buffer = NULL;
+  txq->stats.depth--;
+
+  return true;
+}
+
+static bool ready(bss_txq_t *txq)
+{
+  lock(txq);
+  bool ready = bss_pool_in_flight(&txq->pool) < BSS_TXQ_WINDOW && next_entry(txq) >= 0;
+  unlock(txq);
+
+  return ready;
+}
+
+// Hands pending frames to the radio while the window allows it. Only one
+// caller pumps at a time and seals and sends without the lock, the others
+// leave their frames to it. The pumper looks once more after it stopped, for
+// frames pushed or completions that came meanwhile.
+static void pump(bss_txq_t *txq)
+{
+  bss_txq_entry_t next;
+
+  do
+  {
+    if (txq->pumping.exchange(true, std::memory_order_acquire))
+      return;
+
+    for (;;)
+    {
+      lock(txq);
+      bool taken = take_next(txq, &next);
+      unlock(txq);
+
+      if (!taken)
+        break;
+
+      bss_pool_buffer_t *buffer = next.buffer;
+
+      if (next.key_id != BSS_TXQ_SEALED)
+        buffer->len = txq->seal(buffer->data, buffer->len, next.key_id, next.key);
+
+      bool sent = false;
+
+      if (buffer->len == 0)
+        bss_pool_release(&txq->pool, buffer);
+      else
+        sent = bss_pool_submit(&txq->pool, buffer, next.mac, txq->send);
+
+      lock(txq);
+
+      if (sent)
+        txq->stats.sent++;
+      else
+        txq->stats.failed++;
+
+      unlock(txq);
+    }
+
+    txq->pumping.store(false, std::memory_order_release);
+  } while (ready(txq));
+}
+
+void bss_txq_init(bss_txq_t *txq, bss_pool_send_t send, bss_txq_seal_t seal)
+{
+  bss_pool_init(&txq->pool);
+
+  txq->send = send;
+  txq->seal = seal;
+  txq->next_order = 0;
+  txq->pumping.store(false, std::memory_order_relaxed);
+  memset(&txq->stats, 0, sizeof(txq->stats));
+
+  for (int i = 0; i < BSS_POOL_BUFFERS; i++)
+    txq->entries[i].buffer = NULL;
+
+#ifdef ARDUINO
+  txq->lock = xSemaphoreCreateMutex();
+#endif
+}
+
+bss_pool_buffer_t *bss_txq_acquire(bss_txq_t *txq, uint8_t priority)
+{
+  bss_pool_buffer_t *buffer = bss_pool_acquire(&txq->pool);
+
+  if (buffer != NULL)
+    return buffer;
+
+  lock(txq);
+
+  int i = victim_entry(txq, priority);
+
+  if (i >= 0)
+  {
+    // the buffer stays owned and changes hands
+    buffer = txq->entries[i].buffer;
+    buffer->len = 0;
+
+    txq->entries[i].buffer = NULL;
+    txq->stats.depth--;
+  }
+
+  txq->stats.dropped++;
+
+  unlock(txq);
+
+  return buffer;
+}
+
+void bss_txq_release(bss_txq_t *txq, bss_pool_buffer_t *buffer)
+{
+  bss_pool_release(&txq->pool, buffer);
+}
+
+void bss_txq_push(bss_txq_t *txq, bss_pool_buffer_t *buffer, const uint8_t *mac, uint8_t priority,
+                  uint16_t supersede, uint8_t key_id, const uint8_t *key)
+{
+  bss_txq_entry_t *entry = NULL;
+
+  lock(txq);
+
+  for (int i = 0; i < BSS_POOL_BUFFERS && supersede != BSS_TXQ_KEEP; i++)
+  {
+    bss_txq_entry_t *pending = &txq->entries[i];
+
+    if (pending->buffer != NULL && pending->supersede == supersede && mac_equal(pending->mac, mac))
+    {
+      bss_pool_release(&txq->pool, pending->buffer);
+      txq->stats.superseded++;
+
+      // keeps its place in the queue
+      entry = pending;
+      break;
+    }
+  }
+
+  if (entry == NULL)
+  {
+    for (int i = 0; i < BSS_POOL_BUFFERS; i++)
+    {
+      if (txq->entries[i].buffer == NULL)
+      {
+        entry = &txq->entries[i];
+        break;
+      }
+    }
+
+    // there are as many entries as buffers
+    entry->order = txq->next_order++;
+
+    if (++txq->stats.depth > txq->stats.max_depth)
+      txq->stats.max_depth = txq->stats.depth;
+  }
+
+  entry->buffer = buffer;
+  mac_copy(entry->mac, mac);
+  entry->priority = priority;
+  entry->supersede = supersede;
+  entry->key_id = key_id;
+
+  if (key != NULL)
+    memcpy(entry->key, key, BSS_AUTH_KEY_SIZE);
+
+  unlock(txq);
+
+  pump(txq);
+}
+
+bool bss_txq_sent(bss_txq_t *txq)
+{
+  bss_pool_complete(&txq->pool);
+  return ready(txq);
+}
+
+void bss_txq_pump(bss_txq_t *txq)
+{
+  pump(txq);
+}
+
+void bss_txq_get_stats(bss_txq_t *txq, bss_txq_stats_t *stats)
+{
+  lock(txq);
+
+  *stats = txq->stats;
+  stats->in_flight = bss_pool_in_flight(&txq->pool);
+
+  unlock(txq);
+}